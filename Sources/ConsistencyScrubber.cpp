@@ -0,0 +1,728 @@
+#include "ConsistencyScrubber.h"
+#include "Crc32c.h"
+#include "IOToolbox.h"
+#include "S3Backend.h"
+#include "SaolaConfiguration.h"
+#include "Trace.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+namespace Saola
+{
+  static const char *const POINTER_EXTENSION = ".symlink";
+
+  // Payloads modified more recently might belong to a Create or a
+  // tiering relocation whose pointer is not published yet
+  static const int64_t GRACE_SECONDS = 600;
+
+  // Number of levels below a mount directory that can be split into units
+  static const unsigned int MAX_UNIT_DEPTH = 4;
+
+  static const unsigned int UNITS_PER_THREAD = 16;
+
+  static const int64_t CHECKPOINT_INTERVAL = 5;  // Seconds
+
+  static const size_t READ_CHUNK_SIZE = 1024 * 1024;
+
+  static const char *GetStateName(ConsistencyScrubber::State state)
+  {
+    switch (state)
+    {
+    case ConsistencyScrubber::State_Idle:
+      return "Idle";
+
+    case ConsistencyScrubber::State_Running:
+      return "Running";
+
+    case ConsistencyScrubber::State_Completed:
+      return "Completed";
+
+    case ConsistencyScrubber::State_Cancelled:
+      return "Cancelled";
+
+    case ConsistencyScrubber::State_Failed:
+      return "Failed";
+
+    default:
+      return "Unknown";
+    }
+  }
+
+  static bool IsSamePayload(const std::string &a,
+                            const std::string &b)
+  {
+    if (boost::filesystem::absolute(a).lexically_normal() == boost::filesystem::absolute(b).lexically_normal())
+    {
+      return true;
+    }
+
+    // Same file reached through different paths (e.g. a symbolic link to the mount)
+    boost::system::error_code err;
+    return boost::filesystem::equivalent(a, b, err) && !err;
+  }
+
+  static void ListSubdirectories(std::vector<std::string> &target,
+                                 const std::string &directory)
+  {
+    boost::system::error_code err;
+    for (boost::filesystem::directory_iterator it(directory, err), end; !err && it != end; it.increment(err))
+    {
+      if (boost::filesystem::is_directory(it->symlink_status(err)))
+      {
+        target.push_back(it->path().string());
+      }
+    }
+  }
+
+  // Token bucket shared by the scanning threads
+  class ConsistencyScrubber::RateLimiter : public boost::noncopyable
+  {
+  private:
+    boost::mutex                           mutex_;
+    double                                 rate_;  // Units per second, 0 means unlimited
+    std::chrono::steady_clock::time_point  next_;
+
+  public:
+    explicit RateLimiter(double rate) : rate_(rate), next_(std::chrono::steady_clock::now())
+    {
+    }
+
+    void Acquire(uint64_t units,
+                 const std::atomic<bool> &cancelled)
+    {
+      if (rate_ <= 0)
+      {
+        return;
+      }
+
+      std::chrono::steady_clock::time_point wakeup;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        wakeup = std::max(next_, std::chrono::steady_clock::now());
+        next_ = wakeup + std::chrono::microseconds(static_cast<int64_t>(static_cast<double>(units) * 1000000.0 / rate_));
+      }
+
+      while (!cancelled && std::chrono::steady_clock::now() < wakeup)
+      {
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                                      wakeup - std::chrono::steady_clock::now(), std::chrono::milliseconds(100)));
+      }
+    }
+  };
+
+  std::string ConsistencyScrubber::Unit::GetIdentifier() const
+  {
+    return std::string(pointers_ ? "pointers:" : "payloads:") + (recursive_ ? "tree:" : "files:") + path_;
+  }
+
+  ConsistencyScrubber::ConsistencyScrubber(std::shared_ptr<StorageArea> &storageArea,
+                                           DeletionWorker *deletionWorker)
+      : storageArea_(storageArea), deletionWorker_(deletionWorker), controller_(NULL),
+        state_(State_Idle), cancelled_(false), verifyPayloads_(false), resumed_(false),
+        startTime_(0), deadline_(0), report_(NULL), lastCheckpoint_(0),
+        pointersCount_(0), danglingPointersCount_(0), payloadsCount_(0), orphanedPayloadsCount_(0),
+        queuedForDeletionCount_(0), unreadablePayloadsCount_(0), corruptedPayloadsCount_(0), verifiedBytes_(0)
+  {
+  }
+
+  ConsistencyScrubber::~ConsistencyScrubber()
+  {
+    Stop();
+  }
+
+  void ConsistencyScrubber::Report(const char *kind,
+                                   const std::string &uuid,
+                                   const std::string &path)
+  {
+    LOG(WARNING) << "[SaolaStorage][Scrubber] - " << kind << " " << uuid << " " << path;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (report_ != NULL)
+    {
+      fprintf(report_, "%s\t%s\t%s\n", kind, uuid.c_str(), path.c_str());
+      fflush(report_);
+    }
+  }
+
+  void ConsistencyScrubber::CheckPointer(const std::string &uuid)
+  {
+    filesLimiter_->Acquire(1, cancelled_);
+    pointersCount_++;
+
+    StorageArea::Locator locator;
+    if (!storageArea_->LookupLocator(locator, uuid))
+    {
+      return;  // Removed meanwhile
+    }
+
+    const std::string &path = locator.path_;
+
+    if (S3Backend::IsObjectLocation(path))
+    {
+      return;  // The object store keeps its own consistency
+    }
+
+    boost::system::error_code err;
+    if (!boost::filesystem::is_regular_file(path, err))
+    {
+      std::string current;
+      if (storageArea_->LookupPointer(current, uuid) && current == path)
+      {
+        danglingPointersCount_++;
+        Report("dangling-pointer", uuid, path);
+      }
+
+      return;  // Otherwise, relocated or removed meanwhile
+    }
+
+    if (verifyPayloads_)
+    {
+      const uint64_t expected = boost::filesystem::file_size(path, err);
+      bytesLimiter_->Acquire(err ? 0 : expected, cancelled_);
+
+      uint64_t size = 0;
+      uint32_t crc = 0;
+      bool ok = false;
+
+      {
+        boost::filesystem::ifstream f(path, std::ios::in | std::ios::binary);
+        std::vector<char> buffer(READ_CHUNK_SIZE);
+
+        while (f.good())
+        {
+          f.read(&buffer[0], buffer.size());
+          crc = Crc32c::Extend(crc, &buffer[0], static_cast<size_t>(f.gcount()));
+          size += static_cast<uint64_t>(f.gcount());
+        }
+
+        ok = (!err && f.eof() && !f.bad() && size == expected);
+      }
+
+      verifiedBytes_ += size;
+
+      const bool corrupted = (ok && locator.hasChecksum_ &&
+                              (size != locator.size_ || crc != locator.crc32c_));
+
+      std::string current;
+      if ((!ok || corrupted) &&
+          storageArea_->LookupPointer(current, uuid) && current == path)
+      {
+        if (ok)
+        {
+          corruptedPayloadsCount_++;
+          Report("corrupted-payload", uuid, path);
+        }
+        else
+        {
+          unreadablePayloadsCount_++;
+          Report("unreadable-payload", uuid, path);
+        }
+      }
+    }
+  }
+
+  void ConsistencyScrubber::CheckPayload(const std::string &uuid,
+                                         const std::string &path)
+  {
+    filesLimiter_->Acquire(1, cancelled_);
+    payloadsCount_++;
+
+    std::string pointer;
+    if (storageArea_->LookupPointer(pointer, uuid) && IsSamePayload(pointer, path))
+    {
+      return;
+    }
+
+    if (IsSamePayload(storageArea_->GetLegacyPath(uuid), path))
+    {
+      return;  // Attachment stored before the plugin was installed, without pointer
+    }
+
+    boost::system::error_code err;
+    const std::time_t modified = boost::filesystem::last_write_time(path, err);
+    if (err || static_cast<int64_t>(modified) >= deadline_)
+    {
+      return;
+    }
+
+    orphanedPayloadsCount_++;
+    Report("orphaned-payload", uuid, path);
+
+    if (deletionWorker_ != NULL)
+    {
+      deletionWorker_->EnqueueOrphan(uuid, path);
+      queuedForDeletionCount_++;
+    }
+  }
+
+  void ConsistencyScrubber::ScanUnit(const Unit &unit)
+  {
+    SAOLA_TRACE(Storage, Verbose) << "[SaolaStorage][Scrubber] - Scanning " << unit.GetIdentifier();
+
+    boost::system::error_code err;
+
+    boost::filesystem::recursive_directory_iterator recursive;
+    boost::filesystem::directory_iterator flat;
+
+    if (unit.recursive_)
+    {
+      recursive = boost::filesystem::recursive_directory_iterator(unit.path_, err);
+    }
+    else
+    {
+      flat = boost::filesystem::directory_iterator(unit.path_, err);
+    }
+
+    while (!err && !cancelled_)
+    {
+      boost::filesystem::path path;
+      boost::filesystem::file_status status;
+
+      if (unit.recursive_)
+      {
+        if (recursive == boost::filesystem::recursive_directory_iterator())
+        {
+          break;
+        }
+
+        path = recursive->path();
+        status = recursive->symlink_status(err);
+        recursive.increment(err);
+      }
+      else
+      {
+        if (flat == boost::filesystem::directory_iterator())
+        {
+          break;
+        }
+
+        path = flat->path();
+        status = flat->symlink_status(err);
+        flat.increment(err);
+      }
+
+      if (!boost::filesystem::is_regular_file(status))
+      {
+        continue;
+      }
+
+      const std::string filename = path.filename().string();
+
+      if (unit.pointers_)
+      {
+        const size_t length = strlen(POINTER_EXTENSION);
+
+        if (filename.size() > length &&
+            filename.compare(filename.size() - length, length, POINTER_EXTENSION) == 0 &&
+            Orthanc::Toolbox::IsUuid(filename.substr(0, filename.size() - length)))
+        {
+          CheckPointer(filename.substr(0, filename.size() - length));
+        }
+      }
+      else if (!IOToolbox::IsTemporaryPath(filename) &&
+               Orthanc::Toolbox::IsUuid(filename))
+      {
+        CheckPayload(filename, path.string());
+      }
+    }
+
+    if (err)
+    {
+      LOG(ERROR) << "[SaolaStorage][Scrubber] - Error while scanning " << unit.path_ << ": " << err.message();
+    }
+  }
+
+  void ConsistencyScrubber::BuildUnits(const std::string &root,
+                                       const std::vector<std::string> &mounts,
+                                       size_t minimumCount)
+  {
+    std::vector<Unit> units;
+
+    // The pointers are spread over the 256 first-level directories of StorageDirectory
+    std::vector<std::string> level;
+    ListSubdirectories(level, root);
+
+    for (size_t i = 0; i < level.size(); i++)
+    {
+      Unit unit;
+      unit.pointers_ = true;
+      unit.recursive_ = true;
+      unit.path_ = level[i];
+      units.push_back(unit);
+    }
+
+    // The layout of the mounts depends on "StoragePathFormat": split
+    // them level by level until there are enough units to keep all
+    // the threads busy
+    level.clear();
+    for (size_t i = 0; i < mounts.size(); i++)
+    {
+      if (boost::filesystem::is_directory(mounts[i]))
+      {
+        level.push_back(mounts[i]);
+      }
+    }
+
+    for (unsigned int depth = 0; !level.empty(); depth++)
+    {
+      Unit unit;
+      unit.pointers_ = false;
+
+      if (level.size() >= minimumCount || depth == MAX_UNIT_DEPTH)
+      {
+        unit.recursive_ = true;
+
+        for (size_t i = 0; i < level.size(); i++)
+        {
+          unit.path_ = level[i];
+          units.push_back(unit);
+        }
+
+        break;
+      }
+
+      std::vector<std::string> next;
+      unit.recursive_ = false;
+
+      for (size_t i = 0; i < level.size(); i++)
+      {
+        unit.path_ = level[i];
+        units.push_back(unit);
+        ListSubdirectories(next, level[i]);
+      }
+
+      level.swap(next);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    units_.swap(units);
+  }
+
+  void ConsistencyScrubber::SaveCheckpoint(bool force)
+  {
+    // The caller must hold "mutex_"
+    const int64_t now = static_cast<int64_t>(time(NULL));
+
+    if (!force && now - lastCheckpoint_ < CHECKPOINT_INTERVAL)
+    {
+      return;
+    }
+
+    Json::Value checkpoint = Json::objectValue;
+    checkpoint["StartTime"] = static_cast<Json::Int64>(startTime_);
+    checkpoint["VerifyPayloads"] = verifyPayloads_;
+    checkpoint["Completed"] = Json::arrayValue;
+
+    for (std::set<std::string>::const_iterator it = completedUnits_.begin(); it != completedUnits_.end(); ++it)
+    {
+      checkpoint["Completed"].append(*it);
+    }
+
+    Json::Value &counters = checkpoint["Counters"];
+    counters["Pointers"] = static_cast<Json::UInt64>(pointersCount_.load());
+    counters["DanglingPointers"] = static_cast<Json::UInt64>(danglingPointersCount_.load());
+    counters["Payloads"] = static_cast<Json::UInt64>(payloadsCount_.load());
+    counters["OrphanedPayloads"] = static_cast<Json::UInt64>(orphanedPayloadsCount_.load());
+    counters["QueuedForDeletion"] = static_cast<Json::UInt64>(queuedForDeletionCount_.load());
+    counters["UnreadablePayloads"] = static_cast<Json::UInt64>(unreadablePayloadsCount_.load());
+    counters["CorruptedPayloads"] = static_cast<Json::UInt64>(corruptedPayloadsCount_.load());
+    counters["VerifiedBytes"] = static_cast<Json::UInt64>(verifiedBytes_.load());
+
+    std::string s;
+    Orthanc::Toolbox::WriteFastJson(s, checkpoint);
+
+    try
+    {
+      IOToolbox::WriteFileAtomic(s.c_str(), s.size(), SaolaConfiguration::Instance()->ScrubberCheckpointPath(),
+                                 IOToolbox::FsyncPolicy_None, false);
+      lastCheckpoint_ = now;
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      LOG(ERROR) << "[SaolaStorage][Scrubber] - Cannot write the checkpoint: " << e.What();
+    }
+  }
+
+  bool ConsistencyScrubber::LoadCheckpoint()
+  {
+    const std::string path = SaolaConfiguration::Instance()->ScrubberCheckpointPath();
+
+    if (!Orthanc::SystemToolbox::IsExistingFile(path))
+    {
+      return false;
+    }
+
+    std::string s;
+    Orthanc::SystemToolbox::ReadFile(s, path);
+
+    Json::Value checkpoint;
+    if (!Orthanc::Toolbox::ReadJson(checkpoint, s) ||
+        !checkpoint.isMember("Completed") ||
+        !checkpoint.isMember("Counters"))
+    {
+      LOG(ERROR) << "[SaolaStorage][Scrubber] - Ignoring corrupted checkpoint: " << path;
+      return false;
+    }
+
+    startTime_ = checkpoint["StartTime"].asInt64();
+    verifyPayloads_ = checkpoint["VerifyPayloads"].asBool();
+
+    for (Json::ArrayIndex i = 0; i < checkpoint["Completed"].size(); i++)
+    {
+      completedUnits_.insert(checkpoint["Completed"][i].asString());
+    }
+
+    const Json::Value &counters = checkpoint["Counters"];
+    pointersCount_ = counters["Pointers"].asUInt64();
+    danglingPointersCount_ = counters["DanglingPointers"].asUInt64();
+    payloadsCount_ = counters["Payloads"].asUInt64();
+    orphanedPayloadsCount_ = counters["OrphanedPayloads"].asUInt64();
+    queuedForDeletionCount_ = counters["QueuedForDeletion"].asUInt64();
+    unreadablePayloadsCount_ = counters["UnreadablePayloads"].asUInt64();
+    corruptedPayloadsCount_ = counters["CorruptedPayloads"].asUInt64();
+    verifiedBytes_ = counters["VerifiedBytes"].asUInt64();
+
+    return true;
+  }
+
+  void ConsistencyScrubber::Run(unsigned int threadsCount)
+  {
+    try
+    {
+      std::vector<std::string> mounts;
+      SaolaConfiguration::Instance()->GetWritableMountDirectories(mounts);
+
+      if (SaolaConfiguration::Instance()->TieringEnable())
+      {
+        mounts.push_back(SaolaConfiguration::Instance()->GetColdMountDirectory());
+      }
+
+      const std::vector<std::string> additional = SaolaConfiguration::Instance()->ScrubberAdditionalMountDirectories();
+      mounts.insert(mounts.end(), additional.begin(), additional.end());
+
+      BuildUnits(storageArea_->GetRoot(), mounts, threadsCount * UNITS_PER_THREAD);
+
+      LOG(WARNING) << "[SaolaStorage][Scrubber] - " << (resumed_ ? "Resuming" : "Starting") << " the scrub of "
+                   << units_.size() << " unit(s) with " << threadsCount << " thread(s)";
+
+      std::atomic<size_t> next(0);
+      std::vector<std::thread *> threads;
+
+      for (unsigned int t = 0; t < threadsCount; t++)
+      {
+        threads.push_back(new std::thread([this, &next]()
+        {
+          for (;;)
+          {
+            const size_t i = next++;
+            if (cancelled_ || i >= units_.size())
+            {
+              return;
+            }
+
+            const std::string identifier = units_[i].GetIdentifier();
+
+            {
+              boost::mutex::scoped_lock lock(mutex_);
+              if (completedUnits_.find(identifier) != completedUnits_.end())
+              {
+                continue;
+              }
+            }
+
+            try
+            {
+              ScanUnit(units_[i]);
+            }
+            catch (Orthanc::OrthancException &e)
+            {
+              LOG(ERROR) << "[SaolaStorage][Scrubber] - Error while scanning " << units_[i].path_ << ": " << e.What();
+            }
+            catch (boost::filesystem::filesystem_error &e)
+            {
+              LOG(ERROR) << "[SaolaStorage][Scrubber] - Error while scanning " << units_[i].path_ << ": " << e.what();
+            }
+
+            if (!cancelled_)
+            {
+              boost::mutex::scoped_lock lock(mutex_);
+              completedUnits_.insert(identifier);
+              SaveCheckpoint(false);
+            }
+          }
+        }));
+      }
+
+      for (size_t t = 0; t < threads.size(); t++)
+      {
+        threads[t]->join();
+        delete threads[t];
+      }
+
+      if (cancelled_)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        SaveCheckpoint(true);
+        state_ = State_Cancelled;
+      }
+      else
+      {
+        boost::system::error_code err;
+        boost::filesystem::remove(SaolaConfiguration::Instance()->ScrubberCheckpointPath(), err);
+        state_ = State_Completed;
+      }
+
+      LOG(WARNING) << "[SaolaStorage][Scrubber] - Scrub " << GetStateName(static_cast<State>(state_.load())) << ": "
+                   << danglingPointersCount_.load() << " dangling pointer(s), "
+                   << orphanedPayloadsCount_.load() << " orphaned payload(s), "
+                   << unreadablePayloadsCount_.load() << " unreadable payload(s), "
+                   << corruptedPayloadsCount_.load() << " corrupted payload(s), report in "
+                   << SaolaConfiguration::Instance()->ScrubberReportPath();
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      LOG(ERROR) << "[SaolaStorage][Scrubber] - Scrub failed: " << e.What();
+      state_ = State_Failed;
+    }
+    catch (boost::filesystem::filesystem_error &e)
+    {
+      LOG(ERROR) << "[SaolaStorage][Scrubber] - Scrub failed: " << e.what();
+      state_ = State_Failed;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (report_ != NULL)
+    {
+      fclose(report_);
+      report_ = NULL;
+    }
+  }
+
+  void ConsistencyScrubber::Start(bool resume,
+                                  bool verifyPayloads)
+  {
+    if (state_ == State_Running)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "A scrub is already running");
+    }
+
+    if (controller_ != NULL)
+    {
+      controller_->join();
+      delete controller_;
+      controller_ = NULL;
+    }
+
+    pointersCount_ = 0;
+    danglingPointersCount_ = 0;
+    payloadsCount_ = 0;
+    orphanedPayloadsCount_ = 0;
+    queuedForDeletionCount_ = 0;
+    unreadablePayloadsCount_ = 0;
+    corruptedPayloadsCount_ = 0;
+    verifiedBytes_ = 0;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      units_.clear();
+      completedUnits_.clear();
+      lastCheckpoint_ = 0;
+
+      startTime_ = static_cast<int64_t>(time(NULL));
+      verifyPayloads_ = verifyPayloads;
+      resumed_ = (resume && LoadCheckpoint());
+
+      if (!resumed_)
+      {
+        boost::system::error_code err;
+        boost::filesystem::remove(SaolaConfiguration::Instance()->ScrubberCheckpointPath(), err);
+      }
+
+      const std::string reportPath = SaolaConfiguration::Instance()->ScrubberReportPath();
+      report_ = fopen(reportPath.c_str(), resumed_ ? "a" : "w");
+      if (report_ == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the scrub report: " + reportPath);
+      }
+    }
+
+    deadline_ = static_cast<int64_t>(time(NULL)) - GRACE_SECONDS;
+
+    filesLimiter_.reset(new RateLimiter(SaolaConfiguration::Instance()->ScrubberMaxFilesPerSecond()));
+    bytesLimiter_.reset(new RateLimiter(static_cast<double>(SaolaConfiguration::Instance()->ScrubberMaxMBPerSecond()) * 1024.0 * 1024.0));
+
+    cancelled_ = false;
+    state_ = State_Running;
+
+    const unsigned int threadsCount = static_cast<unsigned int>(std::max(1, SaolaConfiguration::Instance()->ScrubberThreads()));
+    controller_ = new std::thread([this, threadsCount]()
+    {
+      Run(threadsCount);
+    });
+  }
+
+  void ConsistencyScrubber::Cancel()
+  {
+    if (state_ == State_Running)
+    {
+      LOG(WARNING) << "[SaolaStorage][Scrubber] - Cancelling the scrub";
+      cancelled_ = true;
+    }
+  }
+
+  void ConsistencyScrubber::Stop()
+  {
+    Cancel();
+
+    if (controller_ != NULL)
+    {
+      if (controller_->joinable())
+      {
+        controller_->join();
+      }
+
+      delete controller_;
+      controller_ = NULL;
+    }
+  }
+
+  void ConsistencyScrubber::GetStatus(Json::Value &status)
+  {
+    status["State"] = GetStateName(static_cast<State>(state_.load()));
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      status["Resumed"] = resumed_;
+      status["VerifyPayloads"] = verifyPayloads_;
+      status["StartTime"] = static_cast<Json::Int64>(startTime_);
+      status["Units"] = static_cast<Json::UInt64>(units_.size());
+      status["CompletedUnits"] = static_cast<Json::UInt64>(completedUnits_.size());
+    }
+
+    status["Pointers"] = static_cast<Json::UInt64>(pointersCount_.load());
+    status["DanglingPointers"] = static_cast<Json::UInt64>(danglingPointersCount_.load());
+    status["Payloads"] = static_cast<Json::UInt64>(payloadsCount_.load());
+    status["OrphanedPayloads"] = static_cast<Json::UInt64>(orphanedPayloadsCount_.load());
+    status["QueuedForDeletion"] = static_cast<Json::UInt64>(queuedForDeletionCount_.load());
+    status["UnreadablePayloads"] = static_cast<Json::UInt64>(unreadablePayloadsCount_.load());
+    status["CorruptedPayloads"] = static_cast<Json::UInt64>(corruptedPayloadsCount_.load());
+    status["VerifiedBytes"] = static_cast<Json::UInt64>(verifiedBytes_.load());
+    status["ReportPath"] = SaolaConfiguration::Instance()->ScrubberReportPath();
+    status["CheckpointPath"] = SaolaConfiguration::Instance()->ScrubberCheckpointPath();
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "DeletionWorker.h"
+#include "StorageArea.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Background job cross-checking the ".symlink" pointers below
+  // StorageDirectory against the payloads below the mount directories:
+  //  - a pointer whose payload is missing is a "dangling pointer"
+  //    (reported only, Orthanc still references the attachment),
+  //  - a payload that no pointer references is "orphaned" (reported,
+  //    then queued for deletion if DelayedDeletion is enabled),
+  //  - if "VerifyPayloads" is set, a payload whose content does not
+  //    match the CRC32C stored in its pointer is "corrupted".
+  // The trees are split into units that are scanned in parallel. The
+  // completed units are checkpointed, so that a cancelled or
+  // interrupted scrub can be resumed.
+  class ConsistencyScrubber : public boost::noncopyable
+  {
+  public:
+    enum State
+    {
+      State_Idle,
+      State_Running,
+      State_Completed,
+      State_Cancelled,
+      State_Failed
+    };
+
+    struct Unit
+    {
+      bool         pointers_;   // Pointers below StorageDirectory, or payloads below a mount
+      bool         recursive_;  // If "false", only the files directly inside "path_"
+      std::string  path_;
+
+      std::string GetIdentifier() const;
+    };
+
+  private:
+    class RateLimiter;
+
+    std::shared_ptr<StorageArea>   storageArea_;
+    DeletionWorker                *deletionWorker_;  // Can be NULL
+
+    std::thread                   *controller_;
+    std::atomic<int>               state_;
+    std::atomic<bool>              cancelled_;
+    bool                           verifyPayloads_;
+    bool                           resumed_;
+    int64_t                        startTime_;
+    int64_t                        deadline_;  // Payloads modified after this time (seconds since epoch) might still be in creation
+
+    std::unique_ptr<RateLimiter>   filesLimiter_;
+    std::unique_ptr<RateLimiter>   bytesLimiter_;
+
+    boost::mutex                   mutex_;  // Protects the members below
+    std::vector<Unit>              units_;
+    std::set<std::string>          completedUnits_;
+    FILE                          *report_;
+    int64_t                        lastCheckpoint_;
+
+    std::atomic<uint64_t>          pointersCount_;
+    std::atomic<uint64_t>          danglingPointersCount_;
+    std::atomic<uint64_t>          payloadsCount_;
+    std::atomic<uint64_t>          orphanedPayloadsCount_;
+    std::atomic<uint64_t>          queuedForDeletionCount_;
+    std::atomic<uint64_t>          unreadablePayloadsCount_;
+    std::atomic<uint64_t>          corruptedPayloadsCount_;  // Readable, but not matching the checksum of the pointer
+    std::atomic<uint64_t>          verifiedBytes_;
+
+    void Report(const char *kind,
+                const std::string &uuid,
+                const std::string &path);
+
+    void CheckPointer(const std::string &uuid);
+
+    void CheckPayload(const std::string &uuid,
+                      const std::string &path);
+
+    void ScanUnit(const Unit &unit);
+
+    void BuildUnits(const std::string &root,
+                    const std::vector<std::string> &mounts,
+                    size_t minimumCount);
+
+    void SaveCheckpoint(bool force);
+
+    bool LoadCheckpoint();
+
+    void Run(unsigned int threadsCount);
+
+  public:
+    ConsistencyScrubber(std::shared_ptr<StorageArea> &storageArea,
+                        DeletionWorker *deletionWorker);
+
+    ~ConsistencyScrubber();
+
+    void Start(bool resume,
+               bool verifyPayloads);
+
+    // The checkpoint is kept, the scrub can be resumed later on
+    void Cancel();
+
+    void Stop();
+
+    void GetStatus(Json::Value &status);
+  };
+}
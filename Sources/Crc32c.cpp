@@ -0,0 +1,197 @@
+#include "Crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <nmmintrin.h>
+#  define SAOLA_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define SAOLA_CRC32C_ARMV8 1
+#endif
+
+namespace Saola
+{
+  namespace Crc32c
+  {
+    static const uint32_t POLYNOMIAL = 0x82f63b78;  // Reversed 0x1edc6f41
+
+    namespace
+    {
+      // tables_[k][b] is the CRC of byte "b" followed by "k" zero bytes
+      class Tables
+      {
+      private:
+        uint32_t tables_[8][256];
+
+      public:
+        Tables()
+        {
+          for (uint32_t b = 0; b < 256; b++)
+          {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; i++)
+            {
+              crc = (crc >> 1) ^ (POLYNOMIAL & (0u - (crc & 1)));
+            }
+
+            tables_[0][b] = crc;
+          }
+
+          for (uint32_t b = 0; b < 256; b++)
+          {
+            for (int k = 1; k < 8; k++)
+            {
+              tables_[k][b] = (tables_[k - 1][b] >> 8) ^ tables_[0][tables_[k - 1][b] & 0xff];
+            }
+          }
+        }
+
+        const uint32_t *operator[](size_t k) const
+        {
+          return tables_[k];
+        }
+      };
+
+      const Tables TABLES;
+    }
+
+    uint32_t ExtendSoftware(uint32_t crc,
+                            const void *data,
+                            size_t size)
+    {
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+      uint32_t c = ~crc;
+
+      while (size >= 8)
+      {
+        uint32_t low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        low = __builtin_bswap32(low);
+        high = __builtin_bswap32(high);
+#endif
+
+        low ^= c;
+        c = (TABLES[7][low & 0xff] ^ TABLES[6][(low >> 8) & 0xff] ^
+             TABLES[5][(low >> 16) & 0xff] ^ TABLES[4][low >> 24] ^
+             TABLES[3][high & 0xff] ^ TABLES[2][(high >> 8) & 0xff] ^
+             TABLES[1][(high >> 16) & 0xff] ^ TABLES[0][high >> 24]);
+
+        p += 8;
+        size -= 8;
+      }
+
+      while (size > 0)
+      {
+        c = (c >> 8) ^ TABLES[0][(c ^ *p) & 0xff];
+        p++;
+        size--;
+      }
+
+      return ~c;
+    }
+
+#if SAOLA_CRC32C_SSE42 == 1
+    __attribute__((target("sse4.2")))
+    static uint32_t ExtendHardware(uint32_t crc,
+                                   const void *data,
+                                   size_t size)
+    {
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+      uint64_t c = ~crc;
+
+      while (size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0)
+      {
+        c = _mm_crc32_u8(static_cast<uint32_t>(c), *p);
+        p++;
+        size--;
+      }
+
+      while (size >= 8)
+      {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        size -= 8;
+      }
+
+      while (size > 0)
+      {
+        c = _mm_crc32_u8(static_cast<uint32_t>(c), *p);
+        p++;
+        size--;
+      }
+
+      return ~static_cast<uint32_t>(c);
+    }
+
+    static bool HasHardwareSupport()
+    {
+      return __builtin_cpu_supports("sse4.2");
+    }
+
+#elif SAOLA_CRC32C_ARMV8 == 1
+    static uint32_t ExtendHardware(uint32_t crc,
+                                   const void *data,
+                                   size_t size)
+    {
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+      uint32_t c = ~crc;
+
+      while (size >= 8)
+      {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = __crc32cd(c, word);
+        p += 8;
+        size -= 8;
+      }
+
+      while (size > 0)
+      {
+        c = __crc32cb(c, *p);
+        p++;
+        size--;
+      }
+
+      return ~c;
+    }
+
+    static bool HasHardwareSupport()
+    {
+      return true;  // Compiled for a target with the CRC extension
+    }
+
+#else
+    static uint32_t ExtendHardware(uint32_t crc,
+                                   const void *data,
+                                   size_t size)
+    {
+      return ExtendSoftware(crc, data, size);
+    }
+
+    static bool HasHardwareSupport()
+    {
+      return false;
+    }
+#endif
+
+    static const bool HARDWARE = HasHardwareSupport();
+
+    uint32_t Extend(uint32_t crc,
+                    const void *data,
+                    size_t size)
+    {
+      return (HARDWARE ? ExtendHardware(crc, data, size) : ExtendSoftware(crc, data, size));
+    }
+
+    bool IsHardwareAccelerated()
+    {
+      return HARDWARE;
+    }
+  }
+}
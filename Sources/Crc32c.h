@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Saola
+{
+  // CRC-32C (Castagnoli), as used by iSCSI, ext4 or RocksDB. Uses the
+  // dedicated instructions of SSE 4.2 (detected at runtime) or ARMv8
+  // (if the target has them), and a slicing-by-8 table otherwise.
+  namespace Crc32c
+  {
+    // Continues the checksum "crc" of the preceding bytes, starting from 0
+    uint32_t Extend(uint32_t crc,
+                    const void *data,
+                    size_t size);
+
+    uint32_t ExtendSoftware(uint32_t crc,
+                            const void *data,
+                            size_t size);
+
+    inline uint32_t Compute(const void *data,
+                            size_t size)
+    {
+      return Extend(0, data, size);
+    }
+
+    bool IsHardwareAccelerated();
+  }
+}
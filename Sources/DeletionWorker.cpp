@@ -1,58 +1,210 @@
 #include "DeletionWorker.h"
 #include "SaolaConfiguration.h"
+#include "Trace.h"
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
 #include <Logging.h>
 #include <Enumerations.h>
+#include <algorithm>
 #include <chrono>
+#include <ctime>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
 namespace Saola
 {
-  void DeletionWorker::Run()
+  // Sliding windows of the throughput in the status, the drain time is estimated over the second one
+  static const unsigned int THROUGHPUT_WINDOWS[] = { 60, 300, 900 };
+
+  // Upper bound of the delay before "Stop()" is noticed
+  static const unsigned int GRANULARITY = 100;
+
+  void DeletionWorker::RefreshOldestEnqueued()
+  {
+    int64_t enqueued;
+    oldestEnqueued_ = (db_->LookupOldestEnqueued(enqueued) ? enqueued : 0);
+  }
+
+  void DeletionWorker::NotifyEnqueued()
+  {
+    // Only the first entry of an empty queue can be the oldest one
+    int64_t empty = 0;
+    oldestEnqueued_.compare_exchange_strong(empty, static_cast<int64_t>(time(NULL)));
+  }
+
+  void DeletionWorker::TakeBatch(std::vector<PendingDeletionsDatabase::Entry> &entries)
   {
-    std::string uuid;
-    Orthanc::FileContentType type = Orthanc::FileContentType_Dicom; // Dummy initialization
+    const std::shared_ptr<const SaolaConfiguration> snapshot = SaolaConfiguration::Instance();
+    const SaolaConfiguration &configuration = *snapshot;
+
+    // The entries stay in the queue until they are completed: those
+    // that failed, or those of a node that crashed, are taken again
+    // once the lease expires
+    db_->LeaseBatch(entries, configuration.DelayedDeletionBatchSize(), databaseServerIdentifier_,
+                    configuration.DelayedDeletionLeaseSeconds());
+  }
+
+  bool DeletionWorker::Run()
+  {
+    std::vector<PendingDeletionsDatabase::Entry> entries;
 
     bool hasDeleted = false;
 
-    while (this->m_state == State_Running && db_->Dequeue(uuid, type))
+    while (this->m_state == State_Running)
     {
+      try
+      {
+        TakeBatch(entries);
+      }
+      catch (Orthanc::OrthancException &ex)
+      {
+        // E.g. the shared database is locked by another node for too long
+        LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot read the pending deletions: " << ex.What();
+        errorsCount_++;
+        break;
+      }
+
+      if (entries.empty())
+      {
+        break;
+      }
+
       if (!hasDeleted)
       {
-        LOG(INFO) << "[SaolaStorage][DelayedDeletion] - Starting to process the pending deletions";
+        SAOLA_TRACE(Deletion, Info) << "[SaolaStorage][DelayedDeletion] - Starting to process the pending deletions";
       }
 
       hasDeleted = true;
 
+      // The attachments of a batch are removed together, which groups
+      // the files of a same series or study directory
+      std::vector<std::string> attachments;
+      attachments.reserve(entries.size());
+
+      // Only the entries that were handled leave the queue: the others
+      // are retried once their lease expires
+      std::vector<PendingDeletionsDatabase::Entry> completed;
+      completed.reserve(entries.size());
+
+      uint64_t bytes = 0;
+      size_t failures = 0;
+
+      for (size_t i = 0; i < entries.size(); i++)
+      {
+        SAOLA_TRACE(Deletion, Verbose) << "[SaolaStorage][DelayedDeletion] - Asynchronous removal of file: " << entries[i].uuid_ << "\" of type " << static_cast<int>(entries[i].type_);
+
+        if (entries[i].path_.empty())
+        {
+          attachments.push_back(entries[i].uuid_);
+        }
+        else
+        {
+          try
+          {
+            boost::system::error_code err;
+            const uintmax_t size = boost::filesystem::file_size(entries[i].path_, err);
+
+            if (storageArea_->RemoveOrphanedPayload(entries[i].uuid_, entries[i].path_) &&
+                !err)
+            {
+              bytes += size;
+            }
+
+            completed.push_back(entries[i]);
+          }
+          catch (Orthanc::OrthancException &ex)
+          {
+            LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot remove file: " << entries[i].path_ << " " << ex.What();
+            failures++;
+          }
+        }
+      }
+
       try
       {
-        LOG(INFO) << "[SaolaStorage][DelayedDeletion] - Asynchronous removal of file: " << uuid << "\" of type " << static_cast<int>(type);
-        storageArea_->RemoveAttachment(uuid);
-        if (SaolaConfiguration::Instance().DelayedDeletionThrottleDelayMs() > 0)
+        uint64_t removedBytes = 0;
+        std::vector<std::pair<std::string, std::string> > leftovers;
+        storageArea_->RemoveAttachments(attachments, &removedBytes, &leftovers);
+        bytes += removedBytes;
+
+        // The pointers of these attachments are gone: their payloads
+        // are retried by path, as orphans
+        for (size_t i = 0; i < leftovers.size(); i++)
+        {
+          EnqueueOrphan(leftovers[i].first, leftovers[i].second);
+          failures++;
+        }
+
+        for (size_t i = 0; i < entries.size(); i++)
         {
-          std::this_thread::sleep_for(std::chrono::milliseconds(SaolaConfiguration::Instance().DelayedDeletionThrottleDelayMs()));
+          if (entries[i].path_.empty())
+          {
+            completed.push_back(entries[i]);
+          }
         }
       }
       catch (Orthanc::OrthancException &ex)
       {
-        LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot remove file: " << uuid << " " << ex.What();
+        LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot remove " << attachments.size() << " file(s): " << ex.What();
+        failures += attachments.size();
+      }
+
+      deletedFilesCount_ += entries.size() - failures;
+      deletedBytes_ += bytes;
+      errorsCount_ += failures;
+      throughput_.Add(entries.size() - failures, bytes);
+
+      try
+      {
+        db_->Complete(completed);
+      }
+      catch (Orthanc::OrthancException &ex)
+      {
+        // The entries will be handled again once their lease expires
+        LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot complete " << completed.size() << " pending deletion(s): " << ex.What();
+        errorsCount_++;
+      }
+
+      try
+      {
+        RefreshOldestEnqueued();
+      }
+      catch (Orthanc::OrthancException &ex)
+      {
+        LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot look up the oldest pending deletion: " << ex.What();
+      }
+
+      // Same average rate as when the files were removed one by one
+      const uint64_t throttleMs = static_cast<uint64_t>(std::max(0, SaolaConfiguration::Instance()->DelayedDeletionThrottleDelayMs())) * entries.size();
+
+      for (uint64_t slept = 0; slept < throttleMs && this->m_state == State_Running; slept += GRANULARITY)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min<uint64_t>(GRANULARITY, throttleMs - slept)));
       }
     }
 
     if (hasDeleted)
     {
-      LOG(INFO) << "[SaolaStorage][DelayedDeletion] - All the pending deletions have been completed";
+      SAOLA_TRACE(Deletion, Info) << "[SaolaStorage][DelayedDeletion] - All the pending deletions have been completed";
     }
+
+    return hasDeleted;
   }
 
   void DeletionWorker::Start()
   {
-    LOG(INFO) << "[SaolaStorage][DelayedDeletion] - Starting the deletion thread";
-    static const unsigned int GRANULARITY = 100;
+    SAOLA_TRACE(Deletion, Info) << "[SaolaStorage][DelayedDeletion] - Starting the deletion thread";
+
+    // In a shared queue, the other nodes also enqueue and delete
+    static const unsigned int COUNTERS_REFRESH_SECONDS = 60;
+
+    // An idle node polls a shared queue less and less often, as each
+    // poll writes to the database on the NAS
+    static const unsigned int SHARED_IDLE_MAX_MS = 5000;
+
     if (this->m_state != State_Setup)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
@@ -62,10 +214,43 @@ namespace Saola
 
     this->m_worker = new std::thread([this]()
                                      {
+    time_t lastRefresh = time(NULL);
+    unsigned int pollMs = GRANULARITY;
+
     while (this->m_state == State_Running)
     {
-      this->Run();
-      std::this_thread::sleep_for(std::chrono::milliseconds(GRANULARITY));
+      const bool hasDeleted = this->Run();
+
+      if (!db_->IsShared() ||
+          hasDeleted)
+      {
+        pollMs = GRANULARITY;
+      }
+      else
+      {
+        pollMs = std::min(SHARED_IDLE_MAX_MS, 2 * pollMs);
+      }
+
+      if (db_->IsShared() &&
+          time(NULL) >= lastRefresh + static_cast<time_t>(COUNTERS_REFRESH_SECONDS))
+      {
+        try
+        {
+          db_->RefreshCounters();
+          RefreshOldestEnqueued();
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][DelayedDeletion] - Cannot count the pending deletions: " << ex.What();
+        }
+
+        lastRefresh = time(NULL);
+      }
+
+      for (unsigned int slept = 0; slept < pollMs && this->m_state == State_Running; slept += GRANULARITY)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(GRANULARITY));
+      }
     } });
   }
 
@@ -83,22 +268,104 @@ namespace Saola
 
   void DeletionWorker::GetStatistics(Json::Value &status)
   {
-    status["FilesPendingDeletion"] = db_->GetSize();
+    const unsigned int pending = db_->GetSize();
+    status["FilesPendingDeletion"] = pending;
+
+    std::map<int, unsigned int> byPriority;
+    db_->GetSizeByPriority(byPriority);
+
+    status["FilesPendingDeletionByPriority"] = Json::objectValue;
+    for (std::map<int, unsigned int>::const_iterator it = byPriority.begin(); it != byPriority.end(); ++it)
+    {
+      status["FilesPendingDeletionByPriority"][boost::lexical_cast<std::string>(it->first)] = it->second;
+    }
     status["DatabaseServerIdentifier"] = databaseServerIdentifier_;
+    status["SharedQueue"] = db_->IsShared();
+
+    status["DeletedFilesCount"] = static_cast<Json::UInt64>(deletedFilesCount_.load());
+    status["DeletedBytes"] = static_cast<Json::UInt64>(deletedBytes_.load());
+    status["ErrorsCount"] = static_cast<Json::UInt64>(errorsCount_.load());
+
+    const int64_t oldest = oldestEnqueued_.load();
+    if (pending > 0 && oldest > 0)
+    {
+      status["OldestPendingAgeSeconds"] = static_cast<Json::Int64>(std::max<int64_t>(0, static_cast<int64_t>(time(NULL)) - oldest));
+    }
+    else
+    {
+      status["OldestPendingAgeSeconds"] = Json::nullValue;
+    }
+
+    const int64_t now = ThroughputMeter::GetNow();
+
+    double drainRate = 0;
+
+    status["Throughput"] = Json::objectValue;
+    for (size_t i = 0; i < sizeof(THROUGHPUT_WINDOWS) / sizeof(THROUGHPUT_WINDOWS[0]); i++)
+    {
+      double filesPerSecond, bytesPerSecond;
+      throughput_.GetRates(filesPerSecond, bytesPerSecond, THROUGHPUT_WINDOWS[i], now);
+
+      Json::Value& window = status["Throughput"][boost::lexical_cast<std::string>(THROUGHPUT_WINDOWS[i]) + "s"];
+      window["FilesPerSecond"] = filesPerSecond;
+      window["BytesPerSecond"] = bytesPerSecond;
+
+      if (i == 1)
+      {
+        drainRate = filesPerSecond;
+      }
+    }
+
+    // Null if nothing was deleted recently, e.g. while the worker is throttled to a halt
+    if (pending == 0)
+    {
+      status["EstimatedDrainSeconds"] = 0;
+    }
+    else if (drainRate > 0)
+    {
+      status["EstimatedDrainSeconds"] = static_cast<Json::UInt64>(static_cast<double>(pending) / drainRate);
+    }
+    else
+    {
+      status["EstimatedDrainSeconds"] = Json::nullValue;
+    }
   }
 
   void DeletionWorker::Enqueue(const std::string& uuid, Orthanc::FileContentType type)
   {
-    LOG(INFO) << "[SaolaStorage][DelayedDeletion] - Scheduling delayed deletion of " << uuid;
-    db_->Enqueue(uuid, type);
+    const int priority = SaolaConfiguration::Instance()->DelayedDeletionPriority(type);
+    SAOLA_TRACE(Deletion, Verbose) << "[SaolaStorage][DelayedDeletion] - Scheduling delayed deletion of " << uuid << " with priority " << priority;
+    db_->Enqueue(uuid, type, priority);
+    NotifyEnqueued();
+  }
+
+  bool DeletionWorker::SetPriority(const std::string& uuid, int priority)
+  {
+    SAOLA_TRACE(Deletion, Verbose) << "[SaolaStorage][DelayedDeletion] - Changing the priority of the deletion of " << uuid << " to " << priority;
+    return db_->SetPriority(uuid, priority);
+  }
+
+  void DeletionWorker::EnqueueOrphan(const std::string& uuid, const std::string& path)
+  {
+    SAOLA_TRACE(Deletion, Verbose) << "[SaolaStorage][DelayedDeletion] - Scheduling deletion of orphaned payload " << path;
+    db_->EnqueueOrphan(uuid, path);
+    NotifyEnqueued();
   }
 
   DeletionWorker::DeletionWorker(std::shared_ptr<StorageArea> &storageArea)
-      : storageArea_(storageArea), m_state(State_Setup)
+      : storageArea_(storageArea), m_state(State_Setup),
+        deletedFilesCount_(0), deletedBytes_(0), errorsCount_(0), oldestEnqueued_(0)
   {
     databaseServerIdentifier_ = OrthancPluginGetDatabaseServerIdentifier(OrthancPlugins::GetGlobalContext());
 
-    db_.reset(new Saola::PendingDeletionsDatabase(SaolaConfiguration::Instance().DelayedDeletionPath()));
+    db_.reset(new Saola::PendingDeletionsDatabase(SaolaConfiguration::Instance()->DelayedDeletionPath(),
+                                                  SaolaConfiguration::Instance()->DelayedDeletionAgingSeconds(),
+                                                  SaolaConfiguration::Instance()->DelayedDeletionSharedQueue()));
+
+    // The leases of the previous run of this node are not awaited
+    db_->ReleaseLeases(databaseServerIdentifier_);
+
+    RefreshOldestEnqueued();
   }
 
   DeletionWorker::~DeletionWorker()
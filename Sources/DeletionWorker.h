@@ -2,7 +2,9 @@
 
 #include "PendingDeletionsDatabase.h"
 #include "StorageArea.h"
+#include "ThroughputMeter.h"
 
+#include <atomic>
 #include <thread>
 #include <boost/noncopyable.hpp>
 #include <json/value.h>
@@ -29,7 +31,23 @@ namespace Saola
 
     State m_state;
 
-    void Run();
+    // Statistics of "/delayed-deletion/status", which never touch the database
+    ThroughputMeter throughput_;
+    std::atomic<uint64_t> deletedFilesCount_;
+    std::atomic<uint64_t> deletedBytes_;
+    std::atomic<uint64_t> errorsCount_;
+    std::atomic<int64_t> oldestEnqueued_;  // Seconds since epoch, 0 if unknown
+
+    void RefreshOldestEnqueued();
+
+    // Avoids a lookup of the oldest entry on each enqueue
+    void NotifyEnqueued();
+
+    // Leases the next batch, which is completed once removed
+    void TakeBatch(std::vector<PendingDeletionsDatabase::Entry> &entries);
+
+    // Returns "false" if no entry was taken
+    bool Run();
 
   public:
     DeletionWorker(std::shared_ptr<StorageArea> &storageArea);
@@ -38,8 +56,13 @@ namespace Saola
 
     void GetStatistics(Json::Value &status);
 
+    // The priority depends on the content type, cf. "DelayedDeletion.Priorities"
     void Enqueue(const std::string &uuid, Orthanc::FileContentType type);
 
+    bool SetPriority(const std::string &uuid, int priority);
+
+    void EnqueueOrphan(const std::string &uuid, const std::string &path);
+
     void Start();
 
     void Stop();
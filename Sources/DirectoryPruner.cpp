@@ -0,0 +1,284 @@
+#include "DirectoryPruner.h"
+#include "IOToolbox.h"
+#include "Trace.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <ctime>
+
+namespace Saola
+{
+  DirectoryPruner::DirectoryPruner(unsigned int intervalSeconds,
+                                   unsigned int graceSeconds)
+      : intervalSeconds_(std::max(1u, intervalSeconds)), graceSeconds_(graceSeconds),
+        running_(false), thread_(NULL), pinsCount_(0), sweeps_(0), removedDirectories_(0), skippedPinnedDirectories_(0)
+  {
+    for (size_t i = 0; i < PIN_SLOTS; i++)
+    {
+      pins_[i] = 0;
+    }
+  }
+
+  size_t DirectoryPruner::GetPinSlot(const std::string &directory)
+  {
+    return std::hash<std::string>()(directory) % PIN_SLOTS;
+  }
+
+  DirectoryPruner::Pin::Pin(DirectoryPruner &pruner,
+                            const std::string &directory)
+      : pruner_(pruner)
+  {
+    std::string current = directory;
+
+    while (!current.empty())
+    {
+      slots_.push_back(GetPinSlot(current));
+
+      const size_t separator = current.find_last_of("/\\");
+      current.resize(separator == std::string::npos ? 0 : separator);
+    }
+
+    for (size_t i = 0; i < slots_.size(); i++)
+    {
+      std::atomic<int> &pins = pruner_.pins_[slots_[i]];
+
+      int count = pins.load();
+      for (;;)
+      {
+        if (count == REMOVING)
+        {
+          // The sweep is removing this directory, which is recreated afterwards by the writer
+          std::this_thread::yield();
+          count = pins.load();
+        }
+        else if (pins.compare_exchange_weak(count, count + 1))
+        {
+          break;
+        }
+      }
+    }
+
+    pruner_.pinsCount_++;
+  }
+
+  DirectoryPruner::Pin::~Pin()
+  {
+    for (size_t i = 0; i < slots_.size(); i++)
+    {
+      pruner_.pins_[slots_[i]]--;
+    }
+
+    pruner_.pinsCount_--;
+  }
+
+  DirectoryPruner::~DirectoryPruner()
+  {
+    if (thread_ != NULL)
+    {
+      LOG(ERROR) << "[SaolaStorage][Pruner]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  bool DirectoryPruner::IsBelowRoot(const std::string &directory)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < roots_.size(); i++)
+    {
+      const std::string &root = roots_[i];
+      if (directory.size() > root.size() + 1 &&
+          directory.compare(0, root.size(), root) == 0 &&
+          (directory[root.size()] == '/' || directory[root.size()] == '\\'))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void DirectoryPruner::AddRoot(const std::string &root)
+  {
+    std::string s = root;
+    while (s.size() > 1 && (s[s.size() - 1] == '/' || s[s.size() - 1] == '\\'))
+    {
+      s.resize(s.size() - 1);
+    }
+
+    if (s.empty())
+    {
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (std::find(roots_.begin(), roots_.end(), s) == roots_.end())
+    {
+      roots_.push_back(s);
+    }
+  }
+
+  void DirectoryPruner::Touch(const std::string &directory)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    touched_.insert(directory);
+  }
+
+  size_t DirectoryPruner::Sweep()
+  {
+    std::set<std::string> candidates;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      candidates.swap(touched_);
+    }
+
+    const time_t deadline = time(NULL) - static_cast<time_t>(graceSeconds_);
+
+    std::set<std::string> deferred;
+    size_t removed = 0;
+
+    // A subdirectory sorts after its parent: processing the set from
+    // its end prunes the children before trying their parents. The
+    // removal of a child updates the modification time of its parent,
+    // which is thus usually removed by the next sweep.
+    while (!candidates.empty())
+    {
+      std::set<std::string>::iterator last = candidates.end();
+      --last;
+
+      const std::string directory = *last;
+      candidates.erase(last);
+
+      if (!IsBelowRoot(directory))
+      {
+        continue;
+      }
+
+      boost::system::error_code err;
+      const time_t modified = boost::filesystem::last_write_time(directory, err);
+      if (err)
+      {
+        continue;  // Already removed
+      }
+
+      if (modified > deadline)
+      {
+        deferred.insert(directory);
+        continue;
+      }
+
+      // Claimed only if neither the directory nor its subdirectories
+      // are pinned, the writers wait for the end of the removal
+      std::atomic<int> &pins = pins_[GetPinSlot(directory)];
+
+      int unpinned = 0;
+      const bool pinned = !pins.compare_exchange_strong(unpinned, REMOVING);
+
+      bool isRemoved = false;
+      if (!pinned)
+      {
+        isRemoved = IOToolbox::RemoveDirectoryIfEmpty(directory);
+        pins = 0;
+      }
+
+      if (pinned)
+      {
+        // A writer is filling it, it might be empty again once the writer fails or its file is removed
+        skippedPinnedDirectories_++;
+        deferred.insert(directory);
+      }
+      else if (isRemoved)
+      {
+        SAOLA_TRACE(Storage, Verbose) << "[SaolaStorage][Pruner] - Removed empty directory " << directory;
+        removed++;
+        candidates.insert(boost::filesystem::path(directory).parent_path().string());
+      }
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      touched_.insert(deferred.begin(), deferred.end());
+    }
+
+    sweeps_++;
+    removedDirectories_ += removed;
+
+    return removed;
+  }
+
+  void DirectoryPruner::Start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (thread_ != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    running_ = true;
+
+    thread_ = new std::thread([this]()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (running_)
+      {
+        stopped_.timed_wait(lock, boost::posix_time::seconds(intervalSeconds_));
+
+        if (running_)
+        {
+          lock.unlock();
+
+          try
+          {
+            Sweep();
+          }
+          catch (std::exception &e)
+          {
+            LOG(ERROR) << "[SaolaStorage][Pruner] - Error while pruning the directories: " << e.what();
+          }
+
+          lock.lock();
+        }
+      }
+    });
+  }
+
+  void DirectoryPruner::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      running_ = false;
+      stopped_.notify_all();
+    }
+
+    if (thread_ != NULL)
+    {
+      if (thread_->joinable())
+      {
+        thread_->join();
+      }
+
+      delete thread_;
+      thread_ = NULL;
+    }
+  }
+
+  void DirectoryPruner::GetStatistics(Json::Value &status)
+  {
+    status["Sweeps"] = static_cast<Json::UInt64>(sweeps_.load());
+    status["RemovedDirectories"] = static_cast<Json::UInt64>(removedDirectories_.load());
+    status["SkippedPinnedDirectories"] = static_cast<Json::UInt64>(skippedPinnedDirectories_.load());
+
+    status["PinnedDirectories"] = static_cast<Json::UInt64>(pinsCount_.load());
+
+    boost::mutex::scoped_lock lock(mutex_);
+    status["PendingDirectories"] = static_cast<Json::UInt64>(touched_.size());
+  }
+}
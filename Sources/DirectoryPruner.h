@@ -0,0 +1,93 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Deferred removal of the directories emptied by the deletions. The
+  // deletions only record the directories they touched, and a periodic
+  // sweep removes the empty ones, then climbs towards the root as the
+  // parents become empty too. Only the directories strictly below a
+  // registered root are removed. The writers pin the directory they
+  // are filling: neither it nor its parents are removed until it is
+  // unpinned, so that a directory cannot vanish between its creation
+  // and the write of the file. A directory modified less than
+  // "graceSeconds" ago is also kept for the next sweep.
+  //
+  // A pin increments the counters of its directory and of all its
+  // parents, in a fixed table of atomic counters indexed by the hash
+  // of the path (a collision only defers a removal). The sweep claims
+  // the counter of a directory while removing it: a writer only waits
+  // if it pins that very directory during its "rmdir()".
+  class DirectoryPruner : public boost::noncopyable
+  {
+  public:
+    class Pin : public boost::noncopyable
+    {
+    private:
+      DirectoryPruner      &pruner_;
+      std::vector<size_t>   slots_;  // Of the directory and its parents
+
+    public:
+      Pin(DirectoryPruner &pruner,
+          const std::string &directory);
+
+      ~Pin();
+    };
+
+  private:
+    unsigned int               intervalSeconds_;
+    unsigned int               graceSeconds_;
+
+    boost::mutex               mutex_;  // Protects the members below
+    boost::condition_variable  stopped_;
+    std::vector<std::string>   roots_;
+    std::set<std::string>      touched_;
+    bool                       running_;
+    std::thread               *thread_;
+
+    static const size_t PIN_SLOTS = 4096;
+    static const int    REMOVING = -1;  // Claimed by the sweep
+
+    std::atomic<int>           pins_[PIN_SLOTS];
+    std::atomic<uint64_t>      pinsCount_;
+
+    std::atomic<uint64_t>      sweeps_;
+    std::atomic<uint64_t>      removedDirectories_;
+    std::atomic<uint64_t>      skippedPinnedDirectories_;
+
+    bool IsBelowRoot(const std::string &directory);
+
+    static size_t GetPinSlot(const std::string &directory);
+
+  public:
+    DirectoryPruner(unsigned int intervalSeconds,
+                    unsigned int graceSeconds);
+
+    ~DirectoryPruner();
+
+    // Directories not below a root are never removed
+    void AddRoot(const std::string &root);
+
+    // Called after a file was removed from "directory"
+    void Touch(const std::string &directory);
+
+    // Returns the number of removed directories
+    size_t Sweep();
+
+    void Start();
+
+    void Stop();
+
+    void GetStatistics(Json::Value &status);
+  };
+}
@@ -0,0 +1,288 @@
+#include "DiskSpaceMonitor.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__) || defined(__APPLE__)
+#  include <sys/statvfs.h>
+#else
+#  include <boost/filesystem.hpp>
+#endif
+
+namespace Saola
+{
+  DiskSpaceMonitor::Volume::Volume(const std::string &path)
+      : path_(path), valid_(false), full_(false), totalBytes_(0), freeBytes_(0)
+  {
+    // Orthanc metrics have no labels: the volume goes into the name
+    for (size_t i = 0; i < path.size(); i++)
+    {
+      if (isalnum(static_cast<unsigned char>(path[i])))
+      {
+        metric_ += static_cast<char>(tolower(static_cast<unsigned char>(path[i])));
+      }
+      else if (!metric_.empty() && metric_[metric_.size() - 1] != '_')
+      {
+        metric_ += '_';
+      }
+    }
+  }
+
+  DiskSpaceMonitor::DiskSpaceMonitor(unsigned int highWaterPercent,
+                                     unsigned int lowWaterPercent,
+                                     uint64_t minFreeBytes,
+                                     unsigned int refreshSeconds)
+      : refreshSeconds_(std::max(1u, refreshSeconds)), running_(false), thread_(NULL),
+        rejected_(0), redirected_(0)
+  {
+    SetThresholds(highWaterPercent, lowWaterPercent, minFreeBytes);
+  }
+
+  DiskSpaceMonitor::~DiskSpaceMonitor()
+  {
+    if (thread_ != NULL)
+    {
+      LOG(ERROR) << "[SaolaStorage][DiskSpace]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  void DiskSpaceMonitor::SetThresholds(unsigned int highWaterPercent,
+                                       unsigned int lowWaterPercent,
+                                       uint64_t minFreeBytes)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    highWaterPercent_ = std::min(100u, highWaterPercent);
+    lowWaterPercent_ = std::min(highWaterPercent_, lowWaterPercent);
+    minFreeBytes_ = minFreeBytes;
+  }
+
+  void DiskSpaceMonitor::RefreshVolume(Volume &volume)
+  {
+    uint64_t totalBytes = 0;
+    uint64_t freeBytes = 0;
+
+#if defined(__linux__) || defined(__APPLE__)
+    struct statvfs s;
+    if (statvfs(volume.path_.c_str(), &s) != 0)
+    {
+      if (volume.valid_)
+      {
+        LOG(WARNING) << "[SaolaStorage][DiskSpace] - Cannot get the free space of " << volume.path_ << ": " << strerror(errno);
+      }
+
+      volume.valid_ = false;
+      volume.full_ = false;
+      return;
+    }
+
+    totalBytes = static_cast<uint64_t>(s.f_blocks) * s.f_frsize;
+    freeBytes = static_cast<uint64_t>(s.f_bavail) * s.f_frsize;  // Available to unprivileged users
+#else
+    boost::system::error_code err;
+    const boost::filesystem::space_info info = boost::filesystem::space(volume.path_, err);
+    if (err)
+    {
+      volume.valid_ = false;
+      volume.full_ = false;
+      return;
+    }
+
+    totalBytes = info.capacity;
+    freeBytes = info.available;
+#endif
+
+    const double usedPercent = (totalBytes == 0 ? 0.0 :
+                                100.0 * static_cast<double>(totalBytes - std::min(freeBytes, totalBytes)) /
+                                static_cast<double>(totalBytes));
+
+    bool full;
+
+    {
+      // Hysteresis, so that the state does not flap around the high-water mark
+      boost::mutex::scoped_lock lock(mutex_);
+      if (volume.full_)
+      {
+        full = (usedPercent >= lowWaterPercent_ || freeBytes < minFreeBytes_);
+      }
+      else
+      {
+        full = (usedPercent >= highWaterPercent_ || freeBytes < minFreeBytes_);
+      }
+    }
+
+    if (full != volume.full_.load())
+    {
+      if (full)
+      {
+        LOG(ERROR) << "[SaolaStorage][DiskSpace] - Volume " << volume.path_ << " is full (" << usedPercent
+                   << "% used, " << freeBytes / (1024 * 1024) << "MB free), rejecting the new attachments";
+      }
+      else
+      {
+        LOG(WARNING) << "[SaolaStorage][DiskSpace] - Volume " << volume.path_ << " has free space again (" << usedPercent << "% used)";
+      }
+    }
+
+    volume.totalBytes_ = totalBytes;
+    volume.freeBytes_ = freeBytes;
+    volume.full_ = full;
+    volume.valid_ = true;
+
+    OrthancPluginContext *context = OrthancPlugins::GetGlobalContext();
+    if (context != NULL)
+    {
+      OrthancPluginSetMetricsValue(context, ("saola_volume_free_mb_" + volume.metric_).c_str(),
+                                   static_cast<float>(freeBytes / (1024 * 1024)), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, ("saola_volume_used_percent_" + volume.metric_).c_str(),
+                                   static_cast<float>(usedPercent), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, ("saola_volume_full_" + volume.metric_).c_str(),
+                                   full ? 1.0f : 0.0f, OrthancPluginMetricsType_Default);
+    }
+  }
+
+  void DiskSpaceMonitor::RegisterVolume(const std::string &path)
+  {
+    Volume *volume = NULL;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (size_t i = 0; i < volumes_.size(); i++)
+      {
+        if (volumes_[i]->path_ == path)
+        {
+          return;
+        }
+      }
+
+      volumes_.push_back(std::unique_ptr<Volume>(new Volume(path)));
+      volume = volumes_.back().get();
+    }
+
+    // The volumes are never unregistered, "volume" stays valid
+    RefreshVolume(*volume);
+  }
+
+  bool DiskSpaceMonitor::IsFull(const std::string &path)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < volumes_.size(); i++)
+    {
+      if (volumes_[i]->path_ == path)
+      {
+        return volumes_[i]->full_;
+      }
+    }
+
+    return false;
+  }
+
+  void DiskSpaceMonitor::Refresh()
+  {
+    std::vector<Volume *> volumes;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      for (size_t i = 0; i < volumes_.size(); i++)
+      {
+        volumes.push_back(volumes_[i].get());
+      }
+    }
+
+    for (size_t i = 0; i < volumes.size(); i++)
+    {
+      RefreshVolume(*volumes[i]);
+    }
+
+    OrthancPluginContext *context = OrthancPlugins::GetGlobalContext();
+    if (context != NULL)
+    {
+      OrthancPluginSetMetricsValue(context, "saola_create_rejected_full", static_cast<float>(rejected_.load()), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, "saola_create_redirected_full", static_cast<float>(redirected_.load()), OrthancPluginMetricsType_Default);
+    }
+  }
+
+  void DiskSpaceMonitor::Start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (thread_ != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    running_ = true;
+
+    thread_ = new std::thread([this]()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (running_)
+      {
+        stopped_.timed_wait(lock, boost::posix_time::seconds(refreshSeconds_));
+
+        if (running_)
+        {
+          lock.unlock();
+          Refresh();
+          lock.lock();
+        }
+      }
+    });
+  }
+
+  void DiskSpaceMonitor::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      running_ = false;
+      stopped_.notify_all();
+    }
+
+    if (thread_ != NULL)
+    {
+      if (thread_->joinable())
+      {
+        thread_->join();
+      }
+
+      delete thread_;
+      thread_ = NULL;
+    }
+  }
+
+  void DiskSpaceMonitor::GetStatistics(Json::Value &status)
+  {
+    status["RejectedCreates"] = static_cast<Json::UInt64>(rejected_.load());
+    status["RedirectedCreates"] = static_cast<Json::UInt64>(redirected_.load());
+    status["Volumes"] = Json::arrayValue;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    status["HighWaterPercent"] = highWaterPercent_;
+    status["LowWaterPercent"] = lowWaterPercent_;
+    status["MinFreeMB"] = static_cast<Json::UInt64>(minFreeBytes_ / (1024 * 1024));
+
+    for (size_t i = 0; i < volumes_.size(); i++)
+    {
+      const Volume &volume = *volumes_[i];
+
+      Json::Value item;
+      item["Path"] = volume.path_;
+      item["Valid"] = volume.valid_.load();
+      item["Full"] = volume.full_.load();
+      item["TotalMB"] = static_cast<Json::UInt64>(volume.totalBytes_.load() / (1024 * 1024));
+      item["FreeMB"] = static_cast<Json::UInt64>(volume.freeBytes_.load() / (1024 * 1024));
+      status["Volumes"].append(item);
+    }
+  }
+}
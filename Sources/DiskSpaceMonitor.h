@@ -0,0 +1,88 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Keeps track of the free space of the volumes with statvfs(),
+  // refreshed in the background, so that "Create()" can refuse a write
+  // before it fails halfway. A volume is "full" once its usage reaches
+  // the high-water mark (or its free space drops below the minimum),
+  // and stays so until its usage is back below the low-water mark.
+  class DiskSpaceMonitor : public boost::noncopyable
+  {
+  private:
+    struct Volume
+    {
+      std::string            path_;
+      std::string            metric_;  // Suffix of the names of the metrics
+      std::atomic<bool>      valid_;
+      std::atomic<bool>      full_;
+      std::atomic<uint64_t>  totalBytes_;
+      std::atomic<uint64_t>  freeBytes_;
+
+      explicit Volume(const std::string &path);
+    };
+
+    unsigned int                          refreshSeconds_;
+
+    boost::mutex                          mutex_;  // Protects the members below
+    boost::condition_variable             stopped_;
+    std::vector<std::unique_ptr<Volume> > volumes_;
+    unsigned int                          highWaterPercent_;
+    unsigned int                          lowWaterPercent_;
+    uint64_t                              minFreeBytes_;
+    bool                                  running_;
+    std::thread                          *thread_;
+
+    std::atomic<uint64_t>                 rejected_;
+    std::atomic<uint64_t>                 redirected_;
+
+    void RefreshVolume(Volume &volume);
+
+  public:
+    DiskSpaceMonitor(unsigned int highWaterPercent,
+                     unsigned int lowWaterPercent,
+                     uint64_t minFreeBytes,
+                     unsigned int refreshSeconds);
+
+    ~DiskSpaceMonitor();
+
+    void SetThresholds(unsigned int highWaterPercent,
+                       unsigned int lowWaterPercent,
+                       uint64_t minFreeBytes);
+
+    // Refreshes the new volume at once
+    void RegisterVolume(const std::string &path);
+
+    // Volumes that are not registered, or whose statvfs() fails, are never full
+    bool IsFull(const std::string &path);
+
+    void Refresh();
+
+    void CountRejected()
+    {
+      rejected_++;
+    }
+
+    void CountRedirected()
+    {
+      redirected_++;
+    }
+
+    void Start();
+
+    void Stop();
+
+    void GetStatistics(Json::Value &status);
+  };
+}
@@ -0,0 +1,83 @@
+#include "FilesystemBackend.h"
+
+#include "IOToolbox.h"
+#include "SaolaConfiguration.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstring>
+
+namespace Saola
+{
+  bool FilesystemBackend::IsOwner(const std::string &location) const
+  {
+    return location.find("://") == std::string::npos;
+  }
+
+
+  void FilesystemBackend::Write(const std::string &location,
+                                const void *content,
+                                size_t size)
+  {
+    const std::string parent = boost::filesystem::path(location).parent_path().string();
+
+    const int error = (parent.empty() ? 0 : IOToolbox::MakeDirectories(parent));
+    if (error != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_MakeDirectory,
+                                      "[SaolaStorage] Cannot create the directory " + parent + ": " + strerror(error));
+    }
+
+    IOToolbox::WriteFileAtomic(content, size, location, SaolaConfiguration::Instance()->GetFsyncPolicy(), false);
+  }
+
+
+  uint64_t FilesystemBackend::GetSize(const std::string &location)
+  {
+    boost::system::error_code err;
+    const uintmax_t size = boost::filesystem::file_size(location, err);
+
+    if (err)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "[SaolaStorage] Missing payload " + location);
+    }
+
+    return static_cast<uint64_t>(size);
+  }
+
+
+  void FilesystemBackend::ReadWhole(std::string &target,
+                                    const std::string &location)
+  {
+    Orthanc::SystemToolbox::ReadFile(target, location);
+  }
+
+
+  void FilesystemBackend::ReadRange(void *target,
+                                    size_t size,
+                                    const std::string &location,
+                                    uint64_t offset)
+  {
+    std::string content;
+    Orthanc::SystemToolbox::ReadFileRange(content, location, offset, offset + size, true);
+
+    if (content.size() != size)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+    }
+    else if (!content.empty())
+    {
+      memcpy(target, content.c_str(), content.size());
+    }
+  }
+
+
+  void FilesystemBackend::Remove(const std::string &location)
+  {
+    boost::system::error_code err;
+    boost::filesystem::remove(location, err);
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "IStorageBackend.h"
+
+namespace Saola
+{
+  // Payloads below the mount directories, the location being the path
+  // of the file. "StorageArea" keeps its own path for the creations
+  // and removals (pins of the directories, io_uring chains, removals
+  // grouped by directory).
+  class FilesystemBackend : public IStorageBackend
+  {
+  public:
+    // Any location that is not a URI ("scheme://...")
+    virtual bool IsOwner(const std::string &location) const;
+
+    // Also creates the missing parent directories
+    virtual void Write(const std::string &location,
+                       const void *content,
+                       size_t size);
+
+    virtual uint64_t GetSize(const std::string &location);
+
+    virtual void ReadWhole(std::string &target,
+                           const std::string &location);
+
+    virtual void ReadRange(void *target,
+                           size_t size,
+                           const std::string &location,
+                           uint64_t offset);
+
+    virtual void Remove(const std::string &location);
+  };
+}
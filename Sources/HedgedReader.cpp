@@ -0,0 +1,374 @@
+#include "HedgedReader.h"
+#include "FilesystemBackend.h"
+#include "IOLatencyRecorder.h"
+#include "SaolaConfiguration.h"
+#include "Trace.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <string.h>
+
+namespace Saola
+{
+  namespace
+  {
+    // Shared by the caller and the reads, which might outlive it
+    struct Request
+    {
+      boost::mutex               mutex_;
+      boost::condition_variable  done_;
+      unsigned int               pending_;
+      bool                       hasResult_;
+      std::string               *whole_;  // Targets of the caller, only written before "hasResult_" is set
+      void                      *range_;
+      std::string                winner_;
+      std::unique_ptr<Orthanc::OrthancException>  error_;  // First failure
+
+      Request(std::string *whole,
+              void *range) :
+        pending_(0),
+        hasResult_(false),
+        whole_(whole),
+        range_(range)
+      {
+      }
+    };
+  }
+
+
+  static void ReadPayload(std::string *whole,
+                          void *range,
+                          const std::string &location,
+                          uint64_t offset,
+                          size_t size)
+  {
+    FilesystemBackend backend;
+
+    if (whole != NULL)
+    {
+      backend.ReadWhole(*whole, location);
+    }
+    else if (size > 0)
+    {
+      backend.ReadRange(range, size, location, offset);
+    }
+  }
+
+
+  static void Read(const std::shared_ptr<Request> &request,
+                   const std::string &location,
+                   uint64_t offset,
+                   size_t size,
+                   bool isReplica)
+  {
+    // The caller might have returned meanwhile: read into a private buffer
+    std::string content;
+    std::unique_ptr<Orthanc::OrthancException> error;
+
+    try
+    {
+      if (isReplica &&
+          !Orthanc::SystemToolbox::IsRegularFile(location))
+      {
+        // Not replicated yet: the caller keeps waiting for the primary,
+        // whose error is reported if it fails
+        boost::mutex::scoped_lock lock(request->mutex_);
+        request->pending_--;
+        request->done_.notify_all();
+        return;
+      }
+
+      if (request->whole_ != NULL)
+      {
+        ReadPayload(&content, NULL, location, offset, size);
+      }
+      else
+      {
+        content.resize(size);
+        ReadPayload(NULL, content.empty() ? NULL : &content[0], location, offset, size);
+      }
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      error.reset(new Orthanc::OrthancException(e));
+    }
+    catch (std::exception &e)
+    {
+      error.reset(new Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, e.what()));
+    }
+
+    boost::mutex::scoped_lock lock(request->mutex_);
+
+    request->pending_--;
+
+    if (error.get() != NULL)
+    {
+      if (request->error_.get() == NULL)
+      {
+        request->error_.reset(error.release());
+      }
+    }
+    else if (!request->hasResult_)
+    {
+      // The caller is still waiting for this first answer
+      if (request->whole_ != NULL)
+      {
+        request->whole_->swap(content);
+      }
+      else if (!content.empty())
+      {
+        memcpy(request->range_, content.c_str(), content.size());
+      }
+
+      request->hasResult_ = true;
+      request->winner_ = location;
+    }
+
+    request->done_.notify_all();
+  }
+
+
+  HedgedReader::HedgedReader() :
+    idleCount_(0),
+    stopping_(false),
+    readsCount_(0),
+    hedgedCount_(0),
+    replicaWinsCount_(0),
+    saturatedCount_(0)
+  {
+  }
+
+
+  HedgedReader::~HedgedReader()
+  {
+    Stop();
+  }
+
+
+  void HedgedReader::Worker()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (;;)
+    {
+      while (tasks_.empty() &&
+             !stopping_)
+      {
+        taskAvailable_.wait(lock);
+      }
+
+      // The queued reads are completed even when stopping, as their callers wait for them
+      if (tasks_.empty())
+      {
+        return;
+      }
+
+      Task task;
+      task.swap(tasks_.front());
+      tasks_.pop_front();
+      idleCount_--;
+
+      lock.unlock();
+      task();
+      lock.lock();
+
+      idleCount_++;
+    }
+  }
+
+
+  bool HedgedReader::TrySubmit(const Task &task)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // Each queued task must have an idle thread waiting for it
+    if (stopping_ ||
+        tasks_.size() >= idleCount_)
+    {
+      return false;
+    }
+
+    tasks_.push_back(task);
+    taskAvailable_.notify_one();
+    return true;
+  }
+
+
+  void HedgedReader::Start(unsigned int threadsCount)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!workers_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    stopping_ = false;
+    idleCount_ = std::max(1u, threadsCount);
+
+    for (unsigned int i = 0; i < idleCount_; i++)
+    {
+      workers_.push_back(new std::thread(&HedgedReader::Worker, this));
+    }
+  }
+
+
+  void HedgedReader::Stop()
+  {
+    std::vector<std::thread *> workers;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+      workers.swap(workers_);
+      taskAvailable_.notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      if (workers[i]->joinable())
+      {
+        workers[i]->join();
+      }
+
+      delete workers[i];
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    idleCount_ = 0;
+  }
+
+
+  uint64_t HedgedReader::GetDelayUs(const std::string &primary)
+  {
+    const std::shared_ptr<const SaolaConfiguration> snapshot = SaolaConfiguration::Instance();
+    const SaolaConfiguration &configuration = *snapshot;
+
+    const uint64_t minUs = static_cast<uint64_t>(configuration.ReplicationHedgedReadsMinDelayMs()) * 1000;
+    const uint64_t maxUs = static_cast<uint64_t>(configuration.ReplicationHedgedReadsMaxDelayMs()) * 1000;
+
+    uint64_t latencyUs;
+    if (IOLatencyRecorder::Instance().LookupReadPercentile(latencyUs, primary, configuration.ReplicationHedgedReadsPercentile()))
+    {
+      return std::min(maxUs, std::max(minUs, latencyUs));
+    }
+    else
+    {
+      return maxUs;  // Unknown volume, or too few reads so far
+    }
+  }
+
+
+  void HedgedReader::Execute(std::string *whole,
+                             void *range,
+                             std::string &location,
+                             const std::string &replica,
+                             uint64_t offset,
+                             size_t size)
+  {
+    readsCount_++;
+
+    std::shared_ptr<Request> request(new Request(whole, range));
+
+    const std::function<bool(const std::string &, bool)> launch = [this, &request, offset, size](const std::string &path,
+                                                                                                 bool isReplica)
+    {
+      // Locked, so that the read cannot complete before being counted as pending
+      boost::mutex::scoped_lock lock(request->mutex_);
+
+      const std::shared_ptr<Request> shared = request;
+      if (TrySubmit([shared, path, offset, size, isReplica]() { Read(shared, path, offset, size, isReplica); }))
+      {
+        request->pending_++;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    };
+
+    // The replica is only looked up if the primary is slow, by its own read
+    if (!launch(location, false))
+    {
+      saturatedCount_++;
+      ReadPayload(whole, range, location, offset, size);
+      return;
+    }
+
+    const boost::posix_time::time_duration delay = boost::posix_time::microseconds(static_cast<int64_t>(GetDelayUs(location)));
+
+    boost::mutex::scoped_lock lock(request->mutex_);
+
+    if (!request->done_.timed_wait(lock, delay, [&request]() { return request->pending_ == 0; }))
+    {
+      lock.unlock();
+
+      if (launch(replica, true))
+      {
+        hedgedCount_++;
+        SAOLA_TRACE(Storage, Verbose) << "HedgedReader: " << location << " has not answered within " << delay.total_milliseconds()
+                                      << "ms, also reading its replica " << replica;
+      }
+      else
+      {
+        saturatedCount_++;  // Keeps waiting for the primary
+      }
+
+      lock.lock();
+    }
+
+    // Waits for the first successful read, or for both failures
+    while (!request->hasResult_ &&
+           request->pending_ > 0)
+    {
+      request->done_.wait(lock);
+    }
+
+    if (!request->hasResult_)
+    {
+      throw Orthanc::OrthancException(*request->error_);
+    }
+
+    if (request->winner_ == replica)
+    {
+      replicaWinsCount_++;
+    }
+
+    location = request->winner_;
+  }
+
+
+  void HedgedReader::ReadWhole(std::string &target,
+                               std::string &location,
+                               const std::string &replica)
+  {
+    Execute(&target, NULL, location, replica, 0, 0);
+  }
+
+
+  void HedgedReader::ReadRange(void *target,
+                               size_t size,
+                               std::string &location,
+                               const std::string &replica,
+                               uint64_t offset)
+  {
+    Execute(NULL, target, location, replica, offset, size);
+  }
+
+
+  void HedgedReader::GetStatistics(Json::Value &status) const
+  {
+    status["ReadsCount"] = static_cast<Json::UInt64>(readsCount_.load());
+    status["HedgedCount"] = static_cast<Json::UInt64>(hedgedCount_.load());
+    status["ReplicaWinsCount"] = static_cast<Json::UInt64>(replicaWinsCount_.load());
+    status["SaturatedCount"] = static_cast<Json::UInt64>(saturatedCount_.load());
+  }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Reads a payload stored on two mounts (the primary one and its
+  // replica). The primary is read first; if it has not answered
+  // within the recent read latencies of its volume (see
+  // "IOLatencyRecorder::LookupReadPercentile()"), the replica is read
+  // as well, and the first answer wins. This hides the stalls of one
+  // volume (e.g. a NAS failing over) from the viewers.
+  //
+  // The reads run in a fixed pool of threads, so that a stalled read
+  // never blocks the caller once the other one answered. The replica
+  // is only looked up by its own read, once the primary is late: if
+  // it does not exist yet, the caller keeps waiting for the primary.
+  // If the pool is not started or has no idle thread, the primary is
+  // read on the caller thread without hedging.
+  class HedgedReader : public boost::noncopyable
+  {
+  private:
+    typedef std::function<void()> Task;
+
+    boost::mutex                mutex_;
+    boost::condition_variable   taskAvailable_;
+    std::deque<Task>            tasks_;
+    std::vector<std::thread *>  workers_;
+    unsigned int                idleCount_;
+    bool                        stopping_;
+
+    std::atomic<uint64_t> readsCount_;
+    std::atomic<uint64_t> hedgedCount_;     // The replica was read as well, if it exists
+    std::atomic<uint64_t> replicaWinsCount_;
+    std::atomic<uint64_t> saturatedCount_;  // Read on the caller thread, as no thread of the pool was idle
+
+    void Worker();
+
+    // Returns "false" if no thread of the pool can run "task" at once
+    bool TrySubmit(const Task &task);
+
+    void Execute(std::string *whole,
+                 void *range,
+                 std::string &location,
+                 const std::string &replica,
+                 uint64_t offset,
+                 size_t size);
+
+  public:
+    HedgedReader();
+
+    ~HedgedReader();
+
+    void Start(unsigned int threadsCount);
+
+    // Waits for the reads in progress, even the stalled ones
+    void Stop();
+
+    // Delay before reading the replica of a payload of "primary"
+    static uint64_t GetDelayUs(const std::string &primary);
+
+    // "location" is the primary on input, and the location that
+    // answered on output. Throws the error of the first failed read if
+    // both fail, or if the primary fails before the replica is read.
+    void ReadWhole(std::string &target,
+                   std::string &location,
+                   const std::string &replica);
+
+    void ReadRange(void *target,
+                   size_t size,
+                   std::string &location,
+                   const std::string &replica,
+                   uint64_t offset);
+
+    void GetStatistics(Json::Value &status) const;
+  };
+}
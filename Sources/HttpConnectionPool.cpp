@@ -0,0 +1,619 @@
+#include "HttpConnectionPool.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_WIN32)
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/socket.h>
+#  include <sys/time.h>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#endif
+
+namespace Saola
+{
+  static const size_t RECEIVE_CHUNK = 64 * 1024;
+
+  // The server closed a kept-alive connection before answering
+  struct ConnectionClosed
+  {
+  };
+
+
+  static std::string ToLower(const std::string &s)
+  {
+    std::string result(s);
+    for (size_t i = 0; i < result.size(); i++)
+    {
+      result[i] = static_cast<char>(tolower(static_cast<unsigned char>(result[i])));
+    }
+    return result;
+  }
+
+
+  static std::string Trim(const std::string &s)
+  {
+    size_t start = 0;
+    while (start < s.size() && isspace(static_cast<unsigned char>(s[start])))
+    {
+      start++;
+    }
+
+    size_t end = s.size();
+    while (end > start && isspace(static_cast<unsigned char>(s[end - 1])))
+    {
+      end--;
+    }
+
+    return s.substr(start, end - start);
+  }
+
+
+  bool HttpConnectionPool::Response::LookupHeader(std::string &value,
+                                                  const std::string &name) const
+  {
+    std::map<std::string, std::string>::const_iterator found = headers_.find(ToLower(name));
+    if (found == headers_.end())
+    {
+      return false;
+    }
+    else
+    {
+      value = found->second;
+      return true;
+    }
+  }
+
+
+#if !defined(_WIN32)
+  class HttpConnectionPool::Connection : public boost::noncopyable
+  {
+  private:
+    int          fd_;
+    std::string  buffer_;    // Received, from "position_" on not consumed yet
+    size_t       position_;
+    bool         received_;  // Whether the current response has started
+
+    // Returns "false" at the end of the stream
+    bool Fill()
+    {
+      if (position_ == buffer_.size())
+      {
+        buffer_.clear();
+        position_ = 0;
+      }
+
+      const size_t previous = buffer_.size();
+      buffer_.resize(previous + RECEIVE_CHUNK);
+
+      ssize_t r;
+      do
+      {
+        r = recv(fd_, &buffer_[previous], RECEIVE_CHUNK, 0);
+      }
+      while (r < 0 && errno == EINTR);
+
+      buffer_.resize(previous + (r > 0 ? static_cast<size_t>(r) : 0));
+
+      if (r > 0)
+      {
+        received_ = true;
+        return true;
+      }
+      else if (r == 0 || errno == ECONNRESET)
+      {
+        if (!received_)
+        {
+          throw ConnectionClosed();
+        }
+        return false;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "[SaolaStorage] Timeout while waiting for the object store");
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        std::string("[SaolaStorage] Cannot receive from the object store: ") + strerror(errno));
+      }
+    }
+
+  public:
+    Connection(const std::string &host,
+               uint16_t port,
+               unsigned int timeoutSeconds) :
+      fd_(-1),
+      position_(0),
+      received_(false)
+    {
+      struct addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_NUMERICSERV;
+
+      struct addrinfo *addresses = NULL;
+      const int error = getaddrinfo(host.c_str(), boost::lexical_cast<std::string>(port).c_str(), &hints, &addresses);
+      if (error != 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "[SaolaStorage] Cannot resolve the object store " + host + ": " + gai_strerror(error));
+      }
+
+      int lastError = 0;
+      for (struct addrinfo *a = addresses; a != NULL && fd_ < 0; a = a->ai_next)
+      {
+        fd_ = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd_ < 0)
+        {
+          lastError = errno;
+          continue;
+        }
+
+        struct timeval timeout;
+        timeout.tv_sec = timeoutSeconds;
+        timeout.tv_usec = 0;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // The requests are written at once, Nagle would only delay them
+        const int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(fd_, a->ai_addr, a->ai_addrlen) != 0)
+        {
+          lastError = errno;
+          close(fd_);
+          fd_ = -1;
+        }
+      }
+
+      freeaddrinfo(addresses);
+
+      if (fd_ < 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "[SaolaStorage] Cannot connect to the object store " + host + ":" +
+                                        boost::lexical_cast<std::string>(port) + ": " + strerror(lastError));
+      }
+    }
+
+    ~Connection()
+    {
+      close(fd_);
+    }
+
+    void Send(const std::string &header,
+              const void *body,
+              size_t bodySize)
+    {
+      received_ = false;
+
+      struct iovec iov[2];
+      iov[0].iov_base = const_cast<char *>(header.c_str());
+      iov[0].iov_len = header.size();
+      iov[1].iov_base = const_cast<void *>(body);
+      iov[1].iov_len = (body == NULL ? 0 : bodySize);
+
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = iov;
+      message.msg_iovlen = 2;
+
+      while (iov[0].iov_len + iov[1].iov_len > 0)
+      {
+        const ssize_t r = sendmsg(fd_, &message, MSG_NOSIGNAL);
+
+        if (r < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+          else if (errno == EPIPE || errno == ECONNRESET)
+          {
+            throw ConnectionClosed();
+          }
+          else
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                            std::string("[SaolaStorage] Cannot send to the object store: ") + strerror(errno));
+          }
+        }
+
+        size_t sent = static_cast<size_t>(r);
+        for (unsigned int i = 0; i < 2; i++)
+        {
+          const size_t n = std::min(sent, iov[i].iov_len);
+          iov[i].iov_base = reinterpret_cast<char *>(iov[i].iov_base) + n;
+          iov[i].iov_len -= n;
+          sent -= n;
+        }
+
+        message.msg_iov = (iov[0].iov_len > 0 ? &iov[0] : &iov[1]);
+        message.msg_iovlen = (iov[0].iov_len > 0 ? 2 : 1);
+      }
+    }
+
+    void ReadLine(std::string &line)
+    {
+      for (;;)
+      {
+        const size_t end = buffer_.find("\r\n", position_);
+        if (end != std::string::npos)
+        {
+          line.assign(buffer_, position_, end - position_);
+          position_ = end + 2;
+          return;
+        }
+        else if (!Fill())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "[SaolaStorage] Truncated answer from the object store");
+        }
+      }
+    }
+
+    // Appends "size" bytes to "target" (if "direct" is NULL), or copies them to "direct"
+    void Read(std::string *target,
+              char *direct,
+              size_t size)
+    {
+      while (size > 0)
+      {
+        if (position_ == buffer_.size())
+        {
+          if (direct != NULL &&
+              size >= RECEIVE_CHUNK)
+          {
+            // Large bodies go straight into the buffer of the caller
+            ssize_t r;
+            do
+            {
+              r = recv(fd_, direct, size, 0);
+            }
+            while (r < 0 && errno == EINTR);
+
+            if (r <= 0)
+            {
+              throw Orthanc::OrthancException(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ?
+                                              Orthanc::ErrorCode_Timeout : Orthanc::ErrorCode_NetworkProtocol,
+                                              "[SaolaStorage] Truncated answer from the object store");
+            }
+
+            direct += r;
+            size -= static_cast<size_t>(r);
+            continue;
+          }
+          else if (!Fill())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "[SaolaStorage] Truncated answer from the object store");
+          }
+        }
+
+        const size_t n = std::min(size, buffer_.size() - position_);
+        if (direct != NULL)
+        {
+          memcpy(direct, &buffer_[position_], n);
+          direct += n;
+        }
+        else
+        {
+          target->append(buffer_, position_, n);
+        }
+
+        position_ += n;
+        size -= n;
+      }
+    }
+
+    // Body delimited by the end of the connection
+    void ReadToEnd(std::string &target)
+    {
+      for (;;)
+      {
+        target.append(buffer_, position_, std::string::npos);
+        position_ = buffer_.size();
+
+        if (!Fill())
+        {
+          return;
+        }
+      }
+    }
+
+    // Sends the request, and reads the whole answer. "keepAlive" tells
+    // whether the connection can serve another request.
+    void Exchange(HttpConnectionPool::Response &response,
+                  bool &keepAlive,
+                  const std::string &header,
+                  const HttpConnectionPool::Request &request,
+                  void *target,
+                  size_t targetSize)
+    {
+      Send(header, request.body_, request.bodySize_);
+
+      response = HttpConnectionPool::Response();
+
+      std::string line;
+      do
+      {
+        ReadLine(line);  // Skips the "100 Continue" answers
+        response.headers_.clear();
+
+        if (line.size() < 12 ||
+            line.compare(0, 5, "HTTP/") != 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "[SaolaStorage] Bad answer from the object store: " + line);
+        }
+
+        response.status_ = static_cast<unsigned int>(atoi(line.c_str() + 9));
+        keepAlive = (line.compare(0, 8, "HTTP/1.1") == 0);
+
+        for (;;)
+        {
+          std::string field;
+          ReadLine(field);
+          if (field.empty())
+          {
+            break;
+          }
+
+          const size_t colon = field.find(':');
+          if (colon != std::string::npos)
+          {
+            response.headers_[ToLower(Trim(field.substr(0, colon)))] = Trim(field.substr(colon + 1));
+          }
+        }
+      }
+      while (response.status_ == 100);
+
+      std::string value;
+      if (response.LookupHeader(value, "connection"))
+      {
+        keepAlive = (ToLower(value) != "close");
+      }
+
+      const bool success = (response.status_ >= 200 && response.status_ < 300);
+      char *direct = (success && target != NULL ? reinterpret_cast<char *>(target) : NULL);
+
+      if (request.method_ == "HEAD" ||
+          response.status_ == 204 ||
+          response.status_ == 304)
+      {
+        return;
+      }
+
+      if (response.LookupHeader(value, "transfer-encoding") &&
+          ToLower(value) != "identity")
+      {
+        for (;;)
+        {
+          ReadLine(line);
+          const size_t chunk = static_cast<size_t>(strtoull(line.c_str(), NULL, 16));
+
+          if (chunk == 0)
+          {
+            do
+            {
+              ReadLine(line);  // Trailers
+            }
+            while (!line.empty());
+            break;
+          }
+
+          if (direct != NULL &&
+              response.bodySize_ + chunk > targetSize)
+          {
+            keepAlive = false;
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "[SaolaStorage] Answer of the object store is too large");
+          }
+
+          Read(&response.body_, direct == NULL ? NULL : direct + response.bodySize_, chunk);
+          response.bodySize_ += chunk;
+          ReadLine(line);
+        }
+      }
+      else if (response.LookupHeader(value, "content-length"))
+      {
+        const size_t length = static_cast<size_t>(strtoull(value.c_str(), NULL, 10));
+
+        if (direct != NULL &&
+            length > targetSize)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "[SaolaStorage] Answer of the object store is too large");
+        }
+
+        Read(&response.body_, direct, length);
+        response.bodySize_ = length;
+      }
+      else
+      {
+        ReadToEnd(response.body_);
+        keepAlive = false;
+
+        if (direct != NULL)
+        {
+          if (response.body_.size() > targetSize)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "[SaolaStorage] Answer of the object store is too large");
+          }
+
+          memcpy(direct, response.body_.c_str(), response.body_.size());
+          response.bodySize_ = response.body_.size();
+          response.body_.clear();
+        }
+      }
+
+      if (direct == NULL)
+      {
+        response.bodySize_ = response.body_.size();
+      }
+    }
+  };
+
+
+  HttpConnectionPool::Connection *HttpConnectionPool::Acquire(bool &reused)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (!idle_.empty())
+      {
+        Connection *connection = idle_.back();
+        idle_.pop_back();
+        reused = true;
+        reusedCount_++;
+        return connection;
+      }
+    }
+
+    reused = false;
+    Connection *connection = new Connection(host_, port_, timeoutSeconds_);
+    createdCount_++;
+    return connection;
+  }
+
+
+  void HttpConnectionPool::Release(Connection *connection)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (idle_.size() < maxIdle_)
+      {
+        idle_.push_back(connection);
+        return;
+      }
+    }
+
+    delete connection;
+  }
+
+#endif
+
+
+  HttpConnectionPool::HttpConnectionPool(const std::string &host,
+                                         uint16_t port,
+                                         unsigned int maxIdle,
+                                         unsigned int timeoutSeconds) :
+    host_(host),
+    port_(port),
+    maxIdle_(maxIdle),
+    timeoutSeconds_(timeoutSeconds),
+    createdCount_(0),
+    reusedCount_(0),
+    requestsCount_(0)
+  {
+  }
+
+
+  HttpConnectionPool::~HttpConnectionPool()
+  {
+#if !defined(_WIN32)
+    for (size_t i = 0; i < idle_.size(); i++)
+    {
+      delete idle_[i];
+    }
+#endif
+  }
+
+
+  std::string HttpConnectionPool::GetHostHeader() const
+  {
+    return (port_ == 80 ? host_ : host_ + ":" + boost::lexical_cast<std::string>(port_));
+  }
+
+
+  void HttpConnectionPool::Execute(Response &response,
+                                   const Request &request,
+                                   void *target,
+                                   size_t targetSize)
+  {
+#if defined(_WIN32)
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented, "[SaolaStorage] The object store is not supported on Windows");
+#else
+    requestsCount_++;
+
+    std::string header = request.method_ + " " + request.target_ + " HTTP/1.1\r\n";
+    header += "Host: " + GetHostHeader() + "\r\n";
+
+    for (size_t i = 0; i < request.headers_.size(); i++)
+    {
+      header += request.headers_[i].first + ": " + request.headers_[i].second + "\r\n";
+    }
+
+    if (request.body_ != NULL ||
+        request.method_ == "PUT" ||
+        request.method_ == "POST")
+    {
+      header += "Content-Length: " + boost::lexical_cast<std::string>(request.bodySize_) + "\r\n";
+    }
+
+    header += "\r\n";
+
+    for (unsigned int attempt = 0; ; attempt++)
+    {
+      bool reused;
+      Connection *connection = Acquire(reused);
+
+      try
+      {
+        bool keepAlive;
+        connection->Exchange(response, keepAlive, header, request, target, targetSize);
+
+        if (keepAlive)
+        {
+          Release(connection);
+        }
+        else
+        {
+          delete connection;
+        }
+
+        return;
+      }
+      catch (ConnectionClosed &)
+      {
+        delete connection;
+
+        if (!reused || attempt > 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                          "[SaolaStorage] The object store closed the connection");
+        }
+      }
+      catch (...)
+      {
+        delete connection;
+        throw;
+      }
+    }
+#endif
+  }
+
+
+
+
+  void HttpConnectionPool::GetStatistics(Json::Value &status)
+  {
+    status["Endpoint"] = host_ + ":" + boost::lexical_cast<std::string>(port_);
+    status["CreatedConnections"] = static_cast<Json::UInt64>(createdCount_.load());
+    status["ReusedConnections"] = static_cast<Json::UInt64>(reusedCount_.load());
+    status["Requests"] = static_cast<Json::UInt64>(requestsCount_.load());
+
+    boost::mutex::scoped_lock lock(mutex_);
+    status["IdleConnections"] = static_cast<Json::UInt64>(idle_.size());
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Saola
+{
+  // Minimal HTTP/1.1 client for the object store endpoint, over plain
+  // TCP. The connections are kept alive and shared by the calling
+  // threads: a request reuses an idle connection if there is one,
+  // which saves the TCP handshake (and the slow start) on each call.
+  // There is no TLS: the configuration refuses a non-loopback
+  // endpoint unless "ObjectStorage.AllowInsecure" is set.
+  class HttpConnectionPool : public boost::noncopyable
+  {
+  public:
+    struct Request
+    {
+      std::string  method_;
+      std::string  target_;   // Path and query string
+      std::vector<std::pair<std::string, std::string> >  headers_;
+      const void  *body_;
+      size_t       bodySize_;
+
+      Request() :
+        body_(NULL),
+        bodySize_(0)
+      {
+      }
+    };
+
+    struct Response
+    {
+      unsigned int  status_;
+      std::map<std::string, std::string>  headers_;  // Lower-case names
+      std::string   body_;       // Unless the body was read into the buffer given to "Execute()"
+      size_t        bodySize_;
+
+      Response() :
+        status_(0),
+        bodySize_(0)
+      {
+      }
+
+      bool LookupHeader(std::string &value,
+                        const std::string &name) const;
+    };
+
+  private:
+    class Connection;
+
+    std::string  host_;
+    uint16_t     port_;
+    unsigned int maxIdle_;
+    unsigned int timeoutSeconds_;
+
+    boost::mutex               mutex_;
+    std::vector<Connection *>  idle_;
+
+    std::atomic<uint64_t>  createdCount_;
+    std::atomic<uint64_t>  reusedCount_;
+    std::atomic<uint64_t>  requestsCount_;
+
+    Connection *Acquire(bool &reused);
+
+    void Release(Connection *connection);
+
+  public:
+    HttpConnectionPool(const std::string &host,
+                       uint16_t port,
+                       unsigned int maxIdle,
+                       unsigned int timeoutSeconds);
+
+    ~HttpConnectionPool();
+
+    const std::string &GetHost() const
+    {
+      return host_;
+    }
+
+    uint16_t GetPort() const
+    {
+      return port_;
+    }
+
+    // Value of the "Host" header of the requests
+    std::string GetHostHeader() const;
+
+    // Throws "ErrorCode_NetworkProtocol" if the endpoint cannot be
+    // reached. If "target" is not NULL, a successful (2xx) body is
+    // read into it, and must not be larger than "targetSize". A
+    // request sent on a reused connection that the server closed
+    // meanwhile is replayed once on a new connection.
+    void Execute(Response &response,
+                 const Request &request,
+                 void *target = NULL,
+                 size_t targetSize = 0);
+
+    void GetStatistics(Json::Value &status);
+  };
+}
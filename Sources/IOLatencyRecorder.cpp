@@ -0,0 +1,317 @@
+#include "IOLatencyRecorder.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace Saola
+{
+  static const char *GetOperationName(IOOperation operation)
+  {
+    switch (operation)
+    {
+    case IOOperation_Create:
+      return "Create";
+
+    case IOOperation_ReadWhole:
+      return "ReadWhole";
+
+    case IOOperation_ReadRange:
+      return "ReadRange";
+
+    case IOOperation_Remove:
+      return "Remove";
+
+    default:
+      return "Unknown";
+    }
+  }
+
+  static uint64_t GetNowMicroseconds()
+  {
+    static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+    return static_cast<uint64_t>((boost::posix_time::microsec_clock::universal_time() - EPOCH).total_microseconds());
+  }
+
+  static uint32_t Saturate(uint64_t value)
+  {
+    return static_cast<uint32_t>(std::min<uint64_t>(value, 0xffffffffu));
+  }
+
+  static uint64_t GetTotal(const IOLatencyRecorder::Event &event)
+  {
+    return static_cast<uint64_t>(event.resolveUs_) + static_cast<uint64_t>(event.ioUs_);
+  }
+
+  // Below this count of reads, the histogram of a volume is not trusted
+  static const uint32_t MIN_HISTOGRAM_SAMPLES = 32;
+
+  static size_t GetHistogramBucket(uint64_t us)
+  {
+    size_t bucket = 0;
+    while (us > 1)
+    {
+      us >>= 1;
+      bucket++;
+    }
+
+    return bucket;
+  }
+
+  static void FormatPercentiles(Json::Value &target,
+                                std::vector<uint64_t> &latencies)
+  {
+    std::sort(latencies.begin(), latencies.end());
+
+    target["Count"] = static_cast<Json::UInt64>(latencies.size());
+
+    if (!latencies.empty())
+    {
+      target["P50Us"] = static_cast<Json::UInt64>(latencies[latencies.size() * 50 / 100]);
+      target["P90Us"] = static_cast<Json::UInt64>(latencies[latencies.size() * 90 / 100]);
+      target["P99Us"] = static_cast<Json::UInt64>(latencies[latencies.size() * 99 / 100]);
+      target["MaxUs"] = static_cast<Json::UInt64>(latencies.back());
+    }
+  }
+
+  IOLatencyRecorder::IOLatencyRecorder() : next_(0), volumesCount_(1)
+  {
+    volumes_[0] = "unknown";
+
+    for (size_t i = 0; i < CAPACITY; i++)
+    {
+      slots_[i].sequence_ = 0;
+    }
+
+    for (size_t i = 0; i < MAX_VOLUMES; i++)
+    {
+      readSamples_[i] = 0;
+
+      for (size_t j = 0; j < HISTOGRAM_BUCKETS; j++)
+      {
+        readHistograms_[i][j] = 0;
+      }
+    }
+  }
+
+  IOLatencyRecorder &IOLatencyRecorder::Instance()
+  {
+    static IOLatencyRecorder recorder_;
+    return recorder_;
+  }
+
+  void IOLatencyRecorder::RegisterVolume(const std::string &root)
+  {
+    boost::mutex::scoped_lock lock(volumesMutex_);
+
+    const size_t count = volumesCount_.load();
+
+    if (root.empty() ||
+        count >= MAX_VOLUMES ||
+        std::find(volumes_, volumes_ + count, root) != volumes_ + count)
+    {
+      return;
+    }
+
+    volumes_[count] = root;
+    volumesCount_.store(count + 1);  // Publishes the new volume to the concurrent "LookupVolume()"
+  }
+
+  unsigned int IOLatencyRecorder::LookupVolume(const std::string &path) const
+  {
+    const size_t count = volumesCount_.load();
+
+    unsigned int best = 0;
+    size_t bestLength = 0;
+
+    for (size_t i = 1; i < count; i++)
+    {
+      const std::string &volume = volumes_[i];
+      if (volume.size() > bestLength &&
+          path.compare(0, volume.size(), volume) == 0)
+      {
+        best = static_cast<unsigned int>(i);
+        bestLength = volume.size();
+      }
+    }
+
+    return best;
+  }
+
+  void IOLatencyRecorder::RecordRead(unsigned int volume,
+                                     uint64_t ioUs)
+  {
+    std::atomic<uint32_t> *histogram = readHistograms_[volume];
+
+    histogram[std::min(GetHistogramBucket(ioUs), HISTOGRAM_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+
+    if (readSamples_[volume].fetch_add(1, std::memory_order_relaxed) % DECAY_PERIOD == DECAY_PERIOD - 1)
+    {
+      // Racy with the concurrent increments, which only makes the estimate a bit less accurate
+      for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+      {
+        histogram[i].store(histogram[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool IOLatencyRecorder::LookupReadPercentile(uint64_t &latencyUs,
+                                               const std::string &path,
+                                               unsigned int percentile) const
+  {
+    const std::atomic<uint32_t> *histogram = readHistograms_[LookupVolume(path)];
+
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      counts[i] = histogram[i].load(std::memory_order_relaxed);
+      total += counts[i];
+    }
+
+    if (total < MIN_HISTOGRAM_SAMPLES)
+    {
+      return false;
+    }
+
+    const uint64_t rank = (total * std::min(percentile, 100u) + 99) / 100;
+
+    uint64_t cumulated = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      if (counts[i] > 0 &&
+          cumulated + counts[i] >= rank)
+      {
+        // Linear interpolation within the bucket [2^i, 2^(i+1))
+        const uint64_t lower = (i == 0 ? 0 : (static_cast<uint64_t>(1) << i));
+        const uint64_t upper = static_cast<uint64_t>(1) << (i + 1);
+        latencyUs = lower + (upper - lower) * (rank - cumulated) / counts[i];
+        return true;
+      }
+
+      cumulated += counts[i];
+    }
+
+    return false;
+  }
+
+  void IOLatencyRecorder::Record(IOOperation operation,
+                                 const std::string &uuid,
+                                 uint64_t bytes,
+                                 uint64_t resolveUs,
+                                 uint64_t ioUs,
+                                 const std::string &path)
+  {
+    const unsigned int volume = LookupVolume(path);
+
+    const uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slots_[index & (CAPACITY - 1)];
+
+    // Odd sequence: the slot is being written
+    slot.sequence_.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Event &event = slot.event_;
+    event.timestamp_ = GetNowMicroseconds();
+    event.operation_ = operation;
+    strncpy(event.uuid_, uuid.c_str(), sizeof(event.uuid_) - 1);
+    event.uuid_[sizeof(event.uuid_) - 1] = '\0';
+    event.bytes_ = bytes;
+    event.resolveUs_ = Saturate(resolveUs);
+    event.ioUs_ = Saturate(ioUs);
+    event.volume_ = volume;
+
+    slot.sequence_.store(2 * index + 2, std::memory_order_release);
+
+    if (operation == IOOperation_ReadWhole ||
+        operation == IOOperation_ReadRange)
+    {
+      RecordRead(volume, ioUs);
+    }
+  }
+
+  void IOLatencyRecorder::Format(Json::Value &target,
+                                 uint64_t thresholdUs,
+                                 unsigned int limit) const
+  {
+    std::vector<Event> events;
+    events.reserve(CAPACITY);
+
+    for (size_t i = 0; i < CAPACITY; i++)
+    {
+      const Slot &slot = slots_[i];
+
+      const uint64_t before = slot.sequence_.load(std::memory_order_acquire);
+      if (before == 0 || (before & 1))
+      {
+        continue;  // Empty or being written
+      }
+
+      Event event = slot.event_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      if (slot.sequence_.load(std::memory_order_relaxed) == before)
+      {
+        events.push_back(event);
+      }
+    }
+
+    std::vector<uint64_t> byOperation[IOOperation_Count];
+    std::map<unsigned int, std::vector<uint64_t> > byVolume;
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+      const uint64_t total = GetTotal(events[i]);
+      if (events[i].operation_ < IOOperation_Count)
+      {
+        byOperation[events[i].operation_].push_back(total);
+      }
+      byVolume[events[i].volume_].push_back(total);
+    }
+
+    target = Json::objectValue;
+    target["Operations"] = Json::objectValue;
+    for (int op = 0; op < IOOperation_Count; op++)
+    {
+      FormatPercentiles(target["Operations"][GetOperationName(static_cast<IOOperation>(op))], byOperation[op]);
+    }
+
+    const size_t volumesCount = volumesCount_.load();
+
+    target["Volumes"] = Json::objectValue;
+    for (std::map<unsigned int, std::vector<uint64_t> >::iterator it = byVolume.begin(); it != byVolume.end(); ++it)
+    {
+      if (it->first < volumesCount)
+      {
+        FormatPercentiles(target["Volumes"][volumes_[it->first]], it->second);
+      }
+    }
+
+    // Most recent slow operations first
+    std::sort(events.begin(), events.end(), [](const Event &a, const Event &b)
+              { return a.timestamp_ > b.timestamp_; });
+
+    target["SlowOperations"] = Json::arrayValue;
+    for (size_t i = 0; i < events.size() && target["SlowOperations"].size() < limit; i++)
+    {
+      const Event &event = events[i];
+      if (GetTotal(event) >= thresholdUs)
+      {
+        Json::Value item = Json::objectValue;
+        item["Timestamp"] = boost::posix_time::to_iso_extended_string(
+          boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1)) + boost::posix_time::microseconds(static_cast<int64_t>(event.timestamp_)));
+        item["Operation"] = GetOperationName(event.operation_);
+        item["Uuid"] = event.uuid_;
+        item["Bytes"] = static_cast<Json::UInt64>(event.bytes_);
+        item["ResolveUs"] = event.resolveUs_;
+        item["IOUs"] = event.ioUs_;
+        item["Volume"] = (event.volume_ < volumesCount ? volumes_[event.volume_] : volumes_[0]);
+        target["SlowOperations"].append(item);
+      }
+    }
+  }
+}
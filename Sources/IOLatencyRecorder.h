@@ -0,0 +1,98 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+namespace Saola
+{
+  enum IOOperation
+  {
+    IOOperation_Create,
+    IOOperation_ReadWhole,
+    IOOperation_ReadRange,
+    IOOperation_Remove,
+    IOOperation_Count  // Sentinel
+  };
+
+  // Fixed-size ring buffer of the last storage operations. Writers
+  // never block: each slot is protected by a sequence number
+  // (seqlock), readers simply skip the slots being overwritten.
+  class IOLatencyRecorder : public boost::noncopyable
+  {
+  public:
+    struct Event
+    {
+      uint64_t     timestamp_;    // Microseconds since epoch
+      IOOperation  operation_;
+      char         uuid_[40];
+      uint64_t     bytes_;
+      uint32_t     resolveUs_;    // Time spent to locate the file (pointer, DICOM parsing...)
+      uint32_t     ioUs_;         // Time spent reading/writing/removing the file
+      unsigned int volume_;
+    };
+
+  private:
+    static const size_t CAPACITY = 4096;  // Must be a power of 2
+    static const size_t MAX_VOLUMES = 16;
+
+    // Histograms of the read latencies by volume, in power-of-2
+    // buckets of microseconds. They are halved every "DECAY_PERIOD"
+    // reads of the volume, so that they follow the recent behavior.
+    static const size_t HISTOGRAM_BUCKETS = 32;
+    static const uint32_t DECAY_PERIOD = 1024;
+
+    struct Slot
+    {
+      std::atomic<uint64_t>  sequence_;
+      Event                  event_;
+    };
+
+    Slot                   slots_[CAPACITY];
+    std::atomic<uint64_t>  next_;
+
+    // Append-only table of the known volumes, index 0 is "unknown"
+    boost::mutex           volumesMutex_;
+    std::string            volumes_[MAX_VOLUMES];
+    std::atomic<size_t>    volumesCount_;
+
+    std::atomic<uint32_t>  readHistograms_[MAX_VOLUMES][HISTOGRAM_BUCKETS];
+    std::atomic<uint32_t>  readSamples_[MAX_VOLUMES];
+
+    void RecordRead(unsigned int volume,
+                    uint64_t ioUs);
+
+    IOLatencyRecorder();
+
+    unsigned int LookupVolume(const std::string &path) const;
+
+  public:
+    static IOLatencyRecorder &Instance();
+
+    void RegisterVolume(const std::string &root);
+
+    void Record(IOOperation operation,
+                const std::string &uuid,
+                uint64_t bytes,
+                uint64_t resolveUs,
+                uint64_t ioUs,
+                const std::string &path);
+
+    // Estimated percentile of the recent read latencies of the volume
+    // of "path", from its histogram. Returns "false" if the volume has
+    // too few reads to tell.
+    bool LookupReadPercentile(uint64_t &latencyUs,
+                              const std::string &path,
+                              unsigned int percentile) const;
+
+    // Dumps the operations slower than "thresholdUs" (most recent
+    // first), together with percentiles per operation and per volume
+    void Format(Json::Value &target,
+                uint64_t thresholdUs,
+                unsigned int limit) const;
+  };
+}
@@ -0,0 +1,714 @@
+#include "IOToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#if defined(__linux__)
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace Saola
+{
+  namespace IOToolbox
+  {
+    static const char *const TEMPORARY_SUFFIX = ".saola-tmp";
+
+    FsyncPolicy StringToFsyncPolicy(const std::string &value)
+    {
+      if (boost::iequals(value, "None"))
+      {
+        return FsyncPolicy_None;
+      }
+      else if (boost::iequals(value, "Data"))
+      {
+        return FsyncPolicy_Data;
+      }
+      else if (boost::iequals(value, "Full"))
+      {
+        return FsyncPolicy_Full;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown fsync policy (must be \"None\", \"Data\" or \"Full\"): " + value);
+      }
+    }
+
+    const char *EnumerationToString(FsyncPolicy policy)
+    {
+      switch (policy)
+      {
+      case FsyncPolicy_None:
+        return "None";
+
+      case FsyncPolicy_Data:
+        return "Data";
+
+      case FsyncPolicy_Full:
+        return "Full";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    ChecksumVerification StringToChecksumVerification(const std::string &value)
+    {
+      if (boost::iequals(value, "Off"))
+      {
+        return ChecksumVerification_Off;
+      }
+      else if (boost::iequals(value, "Sampled"))
+      {
+        return ChecksumVerification_Sampled;
+      }
+      else if (boost::iequals(value, "Always"))
+      {
+        return ChecksumVerification_Always;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown checksum verification (must be \"Off\", \"Sampled\" or \"Always\"): " + value);
+      }
+    }
+
+    const char *EnumerationToString(ChecksumVerification verification)
+    {
+      switch (verification)
+      {
+      case ChecksumVerification_Off:
+        return "Off";
+
+      case ChecksumVerification_Sampled:
+        return "Sampled";
+
+      case ChecksumVerification_Always:
+        return "Always";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    DiskFullPolicy StringToDiskFullPolicy(const std::string &value)
+    {
+      if (boost::iequals(value, "Reject"))
+      {
+        return DiskFullPolicy_Reject;
+      }
+      else if (boost::iequals(value, "Redirect"))
+      {
+        return DiskFullPolicy_Redirect;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown disk full policy (must be \"Reject\" or \"Redirect\"): " + value);
+      }
+    }
+
+    const char *EnumerationToString(DiskFullPolicy policy)
+    {
+      switch (policy)
+      {
+      case DiskFullPolicy_Reject:
+        return "Reject";
+
+      case DiskFullPolicy_Redirect:
+        return "Redirect";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    bool IsTransientError(int error)
+    {
+      switch (error)
+      {
+      case ENOENT:  // A parent was removed between its creation and the next step
+      case EINTR:
+      case EAGAIN:
+      case EBUSY:
+#if defined(ESTALE)
+      case ESTALE:  // Network filesystems
+#endif
+        return true;
+
+      default:
+        return false;
+      }
+    }
+
+    std::string GetTemporaryPath(const std::string &path)
+    {
+      return path + TEMPORARY_SUFFIX;
+    }
+
+    bool IsTemporaryPath(const std::string &path)
+    {
+      const size_t length = strlen(TEMPORARY_SUFFIX);
+      return (path.size() > length &&
+              path.compare(path.size() - length, length, TEMPORARY_SUFFIX) == 0);
+    }
+
+#if defined(__linux__)
+    static const size_t DIRECT_IO_ALIGNMENT = 4096;
+    static const size_t DIRECT_IO_CHUNK_SIZE = 8 * 1024 * 1024;
+
+    namespace
+    {
+      class FileDescriptor
+      {
+      private:
+        int fd_;
+
+      public:
+        explicit FileDescriptor(int fd) : fd_(fd)
+        {
+        }
+
+        ~FileDescriptor()
+        {
+          if (fd_ >= 0)
+          {
+            ::close(fd_);
+          }
+        }
+
+        int Get() const
+        {
+          return fd_;
+        }
+
+        void Close(const std::string &path)
+        {
+          int fd = fd_;
+          fd_ = -1;
+          if (::close(fd) != 0)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                            "Cannot close file " + path + ": " + strerror(errno));
+          }
+        }
+      };
+    }
+
+    static void ThrowWriteError(const std::string &path,
+                                int error)
+    {
+      throw Orthanc::OrthancException(error == ENOSPC ? Orthanc::ErrorCode_FullStorage : Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot write file " + path + ": " + strerror(error));
+    }
+
+    static void WriteAll(int fd,
+                         const void *buffer,
+                         size_t size,
+                         uint64_t offset,
+                         const std::string &path)
+    {
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(buffer);
+
+      while (size > 0)
+      {
+        ssize_t written = ::pwrite(fd, p, size, static_cast<off_t>(offset));
+        if (written < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+
+          ThrowWriteError(path, errno);
+        }
+
+        p += written;
+        offset += static_cast<uint64_t>(written);
+        size -= static_cast<size_t>(written);
+      }
+    }
+
+    // Flushes the content of a file being written through its own
+    // descriptor, which saves re-opening it before the rename
+    static void SyncAndClose(FileDescriptor &fd,
+                             const std::string &path,
+                             FsyncPolicy policy)
+    {
+      if (policy != FsyncPolicy_None &&
+          ::fdatasync(fd.Get()) != 0)
+      {
+        ThrowWriteError(path, errno);
+      }
+
+      fd.Close(path);
+    }
+
+    static void WriteFileDirect(const void *content,
+                                size_t size,
+                                const std::string &path,
+                                FsyncPolicy policy)
+    {
+      FileDescriptor fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644));
+
+      if (fd.Get() < 0)
+      {
+        if (errno == EINVAL)
+        {
+          // The filesystem does not support O_DIRECT (e.g. tmpfs)
+          Orthanc::SystemToolbox::WriteFile(content, size, path, policy != FsyncPolicy_None);
+          return;
+        }
+
+        ThrowWriteError(path, errno);
+      }
+
+      if (size == 0)
+      {
+        SyncAndClose(fd, path, policy);
+        return;
+      }
+
+      // Pre-allocate the blocks, so that the filesystem can lay out the file contiguously
+      int error = ::posix_fallocate(fd.Get(), 0, static_cast<off_t>(size));
+      if (error == ENOSPC)
+      {
+        ThrowWriteError(path, error);
+      }
+      else if (error != 0 && error != EOPNOTSUPP && error != EINVAL)
+      {
+        LOG(WARNING) << "[SaolaStorage][IOToolbox] - Cannot pre-allocate " << size << " bytes for " << path << ": " << strerror(error);
+      }
+
+      const uint8_t *source = reinterpret_cast<const uint8_t *>(content);
+      const size_t aligned = size - size % DIRECT_IO_ALIGNMENT;
+
+      size_t offset = 0;
+
+      if (aligned > 0)
+      {
+        // O_DIRECT requires both the memory buffer and the length to be aligned
+        void *buffer = NULL;
+        if (::posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, std::min(DIRECT_IO_CHUNK_SIZE, aligned)) != 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+        }
+
+        std::unique_ptr<void, void (*)(void *)> guard(buffer, ::free);
+
+        while (offset < aligned)
+        {
+          const size_t chunk = std::min(DIRECT_IO_CHUNK_SIZE, aligned - offset);
+          memcpy(buffer, source + offset, chunk);
+          WriteAll(fd.Get(), buffer, chunk, offset, path);
+          offset += chunk;
+        }
+      }
+
+      if (offset < size)
+      {
+        // Unaligned tail: switch O_DIRECT off, then flush and drop these few pages from the cache
+        int flags = ::fcntl(fd.Get(), F_GETFL);
+        if (flags < 0 ||
+            ::fcntl(fd.Get(), F_SETFL, flags & ~O_DIRECT) < 0)
+        {
+          ThrowWriteError(path, errno);
+        }
+
+        WriteAll(fd.Get(), source + offset, size - offset, offset, path);
+
+        if (::fdatasync(fd.Get()) != 0)
+        {
+          ThrowWriteError(path, errno);
+        }
+
+        ::posix_fadvise(fd.Get(), static_cast<off_t>(offset), 0, POSIX_FADV_DONTNEED);
+
+        // The whole file is flushed by now
+        fd.Close(path);
+        return;
+      }
+
+      SyncAndClose(fd, path, policy);
+    }
+
+    void WriteFileDirect(const void *content,
+                         size_t size,
+                         const std::string &path)
+    {
+      WriteFileDirect(content, size, path, FsyncPolicy_None);
+    }
+
+    static void WriteFileBuffered(const void *content,
+                                  size_t size,
+                                  const std::string &path,
+                                  FsyncPolicy policy)
+    {
+      FileDescriptor fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+
+      if (fd.Get() < 0)
+      {
+        ThrowWriteError(path, errno);
+      }
+
+      WriteAll(fd.Get(), content, size, 0, path);
+      SyncAndClose(fd, path, policy);
+    }
+
+    static void CopyFile(const std::string &source,
+                         const std::string &target,
+                         FsyncPolicy policy)
+    {
+      FileDescriptor input(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+
+      if (input.Get() < 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile,
+                                        "Cannot open file " + source + ": " + strerror(errno));
+      }
+
+      FileDescriptor output(::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+
+      if (output.Get() < 0)
+      {
+        ThrowWriteError(target, errno);
+      }
+
+      std::vector<uint8_t> buffer(DIRECT_IO_CHUNK_SIZE);
+      uint64_t offset = 0;
+
+      for (;;)
+      {
+        ssize_t count = ::read(input.Get(), &buffer[0], buffer.size());
+        if (count < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                          "Cannot read file " + source + ": " + strerror(errno));
+        }
+        else if (count == 0)
+        {
+          break;
+        }
+
+        WriteAll(output.Get(), &buffer[0], static_cast<size_t>(count), offset, target);
+        offset += static_cast<uint64_t>(count);
+      }
+
+      SyncAndClose(output, target, policy);
+    }
+
+    void CommitTemporaryFile(const std::string &path,
+                             FsyncPolicy policy)
+    {
+      if (::rename(GetTemporaryPath(path).c_str(), path.c_str()) != 0)
+      {
+        ThrowWriteError(path, errno);
+      }
+
+      if (policy == FsyncPolicy_Full)
+      {
+        // Makes the new directory entry durable
+        FileDescriptor fd(::open(boost::filesystem::path(path).parent_path().string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+        if (fd.Get() < 0 ||
+            ::fsync(fd.Get()) != 0)
+        {
+          ThrowWriteError(path, errno);
+        }
+
+        fd.Close(path);
+      }
+    }
+
+    void WriteFileAtomic(const void *content,
+                         size_t size,
+                         const std::string &path,
+                         FsyncPolicy policy,
+                         bool direct)
+    {
+      const std::string tmp = GetTemporaryPath(path);
+
+      try
+      {
+        if (direct)
+        {
+          WriteFileDirect(content, size, tmp, policy);
+        }
+        else
+        {
+          WriteFileBuffered(content, size, tmp, policy);
+        }
+
+        CommitTemporaryFile(path, policy);
+      }
+      catch (Orthanc::OrthancException &)
+      {
+        ::unlink(tmp.c_str());
+        throw;
+      }
+    }
+
+    void CopyFileAtomic(const std::string &source,
+                        const std::string &path,
+                        FsyncPolicy policy)
+    {
+      const std::string tmp = GetTemporaryPath(path);
+
+      try
+      {
+        CopyFile(source, tmp, policy);
+        CommitTemporaryFile(path, policy);
+      }
+      catch (Orthanc::OrthancException &)
+      {
+        ::unlink(tmp.c_str());
+        throw;
+      }
+    }
+
+    size_t RemoveFilesInDirectory(const std::string &directory,
+                                  const std::vector<std::string> &names,
+                                  std::vector<std::string> *failed)
+    {
+      const int dirfd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dirfd < 0)
+      {
+        if (errno != ENOENT)
+        {
+          LOG(WARNING) << "[SaolaStorage] Cannot open directory " << directory << ": " << strerror(errno);
+
+          if (failed != NULL)
+          {
+            failed->insert(failed->end(), names.begin(), names.end());
+          }
+        }
+
+        return 0;
+      }
+
+      size_t count = 0;
+
+      for (size_t i = 0; i < names.size(); i++)
+      {
+        if (::unlinkat(dirfd, names[i].c_str(), 0) == 0)
+        {
+          count++;
+        }
+        else if (errno != ENOENT)
+        {
+          LOG(WARNING) << "[SaolaStorage] Cannot remove " << directory << "/" << names[i] << ": " << strerror(errno);
+
+          if (failed != NULL)
+          {
+            failed->push_back(names[i]);
+          }
+        }
+      }
+
+      ::close(dirfd);
+      return count;
+    }
+
+    bool RemoveDirectoryIfEmpty(const std::string &directory)
+    {
+      return (::rmdir(directory.c_str()) == 0);
+    }
+
+    // The descriptors of "MakeDirectories()" only anchor the "*at()"
+    // calls: O_PATH skips the permission check and the open of the
+    // directory itself, which costs a round trip on some NAS
+#if defined(O_PATH)
+    static const int ANCHOR_FLAGS = O_PATH | O_DIRECTORY | O_CLOEXEC;
+#else
+    static const int ANCHOR_FLAGS = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+#endif
+
+    int MakeDirectories(const std::string &directory)
+    {
+      struct stat info;
+      if (::stat(directory.c_str(), &info) == 0 &&
+          S_ISDIR(info.st_mode))
+      {
+        return 0;  // Most of the time, another attachment already created it
+      }
+
+      int dirfd = ::open(!directory.empty() && directory[0] == '/' ? "/" : ".", ANCHOR_FLAGS);
+      if (dirfd < 0)
+      {
+        return errno;
+      }
+
+      size_t start = 0;
+      while (start < directory.size())
+      {
+        size_t end = directory.find('/', start);
+        if (end == std::string::npos)
+        {
+          end = directory.size();
+        }
+
+        const std::string component = directory.substr(start, end - start);
+        start = end + 1;
+
+        if (component.empty() || component == ".")
+        {
+          continue;
+        }
+
+        if (::mkdirat(dirfd, component.c_str(), 0777) != 0 &&
+            errno != EEXIST)
+        {
+          const int error = errno;
+          ::close(dirfd);
+          return error;
+        }
+
+        // ENOTDIR if "component" is a file, ENOENT if it was removed meanwhile
+        const int child = ::openat(dirfd, component.c_str(), ANCHOR_FLAGS);
+        const int error = errno;
+        ::close(dirfd);
+
+        if (child < 0)
+        {
+          return error;
+        }
+
+        dirfd = child;
+      }
+
+      ::close(dirfd);
+      return 0;
+    }
+
+#else
+
+    void WriteFileDirect(const void *content,
+                         size_t size,
+                         const std::string &path)
+    {
+      Orthanc::SystemToolbox::WriteFile(content, size, path, false);
+    }
+
+    void CommitTemporaryFile(const std::string &path,
+                             FsyncPolicy policy)
+    {
+      // No portable way to flush a directory
+      boost::filesystem::rename(GetTemporaryPath(path), path);
+    }
+
+    void WriteFileAtomic(const void *content,
+                         size_t size,
+                         const std::string &path,
+                         FsyncPolicy policy,
+                         bool direct)
+    {
+      const std::string tmp = GetTemporaryPath(path);
+
+      try
+      {
+        Orthanc::SystemToolbox::WriteFile(content, size, tmp, policy != FsyncPolicy_None);
+        boost::filesystem::rename(tmp, path);
+      }
+      catch (...)
+      {
+        boost::system::error_code err;
+        boost::filesystem::remove(tmp, err);
+        throw;
+      }
+    }
+
+    void CopyFileAtomic(const std::string &source,
+                        const std::string &path,
+                        FsyncPolicy policy)
+    {
+      const std::string tmp = GetTemporaryPath(path);
+
+      try
+      {
+        // No portable way to flush the copy, which is closed by boost
+        boost::filesystem::copy_file(source, tmp, boost::filesystem::copy_options::overwrite_existing);
+        boost::filesystem::rename(tmp, path);
+      }
+      catch (...)
+      {
+        boost::system::error_code err;
+        boost::filesystem::remove(tmp, err);
+        throw;
+      }
+    }
+
+    size_t RemoveFilesInDirectory(const std::string &directory,
+                                  const std::vector<std::string> &names,
+                                  std::vector<std::string> *failed)
+    {
+      size_t count = 0;
+
+      for (size_t i = 0; i < names.size(); i++)
+      {
+        boost::system::error_code err;
+        if (boost::filesystem::remove(boost::filesystem::path(directory) / names[i], err))
+        {
+          count++;
+        }
+        else if (err &&
+                 failed != NULL)
+        {
+          failed->push_back(names[i]);
+        }
+      }
+
+      return count;
+    }
+
+    bool RemoveDirectoryIfEmpty(const std::string &directory)
+    {
+      boost::system::error_code err;
+      return (boost::filesystem::is_empty(directory, err) &&
+              !err &&
+              boost::filesystem::remove(directory, err));
+    }
+
+    // The descriptors of "MakeDirectories()" only anchor the "*at()"
+    // calls: O_PATH skips the permission check and the open of the
+    // directory itself, which costs a round trip on some NAS
+#if defined(O_PATH)
+    static const int ANCHOR_FLAGS = O_PATH | O_DIRECTORY | O_CLOEXEC;
+#else
+    static const int ANCHOR_FLAGS = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+#endif
+
+    int MakeDirectories(const std::string &directory)
+    {
+      boost::system::error_code err;
+      boost::filesystem::create_directories(directory, err);
+
+      if (!err || boost::filesystem::is_directory(directory))
+      {
+        return 0;
+      }
+      else
+      {
+        return err.value();
+      }
+    }
+
+#endif
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Saola
+{
+  namespace IOToolbox
+  {
+    enum FsyncPolicy
+    {
+      FsyncPolicy_None,   // Rely on the kernel writeback, a crash can lose recent files
+      FsyncPolicy_Data,   // Flush the content of the files before publishing them
+      FsyncPolicy_Full    // Also flush the parent directory after publishing them
+    };
+
+    FsyncPolicy StringToFsyncPolicy(const std::string &value);
+
+    const char *EnumerationToString(FsyncPolicy policy);
+
+    enum ChecksumVerification
+    {
+      ChecksumVerification_Off,      // Never check the payloads on read
+      ChecksumVerification_Sampled,  // Check one read out of N
+      ChecksumVerification_Always
+    };
+
+    ChecksumVerification StringToChecksumVerification(const std::string &value);
+
+    const char *EnumerationToString(ChecksumVerification verification);
+
+    enum DiskFullPolicy
+    {
+      DiskFullPolicy_Reject,   // Refuse the new attachments
+      DiskFullPolicy_Redirect  // Write them to the overflow mount directory
+    };
+
+    DiskFullPolicy StringToDiskFullPolicy(const std::string &value);
+
+    const char *EnumerationToString(DiskFullPolicy policy);
+
+    // Writes a file bypassing the page cache (O_DIRECT), after having
+    // pre-allocated its blocks with fallocate(). Large ingests then do
+    // not evict the working set of the readers. Falls back to a
+    // buffered write on platforms/filesystems without O_DIRECT.
+    void WriteFileDirect(const void *content,
+                         size_t size,
+                         const std::string &path);
+
+    // Files being written are named "<path>.saola-tmp" until they are
+    // complete, then renamed. Leftovers of a crash are recognizable.
+    std::string GetTemporaryPath(const std::string &path);
+
+    bool IsTemporaryPath(const std::string &path);
+
+    // Publishes "GetTemporaryPath(path)" as "path", and flushes the
+    // parent directory with "FsyncPolicy_Full". The content of the
+    // temporary file must have been flushed by its writer.
+    void CommitTemporaryFile(const std::string &path,
+                             FsyncPolicy policy);
+
+    // Readers either see no file at "path", or its full content
+    void WriteFileAtomic(const void *content,
+                         size_t size,
+                         const std::string &path,
+                         FsyncPolicy policy,
+                         bool direct);
+
+    // Same as "WriteFileAtomic()", with the content of "source"
+    void CopyFileAtomic(const std::string &source,
+                        const std::string &path,
+                        FsyncPolicy policy);
+
+    // Removes the files "names" of "directory" with unlinkat()
+    // relative to one descriptor of the directory, which resolves its
+    // path once for the whole group. Missing files are ignored.
+    // Returns the number of removed files. If "failed" is not NULL, it
+    // receives the names of the files that could not be removed.
+    size_t RemoveFilesInDirectory(const std::string &directory,
+                                  const std::vector<std::string> &names,
+                                  std::vector<std::string> *failed = NULL);
+
+    // rmdir(), ignoring the errors (the directory is typically not empty)
+    bool RemoveDirectoryIfEmpty(const std::string &directory);
+
+    // Creates "directory" and its missing parents, one component at a
+    // time with mkdirat() relative to a descriptor of the parent.
+    // Components created concurrently by another thread (EEXIST) are
+    // not errors. Never throws: returns 0 on success, or the errno of
+    // the failure, to be classified with "IsTransientError()".
+    int MakeDirectories(const std::string &directory);
+
+    // Errors worth an immediate retry, such as a parent directory
+    // removed by another process between two steps
+    bool IsTransientError(int error);
+  }
+}
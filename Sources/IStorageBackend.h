@@ -0,0 +1,45 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <string>
+
+namespace Saola
+{
+  // Store of the payloads. The ".symlink" pointers always stay below
+  // StorageDirectory: the location on their first line tells which
+  // backend holds the payload, so that several backends can coexist
+  // (e.g. while migrating from the mount directories to an object
+  // store).
+  class IStorageBackend : public boost::noncopyable
+  {
+  public:
+    virtual ~IStorageBackend()
+    {
+    }
+
+    virtual bool IsOwner(const std::string &location) const = 0;
+
+    // Readers either see nothing at "location", or the full content
+    virtual void Write(const std::string &location,
+                       const void *content,
+                       size_t size) = 0;
+
+    // Throws "ErrorCode_InexistentFile" if there is nothing at "location"
+    virtual uint64_t GetSize(const std::string &location) = 0;
+
+    virtual void ReadWhole(std::string &target,
+                           const std::string &location) = 0;
+
+    // Reads exactly "size" bytes from "offset" on, throws
+    // "ErrorCode_CorruptedFile" if the payload is shorter
+    virtual void ReadRange(void *target,
+                           size_t size,
+                           const std::string &location,
+                           uint64_t offset) = 0;
+
+    // A missing payload is not an error
+    virtual void Remove(const std::string &location) = 0;
+  };
+}
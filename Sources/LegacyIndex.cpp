@@ -0,0 +1,528 @@
+#include "LegacyIndex.h"
+#include "IOToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <set>
+
+namespace Saola
+{
+  // Below 1% of false positives
+  static const uint64_t BITS_PER_ENTRY = 10;
+  static const unsigned int HASHES_COUNT = 7;
+
+  static const char MAGIC[8] = { 'S', 'A', 'O', 'L', 'A', 'L', 'X', '1' };
+
+  static const char *GetStateName(LegacyIndex::State state)
+  {
+    switch (state)
+    {
+    case LegacyIndex::State_Empty:
+      return "Empty";
+
+    case LegacyIndex::State_Loading:
+      return "Loading";
+
+    case LegacyIndex::State_Scanning:
+      return "Scanning";
+
+    case LegacyIndex::State_Ready:
+      return "Ready";
+
+    case LegacyIndex::State_Failed:
+      return "Failed";
+
+    default:
+      return "Unknown";
+    }
+  }
+
+  static bool IsLowerHex(char c)
+  {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+  }
+
+  static int GetHexValue(char c)
+  {
+    if (c >= '0' && c <= '9')
+    {
+      return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+      return c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F')
+    {
+      return c - 'A' + 10;
+    }
+    else
+    {
+      return -1;
+    }
+  }
+
+  // Final mix of splitmix64, in case the uuids are not random
+  static uint64_t Mix(uint64_t x)
+  {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  // The 32 hexadecimal digits of "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx",
+  // without the overhead of "Orthanc::Toolbox::IsUuid()" on the hot path
+  static bool ParseUuid(uint64_t &high,
+                        uint64_t &low,
+                        size_t &partition,
+                        const char *uuid,
+                        size_t length)
+  {
+    if (length != 36)
+    {
+      return false;
+    }
+
+    high = 0;
+    low = 0;
+    unsigned int digits = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+      if (i == 8 || i == 13 || i == 18 || i == 23)
+      {
+        if (uuid[i] != '-')
+        {
+          return false;
+        }
+      }
+      else
+      {
+        const int value = GetHexValue(uuid[i]);
+        if (value < 0)
+        {
+          return false;
+        }
+
+        uint64_t &half = (digits < 16 ? high : low);
+        half = (half << 4) | static_cast<uint64_t>(value);
+        digits++;
+      }
+    }
+
+    // Same split as the legacy layout, whose first level is "uuid[0..1]"
+    partition = static_cast<size_t>(high >> 56);
+    high = Mix(high);
+    low = Mix(low) | 1;  // Odd, so that the probes never collapse
+    return true;
+  }
+
+  // Double hashing: the "i"-th probe is "high + i * low"
+  static uint64_t GetProbe(uint64_t high,
+                           uint64_t low,
+                           unsigned int i,
+                           uint64_t bitsCount)
+  {
+    return (high + static_cast<uint64_t>(i) * low) % bitsCount;
+  }
+
+  LegacyIndex::LegacyIndex() :
+    partitions_(new Partitions(PARTITIONS_COUNT)),
+    thread_(NULL),
+    state_(State_Empty),
+    cancelled_(false),
+    scannedDirectoriesCount_(0),
+    hitsCount_(0),
+    falsePositivesCount_(0),
+    lastScanSeconds_(-1)
+  {
+  }
+
+  LegacyIndex::~LegacyIndex()
+  {
+    if (thread_ != NULL)
+    {
+      LOG(ERROR) << "[SaolaStorage][LegacyIndex]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  bool LegacyIndex::MayContain(const std::string &uuid)
+  {
+    uint64_t high, low;
+    size_t partition;
+    if (!ParseUuid(high, low, partition, uuid.c_str(), uuid.size()))
+    {
+      return false;
+    }
+
+    const std::shared_ptr<const Partitions> partitions = std::atomic_load(&partitions_);
+
+    const std::vector<uint64_t> &bits = (*partitions)[partition].bits_;
+    if (bits.empty())
+    {
+      return false;
+    }
+
+    const uint64_t bitsCount = static_cast<uint64_t>(bits.size()) * 64;
+
+    for (unsigned int i = 0; i < HASHES_COUNT; i++)
+    {
+      const uint64_t probe = GetProbe(high, low, i, bitsCount);
+      if ((bits[probe / 64] & (static_cast<uint64_t>(1) << (probe % 64))) == 0)
+      {
+        return false;
+      }
+    }
+
+    hitsCount_++;
+    return true;
+  }
+
+  void LegacyIndex::ScanPartition(Partition &partition,
+                                  const std::string &directory)
+  {
+    std::vector<std::pair<uint64_t, uint64_t> > hashes;
+
+    boost::system::error_code err;
+    for (boost::filesystem::directory_iterator level(directory, err), end; !err && level != end && !cancelled_; level.increment(err))
+    {
+      if (!boost::filesystem::is_directory(level->symlink_status()))
+      {
+        continue;
+      }
+
+      // A legacy attachment is a payload whose uuid has no pointer in the same directory
+      std::vector<std::string> payloads;
+      std::set<std::string> pointers;
+
+      boost::system::error_code err2;
+      for (boost::filesystem::directory_iterator it(level->path(), err2); !err2 && it != end; it.increment(err2))
+      {
+        const std::string name = it->path().filename().string();
+
+        if (name.size() == 36 + 8 &&
+            name.compare(36, 8, ".symlink") == 0)
+        {
+          pointers.insert(name.substr(0, 36));
+        }
+        else if (name.size() == 36 &&
+                 boost::filesystem::is_regular_file(it->symlink_status()))
+        {
+          payloads.push_back(name);
+        }
+      }
+
+      for (size_t i = 0; i < payloads.size(); i++)
+      {
+        uint64_t high, low;
+        size_t index;
+        if (pointers.find(payloads[i]) == pointers.end() &&
+            ParseUuid(high, low, index, payloads[i].c_str(), payloads[i].size()))
+        {
+          hashes.push_back(std::make_pair(high, low));
+        }
+      }
+
+      scannedDirectoriesCount_++;
+    }
+
+    partition.entriesCount_ = hashes.size();
+    partition.bits_.clear();
+
+    if (!hashes.empty())
+    {
+      const uint64_t wordsCount = (hashes.size() * BITS_PER_ENTRY + 63) / 64;
+      partition.bits_.resize(static_cast<size_t>(wordsCount), 0);
+
+      const uint64_t bitsCount = wordsCount * 64;
+      for (size_t i = 0; i < hashes.size(); i++)
+      {
+        for (unsigned int j = 0; j < HASHES_COUNT; j++)
+        {
+          const uint64_t probe = GetProbe(hashes[i].first, hashes[i].second, j, bitsCount);
+          partition.bits_[probe / 64] |= (static_cast<uint64_t>(1) << (probe % 64));
+        }
+      }
+    }
+  }
+
+  void LegacyIndex::Scan(const std::string &root,
+                         unsigned int threadsCount)
+  {
+    const time_t start = time(NULL);
+
+    // The first-level directories of the legacy layout, by partition
+    std::vector<std::pair<size_t, std::string> > directories;
+
+    boost::system::error_code err;
+    for (boost::filesystem::directory_iterator it(root, err), end; !err && it != end; it.increment(err))
+    {
+      const std::string name = it->path().filename().string();
+      // As the uuids of Orthanc, so that each partition has a single directory
+      if (name.size() == 2 &&
+          IsLowerHex(name[0]) &&
+          IsLowerHex(name[1]) &&
+          boost::filesystem::is_directory(it->symlink_status()))
+      {
+        directories.push_back(std::make_pair(static_cast<size_t>(GetHexValue(name[0]) * 16 + GetHexValue(name[1])),
+                                             it->path().string()));
+      }
+    }
+
+    if (err)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "Cannot list the directory " + root + ": " + err.message());
+    }
+
+    std::shared_ptr<Partitions> partitions(new Partitions(PARTITIONS_COUNT));
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread *> threads;
+
+    for (unsigned int t = 0; t < std::max(1u, threadsCount); t++)
+    {
+      threads.push_back(new std::thread([this, &next, &directories, &partitions]()
+      {
+        for (;;)
+        {
+          const size_t i = next++;
+          if (cancelled_ || i >= directories.size())
+          {
+            return;
+          }
+
+          // Each partition is only written by the thread of its directory
+          ScanPartition((*partitions)[directories[i].first], directories[i].second);
+        }
+      }));
+    }
+
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+      threads[t]->join();
+      delete threads[t];
+    }
+
+    if (cancelled_)
+    {
+      return;
+    }
+
+    uint64_t entriesCount = 0;
+    for (size_t i = 0; i < partitions->size(); i++)
+    {
+      entriesCount += (*partitions)[i].entriesCount_;
+    }
+
+    std::atomic_store(&partitions_, std::shared_ptr<const Partitions>(partitions));
+    lastScanSeconds_ = static_cast<int64_t>(time(NULL) - start);
+
+    LOG(WARNING) << "[SaolaStorage][LegacyIndex] - " << entriesCount << " legacy attachment(s) indexed below "
+                 << root << " in " << lastScanSeconds_.load() << " second(s)";
+  }
+
+  bool LegacyIndex::Load(const std::string &path)
+  {
+    if (!Orthanc::SystemToolbox::IsRegularFile(path))
+    {
+      return false;
+    }
+
+    std::string content;
+    Orthanc::SystemToolbox::ReadFile(content, path);
+
+    if (content.size() < sizeof(MAGIC) ||
+        memcmp(content.c_str(), MAGIC, sizeof(MAGIC)) != 0)
+    {
+      LOG(WARNING) << "[SaolaStorage][LegacyIndex] - Ignoring the invalid file " << path;
+      return false;
+    }
+
+    std::shared_ptr<Partitions> partitions(new Partitions(PARTITIONS_COUNT));
+
+    size_t position = sizeof(MAGIC);
+    for (size_t i = 0; i < PARTITIONS_COUNT; i++)
+    {
+      uint64_t header[2];  // Count of entries, then of 64-bit words
+      if (content.size() - position < sizeof(header))
+      {
+        LOG(WARNING) << "[SaolaStorage][LegacyIndex] - Ignoring the truncated file " << path;
+        return false;
+      }
+
+      memcpy(header, content.c_str() + position, sizeof(header));
+      position += sizeof(header);
+
+      if ((content.size() - position) / sizeof(uint64_t) < header[1])
+      {
+        LOG(WARNING) << "[SaolaStorage][LegacyIndex] - Ignoring the truncated file " << path;
+        return false;
+      }
+
+      Partition &partition = (*partitions)[i];
+      partition.entriesCount_ = header[0];
+      partition.bits_.resize(static_cast<size_t>(header[1]));
+
+      if (!partition.bits_.empty())
+      {
+        memcpy(&partition.bits_[0], content.c_str() + position, partition.bits_.size() * sizeof(uint64_t));
+        position += partition.bits_.size() * sizeof(uint64_t);
+      }
+    }
+
+    std::atomic_store(&partitions_, std::shared_ptr<const Partitions>(partitions));
+    return true;
+  }
+
+  void LegacyIndex::Save(const std::string &path) const
+  {
+    const std::shared_ptr<const Partitions> partitions = std::atomic_load(&partitions_);
+
+    std::string content(MAGIC, sizeof(MAGIC));
+
+    for (size_t i = 0; i < partitions->size(); i++)
+    {
+      const Partition &partition = (*partitions)[i];
+
+      const uint64_t header[2] = { partition.entriesCount_, static_cast<uint64_t>(partition.bits_.size()) };
+      content.append(reinterpret_cast<const char *>(header), sizeof(header));
+
+      if (!partition.bits_.empty())
+      {
+        content.append(reinterpret_cast<const char *>(&partition.bits_[0]), partition.bits_.size() * sizeof(uint64_t));
+      }
+    }
+
+    // The filter is built again if it is lost
+    IOToolbox::WriteFileAtomic(content.c_str(), content.size(), path, IOToolbox::FsyncPolicy_None, false);
+  }
+
+  void LegacyIndex::Run(const std::string &root,
+                        const std::string &path,
+                        unsigned int threadsCount,
+                        bool rescan)
+  {
+    try
+    {
+      if (!rescan)
+      {
+        state_ = State_Loading;
+
+        if (Load(path))
+        {
+          LOG(WARNING) << "[SaolaStorage][LegacyIndex] - Loaded the index of the legacy attachments from " << path;
+          state_ = State_Ready;
+          return;
+        }
+      }
+
+      // The current filter, if any, is used until the scan completes
+      state_ = State_Scanning;
+      LOG(WARNING) << "[SaolaStorage][LegacyIndex] - Scanning " << root << " for the legacy attachments with " << threadsCount << " thread(s)";
+
+      Scan(root, threadsCount);
+
+      if (cancelled_)
+      {
+        state_ = State_Empty;
+      }
+      else
+      {
+        Save(path);
+        state_ = State_Ready;
+      }
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      LOG(ERROR) << "[SaolaStorage][LegacyIndex] - Cannot build the index of the legacy attachments: " << e.What();
+      state_ = State_Failed;
+    }
+    catch (boost::filesystem::filesystem_error &e)
+    {
+      LOG(ERROR) << "[SaolaStorage][LegacyIndex] - Cannot build the index of the legacy attachments: " << e.what();
+      state_ = State_Failed;
+    }
+  }
+
+  void LegacyIndex::Start(const std::string &root,
+                          const std::string &path,
+                          unsigned int threadsCount,
+                          bool rescan)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (state_ == State_Loading ||
+        state_ == State_Scanning)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "The index of the legacy attachments is being built");
+    }
+
+    if (thread_ != NULL)
+    {
+      thread_->join();
+      delete thread_;
+      thread_ = NULL;
+    }
+
+    cancelled_ = false;
+    scannedDirectoriesCount_ = 0;
+    state_ = (rescan ? State_Scanning : State_Loading);
+
+    thread_ = new std::thread(&LegacyIndex::Run, this, root, path, threadsCount, rescan);
+  }
+
+  void LegacyIndex::Stop()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    cancelled_ = true;
+
+    if (thread_ != NULL)
+    {
+      if (thread_->joinable())
+      {
+        thread_->join();
+      }
+
+      delete thread_;
+      thread_ = NULL;
+    }
+  }
+
+  void LegacyIndex::GetStatistics(Json::Value &status)
+  {
+    const std::shared_ptr<const Partitions> partitions = std::atomic_load(&partitions_);
+
+    uint64_t entriesCount = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < partitions->size(); i++)
+    {
+      entriesCount += (*partitions)[i].entriesCount_;
+      bytes += (*partitions)[i].bits_.size() * sizeof(uint64_t);
+    }
+
+    status["State"] = GetStateName(static_cast<State>(state_.load()));
+    status["EntriesCount"] = static_cast<Json::UInt64>(entriesCount);
+    status["MemoryBytes"] = static_cast<Json::UInt64>(bytes);
+    status["ScannedDirectoriesCount"] = static_cast<Json::UInt64>(scannedDirectoriesCount_.load());
+    status["HitsCount"] = static_cast<Json::UInt64>(hitsCount_.load());
+    status["FalsePositivesCount"] = static_cast<Json::UInt64>(falsePositivesCount_.load());
+
+    if (lastScanSeconds_ >= 0)
+    {
+      status["LastScanSeconds"] = static_cast<Json::Int64>(lastScanSeconds_.load());
+    }
+    else
+    {
+      status["LastScanSeconds"] = Json::nullValue;
+    }
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Bloom filter of the uuids of the attachments written before the
+  // plugin was enabled, directly below StorageDirectory and without
+  // ".symlink" pointer. Their reads then skip the failed lookup of the
+  // pointer. The filter has no false negative, but about 1% of false
+  // positives: an attachment reported as legacy might still have a
+  // pointer, which the caller must look up if the legacy path fails.
+  //
+  // The filter is split into 256 partitions, one for each first-level
+  // directory of the legacy layout: each one is scanned by a single
+  // thread and sized after its exact count of uuids. The filter is
+  // saved once built, and loaded at the next startup.
+  class LegacyIndex : public boost::noncopyable
+  {
+  public:
+    enum State
+    {
+      State_Empty,
+      State_Loading,
+      State_Scanning,
+      State_Ready,
+      State_Failed
+    };
+
+  private:
+    struct Partition
+    {
+      uint64_t               entriesCount_;
+      std::vector<uint64_t>  bits_;
+
+      Partition() : entriesCount_(0)
+      {
+      }
+    };
+
+    static const size_t PARTITIONS_COUNT = 256;
+
+    typedef std::vector<Partition> Partitions;
+
+    std::shared_ptr<const Partitions>  partitions_;  // Published with "std::atomic_load()"
+
+    boost::mutex                       mutex_;  // Protects "thread_"
+    std::thread                       *thread_;
+    std::atomic<int>                   state_;
+    std::atomic<bool>                  cancelled_;
+
+    std::atomic<uint64_t>              scannedDirectoriesCount_;
+    std::atomic<uint64_t>              hitsCount_;
+    std::atomic<uint64_t>              falsePositivesCount_;
+    std::atomic<int64_t>               lastScanSeconds_;
+
+    void ScanPartition(Partition &partition,
+                       const std::string &directory);
+
+    void Run(const std::string &root,
+             const std::string &path,
+             unsigned int threadsCount,
+             bool rescan);
+
+  public:
+    LegacyIndex();
+
+    ~LegacyIndex();
+
+    // "true" if "uuid" is probably a legacy attachment
+    bool MayContain(const std::string &uuid);
+
+    // The legacy path of an attachment reported by "MayContain()" did not exist, but its pointer did
+    void CountFalsePositive()
+    {
+      falsePositivesCount_++;
+    }
+
+    // Replaces the filter by a scan of the legacy layout below "root"
+    void Scan(const std::string &root,
+              unsigned int threadsCount);
+
+    // Returns "false" if "path" does not contain a valid filter
+    bool Load(const std::string &path);
+
+    void Save(const std::string &path) const;
+
+    // Loads the filter saved at "path" in the background, or scans
+    // "root" then saves the filter there. If "rescan" is "true", the
+    // saved filter is ignored.
+    void Start(const std::string &root,
+               const std::string &path,
+               unsigned int threadsCount,
+               bool rescan);
+
+    void Stop();
+
+    void GetStatistics(Json::Value &status);
+  };
+}
@@ -26,16 +26,33 @@
 #include <SQLite/Transaction.h>
 #include <Logging.h>
 
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <limits>
+
 namespace Saola
 {
 void PendingDeletionsDatabase::Setup()
 {
   // Performance tuning of SQLite with PRAGMAs
   // http://www.sqlite.org/pragma.html
-  db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
-  db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
-  db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
-  db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
+  if (shared_)
+  {
+    // The other nodes wait for the lock instead of failing at once
+    db_.Execute("PRAGMA SYNCHRONOUS=FULL;");
+    db_.Execute("PRAGMA JOURNAL_MODE=DELETE;");
+    db_.Execute("PRAGMA LOCKING_MODE=NORMAL;");
+    db_.Execute("PRAGMA BUSY_TIMEOUT=10000;");
+  }
+  else
+  {
+    db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+    db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
+    db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+    db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
+  }
 
   {
     Orthanc::SQLite::Transaction t(db_);
@@ -45,13 +62,92 @@ void PendingDeletionsDatabase::Setup()
     {
       db_.Execute("CREATE TABLE Pending(uuid TEXT, type INTEGER)");
     }
-    
+
+    if (!db_.DoesColumnExist("Pending", "path"))
+    {
+      db_.Execute("ALTER TABLE Pending ADD COLUMN path TEXT");
+    }
+
+    // The entries queued by previous versions get priority 0 and are
+    // due immediately
+    if (!db_.DoesColumnExist("Pending", "priority"))
+    {
+      db_.Execute("ALTER TABLE Pending ADD COLUMN priority INTEGER DEFAULT 0");
+      db_.Execute("ALTER TABLE Pending ADD COLUMN enqueued INTEGER DEFAULT 0");
+      db_.Execute("ALTER TABLE Pending ADD COLUMN due INTEGER DEFAULT 0");
+    }
+
+    if (!db_.DoesColumnExist("Pending", "leaseOwner"))
+    {
+      db_.Execute("ALTER TABLE Pending ADD COLUMN leaseOwner TEXT");
+      db_.Execute("ALTER TABLE Pending ADD COLUMN leaseExpiry INTEGER DEFAULT 0");
+    }
+
+    db_.Execute("CREATE INDEX IF NOT EXISTS PendingDue ON Pending(due)");
+    db_.Execute("CREATE INDEX IF NOT EXISTS PendingUuid ON Pending(uuid)");
+    db_.Execute("CREATE INDEX IF NOT EXISTS PendingEnqueued ON Pending(enqueued)");
+
     t.Commit();
   }
+
+  RefreshCountersInternal();
+}
+
+
+void PendingDeletionsDatabase::RefreshCountersInternal()
+{
+  std::map<int, uint64_t> sizeByPriority;
+  uint64_t size = 0;
+
+  // The only full scan of the table
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT priority, COUNT(*) FROM Pending GROUP BY priority");
+
+    while (s.Step())
+    {
+      const uint64_t count = static_cast<uint64_t>(s.ColumnInt64(1));
+      sizeByPriority[s.ColumnInt(0)] = count;
+      size += count;
+    }
+  }
+
+  boost::mutex::scoped_lock lock(countersMutex_);
+  sizeByPriority_.swap(sizeByPriority);
+  size_ = size;
+}
+
+
+void PendingDeletionsDatabase::CountEnqueued(int priority,
+                                             int64_t count)
+{
+  boost::mutex::scoped_lock lock(countersMutex_);
+
+  uint64_t &value = sizeByPriority_[priority];
+  value = static_cast<uint64_t>(std::max<int64_t>(0, static_cast<int64_t>(value) + count));
+
+  if (value == 0)
+  {
+    sizeByPriority_.erase(priority);
+  }
+
+  if (count >= 0)
+  {
+    size_ += static_cast<uint64_t>(count);
+  }
+  else
+  {
+    size_ -= std::min<uint64_t>(size_.load(), static_cast<uint64_t>(-count));
+  }
 }
   
 
-PendingDeletionsDatabase::PendingDeletionsDatabase(const std::string& path)
+PendingDeletionsDatabase::PendingDeletionsDatabase(const std::string& path,
+                                                   unsigned int agingSeconds,
+                                                   bool shared) :
+  agingSeconds_(agingSeconds),
+  shared_(shared),
+  leasesCount_(0),
+  size_(0)
 {
   db_.Open(path);
   Setup();
@@ -59,7 +155,8 @@ PendingDeletionsDatabase::PendingDeletionsDatabase(const std::string& path)
   
 
 void PendingDeletionsDatabase::Enqueue(const std::string& uuid,
-                                       Orthanc::FileContentType type)
+                                       Orthanc::FileContentType type,
+                                       int priority)
 {
   boost::mutex::scoped_lock lock(mutex_);
 
@@ -67,20 +164,63 @@ void PendingDeletionsDatabase::Enqueue(const std::string& uuid,
   t.Begin();
 
   {
-    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO Pending VALUES(?, ?)");
+    const int64_t now = static_cast<int64_t>(time(NULL));
+
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO Pending(uuid, type, priority, enqueued, due) VALUES(?, ?, ?, ?, ?)");
     s.BindString(0, uuid);
     s.BindInt(1, type);
+    s.BindInt(2, priority);
+    s.BindInt64(3, now);
+    s.BindInt64(4, now - priority * agingSeconds_);
     s.Run();
   }
 
   t.Commit();
+
+  CountEnqueued(priority, 1);
+}
+
+
+void PendingDeletionsDatabase::EnqueueOrphan(const std::string& uuid,
+                                             const std::string& path)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Transaction t(db_);
+  t.Begin();
+
+  {
+    const int64_t now = static_cast<int64_t>(time(NULL));
+
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO Pending(uuid, type, path, priority, enqueued, due) VALUES(?, ?, ?, 0, ?, ?)");
+    s.BindString(0, uuid);
+    s.BindInt(1, Orthanc::FileContentType_Unknown);
+    s.BindString(2, path);
+    s.BindInt64(3, now);
+    s.BindInt64(4, now);
+    s.Run();
+  }
+
+  t.Commit();
+
+  CountEnqueued(0, 1);
 }
   
 
 bool PendingDeletionsDatabase::Dequeue(std::string& uuid,
                                        Orthanc::FileContentType& type)
+{
+  std::string path;
+  return Dequeue(uuid, type, path);
+}
+
+
+bool PendingDeletionsDatabase::Dequeue(std::string& uuid,
+                                       Orthanc::FileContentType& type,
+                                       std::string& path)
 {
   bool ok = false;
+  int priority = 0;
     
   boost::mutex::scoped_lock lock(mutex_);
 
@@ -88,15 +228,20 @@ bool PendingDeletionsDatabase::Dequeue(std::string& uuid,
   t.Begin();
 
   {
-    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT uuid, type FROM Pending LIMIT 1");
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT rowid, uuid, type, path, priority FROM Pending WHERE leaseExpiry<=? ORDER BY due, rowid LIMIT 1");
+    s.BindInt64(0, static_cast<int64_t>(time(NULL)));
 
     if (s.Step())
     {
-      uuid = s.ColumnString(0);
-      type = static_cast<Orthanc::FileContentType>(s.ColumnInt(1));
+      const int64_t rowid = s.ColumnInt64(0);
+      uuid = s.ColumnString(1);
+      type = static_cast<Orthanc::FileContentType>(s.ColumnInt(2));
+      path = (s.ColumnIsNull(3) ? std::string() : s.ColumnString(3));
+      priority = s.ColumnInt(4);
 
-      Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Pending WHERE uuid=?");
-      s.BindString(0, uuid);
+      // Several orphaned copies of the same uuid can be queued
+      Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Pending WHERE rowid=?");
+      s.BindInt64(0, rowid);
       s.Run();
       
       ok = true;
@@ -105,35 +250,243 @@ bool PendingDeletionsDatabase::Dequeue(std::string& uuid,
 
   t.Commit();
 
+  if (ok)
+  {
+    CountEnqueued(priority, -1);
+  }
+
   return ok;
 }
 
 
-unsigned int PendingDeletionsDatabase::GetSize()
+void PendingDeletionsDatabase::DequeueBatch(std::vector<Entry>& entries,
+                                            unsigned int maxCount)
 {
+  entries.clear();
+
   boost::mutex::scoped_lock lock(mutex_);
 
-  unsigned int value = 0;
-  
   Orthanc::SQLite::Transaction t(db_);
   t.Begin();
 
+  std::vector<int64_t> rowids;
+  std::map<int, int64_t> dequeuedByPriority;
+
   {
-    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT COUNT(*) FROM Pending");
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT rowid, uuid, type, path, priority FROM Pending WHERE leaseExpiry<=? ORDER BY due, rowid LIMIT ?");
+    s.BindInt64(0, static_cast<int64_t>(time(NULL)));
+    s.BindInt(1, static_cast<int>(maxCount));
 
-    if (s.Step())
+    while (s.Step())
     {
-      int tmp = s.ColumnInt(0);
-      if (tmp > 0)
-      {
-        value = static_cast<unsigned int>(tmp);
-      }
+      Entry entry;
+      entry.uuid_ = s.ColumnString(1);
+      entry.type_ = static_cast<Orthanc::FileContentType>(s.ColumnInt(2));
+      entry.path_ = (s.ColumnIsNull(3) ? std::string() : s.ColumnString(3));
+      entry.rowid_ = s.ColumnInt64(0);
+      entry.priority_ = s.ColumnInt(4);
+
+      rowids.push_back(s.ColumnInt64(0));
+      entries.push_back(entry);
+      dequeuedByPriority[s.ColumnInt(4)]++;
     }
   }
 
+  for (size_t i = 0; i < rowids.size(); i++)
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Pending WHERE rowid=?");
+    s.BindInt64(0, rowids[i]);
+    s.Run();
+  }
+
   t.Commit();
 
-  return value;
+  for (std::map<int, int64_t>::const_iterator it = dequeuedByPriority.begin(); it != dequeuedByPriority.end(); ++it)
+  {
+    CountEnqueued(it->first, -it->second);
+  }
+}
+
+
+void PendingDeletionsDatabase::LeaseBatch(std::vector<Entry>& entries,
+                                          unsigned int maxCount,
+                                          const std::string& owner,
+                                          unsigned int leaseSeconds)
+{
+  entries.clear();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const int64_t now = static_cast<int64_t>(time(NULL));
+
+  // Identifies the entries of this call, "owner" being the prefix
+  const std::string lease = owner + "/" + boost::lexical_cast<std::string>(now) + "/" + boost::lexical_cast<std::string>(leasesCount_++);
+
+  // A single write statement: it takes the write lock at once, and
+  // waits for it if another node holds it
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "UPDATE Pending SET leaseOwner=?, leaseExpiry=? WHERE rowid IN "
+                                 "(SELECT rowid FROM Pending WHERE leaseExpiry<=? ORDER BY due, rowid LIMIT ?)");
+    s.BindString(0, lease);
+    s.BindInt64(1, now + static_cast<int64_t>(leaseSeconds));
+    s.BindInt64(2, now);
+    s.BindInt(3, static_cast<int>(maxCount));
+    s.Run();
+  }
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT rowid, uuid, type, path, priority FROM Pending WHERE leaseOwner=? ORDER BY due, rowid");
+  s.BindString(0, lease);
+
+  while (s.Step())
+  {
+    Entry entry;
+    entry.rowid_ = s.ColumnInt64(0);
+    entry.uuid_ = s.ColumnString(1);
+    entry.type_ = static_cast<Orthanc::FileContentType>(s.ColumnInt(2));
+    entry.path_ = (s.ColumnIsNull(3) ? std::string() : s.ColumnString(3));
+    entry.priority_ = s.ColumnInt(4);
+    entry.lease_ = lease;
+    entries.push_back(entry);
+  }
+}
+
+
+void PendingDeletionsDatabase::Complete(const std::vector<Entry>& entries)
+{
+  if (entries.empty())
+  {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<int, int64_t> completedByPriority;
+
+  Orthanc::SQLite::Transaction t(db_);
+  t.Begin();
+
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Pending WHERE rowid=? AND leaseOwner=?");
+    s.BindInt64(0, entries[i].rowid_);
+    s.BindString(1, entries[i].lease_);
+    s.Run();
+
+    if (db_.GetLastChangeCount() > 0)
+    {
+      completedByPriority[entries[i].priority_]++;
+    }
+  }
+
+  t.Commit();
+
+  for (std::map<int, int64_t>::const_iterator it = completedByPriority.begin(); it != completedByPriority.end(); ++it)
+  {
+    CountEnqueued(it->first, -it->second);
+  }
+}
+
+
+void PendingDeletionsDatabase::ReleaseLeases(const std::string& owner)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const std::string prefix = owner + "/";
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "UPDATE Pending SET leaseOwner=NULL, leaseExpiry=0 WHERE substr(leaseOwner, 1, ?)=?");
+  s.BindInt(0, static_cast<int>(prefix.size()));
+  s.BindString(1, prefix);
+  s.Run();
+}
+
+
+void PendingDeletionsDatabase::RefreshCounters()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  RefreshCountersInternal();
+}
+
+
+bool PendingDeletionsDatabase::SetPriority(const std::string& uuid,
+                                           int priority)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // Entries of "uuid" by previous priority, through the index on "uuid"
+  std::map<int, int64_t> moved;
+
+  Orthanc::SQLite::Transaction t(db_);
+  t.Begin();
+
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT priority, COUNT(*) FROM Pending WHERE uuid=? GROUP BY priority");
+    s.BindString(0, uuid);
+
+    while (s.Step())
+    {
+      moved[s.ColumnInt(0)] = s.ColumnInt64(1);
+    }
+  }
+
+  const bool found = !moved.empty();
+
+  if (found)
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "UPDATE Pending SET priority=?, due=enqueued-? WHERE uuid=?");
+    s.BindInt(0, priority);
+    s.BindInt64(1, priority * agingSeconds_);
+    s.BindString(2, uuid);
+    s.Run();
+  }
+
+  t.Commit();
+
+  for (std::map<int, int64_t>::const_iterator it = moved.begin(); it != moved.end(); ++it)
+  {
+    CountEnqueued(it->first, -it->second);
+    CountEnqueued(priority, it->second);
+  }
+
+  return found;
+}
+
+
+unsigned int PendingDeletionsDatabase::GetSize()
+{
+  return static_cast<unsigned int>(std::min<uint64_t>(size_.load(), std::numeric_limits<unsigned int>::max()));
+}
+
+
+void PendingDeletionsDatabase::GetSizeByPriority(std::map<int, unsigned int>& target)
+{
+  boost::mutex::scoped_lock lock(countersMutex_);
+
+  target.clear();
+
+  for (std::map<int, uint64_t>::const_iterator it = sizeByPriority_.begin(); it != sizeByPriority_.end(); ++it)
+  {
+    target[it->first] = static_cast<unsigned int>(std::min<uint64_t>(it->second, std::numeric_limits<unsigned int>::max()));
+  }
+}
+
+
+bool PendingDeletionsDatabase::LookupOldestEnqueued(int64_t& enqueued)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // Through the index on "enqueued"
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT MIN(enqueued) FROM Pending WHERE enqueued > 0");
+
+  if (s.Step() &&
+      !s.ColumnIsNull(0))
+  {
+    enqueued = s.ColumnInt64(0);
+    return true;
+  }
+  else
+  {
+    return false;
+  }
 }
 
 }
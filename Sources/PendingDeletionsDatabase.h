@@ -25,25 +25,125 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <atomic>
+#include <map>
+#include <vector>
+
 namespace Saola
 {
+  // The entries are dequeued by increasing "due" time, which is the
+  // enqueue time minus "priority * agingSeconds": an entry overtakes
+  // the ones enqueued less than "agingSeconds" before it for each
+  // level of priority above theirs (higher is more urgent), and the
+  // low-priority entries are not starved.
+  //
+  // The queue depth is counted once when the database is opened, then
+  // kept up to date in memory: the status requests never scan the
+  // table, nor wait for the enqueues and dequeues.
+  //
+  // The entries being deleted are leased for a limited time, and only
+  // removed from the queue once deleted: a failed deletion is retried
+  // once its lease expires.
+  //
+  // In the shared mode, the database lives on a filesystem shared by
+  // several Orthanc nodes, which all enqueue and drain it. The entries
+  // of a crashed node are taken over by the others once their lease
+  // expires. SQLite then uses its rollback journal with the default
+  // locking mode, as WAL needs shared memory between the processes.
   class PendingDeletionsDatabase : public boost::noncopyable
   {
   private:
     boost::mutex mutex_;
     Orthanc::SQLite::Connection db_;
+    int64_t agingSeconds_;
+    bool shared_;
+    uint64_t leasesCount_;
+
+    std::atomic<uint64_t> size_;
+
+    boost::mutex countersMutex_;
+    std::map<int, uint64_t> sizeByPriority_;
 
     void Setup();
 
+    void CountEnqueued(int priority,
+                       int64_t count);
+
+    void RefreshCountersInternal();
+
   public:
-    PendingDeletionsDatabase(const std::string &path);
+    struct Entry
+    {
+      std::string               uuid_;
+      Orthanc::FileContentType  type_;
+      std::string               path_;  // Empty, except for the orphaned payloads
+      int64_t                   rowid_;
+      int                       priority_;
+      std::string               lease_;  // Set by "LeaseBatch()"
+    };
+
+    explicit PendingDeletionsDatabase(const std::string &path,
+                                      unsigned int agingSeconds = 3600,
+                                      bool shared = false);
+
+    bool IsShared() const
+    {
+      return shared_;
+    }
 
     void Enqueue(const std::string &uuid,
-                 Orthanc::FileContentType type);
+                 Orthanc::FileContentType type,
+                 int priority = 0);
+
+    // Payload found on a mount without any pointer referencing it
+    // (cf. ConsistencyScrubber): removed by path, not by uuid
+    void EnqueueOrphan(const std::string &uuid,
+                       const std::string &path);
 
     bool Dequeue(std::string &uuid,
                  Orthanc::FileContentType &type);
 
+    // "path" is empty, except for the orphaned payloads
+    bool Dequeue(std::string &uuid,
+                 Orthanc::FileContentType &type,
+                 std::string &path);
+
+    // Dequeues at most "maxCount" entries, in the same order as "Dequeue()"
+    void DequeueBatch(std::vector<Entry> &entries,
+                      unsigned int maxCount);
+
+    // Leases at most "maxCount" entries to "owner" for "leaseSeconds",
+    // in the same order as "Dequeue()". The entries leased by other
+    // nodes are skipped until their lease expires. The entries stay in
+    // the queue until "Complete()".
+    void LeaseBatch(std::vector<Entry> &entries,
+                    unsigned int maxCount,
+                    const std::string &owner,
+                    unsigned int leaseSeconds);
+
+    // Removes the leased entries once handled, except those whose
+    // lease expired and was taken over by another node meanwhile
+    void Complete(const std::vector<Entry> &entries);
+
+    // Makes the entries leased by "owner" available at once, e.g. when
+    // the node restarts after a crash
+    void ReleaseLeases(const std::string &owner);
+
+    // Counts the entries again, as the other nodes change the queue in
+    // the shared mode. This scans the table.
+    void RefreshCounters();
+
+    // Changes the priority of the entries of "uuid" that are still
+    // pending. Returns "false" if there are none.
+    bool SetPriority(const std::string &uuid,
+                     int priority);
+
     unsigned int GetSize();
+
+    void GetSizeByPriority(std::map<int, unsigned int> &target);
+
+    // Enqueue time of the oldest pending entry, "false" if there is
+    // none (the entries queued by previous versions have no such time)
+    bool LookupOldestEnqueued(int64_t &enqueued);
   };
 }
@@ -20,6 +20,16 @@
 #include "SaolaConfiguration.h"
 #include "PendingDeletionsDatabase.h"
 #include "DeletionWorker.h"
+#include "ReplicationWorker.h"
+#include "SpoolUploader.h"
+#include "TieringWorker.h"
+#include "IOLatencyRecorder.h"
+#include "WorkloadCapture.h"
+#include "TemporaryFilesCollector.h"
+#include "ConsistencyScrubber.h"
+#include "Crc32c.h"
+#include "Trace.h"
+#include "UringIO.h"
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
@@ -71,6 +81,62 @@ public:
 
 static std::unique_ptr<Saola::DeletionWorker> deletionWorker_;
 
+static std::unique_ptr<Saola::TieringWorker> tieringWorker_;
+static std::unique_ptr<Saola::SpoolUploader> spoolUploader_;
+static std::unique_ptr<Saola::ReplicationWorker> replicationWorker_;
+
+static std::unique_ptr<Saola::WorkloadCapture> workloadCapture_;
+
+static std::unique_ptr<Saola::TemporaryFilesCollector> temporaryFilesCollector_;
+
+static std::unique_ptr<Saola::ConsistencyScrubber> consistencyScrubber_;
+
+// Records one storage callback into the workload capture, if enabled,
+// when going out of scope
+class CapturedCallback : public boost::noncopyable
+{
+private:
+  Orthanc::Toolbox::ElapsedTimer timer_;
+  Saola::IOOperation operation_;
+  const char *uuid_;
+  OrthancPluginContentType type_;
+  uint64_t size_;
+  uint64_t rangeStart_;
+  bool success_;
+
+public:
+  CapturedCallback(Saola::IOOperation operation,
+                   const char *uuid,
+                   OrthancPluginContentType type,
+                   uint64_t size,
+                   uint64_t rangeStart) : operation_(operation),
+                                          uuid_(uuid),
+                                          type_(type),
+                                          size_(size),
+                                          rangeStart_(rangeStart),
+                                          success_(false)
+  {
+  }
+
+  ~CapturedCallback()
+  {
+    if (workloadCapture_.get() != NULL)
+    {
+      workloadCapture_->Record(operation_, uuid_, type_, size_, rangeStart_, timer_.GetElapsedMicroseconds(), success_);
+    }
+  }
+
+  void SetSize(uint64_t size)
+  {
+    size_ = size;
+  }
+
+  void SetSuccess()
+  {
+    success_ = true;
+  }
+};
+
 static Orthanc::FileContentType Convert(OrthancPluginContentType type)
 {
   switch (type)
@@ -96,20 +162,127 @@ OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
   switch (changeType)
   {
   case OrthancPluginChangeType_OrthancStarted:
-    if (SaolaConfiguration::Instance().DelayedDeletionEnable())
+    if (SaolaConfiguration::Instance()->CleanupOnStartup())
+    {
+      std::vector<std::string> roots;
+      SaolaConfiguration::Instance()->GetWritableMountDirectories(roots);
+      roots.push_back(storageArea_->GetRoot());
+
+      if (SaolaConfiguration::Instance()->TieringEnable())
+      {
+        roots.push_back(SaolaConfiguration::Instance()->GetColdMountDirectory());
+      }
+
+      if (storageArea_->GetSpoolJournal() != NULL)
+      {
+        roots.push_back(storageArea_->GetSpoolDirectory());
+      }
+
+      if (storageArea_->GetReplicationQueue() != NULL)
+      {
+        roots.push_back(storageArea_->GetReplicaDirectory());
+      }
+
+      temporaryFilesCollector_.reset(new Saola::TemporaryFilesCollector(roots, SaolaConfiguration::Instance()->CleanupThreads()));
+      temporaryFilesCollector_->Start();
+    }
+
+    if (SaolaConfiguration::Instance()->DelayedDeletionEnable())
     {
       deletionWorker_.reset(new Saola::DeletionWorker(storageArea_));
       deletionWorker_->Start();
     }
 
+    if (SaolaConfiguration::Instance()->TieringEnable())
+    {
+      tieringWorker_.reset(new Saola::TieringWorker(storageArea_));
+      tieringWorker_->Start();
+    }
+
+    // Also resumes the uploads interrupted by the last shutdown or crash
+    if (storageArea_->GetSpoolJournal() != NULL)
+    {
+      spoolUploader_.reset(new Saola::SpoolUploader(storageArea_));
+      spoolUploader_->Start();
+    }
+
+    // Also resumes the replication of the entries queued before the last shutdown
+    if (storageArea_->GetReplicationQueue() != NULL)
+    {
+      replicationWorker_.reset(new Saola::ReplicationWorker(storageArea_));
+      replicationWorker_->Start();
+
+      // Started even if "HedgedReads" is disabled, as the option can be enabled at runtime
+      storageArea_->GetHedgedReader().Start(SaolaConfiguration::Instance()->ReplicationHedgedReadsThreads());
+    }
+
+    storageArea_->GetDirectoryPruner().Start();
+
+    // Loads the saved index, or builds it at the first startup
+    if (SaolaConfiguration::Instance()->LegacyIndexEnable())
+    {
+      storageArea_->GetLegacyIndex().Start(storageArea_->GetRoot(), SaolaConfiguration::Instance()->LegacyIndexPath(),
+                                           SaolaConfiguration::Instance()->LegacyIndexThreads(), false);
+    }
+
+    if (SaolaConfiguration::Instance()->DiskSpaceEnable())
+    {
+      storageArea_->GetDiskSpaceMonitor().Start();
+    }
+
+    // Orphaned payloads are only queued for deletion if DelayedDeletion is enabled
+    consistencyScrubber_.reset(new Saola::ConsistencyScrubber(storageArea_, deletionWorker_.get()));
+
+    if (SaolaConfiguration::Instance()->CaptureEnable())
+    {
+      workloadCapture_.reset(new Saola::WorkloadCapture(SaolaConfiguration::Instance()->CapturePath(),
+                                                        SaolaConfiguration::Instance()->CaptureBufferSize()));
+      workloadCapture_->Start();
+    }
+
     break;
 
   case OrthancPluginChangeType_OrthancStopped:
+    if (temporaryFilesCollector_.get() != NULL)
+    {
+      temporaryFilesCollector_->Stop();
+    }
+
+    if (consistencyScrubber_.get() != NULL)
+    {
+      consistencyScrubber_->Stop();
+    }
+
     if (deletionWorker_.get() != NULL)
     {
       deletionWorker_->Stop();
     }
 
+    if (tieringWorker_.get() != NULL)
+    {
+      tieringWorker_->Stop();
+    }
+
+    if (spoolUploader_.get() != NULL)
+    {
+      spoolUploader_->Stop();
+    }
+
+    if (replicationWorker_.get() != NULL)
+    {
+      replicationWorker_->Stop();
+    }
+
+    storageArea_->GetDirectoryPruner().Stop();
+    storageArea_->GetDiskSpaceMonitor().Stop();
+    storageArea_->GetLegacyIndex().Stop();
+    storageArea_->GetHedgedReader().Stop();
+
+    if (workloadCapture_.get() != NULL)
+    {
+      workloadCapture_->Stop();
+    }
+
     break;
 
   default:
@@ -123,7 +296,7 @@ void GetPluginConfiguration(OrthancPluginRestOutput *output,
                             const char *url,
                             const OrthancPluginHttpRequest *request)
 {
-  const std::string &s = SaolaConfiguration::Instance().ToJsonString();
+  const std::string s = SaolaConfiguration::Instance()->ToJsonString();
   OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
                             s.size(), "application/json");
 }
@@ -141,9 +314,41 @@ void ApplyPluginConfiguration(OrthancPluginRestOutput *output,
   }
 
   config.GetSection(saolaSection, SAOLA_STORAGE);
-  SaolaConfiguration::Instance().ApplyConfiguration(saolaSection.GetJson());
+  SaolaConfiguration::ApplyConfiguration(saolaSection.GetJson());
+
+  const std::shared_ptr<const SaolaConfiguration> snapshot = SaolaConfiguration::Instance();
+  const SaolaConfiguration &configuration = *snapshot;
+
+  std::vector<std::string> mounts;
+  configuration.GetWritableMountDirectories(mounts);
 
-  const std::string &s = SaolaConfiguration::Instance().ToJsonString();
+  // Read by the tiering worker at each migration, hence also reloadable
+  Saola::IOLatencyRecorder::Instance().RegisterVolume(configuration.GetColdMountDirectory());
+  storageArea_->GetDirectoryPruner().AddRoot(configuration.GetColdMountDirectory());
+
+  for (size_t i = 0; i < mounts.size(); i++)
+  {
+    Saola::IOLatencyRecorder::Instance().RegisterVolume(mounts[i]);
+    storageArea_->GetDirectoryPruner().AddRoot(mounts[i]);
+
+    if (configuration.DiskSpaceEnable())
+    {
+      storageArea_->GetDiskSpaceMonitor().RegisterVolume(mounts[i]);
+    }
+  }
+
+  storageArea_->GetDiskSpaceMonitor().SetThresholds(configuration.DiskSpaceHighWaterPercent(),
+                                                    configuration.DiskSpaceLowWaterPercent(),
+                                                    configuration.DiskSpaceMinFreeBytes());
+
+  // Disabling DelayedDeletion is immediate (the queue is still drained), enabling it needs the worker
+  if (configuration.DelayedDeletionEnable() &&
+      deletionWorker_.get() == NULL)
+  {
+    LOG(WARNING) << "[SaolaStorage] Enabling DelayedDeletion only takes effect after a restart";
+  }
+
+  const std::string &s = configuration.ToJsonString();
   OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
                             s.size(), "application/json");
 }
@@ -164,14 +369,363 @@ void GetPluginStatus(OrthancPluginRestOutput *output,
                             s.size(), "application/json");
 }
 
+// Expedites (or delays) the deletion of attachments that are still
+// pending, e.g. the urgent removal of a misidentified study while a
+// retention purge is in progress:
+// { "Attachments" : [ "uuid1", "uuid2" ], "Priority" : 10 }
+void SetDeletionPriority(OrthancPluginRestOutput *output,
+                         const char *url,
+                         const OrthancPluginHttpRequest *request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    return OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+
+  if (deletionWorker_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "DelayedDeletion is not enabled");
+  }
+
+  Json::Value body;
+  Orthanc::Toolbox::ReadJsonWithoutComments(body, request->body, request->bodySize);
+
+  if (body.type() != Json::objectValue ||
+      !body.isMember("Attachments") ||
+      body["Attachments"].type() != Json::arrayValue ||
+      !body.isMember("Priority") ||
+      !body["Priority"].isInt())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Expected a list of \"Attachments\" and an integer \"Priority\"");
+  }
+
+  Json::Value answer;
+  answer["Updated"] = Json::arrayValue;
+  answer["NotPending"] = Json::arrayValue;
+
+  for (Json::ArrayIndex i = 0; i < body["Attachments"].size(); i++)
+  {
+    const std::string uuid = body["Attachments"][i].asString();
+    if (deletionWorker_->SetPriority(uuid, body["Priority"].asInt()))
+    {
+      answer["Updated"].append(uuid);
+    }
+    else
+    {
+      answer["NotPending"].append(uuid);
+    }
+  }
+
+  std::string s = answer.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetTieringStatus(OrthancPluginRestOutput *output,
+                      const char *url,
+                      const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  if (tieringWorker_.get() != NULL)
+  {
+    tieringWorker_->GetStatistics(status);
+  }
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetPrunerStatus(OrthancPluginRestOutput *output,
+                     const char *url,
+                     const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  storageArea_->GetDirectoryPruner().GetStatistics(status);
+  storageArea_->GetDirectoryStatistics(status["DirectoryCreation"]);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetDiskSpaceStatus(OrthancPluginRestOutput *output,
+                        const char *url,
+                        const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  status["Enable"] = SaolaConfiguration::Instance()->DiskSpaceEnable();
+  status["OnFull"] = Saola::IOToolbox::EnumerationToString(SaolaConfiguration::Instance()->GetDiskFullPolicy());
+  storageArea_->GetDiskSpaceMonitor().GetStatistics(status);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetObjectStorageStatus(OrthancPluginRestOutput *output,
+                            const char *url,
+                            const OrthancPluginHttpRequest *request)
+{
+  const SaolaConfiguration::ObjectStorageSettings settings = SaolaConfiguration::Instance()->GetObjectStorage();
+
+  Json::Value status;
+  status["Enable"] = settings.enable_;
+  status["Endpoint"] = settings.endpoint_;
+  status["Bucket"] = settings.bucket_;
+  storageArea_->GetObjectStore().GetStatistics(status);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetSpoolStatus(OrthancPluginRestOutput *output,
+                    const char *url,
+                    const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  status["Enable"] = (storageArea_->GetSpoolJournal() != NULL);
+  if (spoolUploader_.get() != NULL)
+  {
+    spoolUploader_->GetStatistics(status);
+  }
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetReplicationStatus(OrthancPluginRestOutput *output,
+                          const char *url,
+                          const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  status["Enable"] = (storageArea_->GetReplicationQueue() != NULL);
+  if (replicationWorker_.get() != NULL)
+  {
+    replicationWorker_->GetStatistics(status);
+  }
+
+  status["HedgedReads"] = Json::objectValue;
+  status["HedgedReads"]["Enable"] = SaolaConfiguration::Instance()->ReplicationHedgedReads();
+  storageArea_->GetHedgedReader().GetStatistics(status["HedgedReads"]);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetIOUringStatus(OrthancPluginRestOutput *output,
+                      const char *url,
+                      const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  Saola::UringIO::GetStatistics(status);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetCaptureStatus(OrthancPluginRestOutput *output,
+                      const char *url,
+                      const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  if (workloadCapture_.get() != NULL)
+  {
+    workloadCapture_->GetStatistics(status);
+  }
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetCleanupStatus(OrthancPluginRestOutput *output,
+                      const char *url,
+                      const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  if (temporaryFilesCollector_.get() != NULL)
+  {
+    temporaryFilesCollector_->GetStatistics(status);
+  }
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetChecksumStatus(OrthancPluginRestOutput *output,
+                       const char *url,
+                       const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  status["Enable"] = SaolaConfiguration::Instance()->ChecksumEnable();
+  status["Verify"] = Saola::IOToolbox::EnumerationToString(SaolaConfiguration::Instance()->GetChecksumVerification());
+  status["HardwareAccelerated"] = Saola::Crc32c::IsHardwareAccelerated();
+  status["VerifiedReads"] = static_cast<Json::UInt64>(storageArea_->GetVerifiedReadsCount());
+  status["Mismatches"] = static_cast<Json::UInt64>(storageArea_->GetChecksumMismatchesCount());
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void StartScrub(OrthancPluginRestOutput *output,
+                const char *url,
+                const OrthancPluginHttpRequest *request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    return OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+
+  if (consistencyScrubber_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "Orthanc is not started yet");
+  }
+
+  Json::Value body = Json::objectValue;
+  if (request->bodySize > 0)
+  {
+    Orthanc::Toolbox::ReadJsonWithoutComments(body, request->body, request->bodySize);
+  }
+
+  consistencyScrubber_->Start(body.isMember("Resume") && body["Resume"].asBool(),
+                              body.isMember("VerifyPayloads") && body["VerifyPayloads"].asBool());
+
+  Json::Value status;
+  consistencyScrubber_->GetStatus(status);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void CancelScrub(OrthancPluginRestOutput *output,
+                 const char *url,
+                 const OrthancPluginHttpRequest *request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    return OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+
+  Json::Value status;
+  if (consistencyScrubber_.get() != NULL)
+  {
+    consistencyScrubber_->Cancel();
+    consistencyScrubber_->GetStatus(status);
+  }
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetScrubStatus(OrthancPluginRestOutput *output,
+                    const char *url,
+                    const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  if (consistencyScrubber_.get() != NULL)
+  {
+    consistencyScrubber_->GetStatus(status);
+  }
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetLegacyIndexStatus(OrthancPluginRestOutput *output,
+                          const char *url,
+                          const OrthancPluginHttpRequest *request)
+{
+  Json::Value status;
+  status["Enable"] = SaolaConfiguration::Instance()->LegacyIndexEnable();
+  storageArea_->GetLegacyIndex().GetStatistics(status);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+// E.g. after attachments were written while the plugin was disabled
+void RescanLegacyIndex(OrthancPluginRestOutput *output,
+                       const char *url,
+                       const OrthancPluginHttpRequest *request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    return OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+
+  if (!SaolaConfiguration::Instance()->LegacyIndexEnable())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "LegacyIndex is disabled");
+  }
+
+  storageArea_->GetLegacyIndex().Start(storageArea_->GetRoot(), SaolaConfiguration::Instance()->LegacyIndexPath(),
+                                       SaolaConfiguration::Instance()->LegacyIndexThreads(), true);
+
+  Json::Value status;
+  storageArea_->GetLegacyIndex().GetStatistics(status);
+
+  std::string s = status.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
+void GetIOLatency(OrthancPluginRestOutput *output,
+                  const char *url,
+                  const OrthancPluginHttpRequest *request)
+{
+  uint64_t thresholdMs = 100;
+  unsigned int limit = 100;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    const std::string key = request->getKeys[i];
+    if (key == "threshold-ms")
+    {
+      thresholdMs = boost::lexical_cast<uint64_t>(request->getValues[i]);
+    }
+    else if (key == "limit")
+    {
+      limit = boost::lexical_cast<unsigned int>(request->getValues[i]);
+    }
+  }
+
+  Json::Value latency;
+  Saola::IOLatencyRecorder::Instance().Format(latency, thresholdMs * 1000, limit);
+
+  std::string s = latency.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(),
+                            s.size(), "application/json");
+}
+
 static OrthancPluginErrorCode StorageCreate(const char *uuid,
                                             const void *content,
                                             int64_t size,
                                             OrthancPluginContentType type)
 {
+  CapturedCallback captured(Saola::IOOperation_Create, uuid, type, size, 0);
+
   try
   {
-    storageArea_->Create(uuid, content, size);
+    storageArea_->Create(uuid, content, size, Convert(type));
+
+    if (tieringWorker_.get() != NULL)
+    {
+      tieringWorker_->Touch(uuid);
+    }
+
+    captured.SetSuccess();
     return OrthancPluginErrorCode_Success;
   }
   catch (Orthanc::OrthancException &e)
@@ -190,9 +744,18 @@ static OrthancPluginErrorCode StorageReadRange(OrthancPluginMemoryBuffer64 *targ
                                                OrthancPluginContentType type,
                                                uint64_t rangeStart)
 {
+  CapturedCallback captured(Saola::IOOperation_ReadRange, uuid, type, target->size, rangeStart);
+
   try
   {
     storageArea_->ReadRange(target, uuid, rangeStart);
+
+    if (tieringWorker_.get() != NULL)
+    {
+      tieringWorker_->Touch(uuid);
+    }
+
+    captured.SetSuccess();
     return OrthancPluginErrorCode_Success;
   }
   catch (Orthanc::OrthancException &e)
@@ -210,9 +773,19 @@ static OrthancPluginErrorCode StorageReadWhole(OrthancPluginMemoryBuffer64 *targ
                                                const char *uuid,
                                                OrthancPluginContentType type)
 {
+  CapturedCallback captured(Saola::IOOperation_ReadWhole, uuid, type, 0, 0);
+
   try
   {
     storageArea_->ReadWhole(target, uuid);
+    captured.SetSize(target->size);
+
+    if (tieringWorker_.get() != NULL)
+    {
+      tieringWorker_->Touch(uuid);
+    }
+
+    captured.SetSuccess();
     return OrthancPluginErrorCode_Success;
   }
   catch (Orthanc::OrthancException &e)
@@ -229,10 +802,18 @@ static OrthancPluginErrorCode StorageReadWhole(OrthancPluginMemoryBuffer64 *targ
 static OrthancPluginErrorCode StorageRemove(const char *uuid,
                                             OrthancPluginContentType type)
 {
+  CapturedCallback captured(Saola::IOOperation_Remove, uuid, type, 0, 0);
+
   try
   {
-    // Delayed Deletion enabled
-    if (deletionWorker_.get() != NULL)
+    if (tieringWorker_.get() != NULL)
+    {
+      tieringWorker_->Forget(uuid);
+    }
+
+    // Delayed Deletion enabled (the worker keeps draining its queue if it is disabled by a reload)
+    if (deletionWorker_.get() != NULL &&
+        SaolaConfiguration::Instance()->DelayedDeletionEnable())
     {
       deletionWorker_->Enqueue(uuid, Convert(type));
     }
@@ -240,6 +821,8 @@ static OrthancPluginErrorCode StorageRemove(const char *uuid,
     {
       storageArea_->RemoveAttachment(uuid);
     }
+
+    captured.SetSuccess();
     return OrthancPluginErrorCode_Success;
   }
   catch (Orthanc::OrthancException &e)
@@ -317,7 +900,7 @@ static int32_t FilterIncomingDicomInstance(const OrthancPluginDicomInstance *ins
   if (OrthancPlugins::RestApiGet(stats, "/instances/" + instanceId, false) && !stats.isNull() && !stats.empty())
   {
     /* Reject instance if already existing */
-    LOG(INFO) << "[OrthancStorage] FilterIncomingDicomInstance InstanceID already existing: " << instanceId << " , discard incomming StudyInstanceUID " << studyInstanceUID
+    SAOLA_TRACE(Storage, Info) << "[OrthancStorage] FilterIncomingDicomInstance InstanceID already existing: " << instanceId << " , discard incomming StudyInstanceUID " << studyInstanceUID
               << ", SeriesInstanceUID " << seriesInstanceUID << ", SOPInstanceUID " << sopInstanceUID;
     return 0;
   }
@@ -331,7 +914,6 @@ extern "C"
   {
     OrthancPlugins::SetGlobalContext(context);
     Orthanc::Logging::InitializePluginContext(context);
-    Orthanc::Logging::EnableInfoLevel(true);
 
     /* Check the version of the Orthanc core */
     if (OrthancPluginCheckVersion(context) == 0)
@@ -344,7 +926,25 @@ extern "C"
 
     OrthancPluginSetDescription(context, "Implementation of OrthancStorage with supporting multiple storage directories");
 
-    if (SaolaConfiguration::Instance().IsEnabled())
+    bool enabled;
+
+    try
+    {
+      // The first snapshot of the configuration is loaded here, and throws if a setting is invalid
+      enabled = SaolaConfiguration::Instance()->IsEnabled();
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      LOG(ERROR) << "[SaolaStorage] ERROR Invalid configuration: " << e.What();
+      return -1;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "[SaolaStorage] ERROR Native exception while reading the configuration";
+      return -1;
+    }
+
+    if (enabled)
     {
       try
       {
@@ -363,16 +963,33 @@ extern "C"
         return -1;
       }
       // OrthancPluginRegisterReceivedInstanceCallback(context, ReceivedInstanceCallback);
-      if (SaolaConfiguration::Instance().FilterIncomingDicomInstance())
+      if (SaolaConfiguration::Instance()->FilterIncomingDicomInstance())
       {
         OrthancPluginRegisterIncomingDicomInstanceFilter(context, FilterIncomingDicomInstance);
       }
 
       OrthancPluginRegisterStorageArea2(context, StorageCreate, StorageReadWhole, StorageReadRange, StorageRemove);
       OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
-      OrthancPlugins::RegisterRestCallback<GetPluginConfiguration>(SaolaConfiguration::Instance().GetRoot() + ORTHANC_PLUGIN_NAME + "/configuration", true);
-      OrthancPlugins::RegisterRestCallback<ApplyPluginConfiguration>(SaolaConfiguration::Instance().GetRoot() + ORTHANC_PLUGIN_NAME + "/configuration/apply", true);
-      OrthancPlugins::RegisterRestCallback<GetPluginStatus>(SaolaConfiguration::Instance().GetRoot() + ORTHANC_PLUGIN_NAME + "/delayed-deletion/status", true);
+      OrthancPlugins::RegisterRestCallback<GetPluginConfiguration>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/configuration", true);
+      OrthancPlugins::RegisterRestCallback<ApplyPluginConfiguration>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/configuration/apply", true);
+      OrthancPlugins::RegisterRestCallback<GetPluginStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/delayed-deletion/status", true);
+      OrthancPlugins::RegisterRestCallback<SetDeletionPriority>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/delayed-deletion/priority", true);
+      OrthancPlugins::RegisterRestCallback<GetTieringStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/tiering/status", true);
+      OrthancPlugins::RegisterRestCallback<GetIOLatency>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/io/latency", true);
+      OrthancPlugins::RegisterRestCallback<GetCaptureStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/capture/status", true);
+      OrthancPlugins::RegisterRestCallback<GetPrunerStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/pruner/status", true);
+      OrthancPlugins::RegisterRestCallback<GetDiskSpaceStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/disk/status", true);
+      OrthancPlugins::RegisterRestCallback<GetIOUringStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/io-uring/status", true);
+      OrthancPlugins::RegisterRestCallback<GetSpoolStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/spool/status", true);
+      OrthancPlugins::RegisterRestCallback<GetReplicationStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/replication/status", true);
+      OrthancPlugins::RegisterRestCallback<GetObjectStorageStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/object-storage/status", true);
+      OrthancPlugins::RegisterRestCallback<GetCleanupStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/cleanup/status", true);
+      OrthancPlugins::RegisterRestCallback<GetChecksumStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/checksum/status", true);
+      OrthancPlugins::RegisterRestCallback<StartScrub>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/scrub/start", true);
+      OrthancPlugins::RegisterRestCallback<CancelScrub>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/scrub/cancel", true);
+      OrthancPlugins::RegisterRestCallback<GetScrubStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/scrub/status", true);
+      OrthancPlugins::RegisterRestCallback<GetLegacyIndexStatus>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/legacy-index/status", true);
+      OrthancPlugins::RegisterRestCallback<RescanLegacyIndex>(SaolaConfiguration::Instance()->GetRoot() + ORTHANC_PLUGIN_NAME + "/legacy-index/rescan", true);
     }
     else
     {
@@ -0,0 +1,172 @@
+#include "ReplicationDatabase.h"
+
+#include <SQLite/Statement.h>
+#include <SQLite/Transaction.h>
+#include <Logging.h>
+
+#include <ctime>
+
+namespace Saola
+{
+void ReplicationDatabase::Setup()
+{
+  db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+  db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
+  db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+  db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
+
+  {
+    Orthanc::SQLite::Transaction t(db_);
+    t.Begin();
+
+    if (!db_.DoesTableExist("Replication"))
+    {
+      db_.Execute("CREATE TABLE Replication(seq INTEGER PRIMARY KEY AUTOINCREMENT, uuid TEXT, operation INTEGER, "
+                  "path TEXT, enqueued INTEGER, attempts INTEGER DEFAULT 0)");
+    }
+
+    // Seconds since epoch before which a failed entry is not retried
+    if (!db_.DoesColumnExist("Replication", "nextAttempt"))
+    {
+      db_.Execute("ALTER TABLE Replication ADD COLUMN nextAttempt INTEGER DEFAULT 0");
+    }
+
+    t.Commit();
+  }
+}
+
+
+ReplicationDatabase::ReplicationDatabase(const std::string& path)
+{
+  db_.Open(path);
+  Setup();
+}
+
+
+void ReplicationDatabase::EnqueueCopy(const std::string& uuid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO Replication(uuid, operation, path, enqueued) VALUES(?, ?, '', ?)");
+  s.BindString(0, uuid);
+  s.BindInt(1, ReplicationOperation_Copy);
+  s.BindInt64(2, static_cast<int64_t>(time(NULL)));
+  s.Run();
+}
+
+
+void ReplicationDatabase::EnqueueRemovals(const std::vector<std::pair<std::string, std::string> >& removals)
+{
+  if (removals.empty())
+  {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Transaction t(db_);
+  t.Begin();
+
+  const int64_t now = static_cast<int64_t>(time(NULL));
+
+  for (size_t i = 0; i < removals.size(); i++)
+  {
+    Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO Replication(uuid, operation, path, enqueued) VALUES(?, ?, ?, ?)");
+    s.BindString(0, removals[i].first);
+    s.BindInt(1, ReplicationOperation_Remove);
+    s.BindString(2, removals[i].second);
+    s.BindInt64(3, now);
+    s.Run();
+  }
+
+  t.Commit();
+}
+
+
+void ReplicationDatabase::ListPending(std::vector<Entry>& entries,
+                                      unsigned int limit)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  entries.clear();
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT seq, uuid, operation, path, enqueued, attempts FROM Replication "
+                               "WHERE nextAttempt<=? ORDER BY seq LIMIT ?");
+  s.BindInt64(0, static_cast<int64_t>(time(NULL)));
+  s.BindInt(1, static_cast<int>(limit));
+
+  while (s.Step())
+  {
+    Entry entry;
+    entry.seq_ = s.ColumnInt64(0);
+    entry.uuid_ = s.ColumnString(1);
+    entry.operation_ = static_cast<ReplicationOperation>(s.ColumnInt(2));
+    entry.path_ = s.ColumnString(3);
+    entry.enqueued_ = s.ColumnInt64(4);
+    entry.attempts_ = static_cast<unsigned int>(s.ColumnInt(5));
+    entries.push_back(entry);
+  }
+}
+
+
+void ReplicationDatabase::Remove(int64_t seq)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Replication WHERE seq=?");
+  s.BindInt64(0, seq);
+  s.Run();
+}
+
+
+void ReplicationDatabase::CountFailure(int64_t seq,
+                                       unsigned int delaySeconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "UPDATE Replication SET attempts=attempts+1, nextAttempt=? WHERE seq=?");
+  s.BindInt64(0, static_cast<int64_t>(time(NULL)) + static_cast<int64_t>(delaySeconds));
+  s.BindInt64(1, seq);
+  s.Run();
+}
+
+
+unsigned int ReplicationDatabase::GetSize()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  unsigned int value = 0;
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT COUNT(*) FROM Replication");
+
+  if (s.Step())
+  {
+    int tmp = s.ColumnInt(0);
+    if (tmp > 0)
+    {
+      value = static_cast<unsigned int>(tmp);
+    }
+  }
+
+  return value;
+}
+
+
+bool ReplicationDatabase::LookupOldest(int64_t& enqueued)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT enqueued FROM Replication ORDER BY seq LIMIT 1");
+
+  if (s.Step())
+  {
+    enqueued = s.ColumnInt64(0);
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <SQLite/Connection.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Saola
+{
+  enum ReplicationOperation
+  {
+    ReplicationOperation_Copy = 0,   // Copies the current payload of the attachment to the replica
+    ReplicationOperation_Remove = 1  // Removes a payload from the replica
+  };
+
+  // Persistent FIFO queue of the operations to apply to the replica
+  // mount. The entries are only removed once applied, so that the
+  // replication resumes after a restart.
+  class ReplicationDatabase : public boost::noncopyable
+  {
+  private:
+    boost::mutex mutex_;
+    Orthanc::SQLite::Connection db_;
+
+    void Setup();
+
+  public:
+    struct Entry
+    {
+      int64_t               seq_;
+      std::string           uuid_;
+      ReplicationOperation  operation_;
+      std::string           path_;      // Replica to remove, empty for the copies
+      int64_t               enqueued_;  // Seconds since epoch
+      unsigned int          attempts_;  // Failed attempts so far
+    };
+
+    explicit ReplicationDatabase(const std::string &path);
+
+    void EnqueueCopy(const std::string &uuid);
+
+    // (uuid, replica) pairs, in one transaction
+    void EnqueueRemovals(const std::vector<std::pair<std::string, std::string> > &removals);
+
+    // Oldest entries first, without removing them. The entries
+    // postponed by "CountFailure()" are skipped until they are due.
+    void ListPending(std::vector<Entry> &entries,
+                     unsigned int limit);
+
+    void Remove(int64_t seq);
+
+    // Counts a failed attempt, and postpones the entry by "delaySeconds"
+    void CountFailure(int64_t seq,
+                      unsigned int delaySeconds);
+
+    unsigned int GetSize();
+
+    // Enqueue time of the oldest pending entry, "false" if there is none
+    bool LookupOldest(int64_t &enqueued);
+  };
+}
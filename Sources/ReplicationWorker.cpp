@@ -0,0 +1,280 @@
+#include "ReplicationWorker.h"
+#include "IOToolbox.h"
+#include "SaolaConfiguration.h"
+#include "Trace.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <functional>
+
+namespace Saola
+{
+  // Upper bound of the delay before a new entry of the queue is handled
+  static const unsigned int GRANULARITY_MS = 1000;
+
+  // A failed entry is retried after 2^attempts seconds, up to this
+  // delay: the entries are never dropped, as the replica would miss
+  // them, and the postponed ones do not hold the rest of the queue
+  static const unsigned int MAX_RETRY_DELAY_SECONDS = 3600;
+
+  static unsigned int GetRetryDelay(unsigned int attempts)
+  {
+    return (attempts >= 12 ? MAX_RETRY_DELAY_SECONDS : std::min(MAX_RETRY_DELAY_SECONDS, 1u << attempts));
+  }
+
+  ReplicationWorker::ReplicationWorker(std::shared_ptr<StorageArea> &storageArea)
+      : storageArea_(storageArea), running_(false), stopping_(false), thread_(NULL), lagExceeded_(false),
+        replicatedCount_(0), removedCount_(0), failedCount_(0)
+  {
+    if (storageArea_->GetReplicationQueue() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "[SaolaStorage][Replication] The storage area was created without replication");
+    }
+  }
+
+  ReplicationWorker::~ReplicationWorker()
+  {
+    if (thread_ != NULL)
+    {
+      LOG(ERROR) << "[SaolaStorage][Replication]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  void ReplicationWorker::Apply(const ReplicationDatabase::Entry &entry)
+  {
+    if (entry.operation_ == ReplicationOperation_Remove)
+    {
+      boost::system::error_code err;
+      boost::filesystem::remove(entry.path_, err);
+      if (err)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot remove " + entry.path_ + ": " + err.message());
+      }
+
+      storageArea_->GetDirectoryPruner().Touch(boost::filesystem::path(entry.path_).parent_path().string());
+      removedCount_++;
+      return;
+    }
+
+    // The current location of the payload, as it might have been
+    // relocated by the spool uploader or the tiering worker meanwhile
+    std::string source, replica;
+    if (!storageArea_->LookupPointer(source, entry.uuid_) ||
+        !storageArea_->GetReplicaPath(replica, source))
+    {
+      // Removed meanwhile, or stored outside of the mount directories
+      return;
+    }
+
+    const boost::filesystem::path target(replica);
+
+    Saola::DirectoryPruner::Pin pin(storageArea_->GetDirectoryPruner(), target.parent_path().string());
+    boost::filesystem::create_directories(target.parent_path());
+
+    IOToolbox::CopyFileAtomic(source, replica, SaolaConfiguration::Instance()->GetFsyncPolicy());
+
+    replicatedCount_++;
+  }
+
+  size_t ReplicationWorker::ReplicateBatch(const std::vector<ReplicationDatabase::Entry> &entries)
+  {
+    ReplicationDatabase &queue = *storageArea_->GetReplicationQueue();
+
+    // No failure is counted against the entries while the whole mount is unreachable
+    const bool reachable = boost::filesystem::is_directory(storageArea_->GetReplicaDirectory());
+
+    const size_t threadsCount = std::min<size_t>(std::max(1u, SaolaConfiguration::Instance()->ReplicationThreads()), entries.size());
+
+    std::atomic<size_t> handled(0);
+
+    pool_.Run(threadsCount, [this, &entries, &queue, &handled, reachable, threadsCount](size_t t)
+    {
+      for (size_t i = 0; i < entries.size() && !stopping_; i++)
+      {
+        const ReplicationDatabase::Entry &entry = entries[i];
+
+        if (std::hash<std::string>()(entry.uuid_) % threadsCount != t)
+        {
+          continue;
+        }
+
+        try
+        {
+          Apply(entry);
+          queue.Remove(entry.seq_);
+          handled++;
+          continue;
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Replication] - Cannot replicate attachment " << entry.uuid_ << ": " << ex.What();
+        }
+        catch (std::exception &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Replication] - Cannot replicate attachment " << entry.uuid_ << ": " << ex.what();
+        }
+
+        failedCount_++;
+
+        try
+        {
+          if (reachable)
+          {
+            queue.CountFailure(entry.seq_, GetRetryDelay(entry.attempts_));
+          }
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Replication] - Cannot update the queue: " << ex.What();
+        }
+      }
+    });
+
+    return handled.load();
+  }
+
+  void ReplicationWorker::ReplicatePending()
+  {
+    const unsigned int batchSize = SaolaConfiguration::Instance()->ReplicationBatchSize();
+
+    std::vector<ReplicationDatabase::Entry> entries;
+
+    // Interrupted between two batches by "Stop()", the remaining
+    // entries are applied after the restart
+    while (!stopping_)
+    {
+      storageArea_->GetReplicationQueue()->ListPending(entries, batchSize);
+
+      if (entries.empty() ||
+          ReplicateBatch(entries) == 0)
+      {
+        return;  // Done, or the failed entries are retried later on
+      }
+
+      SAOLA_TRACE(Storage, Verbose) << "[SaolaStorage][Replication] - Applied a batch of " << entries.size() << " entries";
+    }
+  }
+
+  int64_t ReplicationWorker::GetLagSeconds()
+  {
+    int64_t enqueued;
+    if (storageArea_->GetReplicationQueue()->LookupOldest(enqueued))
+    {
+      return std::max<int64_t>(0, static_cast<int64_t>(time(NULL)) - enqueued);
+    }
+    else
+    {
+      return 0;
+    }
+  }
+
+  void ReplicationWorker::PublishMetrics()
+  {
+    const int64_t lag = GetLagSeconds();
+    const bool exceeded = (lag > static_cast<int64_t>(SaolaConfiguration::Instance()->ReplicationMaxLagSeconds()));
+
+    if (exceeded != lagExceeded_.load())
+    {
+      if (exceeded)
+      {
+        LOG(ERROR) << "[SaolaStorage][Replication] - The replica is " << lag << " seconds behind, above Replication.MaxLagSeconds";
+      }
+      else
+      {
+        LOG(WARNING) << "[SaolaStorage][Replication] - The replica caught up";
+      }
+
+      lagExceeded_ = exceeded;
+    }
+
+    OrthancPluginContext *context = OrthancPlugins::GetGlobalContext();
+    if (context != NULL)
+    {
+      OrthancPluginSetMetricsValue(context, "saola_replication_lag_seconds", static_cast<float>(lag), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, "saola_replication_pending",
+                                   static_cast<float>(storageArea_->GetReplicationQueue()->GetSize()), OrthancPluginMetricsType_Default);
+    }
+  }
+
+  void ReplicationWorker::Start()
+  {
+    if (thread_ != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    LOG(WARNING) << "[SaolaStorage][Replication] - Starting the worker, " << storageArea_->GetReplicationQueue()->GetSize()
+                 << " entries pending for " << storageArea_->GetReplicaDirectory();
+
+    running_ = true;
+    stopping_ = false;
+
+    thread_ = new std::thread([this]()
+    {
+      while (running_)
+      {
+        try
+        {
+          ReplicatePending();
+          PublishMetrics();
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Replication] - Error in the worker: " << ex.What();
+        }
+        catch (std::exception &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Replication] - Error in the worker: " << ex.what();
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(GRANULARITY_MS));
+      }
+    });
+  }
+
+  void ReplicationWorker::Stop()
+  {
+    LOG(WARNING) << "[SaolaStorage][Replication] - Stopping the worker";
+
+    running_ = false;
+    stopping_ = true;
+
+    if (thread_ != NULL)
+    {
+      if (thread_->joinable())
+      {
+        thread_->join();
+      }
+
+      delete thread_;
+      thread_ = NULL;
+    }
+
+    pool_.Stop();
+  }
+
+  void ReplicationWorker::GetStatistics(Json::Value &status)
+  {
+    const int64_t lag = GetLagSeconds();
+
+    status["ReplicaDirectory"] = storageArea_->GetReplicaDirectory();
+    status["PendingCount"] = storageArea_->GetReplicationQueue()->GetSize();
+    status["LagSeconds"] = static_cast<Json::Int64>(lag);
+    status["MaxLagSeconds"] = SaolaConfiguration::Instance()->ReplicationMaxLagSeconds();
+    status["LagExceeded"] = (lag > static_cast<int64_t>(SaolaConfiguration::Instance()->ReplicationMaxLagSeconds()));
+    status["ReplicatedCount"] = static_cast<Json::UInt64>(replicatedCount_.load());
+    status["RemovedCount"] = static_cast<Json::UInt64>(removedCount_.load());
+    status["FailedCount"] = static_cast<Json::UInt64>(failedCount_.load());
+    status["ReplicaReadsCount"] = static_cast<Json::UInt64>(storageArea_->GetReplicaReadsCount());
+  }
+}
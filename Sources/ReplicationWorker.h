@@ -0,0 +1,64 @@
+#pragma once
+
+#include "StorageArea.h"
+#include "WorkerPool.h"
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace Saola
+{
+  // Applies the replication queue to the replica mount, in the
+  // background and with "Replication.Threads" parallel copies. The
+  // entries of one attachment always go to the same thread, so that
+  // its copy and its removal are applied in order. The entries are
+  // only removed from the queue once applied: while the replica mount
+  // is unreachable, they pile up and the lag grows, which is reported
+  // by the status route and the "saola_replication_*" metrics. A
+  // failed entry is retried with an exponential backoff.
+  class ReplicationWorker : public boost::noncopyable
+  {
+  private:
+    std::shared_ptr<StorageArea> storageArea_;
+
+    std::atomic<bool> running_;
+    std::atomic<bool> stopping_;  // Interrupts "ReplicatePending()"
+    std::thread *thread_;
+    WorkerPool pool_;  // Runs the copies of a batch
+    std::atomic<bool> lagExceeded_;
+
+    std::atomic<uint64_t> replicatedCount_;
+    std::atomic<uint64_t> removedCount_;
+    std::atomic<uint64_t> failedCount_;
+
+    void Apply(const ReplicationDatabase::Entry &entry);
+
+    // Returns the number of entries removed from the queue
+    size_t ReplicateBatch(const std::vector<ReplicationDatabase::Entry> &entries);
+
+    // Seconds since the oldest pending entry was enqueued, 0 if none
+    int64_t GetLagSeconds();
+
+    void PublishMetrics();
+
+  public:
+    explicit ReplicationWorker(std::shared_ptr<StorageArea> &storageArea);
+
+    ~ReplicationWorker();
+
+    // Applies the pending entries until the queue is empty, until a
+    // batch makes no progress (e.g. unreachable replica mount), or
+    // until "Stop()" is called
+    void ReplicatePending();
+
+    void Start();
+
+    void Stop();
+
+    void GetStatistics(Json::Value &status);
+  };
+}
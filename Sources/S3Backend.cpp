@@ -0,0 +1,602 @@
+#include "S3Backend.h"
+
+#include "Sha256.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  static const char *SCHEME = "s3://";
+  static const char *UNSIGNED_PAYLOAD = "UNSIGNED-PAYLOAD";
+  static const size_t MAX_PARTS = 10000;
+
+
+  // RFC 3986 unreserved characters are kept, as required by SigV4
+  static std::string UriEncode(const std::string &s,
+                               bool keepSlash)
+  {
+    static const char *HEX = "0123456789ABCDEF";
+
+    std::string result;
+    result.reserve(s.size());
+
+    for (size_t i = 0; i < s.size(); i++)
+    {
+      const unsigned char c = static_cast<unsigned char>(s[i]);
+      if ((c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z') ||
+          (c >= '0' && c <= '9') ||
+          c == '-' || c == '_' || c == '.' || c == '~' ||
+          (c == '/' && keepSlash))
+      {
+        result.push_back(static_cast<char>(c));
+      }
+      else
+      {
+        result.push_back('%');
+        result.push_back(HEX[c >> 4]);
+        result.push_back(HEX[c & 0x0f]);
+      }
+    }
+
+    return result;
+  }
+
+
+  // Content of the first "<tag>...</tag>" of an XML answer
+  static bool LookupXmlElement(std::string &value,
+                               const std::string &xml,
+                               const std::string &tag)
+  {
+    const std::string open = "<" + tag + ">";
+    const size_t start = xml.find(open);
+    if (start == std::string::npos)
+    {
+      return false;
+    }
+
+    const size_t end = xml.find("</" + tag + ">", start + open.size());
+    if (end == std::string::npos)
+    {
+      return false;
+    }
+
+    value = xml.substr(start + open.size(), end - start - open.size());
+    return true;
+  }
+
+
+  static void Hmac(uint8_t (&digest)[Sha256::DIGEST_SIZE],
+                   const void *key,
+                   size_t keySize,
+                   const std::string &data)
+  {
+    Sha256::Hmac(digest, key, keySize, data.c_str(), data.size());
+  }
+
+
+  S3Backend::S3Backend(const SaolaConfiguration::ObjectStorageSettings &settings) :
+    pool_(settings.host_, settings.port_, settings.maxConnections_, settings.timeoutSeconds_),
+    putsCount_(0),
+    multipartUploadsCount_(0),
+    partsCount_(0),
+    getsCount_(0),
+    headsCount_(0),
+    deletesCount_(0),
+    uploadedBytes_(0),
+    downloadedBytes_(0),
+    errorsCount_(0)
+  {
+  }
+
+
+  bool S3Backend::IsObjectLocation(const std::string &location)
+  {
+    return location.compare(0, strlen(SCHEME), SCHEME) == 0;
+  }
+
+
+  std::string S3Backend::MakeLocation(const SaolaConfiguration::ObjectStorageSettings &settings,
+                                      const std::string &relative)
+  {
+    return SCHEME + settings.bucket_ + "/" + settings.prefix_ + relative;
+  }
+
+
+  void S3Backend::ParseLocation(std::string &bucket,
+                                std::string &key,
+                                const std::string &location)
+  {
+    const size_t start = strlen(SCHEME);
+    const size_t slash = (IsObjectLocation(location) ? location.find('/', start) : std::string::npos);
+
+    if (slash == std::string::npos ||
+        slash == start ||
+        slash + 1 == location.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "[SaolaStorage] Not an object location: " + location);
+    }
+
+    bucket = location.substr(start, slash - start);
+    key = location.substr(slash + 1);
+  }
+
+
+  void S3Backend::Execute(HttpConnectionPool::Response &response,
+                          const SaolaConfiguration::ObjectStorageSettings &settings,
+                          const std::string &method,
+                          const std::string &bucket,
+                          const std::string &key,
+                          const std::string &query,
+                          const void *body,
+                          size_t bodySize,
+                          const std::string &range,
+                          unsigned int expectedStatus,
+                          void *target,
+                          size_t targetSize)
+  {
+    const std::string uri = "/" + UriEncode(bucket, false) + "/" + UriEncode(key, true);
+    const std::string host = pool_.GetHostHeader();
+
+    char timestamp[32];
+    {
+      const time_t now = time(NULL);
+      struct tm utc;
+      gmtime_r(&now, &utc);
+      strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", &utc);
+    }
+
+    const std::string date(timestamp, 8);
+
+    HttpConnectionPool::Request request;
+    request.method_ = method;
+    request.target_ = (query.empty() ? uri : uri + "?" + query);
+    request.body_ = body;
+    request.bodySize_ = bodySize;
+    request.headers_.push_back(std::make_pair("x-amz-content-sha256", UNSIGNED_PAYLOAD));
+    request.headers_.push_back(std::make_pair("x-amz-date", timestamp));
+
+    if (!range.empty())
+    {
+      request.headers_.push_back(std::make_pair("Range", range));
+    }
+
+    // Without credentials, the bucket must allow anonymous access
+    if (!settings.accessKey_.empty())
+    {
+      static const char *SIGNED_HEADERS = "host;x-amz-content-sha256;x-amz-date";
+
+      const std::string canonicalRequest =
+        method + "\n" +
+        uri + "\n" +
+        query + "\n" +
+        "host:" + host + "\n" +
+        "x-amz-content-sha256:" + UNSIGNED_PAYLOAD + "\n" +
+        "x-amz-date:" + timestamp + "\n" +
+        "\n" +
+        SIGNED_HEADERS + "\n" +
+        UNSIGNED_PAYLOAD;
+
+      const std::string scope = date + "/" + settings.region_ + "/s3/aws4_request";
+      const std::string stringToSign =
+        std::string("AWS4-HMAC-SHA256\n") +
+        timestamp + "\n" +
+        scope + "\n" +
+        Sha256::ComputeHex(canonicalRequest);
+
+      const std::string secret = "AWS4" + settings.secretKey_;
+
+      uint8_t dateKey[Sha256::DIGEST_SIZE], regionKey[Sha256::DIGEST_SIZE], serviceKey[Sha256::DIGEST_SIZE];
+      uint8_t signingKey[Sha256::DIGEST_SIZE], signature[Sha256::DIGEST_SIZE];
+      Hmac(dateKey, secret.c_str(), secret.size(), date);
+      Hmac(regionKey, dateKey, sizeof(dateKey), settings.region_);
+      Hmac(serviceKey, regionKey, sizeof(regionKey), "s3");
+      Hmac(signingKey, serviceKey, sizeof(serviceKey), "aws4_request");
+      Hmac(signature, signingKey, sizeof(signingKey), stringToSign);
+
+      request.headers_.push_back(std::make_pair("Authorization",
+                                                "AWS4-HMAC-SHA256 Credential=" + settings.accessKey_ + "/" + scope +
+                                                ", SignedHeaders=" + SIGNED_HEADERS +
+                                                ", Signature=" + Sha256::ToHex(signature)));
+    }
+
+    try
+    {
+      pool_.Execute(response, request, target, targetSize);
+    }
+    catch (Orthanc::OrthancException &)
+    {
+      errorsCount_++;
+      throw;
+    }
+
+    if (response.status_ != expectedStatus)
+    {
+      if (response.status_ / 100 != 2 &&
+          response.status_ != 404)
+      {
+        errorsCount_++;
+      }
+
+      std::string code;
+      if (!LookupXmlElement(code, response.body_, "Code"))
+      {
+        code = "HTTP status " + boost::lexical_cast<std::string>(response.status_);
+      }
+
+      throw Orthanc::OrthancException(response.status_ == 404 ? Orthanc::ErrorCode_InexistentFile : Orthanc::ErrorCode_NetworkProtocol,
+                                      "[SaolaStorage] " + method + " " + bucket + "/" + key + " failed: " + code);
+    }
+  }
+
+
+  void S3Backend::UploadParts(const SaolaConfiguration::ObjectStorageSettings &settings,
+                              const std::string &bucket,
+                              const std::string &key,
+                              const void *content,
+                              size_t size)
+  {
+    const uint64_t partSize = std::max(settings.partSize_, static_cast<uint64_t>((size + MAX_PARTS - 1) / MAX_PARTS));
+    const size_t partsCount = static_cast<size_t>((size + partSize - 1) / partSize);
+
+    std::string uploadId;
+
+    {
+      HttpConnectionPool::Response response;
+      Execute(response, settings, "POST", bucket, key, "uploads=", NULL, 0, "", 200);
+
+      if (!LookupXmlElement(uploadId, response.body_, "UploadId") ||
+          uploadId.empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "[SaolaStorage] No UploadId in the answer of the object store for " + key);
+      }
+    }
+
+    multipartUploadsCount_++;
+
+    const std::string encodedId = UriEncode(uploadId, false);
+    std::vector<std::string> etags(partsCount);
+
+    try
+    {
+      std::atomic<size_t> next(0);
+      std::atomic<bool> failed(false);
+      std::exception_ptr error;
+      boost::mutex errorMutex;
+
+      // The parts are claimed one after the other by the uploaders
+      auto uploader = [&]()
+      {
+        for (;;)
+        {
+          const size_t part = next++;
+          if (part >= partsCount ||
+              failed.load())
+          {
+            return;
+          }
+
+          try
+          {
+            const uint64_t offset = static_cast<uint64_t>(part) * partSize;
+            const size_t length = static_cast<size_t>(std::min(partSize, static_cast<uint64_t>(size) - offset));
+
+            HttpConnectionPool::Response response;
+            Execute(response, settings, "PUT", bucket, key,
+                    "partNumber=" + boost::lexical_cast<std::string>(part + 1) + "&uploadId=" + encodedId,
+                    reinterpret_cast<const uint8_t *>(content) + offset, length, "", 200);
+
+            if (!response.LookupHeader(etags[part], "ETag"))
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                              "[SaolaStorage] No ETag in the answer of the object store for a part of " + key);
+            }
+
+            partsCount_++;
+            uploadedBytes_ += length;
+          }
+          catch (...)
+          {
+            boost::mutex::scoped_lock lock(errorMutex);
+            if (!failed.exchange(true))
+            {
+              error = std::current_exception();
+            }
+            return;
+          }
+        }
+      };
+
+      const size_t threadsCount = std::min(static_cast<size_t>(settings.threads_), partsCount);
+
+      std::vector<std::thread> threads;
+      for (size_t i = 1; i < threadsCount; i++)
+      {
+        threads.push_back(std::thread(uploader));
+      }
+
+      uploader();
+
+      for (size_t i = 0; i < threads.size(); i++)
+      {
+        threads[i].join();
+      }
+
+      if (failed.load())
+      {
+        std::rethrow_exception(error);
+      }
+
+      std::string xml = "<CompleteMultipartUpload>";
+      for (size_t i = 0; i < partsCount; i++)
+      {
+        xml += "<Part><PartNumber>" + boost::lexical_cast<std::string>(i + 1) + "</PartNumber><ETag>" + etags[i] + "</ETag></Part>";
+      }
+      xml += "</CompleteMultipartUpload>";
+
+      // The completion can fail with a 200 status, the error being in the body
+      HttpConnectionPool::Response response;
+      Execute(response, settings, "POST", bucket, key, "uploadId=" + encodedId, xml.c_str(), xml.size(), "", 200);
+
+      if (response.body_.find("<Error>") != std::string::npos)
+      {
+        std::string code;
+        LookupXmlElement(code, response.body_, "Code");
+        errorsCount_++;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "[SaolaStorage] Cannot complete the upload of " + key + ": " + code);
+      }
+    }
+    catch (...)
+    {
+      try
+      {
+        HttpConnectionPool::Response response;
+        Execute(response, settings, "DELETE", bucket, key, "uploadId=" + encodedId, NULL, 0, "", 204);
+      }
+      catch (Orthanc::OrthancException &e)
+      {
+        LOG(WARNING) << "[SaolaStorage] Cannot abort the upload of " << key << ": " << e.What();
+      }
+
+      throw;
+    }
+  }
+
+
+  void S3Backend::Write(const std::string &location,
+                        const void *content,
+                        size_t size)
+  {
+    const SaolaConfiguration::ObjectStorageSettings settings = SaolaConfiguration::Instance()->GetObjectStorage();
+
+    std::string bucket, key;
+    ParseLocation(bucket, key, location);
+
+    // The object only becomes visible once complete, in both cases
+    if (size < settings.multipartThreshold_)
+    {
+      HttpConnectionPool::Response response;
+      Execute(response, settings, "PUT", bucket, key, "", content, size, "", 200);
+      putsCount_++;
+      uploadedBytes_ += size;
+    }
+    else
+    {
+      UploadParts(settings, bucket, key, content, size);
+    }
+  }
+
+
+  uint64_t S3Backend::GetSize(const std::string &location)
+  {
+    const SaolaConfiguration::ObjectStorageSettings settings = SaolaConfiguration::Instance()->GetObjectStorage();
+
+    std::string bucket, key;
+    ParseLocation(bucket, key, location);
+
+    HttpConnectionPool::Response response;
+    Execute(response, settings, "HEAD", bucket, key, "", NULL, 0, "", 200);
+    headsCount_++;
+
+    std::string length;
+    if (response.LookupHeader(length, "Content-Length"))
+    {
+      try
+      {
+        return boost::lexical_cast<uint64_t>(length);
+      }
+      catch (boost::bad_lexical_cast &)
+      {
+      }
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "[SaolaStorage] No size in the answer of the object store for " + key);
+  }
+
+
+  void S3Backend::ReadChunk(const SaolaConfiguration::ObjectStorageSettings &settings,
+                            void *target,
+                            size_t size,
+                            const std::string &bucket,
+                            const std::string &key,
+                            uint64_t offset)
+  {
+    HttpConnectionPool::Response response;
+    try
+    {
+      Execute(response, settings, "GET", bucket, key, "", NULL, 0,
+              "bytes=" + boost::lexical_cast<std::string>(offset) + "-" + boost::lexical_cast<std::string>(offset + size - 1),
+              206, target, size);
+    }
+    catch (Orthanc::OrthancException &)
+    {
+      // A store may ignore a range that covers the whole object
+      if (response.status_ != 200 ||
+          offset != 0)
+      {
+        throw;
+      }
+    }
+
+    getsCount_++;
+    downloadedBytes_ += response.bodySize_;
+
+    if (response.bodySize_ != size)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile,
+                                      "[SaolaStorage] Truncated object in the object store: " + key);
+    }
+  }
+
+
+  void S3Backend::ReadRange(void *target,
+                            size_t size,
+                            const std::string &location,
+                            uint64_t offset)
+  {
+    if (size == 0)
+    {
+      return;
+    }
+
+    const SaolaConfiguration::ObjectStorageSettings settings = SaolaConfiguration::Instance()->GetObjectStorage();
+
+    std::string bucket, key;
+    ParseLocation(bucket, key, location);
+
+    const uint64_t chunkSize = settings.partSize_;
+
+    if (settings.threads_ <= 1 ||
+        size < 2 * chunkSize)
+    {
+      ReadChunk(settings, target, size, bucket, key, offset);
+      return;
+    }
+
+    // Parallel ranged GETs, each over its own connection
+    const size_t chunksCount = static_cast<size_t>((size + chunkSize - 1) / chunkSize);
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    boost::mutex errorMutex;
+
+    auto reader = [&]()
+    {
+      for (;;)
+      {
+        const size_t chunk = next++;
+        if (chunk >= chunksCount ||
+            failed.load())
+        {
+          return;
+        }
+
+        try
+        {
+          const uint64_t start = static_cast<uint64_t>(chunk) * chunkSize;
+          const size_t length = static_cast<size_t>(std::min(chunkSize, static_cast<uint64_t>(size) - start));
+          ReadChunk(settings, reinterpret_cast<uint8_t *>(target) + start, length, bucket, key, offset + start);
+        }
+        catch (...)
+        {
+          boost::mutex::scoped_lock lock(errorMutex);
+          if (!failed.exchange(true))
+          {
+            error = std::current_exception();
+          }
+          return;
+        }
+      }
+    };
+
+    const size_t threadsCount = std::min(static_cast<size_t>(settings.threads_), chunksCount);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadsCount; i++)
+    {
+      threads.push_back(std::thread(reader));
+    }
+
+    reader();
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      threads[i].join();
+    }
+
+    if (failed.load())
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+
+  void S3Backend::ReadWhole(std::string &target,
+                            const std::string &location)
+  {
+    const uint64_t size = GetSize(location);
+    target.resize(static_cast<size_t>(size));
+
+    if (size > 0)
+    {
+      ReadRange(&target[0], target.size(), location, 0);
+    }
+  }
+
+
+  void S3Backend::Remove(const std::string &location)
+  {
+    const SaolaConfiguration::ObjectStorageSettings settings = SaolaConfiguration::Instance()->GetObjectStorage();
+
+    std::string bucket, key;
+    ParseLocation(bucket, key, location);
+
+    HttpConnectionPool::Response response;
+    try
+    {
+      Execute(response, settings, "DELETE", bucket, key, "", NULL, 0, "", 204);
+    }
+    catch (Orthanc::OrthancException &)
+    {
+      // Some stores answer "200 OK", and a missing object is not an error
+      if (response.status_ != 200 &&
+          response.status_ != 404)
+      {
+        throw;
+      }
+    }
+
+    deletesCount_++;
+  }
+
+
+  void S3Backend::GetStatistics(Json::Value &status)
+  {
+    status["Puts"] = static_cast<Json::UInt64>(putsCount_.load());
+    status["MultipartUploads"] = static_cast<Json::UInt64>(multipartUploadsCount_.load());
+    status["Parts"] = static_cast<Json::UInt64>(partsCount_.load());
+    status["Gets"] = static_cast<Json::UInt64>(getsCount_.load());
+    status["Heads"] = static_cast<Json::UInt64>(headsCount_.load());
+    status["Deletes"] = static_cast<Json::UInt64>(deletesCount_.load());
+    status["UploadedBytes"] = static_cast<Json::UInt64>(uploadedBytes_.load());
+    status["DownloadedBytes"] = static_cast<Json::UInt64>(downloadedBytes_.load());
+    status["Errors"] = static_cast<Json::UInt64>(errorsCount_.load());
+    pool_.GetStatistics(status["Connections"]);
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "HttpConnectionPool.h"
+#include "IStorageBackend.h"
+#include "SaolaConfiguration.h"
+
+#include <json/value.h>
+
+#include <atomic>
+
+namespace Saola
+{
+  // Payloads in an S3-compatible object store (AWS S3, MinIO, Ceph
+  // RGW...), located by "s3://<bucket>/<key>" in their pointers. The
+  // requests are signed with AWS Signature Version 4 and go through a
+  // pool of kept-alive connections. The large payloads are uploaded
+  // in parts, and read by parallel ranged GETs of the same size.
+  //
+  // The endpoint and the pool are fixed at startup. The other settings
+  // (credentials, bucket, thresholds...) are read from the current
+  // configuration snapshot on each call.
+  class S3Backend : public IStorageBackend
+  {
+  private:
+    HttpConnectionPool  pool_;
+
+    std::atomic<uint64_t>  putsCount_;
+    std::atomic<uint64_t>  multipartUploadsCount_;
+    std::atomic<uint64_t>  partsCount_;
+    std::atomic<uint64_t>  getsCount_;
+    std::atomic<uint64_t>  headsCount_;
+    std::atomic<uint64_t>  deletesCount_;
+    std::atomic<uint64_t>  uploadedBytes_;
+    std::atomic<uint64_t>  downloadedBytes_;
+    std::atomic<uint64_t>  errorsCount_;
+
+    // Signs and sends one request, throws if the status is not "expectedStatus"
+    void Execute(HttpConnectionPool::Response &response,
+                 const SaolaConfiguration::ObjectStorageSettings &settings,
+                 const std::string &method,
+                 const std::string &bucket,
+                 const std::string &key,
+                 const std::string &query,
+                 const void *body,
+                 size_t bodySize,
+                 const std::string &range,
+                 unsigned int expectedStatus,
+                 void *target = NULL,
+                 size_t targetSize = 0);
+
+    void UploadParts(const SaolaConfiguration::ObjectStorageSettings &settings,
+                     const std::string &bucket,
+                     const std::string &key,
+                     const void *content,
+                     size_t size);
+
+    void ReadChunk(const SaolaConfiguration::ObjectStorageSettings &settings,
+                   void *target,
+                   size_t size,
+                   const std::string &bucket,
+                   const std::string &key,
+                   uint64_t offset);
+
+  public:
+    explicit S3Backend(const SaolaConfiguration::ObjectStorageSettings &settings);
+
+    static bool IsObjectLocation(const std::string &location);
+
+    // "s3://<Bucket>/<Prefix><relative>"
+    static std::string MakeLocation(const SaolaConfiguration::ObjectStorageSettings &settings,
+                                    const std::string &relative);
+
+    // Throws "ErrorCode_ParameterOutOfRange" if "location" is not an object location
+    static void ParseLocation(std::string &bucket,
+                              std::string &key,
+                              const std::string &location);
+
+    virtual bool IsOwner(const std::string &location) const
+    {
+      return IsObjectLocation(location);
+    }
+
+    virtual void Write(const std::string &location,
+                       const void *content,
+                       size_t size);
+
+    virtual uint64_t GetSize(const std::string &location);
+
+    virtual void ReadWhole(std::string &target,
+                           const std::string &location);
+
+    virtual void ReadRange(void *target,
+                           size_t size,
+                           const std::string &location,
+                           uint64_t offset);
+
+    virtual void Remove(const std::string &location);
+
+    void GetStatistics(Json::Value &status);
+  };
+}
@@ -1,24 +1,109 @@
 #include "SaolaConfiguration.h"
+#include "Trace.h"
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
 #include <Toolbox.h>
 #include <Logging.h>
+#include <OrthancException.h>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
 
 static const char *ENABLE = "Enable";
 static const char *ROOT = "Root";
 static const char *FILTER_INCOMING_DICOM_INSTANCE = "FilterIncomingDicomInstance";
 static const char *DELAYED_DELETION = "DelayedDeletion";
+static const char *TIERING = "Tiering";
+static const char *DIRECT_WRITE = "DirectWrite";
+static const char *CAPTURE = "Capture";
+static const char *DURABILITY = "Durability";
+static const char *SCRUBBER = "Scrubber";
+static const char *CHECKSUM = "Checksum";
+static const char *PRUNER = "Pruner";
+static const char *DISK_SPACE = "DiskSpace";
+static const char *IO_URING = "IOUring";
+static const char *OBJECT_STORAGE = "ObjectStorage";
+static const char *SPOOL = "Spool";
+static const char *REPLICATION = "Replication";
+static const char *LEGACY_INDEX = "LegacyIndex";
+static const char *ROUTING = "Routing";
+static const char *TRACE = "Trace";
 static const char *SAOLA_STORAGE = "SaolaStorage";
 static const char *MOUNT_DIRECTORY = "MountDirectory";
 static const char *STORAGE_PATH_FORMAT = "StoragePathFormat";
 
-SaolaConfiguration::SaolaConfiguration(/* args */)
+// Content types of the attachments, as received by the storage callbacks
+static Orthanc::FileContentType StringToContentType(const std::string &value)
+{
+  if (boost::iequals(value, "Dicom"))
+  {
+    return Orthanc::FileContentType_Dicom;
+  }
+  else if (boost::iequals(value, "DicomAsJson"))
+  {
+    return Orthanc::FileContentType_DicomAsJson;
+  }
+  else if (boost::iequals(value, "DicomUntilPixelData"))
+  {
+    return Orthanc::FileContentType_DicomUntilPixelData;
+  }
+  else if (boost::iequals(value, "Unknown"))
+  {
+    return Orthanc::FileContentType_Unknown;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown content type (must be \"Dicom\", \"DicomAsJson\", \"DicomUntilPixelData\" or \"Unknown\"): " + value);
+  }
+}
+
+static const char *ContentTypeToString(Orthanc::FileContentType type)
+{
+  switch (type)
+  {
+    case Orthanc::FileContentType_Dicom:
+      return "Dicom";
+
+    case Orthanc::FileContentType_DicomAsJson:
+      return "DicomAsJson";
+
+    case Orthanc::FileContentType_DicomUntilPixelData:
+      return "DicomUntilPixelData";
+
+    default:
+      return "Unknown";
+  }
+}
+
+SaolaConfiguration::SaolaConfiguration(const Json::Value &section,
+                                       const std::string &storageDirectory,
+                                       const std::string &databaseServerIdentifier) :
+  section_(section),
+  storageDirectory_(storageDirectory),
+  databaseServerIdentifier_(databaseServerIdentifier)
 {
-  OrthancPlugins::OrthancConfiguration orthancConfig;
-  OrthancPlugins::OrthancConfiguration saola, delayedDeletionConfig;
-  orthancConfig.GetSection(saola, SAOLA_STORAGE);
+  OrthancPlugins::OrthancConfiguration saola(section, SAOLA_STORAGE);
+  OrthancPlugins::OrthancConfiguration delayedDeletionConfig, tieringConfig, directWriteConfig, captureConfig, durabilityConfig, scrubberConfig, checksumConfig, prunerConfig, diskSpaceConfig, ioUringConfig, objectStorageConfig, spoolConfig, replicationConfig, legacyIndexConfig;
   saola.GetSection(delayedDeletionConfig, DELAYED_DELETION);
+  saola.GetSection(tieringConfig, TIERING);
+  saola.GetSection(directWriteConfig, DIRECT_WRITE);
+  saola.GetSection(captureConfig, CAPTURE);
+  saola.GetSection(durabilityConfig, DURABILITY);
+  saola.GetSection(scrubberConfig, SCRUBBER);
+  saola.GetSection(checksumConfig, CHECKSUM);
+  saola.GetSection(prunerConfig, PRUNER);
+  saola.GetSection(diskSpaceConfig, DISK_SPACE);
+  saola.GetSection(ioUringConfig, IO_URING);
+  saola.GetSection(objectStorageConfig, OBJECT_STORAGE);
+  saola.GetSection(spoolConfig, SPOOL);
+  saola.GetSection(replicationConfig, REPLICATION);
+  saola.GetSection(legacyIndexConfig, LEGACY_INDEX);
 
   this->enable_ = saola.GetBooleanValue(ENABLE, false);
 
@@ -28,23 +113,373 @@ SaolaConfiguration::SaolaConfiguration(/* args */)
 
   this->storagePathFormat_ = saola.GetStringValue(STORAGE_PATH_FORMAT, "FULL");
 
+  this->maxRetry_ = saola.GetIntegerValue("MaxRetry", 5);
+
   this->filterIncomingDicomInstance_ = saola.GetBooleanValue(FILTER_INCOMING_DICOM_INSTANCE, false);
 
+  if (saola.GetJson().isMember(ROUTING))
+  {
+    const Json::Value &routing = saola.GetJson()[ROUTING];
+    if (routing.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Routing must be a list of rules");
+    }
+
+    for (Json::ArrayIndex i = 0; i < routing.size(); i++)
+    {
+      const Json::Value &rule = routing[i];
+      if (rule.type() != Json::objectValue ||
+          !rule.isMember(MOUNT_DIRECTORY) ||
+          rule[MOUNT_DIRECTORY].type() != Json::stringValue ||
+          rule[MOUNT_DIRECTORY].asString().empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Each routing rule must have a MountDirectory");
+      }
+
+      RoutingRule r;
+      r.anyContentType_ = !rule.isMember("ContentType");
+      r.contentType_ = (r.anyContentType_ ? Orthanc::FileContentType_Unknown : StringToContentType(rule["ContentType"].asString()));
+      r.minSize_ = (rule.isMember("MinSizeKB") ? rule["MinSizeKB"].asUInt64() * 1024 : 0);
+      r.maxSize_ = (rule.isMember("MaxSizeKB") ? rule["MaxSizeKB"].asUInt64() * 1024 : 0);
+      r.mountDirectory_ = rule[MOUNT_DIRECTORY].asString();
+
+      if (r.maxSize_ != 0 && r.maxSize_ <= r.minSize_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The routing rule to " + r.mountDirectory_ + " matches no size");
+      }
+
+      this->routingRules_.push_back(r);
+    }
+  }
+
   this->delayedDeletionEnable_ = delayedDeletionConfig.GetBooleanValue(ENABLE, false);
   this->delayedDeletionThrottleDelayMs_ = delayedDeletionConfig.GetIntegerValue("ThrottleDelayMs", 0);
 
-  const char *databaseServerIdentifier_ = OrthancPluginGetDatabaseServerIdentifier(OrthancPlugins::GetGlobalContext());
-  std::string pathStorage = orthancConfig.GetStringValue("StorageDirectory", "OrthancStorage");
-  LOG(WARNING) << "DelayedDeletion - Path to the storage area: " << pathStorage;
+  const std::string &pathStorage = storageDirectory_;
   boost::filesystem::path defaultDbPath = boost::filesystem::path(pathStorage) / (std::string("pending-deletions.") + databaseServerIdentifier_ + ".db");
   this->delayedDeletionPath_ = delayedDeletionConfig.GetStringValue("Path", defaultDbPath.string());
-  LOG(WARNING) << "DelayedDeletion - Path to the SQLite database: " << this->delayedDeletionPath_;
+
+  this->delayedDeletionAgingSeconds_ = delayedDeletionConfig.GetUnsignedIntegerValue("AgingSeconds", 3600);
+  this->delayedDeletionBatchSize_ = std::max(1u, delayedDeletionConfig.GetUnsignedIntegerValue("BatchSize", 256));
+
+  this->delayedDeletionSharedQueue_ = delayedDeletionConfig.GetBooleanValue("SharedQueue", false);
+  this->delayedDeletionLeaseSeconds_ = std::max(1u, delayedDeletionConfig.GetUnsignedIntegerValue("LeaseSeconds", 300));
+
+  if (this->delayedDeletionSharedQueue_ &&
+      !delayedDeletionConfig.GetJson().isMember("Path"))
+  {
+    // The default path is specific to each node
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "DelayedDeletion.SharedQueue requires DelayedDeletion.Path on the shared filesystem");
+  }
+
+  if (delayedDeletionConfig.GetJson().isMember("Priorities"))
+  {
+    const Json::Value &priorities = delayedDeletionConfig.GetJson()["Priorities"];
+    if (priorities.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "DelayedDeletion.Priorities must map content types to priorities");
+    }
+
+    const Json::Value::Members members = priorities.getMemberNames();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      if (!priorities[members[i]].isInt())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The priority of the deletions of \"" + members[i] + "\" must be an integer");
+      }
+
+      this->delayedDeletionPriorities_[StringToContentType(members[i])] = priorities[members[i]].asInt();
+    }
+  }
+
+  this->tieringEnable_ = tieringConfig.GetBooleanValue(ENABLE, false);
+  this->coldMountDirectory_ = tieringConfig.GetStringValue("ColdMountDirectory", "");
+  this->tieringColdAfterDays_ = tieringConfig.GetIntegerValue("ColdAfterDays", 90);
+  this->tieringPromoteOnAccess_ = tieringConfig.GetBooleanValue("PromoteOnAccess", false);
+  this->tieringThreads_ = tieringConfig.GetIntegerValue("Threads", 4);
+  this->tieringBatchSize_ = tieringConfig.GetIntegerValue("BatchSize", 100);
+  this->tieringIntervalSeconds_ = tieringConfig.GetIntegerValue("IntervalSeconds", 3600);
+
+  boost::filesystem::path defaultTieringPath = boost::filesystem::path(pathStorage) / (std::string("tiering.") + databaseServerIdentifier_ + ".db");
+  this->tieringPath_ = tieringConfig.GetStringValue("Path", defaultTieringPath.string());
+
+  this->directWriteEnable_ = directWriteConfig.GetBooleanValue(ENABLE, false);
+  this->directWriteThreshold_ = static_cast<uint64_t>(directWriteConfig.GetUnsignedIntegerValue("ThresholdMB", 64)) * 1024 * 1024;
+
+  this->captureEnable_ = captureConfig.GetBooleanValue(ENABLE, false);
+  this->captureBufferSize_ = captureConfig.GetUnsignedIntegerValue("BufferSize", 65536);
+
+  boost::filesystem::path defaultCapturePath = boost::filesystem::path(pathStorage) / (std::string("capture.") + databaseServerIdentifier_ + ".trace");
+  this->capturePath_ = captureConfig.GetStringValue("Path", defaultCapturePath.string());
+
+  this->fsyncPolicy_ = Saola::IOToolbox::StringToFsyncPolicy(durabilityConfig.GetStringValue("Fsync", "Data"));
+  this->cleanupOnStartup_ = durabilityConfig.GetBooleanValue("CleanupOnStartup", true);
+  this->cleanupThreads_ = durabilityConfig.GetIntegerValue("CleanupThreads", 4);
+
+  this->scrubberThreads_ = scrubberConfig.GetIntegerValue("Threads", 4);
+  this->scrubberMaxFilesPerSecond_ = scrubberConfig.GetUnsignedIntegerValue("MaxFilesPerSecond", 0);
+  this->scrubberMaxMBPerSecond_ = scrubberConfig.GetUnsignedIntegerValue("MaxMBPerSecond", 0);
+  std::list<std::string> additionalMountDirectories;
+  scrubberConfig.LookupListOfStrings(additionalMountDirectories, "AdditionalMountDirectories", true);
+  this->scrubberAdditionalMountDirectories_.assign(additionalMountDirectories.begin(), additionalMountDirectories.end());
+
+  boost::filesystem::path defaultCheckpointPath = boost::filesystem::path(pathStorage) / (std::string("scrub-checkpoint.") + databaseServerIdentifier_ + ".json");
+  this->scrubberCheckpointPath_ = scrubberConfig.GetStringValue("CheckpointPath", defaultCheckpointPath.string());
+
+  boost::filesystem::path defaultReportPath = boost::filesystem::path(pathStorage) / (std::string("scrub-report.") + databaseServerIdentifier_ + ".txt");
+  this->scrubberReportPath_ = scrubberConfig.GetStringValue("ReportPath", defaultReportPath.string());
+
+  this->checksumEnable_ = checksumConfig.GetBooleanValue(ENABLE, true);
+  this->checksumVerification_ = Saola::IOToolbox::StringToChecksumVerification(checksumConfig.GetStringValue("Verify", "Sampled"));
+  this->checksumSampleEvery_ = std::max(1u, checksumConfig.GetUnsignedIntegerValue("SampleEvery", 100));
+
+  this->prunerIntervalSeconds_ = prunerConfig.GetUnsignedIntegerValue("IntervalSeconds", 60);
+  this->prunerGraceSeconds_ = prunerConfig.GetUnsignedIntegerValue("GraceSeconds", 30);
+
+  this->diskSpaceEnable_ = diskSpaceConfig.GetBooleanValue(ENABLE, true);
+  this->diskSpaceHighWaterPercent_ = std::min(100u, diskSpaceConfig.GetUnsignedIntegerValue("HighWaterPercent", 95));
+  this->diskSpaceLowWaterPercent_ = std::min(this->diskSpaceHighWaterPercent_,
+                                             diskSpaceConfig.GetUnsignedIntegerValue("LowWaterPercent", this->diskSpaceHighWaterPercent_ > 2 ? this->diskSpaceHighWaterPercent_ - 2 : 0));
+  this->diskSpaceMinFreeBytes_ = static_cast<uint64_t>(diskSpaceConfig.GetUnsignedIntegerValue("MinFreeMB", 0)) * 1024 * 1024;
+  this->diskSpaceRefreshSeconds_ = std::max(1u, diskSpaceConfig.GetUnsignedIntegerValue("RefreshSeconds", 5));
+  this->diskFullPolicy_ = Saola::IOToolbox::StringToDiskFullPolicy(diskSpaceConfig.GetStringValue("OnFull", "Reject"));
+  this->overflowMountDirectory_ = diskSpaceConfig.GetStringValue("OverflowMountDirectory", "");
+
+  if (this->diskFullPolicy_ == Saola::IOToolbox::DiskFullPolicy_Redirect &&
+      this->overflowMountDirectory_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "DiskSpace.OnFull is \"Redirect\", but no OverflowMountDirectory is configured");
+  }
+
+  this->ioUringEnable_ = ioUringConfig.GetBooleanValue(ENABLE, true);
+
+  this->objectStorage_.enable_ = objectStorageConfig.GetBooleanValue(ENABLE, false);
+  this->objectStorage_.endpoint_ = objectStorageConfig.GetStringValue("Endpoint", "http://127.0.0.1:9000");
+  this->objectStorage_.bucket_ = objectStorageConfig.GetStringValue("Bucket", "orthanc");
+  this->objectStorage_.region_ = objectStorageConfig.GetStringValue("Region", "us-east-1");
+  this->objectStorage_.accessKey_ = objectStorageConfig.GetStringValue("AccessKey", "");
+  this->objectStorage_.secretKey_ = objectStorageConfig.GetStringValue("SecretKey", "");
+  this->objectStorage_.prefix_ = objectStorageConfig.GetStringValue("Prefix", "");
+  this->objectStorage_.multipartThreshold_ = static_cast<uint64_t>(std::max(1u, objectStorageConfig.GetUnsignedIntegerValue("MultipartThresholdMB", 16))) * 1024 * 1024;
+  this->objectStorage_.partSize_ = static_cast<uint64_t>(std::max(1u, objectStorageConfig.GetUnsignedIntegerValue("PartSizeMB", 8))) * 1024 * 1024;
+  this->objectStorage_.threads_ = std::max(1u, objectStorageConfig.GetUnsignedIntegerValue("Threads", 4));
+  this->objectStorage_.maxConnections_ = std::max(1u, objectStorageConfig.GetUnsignedIntegerValue("MaxConnections", 16));
+  this->objectStorage_.timeoutSeconds_ = std::max(1u, objectStorageConfig.GetUnsignedIntegerValue("TimeoutSeconds", 60));
+  this->objectStorage_.allowInsecure_ = objectStorageConfig.GetBooleanValue("AllowInsecure", false);
+
+  {
+    // "http://host[:port]": the plugin only speaks plain HTTP, a remote
+    // store must be reached through a local TLS proxy (e.g. stunnel)
+    const std::string &endpoint = this->objectStorage_.endpoint_;
+    const size_t start = (boost::istarts_with(endpoint, "http://") ? 7 : std::string::npos);
+    const size_t end = (start == std::string::npos ? std::string::npos : endpoint.find('/', start));
+    const std::string authority = (start == std::string::npos ? "" : endpoint.substr(start, end == std::string::npos ? std::string::npos : end - start));
+    const size_t colon = authority.rfind(':');
+
+    unsigned int port = 80;
+    if (colon != std::string::npos)
+    {
+      try
+      {
+        port = boost::lexical_cast<unsigned int>(authority.substr(colon + 1));
+      }
+      catch (boost::bad_lexical_cast &)
+      {
+        port = 0;
+      }
+    }
+
+    if (authority.empty() ||
+        colon == 0 ||
+        port == 0 ||
+        port > 65535 ||
+        (end != std::string::npos && end + 1 != endpoint.size()))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "ObjectStorage.Endpoint must be \"http://host[:port]\", not: " + endpoint);
+    }
+
+    this->objectStorage_.host_ = authority.substr(0, colon);
+    this->objectStorage_.port_ = static_cast<uint16_t>(port);
+
+    // The requests carry the signed credentials and the payloads in clear
+    const std::string &host = this->objectStorage_.host_;
+    const bool loopback = (boost::iequals(host, "localhost") ||
+                           boost::starts_with(host, "127.") ||
+                           host == "[::1]");
+
+    if (this->objectStorage_.enable_ &&
+        !loopback &&
+        !this->objectStorage_.allowInsecure_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "ObjectStorage.Endpoint is not a loopback address, but the object store is reached over plain HTTP: "
+                                      "use a local TLS proxy, or set ObjectStorage.AllowInsecure to true on a trusted network");
+    }
+  }
+
+  if (this->objectStorage_.bucket_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "ObjectStorage.Bucket cannot be empty");
+  }
+
+  this->spoolEnable_ = spoolConfig.GetBooleanValue(ENABLE, false);
+  this->spoolDirectory_ = spoolConfig.GetStringValue("Directory", "");
+  this->spoolThreads_ = std::max(1u, spoolConfig.GetUnsignedIntegerValue("Threads", 4));
+  this->spoolBatchSize_ = std::max(1u, spoolConfig.GetUnsignedIntegerValue("BatchSize", 100));
+
+  boost::filesystem::path defaultSpoolPath = boost::filesystem::path(pathStorage) / (std::string("spool.") + databaseServerIdentifier_ + ".db");
+  this->spoolPath_ = spoolConfig.GetStringValue("Path", defaultSpoolPath.string());
+
+  if (this->spoolEnable_ &&
+      this->spoolDirectory_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Spool.Directory cannot be empty if the spool is enabled");
+  }
+
+  this->replicationEnable_ = replicationConfig.GetBooleanValue(ENABLE, false);
+  this->replicaMountDirectory_ = replicationConfig.GetStringValue(MOUNT_DIRECTORY, "");
+  this->replicationThreads_ = std::max(1u, replicationConfig.GetUnsignedIntegerValue("Threads", 4));
+  this->replicationBatchSize_ = std::max(1u, replicationConfig.GetUnsignedIntegerValue("BatchSize", 100));
+  this->replicationMaxLagSeconds_ = replicationConfig.GetUnsignedIntegerValue("MaxLagSeconds", 300);
+  this->replicationHedgedReads_ = replicationConfig.GetBooleanValue("HedgedReads", false);
+  this->replicationHedgedReadsPercentile_ = std::min(99u, std::max(50u, replicationConfig.GetUnsignedIntegerValue("HedgedReadsPercentile", 95)));
+  this->replicationHedgedReadsMinDelayMs_ = replicationConfig.GetUnsignedIntegerValue("HedgedReadsMinDelayMs", 5);
+  this->replicationHedgedReadsMaxDelayMs_ = std::max(this->replicationHedgedReadsMinDelayMs_,
+                                                     replicationConfig.GetUnsignedIntegerValue("HedgedReadsMaxDelayMs", 1000));
+  this->replicationHedgedReadsThreads_ = std::max(1u, replicationConfig.GetUnsignedIntegerValue("HedgedReadsThreads", 16));
+
+  boost::filesystem::path defaultReplicationPath = boost::filesystem::path(pathStorage) / (std::string("replication.") + databaseServerIdentifier_ + ".db");
+  this->replicationPath_ = replicationConfig.GetStringValue("Path", defaultReplicationPath.string());
+
+  if (this->replicationEnable_ &&
+      this->replicaMountDirectory_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Replication.MountDirectory cannot be empty if the replication is enabled");
+  }
+
+  this->legacyIndexEnable_ = legacyIndexConfig.GetBooleanValue(ENABLE, false);
+  this->legacyIndexThreads_ = std::max(1u, legacyIndexConfig.GetUnsignedIntegerValue("Threads", 4));
+
+  boost::filesystem::path defaultLegacyIndexPath = boost::filesystem::path(pathStorage) / "legacy-index.bin";
+  this->legacyIndexPath_ = legacyIndexConfig.GetStringValue("Path", defaultLegacyIndexPath.string());
 }
 
-SaolaConfiguration &SaolaConfiguration::Instance()
+static boost::mutex snapshotsMutex_;  // Serializes the publications
+static std::shared_ptr<const SaolaConfiguration> current_;  // Only accessed through "std::atomic_load()" and "std::atomic_store()"
+
+// Settings only read when the workers are created
+static const char *const RESTART_ONLY[][2] = {
+  { NULL, ENABLE },
+  { NULL, ROOT },
+  { DELAYED_DELETION, ENABLE },
+  { DELAYED_DELETION, "Path" },
+  { DELAYED_DELETION, "AgingSeconds" },
+  { DELAYED_DELETION, "SharedQueue" },
+  { TIERING, ENABLE },
+  { TIERING, "Path" },
+  { TIERING, "Threads" },
+  { CAPTURE, ENABLE },
+  { CAPTURE, "Path" },
+  { CAPTURE, "BufferSize" },
+  { DURABILITY, "CleanupOnStartup" },
+  { DURABILITY, "CleanupThreads" },
+  { PRUNER, "IntervalSeconds" },
+  { PRUNER, "GraceSeconds" },
+  { DISK_SPACE, ENABLE },
+  { DISK_SPACE, "RefreshSeconds" },
+  { OBJECT_STORAGE, "Endpoint" },
+  { OBJECT_STORAGE, "AllowInsecure" },
+  { OBJECT_STORAGE, "MaxConnections" },
+  { OBJECT_STORAGE, "TimeoutSeconds" },
+  { SPOOL, ENABLE },
+  { SPOOL, "Directory" },
+  { SPOOL, "Path" },
+  { REPLICATION, ENABLE },
+  { REPLICATION, "MountDirectory" },
+  { REPLICATION, "Path" },
+  { REPLICATION, "HedgedReadsThreads" },
+  { LEGACY_INDEX, ENABLE },
+  { LEGACY_INDEX, "Path" }
+};
+
+static void MergeJson(Json::Value &target,
+                      const Json::Value &source)
 {
-  static SaolaConfiguration configuration_;
-  return configuration_;
+  const Json::Value::Members members = source.getMemberNames();
+  for (size_t i = 0; i < members.size(); i++)
+  {
+    if (target.isMember(members[i]) &&
+        target[members[i]].type() == Json::objectValue &&
+        source[members[i]].type() == Json::objectValue)
+    {
+      MergeJson(target[members[i]], source[members[i]]);
+    }
+    else
+    {
+      target[members[i]] = source[members[i]];
+    }
+  }
+}
+
+std::shared_ptr<const SaolaConfiguration> SaolaConfiguration::Instance()
+{
+  std::shared_ptr<const SaolaConfiguration> current = std::atomic_load(&current_);
+
+  if (current.get() == NULL)
+  {
+    boost::mutex::scoped_lock lock(snapshotsMutex_);
+
+    current = std::atomic_load(&current_);
+    if (current.get() == NULL)
+    {
+      OrthancPlugins::OrthancConfiguration orthancConfig;
+      OrthancPlugins::OrthancConfiguration saola;
+      orthancConfig.GetSection(saola, SAOLA_STORAGE);
+
+      current.reset(new SaolaConfiguration(saola.GetJson(),
+                                           orthancConfig.GetStringValue("StorageDirectory", "OrthancStorage"),
+                                           OrthancPluginGetDatabaseServerIdentifier(OrthancPlugins::GetGlobalContext())));
+
+      if (saola.GetJson().isMember(TRACE))
+      {
+        Saola::Trace::Configure(saola.GetJson()[TRACE]);
+      }
+
+      current->LogPaths();
+      std::atomic_store(&current_, current);
+    }
+  }
+
+  return current;
+}
+
+void SaolaConfiguration::LogPaths() const
+{
+  LOG(WARNING) << "DelayedDeletion - Path to the storage area: " << storageDirectory_;
+  LOG(WARNING) << "DelayedDeletion - Path to the SQLite database: " << this->delayedDeletionPath_;
+
+  if (this->tieringEnable_)
+  {
+    LOG(WARNING) << "Tiering - Cold mount directory: " << this->coldMountDirectory_ << ", path to the SQLite database: " << this->tieringPath_;
+  }
+
+  if (this->spoolEnable_)
+  {
+    LOG(WARNING) << "Spool - Staging directory: " << this->spoolDirectory_ << ", path to the SQLite journal: " << this->spoolPath_;
+  }
+
+  if (this->replicationEnable_)
+  {
+    LOG(WARNING) << "Replication - Replica mount directory: " << this->replicaMountDirectory_ << ", path to the SQLite queue: " << this->replicationPath_;
+  }
 }
 
 bool SaolaConfiguration::IsEnabled() const
@@ -67,6 +502,48 @@ const std::string &SaolaConfiguration::GetMountDirectory() const
   return this->mountDirectory_;
 }
 
+const std::string &SaolaConfiguration::ResolveMountDirectory(Orthanc::FileContentType type,
+                                                            uint64_t size) const
+{
+  for (size_t i = 0; i < this->routingRules_.size(); i++)
+  {
+    const RoutingRule &rule = this->routingRules_[i];
+
+    if ((rule.anyContentType_ || rule.contentType_ == type) &&
+        size >= rule.minSize_ &&
+        (rule.maxSize_ == 0 || size < rule.maxSize_))
+    {
+      return rule.mountDirectory_;
+    }
+  }
+
+  return this->mountDirectory_;
+}
+
+const std::vector<SaolaConfiguration::RoutingRule> &SaolaConfiguration::GetRoutingRules() const
+{
+  return this->routingRules_;
+}
+
+void SaolaConfiguration::GetWritableMountDirectories(std::vector<std::string> &target) const
+{
+  target.clear();
+  target.push_back(this->mountDirectory_);
+
+  for (size_t i = 0; i < this->routingRules_.size(); i++)
+  {
+    target.push_back(this->routingRules_[i].mountDirectory_);
+  }
+
+  if (!this->overflowMountDirectory_.empty())
+  {
+    target.push_back(this->overflowMountDirectory_);
+  }
+
+  std::sort(target.begin(), target.end());
+  target.erase(std::unique(target.begin(), target.end()), target.end());
+}
+
 bool SaolaConfiguration::DelayedDeletionEnable() const
 {
   return this->delayedDeletionEnable_;
@@ -87,38 +564,348 @@ const std::string &SaolaConfiguration::DelayedDeletionPath() const
   return this->delayedDeletionPath_;
 }
 
+unsigned int SaolaConfiguration::DelayedDeletionAgingSeconds() const
+{
+  return this->delayedDeletionAgingSeconds_;
+}
+
+unsigned int SaolaConfiguration::DelayedDeletionBatchSize() const
+{
+  return this->delayedDeletionBatchSize_;
+}
+
+bool SaolaConfiguration::DelayedDeletionSharedQueue() const
+{
+  return this->delayedDeletionSharedQueue_;
+}
+
+unsigned int SaolaConfiguration::DelayedDeletionLeaseSeconds() const
+{
+  return this->delayedDeletionLeaseSeconds_;
+}
+
+int SaolaConfiguration::DelayedDeletionPriority(Orthanc::FileContentType type) const
+{
+  std::map<Orthanc::FileContentType, int>::const_iterator found = this->delayedDeletionPriorities_.find(type);
+  return (found == this->delayedDeletionPriorities_.end() ? 0 : found->second);
+}
+
+bool SaolaConfiguration::TieringEnable() const
+{
+  return this->tieringEnable_;
+}
+
+const std::string &SaolaConfiguration::GetColdMountDirectory() const
+{
+  return this->coldMountDirectory_;
+}
+
+int SaolaConfiguration::TieringColdAfterDays() const
+{
+  return this->tieringColdAfterDays_;
+}
+
+bool SaolaConfiguration::TieringPromoteOnAccess() const
+{
+  return this->tieringPromoteOnAccess_;
+}
+
+int SaolaConfiguration::TieringThreads() const
+{
+  return this->tieringThreads_;
+}
+
+int SaolaConfiguration::TieringBatchSize() const
+{
+  return this->tieringBatchSize_;
+}
+
+int SaolaConfiguration::TieringIntervalSeconds() const
+{
+  return this->tieringIntervalSeconds_;
+}
+
+const std::string &SaolaConfiguration::TieringPath() const
+{
+  return this->tieringPath_;
+}
+
+bool SaolaConfiguration::DirectWriteEnable() const
+{
+  return this->directWriteEnable_;
+}
+
+uint64_t SaolaConfiguration::DirectWriteThreshold() const
+{
+  return this->directWriteThreshold_;
+}
+
+bool SaolaConfiguration::CaptureEnable() const
+{
+  return this->captureEnable_;
+}
+
+const std::string &SaolaConfiguration::CapturePath() const
+{
+  return this->capturePath_;
+}
+
+unsigned int SaolaConfiguration::CaptureBufferSize() const
+{
+  return this->captureBufferSize_;
+}
+
+Saola::IOToolbox::FsyncPolicy SaolaConfiguration::GetFsyncPolicy() const
+{
+  return this->fsyncPolicy_;
+}
+
+bool SaolaConfiguration::CleanupOnStartup() const
+{
+  return this->cleanupOnStartup_;
+}
+
+int SaolaConfiguration::CleanupThreads() const
+{
+  return this->cleanupThreads_;
+}
+
+int SaolaConfiguration::ScrubberThreads() const
+{
+  return this->scrubberThreads_;
+}
+
+unsigned int SaolaConfiguration::ScrubberMaxFilesPerSecond() const
+{
+  return this->scrubberMaxFilesPerSecond_;
+}
+
+unsigned int SaolaConfiguration::ScrubberMaxMBPerSecond() const
+{
+  return this->scrubberMaxMBPerSecond_;
+}
+
+const std::vector<std::string> &SaolaConfiguration::ScrubberAdditionalMountDirectories() const
+{
+  return this->scrubberAdditionalMountDirectories_;
+}
+
+const std::string &SaolaConfiguration::ScrubberCheckpointPath() const
+{
+  return this->scrubberCheckpointPath_;
+}
+
+const std::string &SaolaConfiguration::ScrubberReportPath() const
+{
+  return this->scrubberReportPath_;
+}
+
+unsigned int SaolaConfiguration::PrunerIntervalSeconds() const
+{
+  return this->prunerIntervalSeconds_;
+}
+
+unsigned int SaolaConfiguration::PrunerGraceSeconds() const
+{
+  return this->prunerGraceSeconds_;
+}
+
+bool SaolaConfiguration::ChecksumEnable() const
+{
+  return this->checksumEnable_;
+}
+
+Saola::IOToolbox::ChecksumVerification SaolaConfiguration::GetChecksumVerification() const
+{
+  return this->checksumVerification_;
+}
+
+unsigned int SaolaConfiguration::ChecksumSampleEvery() const
+{
+  return this->checksumSampleEvery_;
+}
+
+bool SaolaConfiguration::DiskSpaceEnable() const
+{
+  return this->diskSpaceEnable_;
+}
+
+unsigned int SaolaConfiguration::DiskSpaceHighWaterPercent() const
+{
+  return this->diskSpaceHighWaterPercent_;
+}
+
+unsigned int SaolaConfiguration::DiskSpaceLowWaterPercent() const
+{
+  return this->diskSpaceLowWaterPercent_;
+}
+
+bool SaolaConfiguration::IOUringEnable() const
+{
+  return this->ioUringEnable_;
+}
+
+const SaolaConfiguration::ObjectStorageSettings& SaolaConfiguration::GetObjectStorage() const
+{
+  return this->objectStorage_;
+}
+
+bool SaolaConfiguration::SpoolEnable() const
+{
+  return this->spoolEnable_;
+}
+
+const std::string& SaolaConfiguration::GetSpoolDirectory() const
+{
+  return this->spoolDirectory_;
+}
+
+const std::string& SaolaConfiguration::SpoolPath() const
+{
+  return this->spoolPath_;
+}
+
+unsigned int SaolaConfiguration::SpoolThreads() const
+{
+  return this->spoolThreads_;
+}
+
+unsigned int SaolaConfiguration::SpoolBatchSize() const
+{
+  return this->spoolBatchSize_;
+}
+
+bool SaolaConfiguration::ReplicationEnable() const
+{
+  return this->replicationEnable_;
+}
+
+const std::string& SaolaConfiguration::GetReplicaMountDirectory() const
+{
+  return this->replicaMountDirectory_;
+}
+
+const std::string& SaolaConfiguration::ReplicationPath() const
+{
+  return this->replicationPath_;
+}
+
+unsigned int SaolaConfiguration::ReplicationThreads() const
+{
+  return this->replicationThreads_;
+}
+
+unsigned int SaolaConfiguration::ReplicationBatchSize() const
+{
+  return this->replicationBatchSize_;
+}
+
+unsigned int SaolaConfiguration::ReplicationMaxLagSeconds() const
+{
+  return this->replicationMaxLagSeconds_;
+}
+
+bool SaolaConfiguration::ReplicationHedgedReads() const
+{
+  return this->replicationHedgedReads_;
+}
+
+unsigned int SaolaConfiguration::ReplicationHedgedReadsPercentile() const
+{
+  return this->replicationHedgedReadsPercentile_;
+}
+
+unsigned int SaolaConfiguration::ReplicationHedgedReadsMinDelayMs() const
+{
+  return this->replicationHedgedReadsMinDelayMs_;
+}
+
+unsigned int SaolaConfiguration::ReplicationHedgedReadsMaxDelayMs() const
+{
+  return this->replicationHedgedReadsMaxDelayMs_;
+}
+
+unsigned int SaolaConfiguration::ReplicationHedgedReadsThreads() const
+{
+  return this->replicationHedgedReadsThreads_;
+}
+
+bool SaolaConfiguration::LegacyIndexEnable() const
+{
+  return this->legacyIndexEnable_;
+}
+
+const std::string& SaolaConfiguration::LegacyIndexPath() const
+{
+  return this->legacyIndexPath_;
+}
+
+unsigned int SaolaConfiguration::LegacyIndexThreads() const
+{
+  return this->legacyIndexThreads_;
+}
+
+uint64_t SaolaConfiguration::DiskSpaceMinFreeBytes() const
+{
+  return this->diskSpaceMinFreeBytes_;
+}
+
+unsigned int SaolaConfiguration::DiskSpaceRefreshSeconds() const
+{
+  return this->diskSpaceRefreshSeconds_;
+}
+
+Saola::IOToolbox::DiskFullPolicy SaolaConfiguration::GetDiskFullPolicy() const
+{
+  return this->diskFullPolicy_;
+}
+
+const std::string& SaolaConfiguration::GetOverflowMountDirectory() const
+{
+  return this->overflowMountDirectory_;
+}
+
 void SaolaConfiguration::ApplyConfiguration(const Json::Value& config)
 {
-  if (config.isMember("MountDirectory"))
-  {
-    this->mountDirectory_ = config["MountDirectory"].asString();
-  }
-  if (config.isMember("StoragePathFormat"))
+  Instance();  // Loads the initial snapshot if needed
+
+  boost::mutex::scoped_lock lock(snapshotsMutex_);
+
+  const std::shared_ptr<const SaolaConfiguration> previous = std::atomic_load(&current_);
+  const SaolaConfiguration &current = *previous;
+
+  Json::Value section = current.section_;
+  MergeJson(section, config);
+
+  // Throws before publishing anything if the new settings are invalid
+  std::shared_ptr<const SaolaConfiguration> next(
+    new SaolaConfiguration(section, current.storageDirectory_, current.databaseServerIdentifier_));
+
+  Json::Value before, after;
+  current.ToJson(before);
+  next->ToJson(after);
+
+  for (size_t i = 0; i < sizeof(RESTART_ONLY) / sizeof(RESTART_ONLY[0]); i++)
   {
-    this->storagePathFormat_ = config["StoragePathFormat"].asString();
+    const char *parent = RESTART_ONLY[i][0];
+    const char *key = RESTART_ONLY[i][1];
+
+    const Json::Value &a = (parent == NULL ? before : before[parent]);
+    const Json::Value &b = (parent == NULL ? after : after[parent]);
+
+    if (a[key] != b[key])
+    {
+      LOG(WARNING) << "[SaolaStorage] The new value of " << (parent == NULL ? "" : std::string(parent) + ".") << key
+                   << " only takes effect after a restart";
+    }
   }
-  if (config.isMember("MaxRetry"))
+
+  if (config.isMember(TRACE))
   {
-    this->maxRetry_ = config["MaxRetry"].asInt();
+    Saola::Trace::Configure(config[TRACE]);
   }
-  // if (config.isMember("DelayedDeletion"))
-  // {
-  //   const Json::Value& delayDeletionConfig = config["DelayedDeletion"];
-  //   if (delayDeletionConfig.isMember("Enable"))
-  //   {
-  //     this->delayedDeletionEnable_ = delayDeletionConfig["Enable"].asBool();
-
-  //   }
-  //   if (delayDeletionConfig.isMember("ThrottleDelayMs"))
-  //   {
-  //     this->delayedDeletionThrottleDelayMs_ = delayDeletionConfig["ThrottleDelayMs"].asInt();
 
-  //   }
-  //   if (delayDeletionConfig.isMember("Path"))
-  //   {
-  //     this->delayedDeletionPath_ = delayDeletionConfig["Path"].asString();
-  //   }
-  // }
+  std::atomic_store(&current_, next);
 }
 
 void SaolaConfiguration::ToJson(Json::Value &json) const
@@ -126,11 +913,126 @@ void SaolaConfiguration::ToJson(Json::Value &json) const
   json["Enable"] = this->enable_;
   json["MountDirectory"] = this->mountDirectory_;
   json["StoragePathFormat"] = this->storagePathFormat_;
-  json["MaxRetry"] = 5;
+  json["Routing"] = Json::arrayValue;
+  for (size_t i = 0; i < this->routingRules_.size(); i++)
+  {
+    const RoutingRule &rule = this->routingRules_[i];
+
+    Json::Value item = Json::objectValue;
+    if (!rule.anyContentType_)
+    {
+      item["ContentType"] = ContentTypeToString(rule.contentType_);
+    }
+    item["MinSizeKB"] = static_cast<Json::UInt64>(rule.minSize_ / 1024);
+    item["MaxSizeKB"] = static_cast<Json::UInt64>(rule.maxSize_ / 1024);
+    item["MountDirectory"] = rule.mountDirectory_;
+    json["Routing"].append(item);
+  }
+  json["MaxRetry"] = this->maxRetry_;
   json["DelayedDeletion"] = Json::objectValue;
   json["DelayedDeletion"]["Enable"] = this->delayedDeletionEnable_;
   json["DelayedDeletion"]["ThrottleDelayMs"] = this->delayedDeletionThrottleDelayMs_;
   json["DelayedDeletion"]["Path"] = this->delayedDeletionPath_;
+  json["DelayedDeletion"]["AgingSeconds"] = this->delayedDeletionAgingSeconds_;
+  json["DelayedDeletion"]["BatchSize"] = this->delayedDeletionBatchSize_;
+  json["DelayedDeletion"]["SharedQueue"] = this->delayedDeletionSharedQueue_;
+  json["DelayedDeletion"]["LeaseSeconds"] = this->delayedDeletionLeaseSeconds_;
+  json["DelayedDeletion"]["Priorities"] = Json::objectValue;
+  for (std::map<Orthanc::FileContentType, int>::const_iterator it = this->delayedDeletionPriorities_.begin();
+       it != this->delayedDeletionPriorities_.end(); ++it)
+  {
+    json["DelayedDeletion"]["Priorities"][ContentTypeToString(it->first)] = it->second;
+  }
+  json["Tiering"] = Json::objectValue;
+  json["Tiering"]["Enable"] = this->tieringEnable_;
+  json["Tiering"]["ColdMountDirectory"] = this->coldMountDirectory_;
+  json["Tiering"]["ColdAfterDays"] = this->tieringColdAfterDays_;
+  json["Tiering"]["PromoteOnAccess"] = this->tieringPromoteOnAccess_;
+  json["Tiering"]["Threads"] = this->tieringThreads_;
+  json["Tiering"]["BatchSize"] = this->tieringBatchSize_;
+  json["Tiering"]["IntervalSeconds"] = this->tieringIntervalSeconds_;
+  json["Tiering"]["Path"] = this->tieringPath_;
+  json["DirectWrite"] = Json::objectValue;
+  json["DirectWrite"]["Enable"] = this->directWriteEnable_;
+  json["DirectWrite"]["ThresholdMB"] = static_cast<Json::UInt64>(this->directWriteThreshold_ / (1024 * 1024));
+  json["Capture"] = Json::objectValue;
+  json["Capture"]["Enable"] = this->captureEnable_;
+  json["Capture"]["Path"] = this->capturePath_;
+  json["Capture"]["BufferSize"] = this->captureBufferSize_;
+  json["Durability"] = Json::objectValue;
+  json["Durability"]["Fsync"] = Saola::IOToolbox::EnumerationToString(this->fsyncPolicy_);
+  json["Durability"]["CleanupOnStartup"] = this->cleanupOnStartup_;
+  json["Durability"]["CleanupThreads"] = this->cleanupThreads_;
+  json["Scrubber"] = Json::objectValue;
+  json["Scrubber"]["Threads"] = this->scrubberThreads_;
+  json["Scrubber"]["MaxFilesPerSecond"] = this->scrubberMaxFilesPerSecond_;
+  json["Scrubber"]["MaxMBPerSecond"] = this->scrubberMaxMBPerSecond_;
+  json["Scrubber"]["AdditionalMountDirectories"] = Json::arrayValue;
+  for (size_t i = 0; i < this->scrubberAdditionalMountDirectories_.size(); i++)
+  {
+    json["Scrubber"]["AdditionalMountDirectories"].append(this->scrubberAdditionalMountDirectories_[i]);
+  }
+  json["Scrubber"]["CheckpointPath"] = this->scrubberCheckpointPath_;
+  json["Scrubber"]["ReportPath"] = this->scrubberReportPath_;
+  json["Pruner"] = Json::objectValue;
+  json["Pruner"]["IntervalSeconds"] = this->prunerIntervalSeconds_;
+  json["Pruner"]["GraceSeconds"] = this->prunerGraceSeconds_;
+  json["Checksum"] = Json::objectValue;
+  json["Checksum"]["Enable"] = this->checksumEnable_;
+  json["Checksum"]["Verify"] = Saola::IOToolbox::EnumerationToString(this->checksumVerification_);
+  json["Checksum"]["SampleEvery"] = this->checksumSampleEvery_;
+  json["DiskSpace"] = Json::objectValue;
+  json["DiskSpace"]["Enable"] = this->diskSpaceEnable_;
+  json["DiskSpace"]["HighWaterPercent"] = this->diskSpaceHighWaterPercent_;
+  json["DiskSpace"]["LowWaterPercent"] = this->diskSpaceLowWaterPercent_;
+  json["DiskSpace"]["MinFreeMB"] = static_cast<Json::UInt64>(this->diskSpaceMinFreeBytes_ / (1024 * 1024));
+  json["DiskSpace"]["RefreshSeconds"] = this->diskSpaceRefreshSeconds_;
+  json["DiskSpace"]["OnFull"] = Saola::IOToolbox::EnumerationToString(this->diskFullPolicy_);
+  json["DiskSpace"]["OverflowMountDirectory"] = this->overflowMountDirectory_;
+
+  json["IOUring"] = Json::objectValue;
+  json["IOUring"]["Enable"] = this->ioUringEnable_;
+
+  json["ObjectStorage"] = Json::objectValue;
+  json["ObjectStorage"]["Enable"] = this->objectStorage_.enable_;
+  json["ObjectStorage"]["Endpoint"] = this->objectStorage_.endpoint_;
+  json["ObjectStorage"]["Bucket"] = this->objectStorage_.bucket_;
+  json["ObjectStorage"]["Region"] = this->objectStorage_.region_;
+  json["ObjectStorage"]["AccessKey"] = this->objectStorage_.accessKey_;
+  json["ObjectStorage"]["SecretKey"] = (this->objectStorage_.secretKey_.empty() ? "" : "********");
+  json["ObjectStorage"]["Prefix"] = this->objectStorage_.prefix_;
+  json["ObjectStorage"]["MultipartThresholdMB"] = static_cast<Json::UInt64>(this->objectStorage_.multipartThreshold_ / (1024 * 1024));
+  json["ObjectStorage"]["PartSizeMB"] = static_cast<Json::UInt64>(this->objectStorage_.partSize_ / (1024 * 1024));
+  json["ObjectStorage"]["Threads"] = this->objectStorage_.threads_;
+  json["ObjectStorage"]["MaxConnections"] = this->objectStorage_.maxConnections_;
+  json["ObjectStorage"]["TimeoutSeconds"] = this->objectStorage_.timeoutSeconds_;
+  json["ObjectStorage"]["AllowInsecure"] = this->objectStorage_.allowInsecure_;
+
+  json["Spool"] = Json::objectValue;
+  json["Spool"]["Enable"] = this->spoolEnable_;
+  json["Spool"]["Directory"] = this->spoolDirectory_;
+  json["Spool"]["Path"] = this->spoolPath_;
+  json["Spool"]["Threads"] = this->spoolThreads_;
+  json["Spool"]["BatchSize"] = this->spoolBatchSize_;
+
+  json["Replication"] = Json::objectValue;
+  json["Replication"]["Enable"] = this->replicationEnable_;
+  json["Replication"]["MountDirectory"] = this->replicaMountDirectory_;
+  json["Replication"]["Path"] = this->replicationPath_;
+  json["Replication"]["Threads"] = this->replicationThreads_;
+  json["Replication"]["BatchSize"] = this->replicationBatchSize_;
+  json["Replication"]["MaxLagSeconds"] = this->replicationMaxLagSeconds_;
+  json["Replication"]["HedgedReads"] = this->replicationHedgedReads_;
+  json["Replication"]["HedgedReadsPercentile"] = this->replicationHedgedReadsPercentile_;
+  json["Replication"]["HedgedReadsMinDelayMs"] = this->replicationHedgedReadsMinDelayMs_;
+  json["Replication"]["HedgedReadsMaxDelayMs"] = this->replicationHedgedReadsMaxDelayMs_;
+  json["Replication"]["HedgedReadsThreads"] = this->replicationHedgedReadsThreads_;
+
+  json["LegacyIndex"] = Json::objectValue;
+  json["LegacyIndex"]["Enable"] = this->legacyIndexEnable_;
+  json["LegacyIndex"]["Path"] = this->legacyIndexPath_;
+  json["LegacyIndex"]["Threads"] = this->legacyIndexThreads_;
+  Saola::Trace::ToJson(json["Trace"]);
 }
 
 const std::string SaolaConfiguration::ToJsonString() const
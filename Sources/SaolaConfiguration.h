@@ -1,12 +1,67 @@
 #pragma once
 
+#include "IOToolbox.h"
+
+#include <Enumerations.h>
 #include <json/value.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
+// The configuration is published as immutable snapshots. "Instance()"
+// returns the current snapshot, and a reload parses a whole new
+// snapshot, then swaps it atomically: the readers see either the
+// previous or the next configuration, never a mix of both. A caller
+// needing several consistent settings, or a reference into a snapshot,
+// keeps the returned pointer: the previous snapshot is freed once its
+// last reader releases it.
 class SaolaConfiguration
 {
+public:
+  // Sends the attachments of one content type, optionally restricted
+  // to a band of sizes, to their own mount directory (e.g. the small
+  // and frequently read metadata on flash)
+  struct RoutingRule
+  {
+    bool                      anyContentType_;
+    Orthanc::FileContentType  contentType_;
+    uint64_t                  minSize_;
+    uint64_t                  maxSize_;  // Exclusive, 0 means no upper bound
+    std::string               mountDirectory_;
+  };
+
+  // S3-compatible object store receiving the new payloads (see
+  // "Saola::S3Backend"), their pointers stay below StorageDirectory
+  struct ObjectStorageSettings
+  {
+    bool          enable_;
+    std::string   endpoint_;
+    std::string   host_;
+    uint16_t      port_;
+    std::string   bucket_;
+    std::string   region_;
+    std::string   accessKey_;
+    std::string   secretKey_;
+    std::string   prefix_;
+    uint64_t      multipartThreshold_;  // Larger payloads are uploaded in parts
+    uint64_t      partSize_;            // Also the size of the parallel ranged reads
+    unsigned int  threads_;             // Parts uploaded or read in parallel by one call
+    unsigned int  maxConnections_;      // Idle connections kept in the pool
+    unsigned int  timeoutSeconds_;
+    bool          allowInsecure_;       // Plain HTTP to a non-loopback endpoint
+  };
+
 private:
 
+  // The "SaolaStorage" section this snapshot was parsed from, on top of which the reloads are applied
+  Json::Value section_;
+
+  std::string storageDirectory_;
+
+  std::string databaseServerIdentifier_;
+
   bool enable_;
 
   int maxRetry_ = 5;
@@ -25,11 +80,114 @@ private:
 
   std::string delayedDeletionPath_;
 
-  SaolaConfiguration(/* args */);
+  unsigned int delayedDeletionAgingSeconds_ = 3600;
+
+  unsigned int delayedDeletionBatchSize_ = 256;
+
+  bool delayedDeletionSharedQueue_ = false;
+
+  unsigned int delayedDeletionLeaseSeconds_ = 300;
+
+  std::map<Orthanc::FileContentType, int> delayedDeletionPriorities_;
+
+  bool tieringEnable_;
+
+  std::string coldMountDirectory_;
+
+  int tieringColdAfterDays_ = 90;
+
+  bool tieringPromoteOnAccess_;
+
+  int tieringThreads_ = 4;
+
+  int tieringBatchSize_ = 100;
+
+  int tieringIntervalSeconds_ = 3600;
+
+  std::string tieringPath_;
+
+  bool directWriteEnable_;
+
+  uint64_t directWriteThreshold_;
+
+  bool captureEnable_;
+
+  std::string capturePath_;
+
+  unsigned int captureBufferSize_ = 65536;
+
+  Saola::IOToolbox::FsyncPolicy fsyncPolicy_;
+
+  bool cleanupOnStartup_;
+
+  int cleanupThreads_ = 4;
+
+  int scrubberThreads_ = 4;
+
+  unsigned int scrubberMaxFilesPerSecond_ = 0;
+
+  unsigned int scrubberMaxMBPerSecond_ = 0;
+
+  std::vector<std::string> scrubberAdditionalMountDirectories_;
+
+  std::string scrubberCheckpointPath_;
+
+  std::string scrubberReportPath_;
+
+  unsigned int prunerIntervalSeconds_ = 60;
+
+  unsigned int prunerGraceSeconds_ = 30;
+
+  bool checksumEnable_;
+  Saola::IOToolbox::ChecksumVerification checksumVerification_;
+  unsigned int checksumSampleEvery_ = 100;
+
+  bool diskSpaceEnable_;
+  unsigned int diskSpaceHighWaterPercent_ = 95;
+  unsigned int diskSpaceLowWaterPercent_ = 93;
+  uint64_t diskSpaceMinFreeBytes_ = 0;
+  unsigned int diskSpaceRefreshSeconds_ = 5;
+  Saola::IOToolbox::DiskFullPolicy diskFullPolicy_;
+  std::string overflowMountDirectory_;  // Receives the new attachments while the mount directory is full
+
+  std::vector<RoutingRule> routingRules_;
+
+  bool ioUringEnable_;  // Only effective if the plugin is built with ENABLE_IO_URING
+
+  ObjectStorageSettings objectStorage_;
+
+  bool spoolEnable_;
+  std::string spoolDirectory_;  // Local SSD staging the new attachments before the mount directory
+  std::string spoolPath_;       // SQLite journal of the staged attachments
+  unsigned int spoolThreads_ = 4;
+  unsigned int spoolBatchSize_ = 100;
+
+  bool replicationEnable_;
+  std::string replicaMountDirectory_;  // Asynchronous mirror of the mount directories
+  std::string replicationPath_;        // SQLite queue of the pending copies and removals
+  unsigned int replicationThreads_ = 4;
+  unsigned int replicationBatchSize_ = 100;
+  unsigned int replicationMaxLagSeconds_ = 300;
+  bool replicationHedgedReads_;
+  unsigned int replicationHedgedReadsPercentile_ = 95;
+  unsigned int replicationHedgedReadsMinDelayMs_ = 5;
+  unsigned int replicationHedgedReadsMaxDelayMs_ = 1000;
+  unsigned int replicationHedgedReadsThreads_ = 16;
+
+  bool legacyIndexEnable_;
+  std::string legacyIndexPath_;  // Saved index of the attachments without pointer
+  unsigned int legacyIndexThreads_ = 4;
+
+  SaolaConfiguration(const Json::Value& section,
+                     const std::string& storageDirectory,
+                     const std::string& databaseServerIdentifier);
+
+  // Only at the first load, not on each reload of the configuration
+  void LogPaths() const;
 
 public:
 
-  static SaolaConfiguration& Instance();
+  static std::shared_ptr<const SaolaConfiguration> Instance();
 
   bool IsEnabled() const;
 
@@ -39,6 +197,15 @@ public:
 
   const std::string& GetMountDirectory() const;
 
+  // First routing rule matching the attachment, or the default mount directory
+  const std::string& ResolveMountDirectory(Orthanc::FileContentType type,
+                                           uint64_t size) const;
+
+  const std::vector<RoutingRule>& GetRoutingRules() const;
+
+  // The default, routing and overflow mount directories, without duplicates
+  void GetWritableMountDirectories(std::vector<std::string>& target) const;
+
   bool DelayedDeletionEnable() const;
 
   bool FilterIncomingDicomInstance() const;
@@ -47,7 +214,139 @@ public:
 
   const std::string& DelayedDeletionPath() const;
 
-  void ApplyConfiguration(const Json::Value& config);
+  unsigned int DelayedDeletionAgingSeconds() const;
+
+  unsigned int DelayedDeletionBatchSize() const;
+
+  // The queue is drained by all the nodes sharing "DelayedDeletion.Path"
+  bool DelayedDeletionSharedQueue() const;
+
+  unsigned int DelayedDeletionLeaseSeconds() const;
+
+  // Priority of the deletion of the attachments of this type (higher is more urgent)
+  int DelayedDeletionPriority(Orthanc::FileContentType type) const;
+
+  bool TieringEnable() const;
+
+  const std::string& GetColdMountDirectory() const;
+
+  int TieringColdAfterDays() const;
+
+  bool TieringPromoteOnAccess() const;
+
+  int TieringThreads() const;
+
+  int TieringBatchSize() const;
+
+  int TieringIntervalSeconds() const;
+
+  const std::string& TieringPath() const;
+
+  bool DirectWriteEnable() const;
+
+  uint64_t DirectWriteThreshold() const;
+
+  bool CaptureEnable() const;
+
+  const std::string& CapturePath() const;
+
+  unsigned int CaptureBufferSize() const;
+
+  Saola::IOToolbox::FsyncPolicy GetFsyncPolicy() const;
+
+  bool CleanupOnStartup() const;
+
+  int CleanupThreads() const;
+
+  int ScrubberThreads() const;
+
+  unsigned int ScrubberMaxFilesPerSecond() const;
+
+  unsigned int ScrubberMaxMBPerSecond() const;
+
+  const std::vector<std::string>& ScrubberAdditionalMountDirectories() const;
+
+  const std::string& ScrubberCheckpointPath() const;
+
+  const std::string& ScrubberReportPath() const;
+
+  unsigned int PrunerIntervalSeconds() const;
+
+  unsigned int PrunerGraceSeconds() const;
+
+  bool ChecksumEnable() const;
+
+  Saola::IOToolbox::ChecksumVerification GetChecksumVerification() const;
+
+  unsigned int ChecksumSampleEvery() const;
+
+  bool DiskSpaceEnable() const;
+
+  unsigned int DiskSpaceHighWaterPercent() const;
+
+  unsigned int DiskSpaceLowWaterPercent() const;
+
+  uint64_t DiskSpaceMinFreeBytes() const;
+
+  unsigned int DiskSpaceRefreshSeconds() const;
+
+  Saola::IOToolbox::DiskFullPolicy GetDiskFullPolicy() const;
+
+  const std::string& GetOverflowMountDirectory() const;
+
+  bool IOUringEnable() const;
+
+  const ObjectStorageSettings& GetObjectStorage() const;
+
+  bool SpoolEnable() const;
+
+  const std::string& GetSpoolDirectory() const;
+
+  const std::string& SpoolPath() const;
+
+  unsigned int SpoolThreads() const;
+
+  unsigned int SpoolBatchSize() const;
+
+  bool ReplicationEnable() const;
+
+  const std::string& GetReplicaMountDirectory() const;
+
+  const std::string& ReplicationPath() const;
+
+  unsigned int ReplicationThreads() const;
+
+  unsigned int ReplicationBatchSize() const;
+
+  // Above this lag, "/replication/status" and the metrics report the replica as lagging
+  unsigned int ReplicationMaxLagSeconds() const;
+
+  // Also reads the replica if the primary mount has not answered
+  // within the "HedgedReadsPercentile" of its recent read latencies,
+  // bounded by "HedgedReadsMinDelayMs" and "HedgedReadsMaxDelayMs"
+  bool ReplicationHedgedReads() const;
+
+  unsigned int ReplicationHedgedReadsPercentile() const;
+
+  unsigned int ReplicationHedgedReadsMinDelayMs() const;
+
+  unsigned int ReplicationHedgedReadsMaxDelayMs() const;
+
+  // Size of the pool running the hedged reads: beyond it, the reads are not hedged
+  unsigned int ReplicationHedgedReadsThreads() const;
+
+  // Skips the lookup of the ".symlink" pointer of the attachments
+  // written before the plugin was enabled, cf. "LegacyIndex"
+  bool LegacyIndexEnable() const;
+
+  const std::string& LegacyIndexPath() const;
+
+  unsigned int LegacyIndexThreads() const;
+
+  // Publishes a new snapshot made of the current settings, overridden
+  // by those of "config". If "config" is invalid, throws and keeps the
+  // current snapshot.
+  static void ApplyConfiguration(const Json::Value& config);
 
   void ToJson(Json::Value& value) const;
 
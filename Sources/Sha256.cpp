@@ -0,0 +1,219 @@
+#include "Sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Saola
+{
+  namespace Sha256
+  {
+    static const size_t BLOCK_SIZE = 64;
+
+    static const uint32_t K[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    static inline uint32_t Rotate(uint32_t x,
+                                  unsigned int n)
+    {
+      return (x >> n) | (x << (32 - n));
+    }
+
+    class Context
+    {
+    private:
+      uint32_t  state_[8];
+      uint8_t   block_[BLOCK_SIZE];
+      size_t    blockSize_;
+      uint64_t  length_;
+
+      void Transform(const uint8_t *block)
+      {
+        uint32_t w[64];
+        for (unsigned int i = 0; i < 16; i++)
+        {
+          w[i] = ((static_cast<uint32_t>(block[4 * i]) << 24) |
+                  (static_cast<uint32_t>(block[4 * i + 1]) << 16) |
+                  (static_cast<uint32_t>(block[4 * i + 2]) << 8) |
+                  static_cast<uint32_t>(block[4 * i + 3]));
+        }
+
+        for (unsigned int i = 16; i < 64; i++)
+        {
+          const uint32_t s0 = Rotate(w[i - 15], 7) ^ Rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+          const uint32_t s1 = Rotate(w[i - 2], 17) ^ Rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+          w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+
+        for (unsigned int i = 0; i < 64; i++)
+        {
+          const uint32_t t1 = h + (Rotate(e, 6) ^ Rotate(e, 11) ^ Rotate(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+          const uint32_t t2 = (Rotate(a, 2) ^ Rotate(a, 13) ^ Rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+          h = g;
+          g = f;
+          f = e;
+          e = d + t1;
+          d = c;
+          c = b;
+          b = a;
+          a = t1 + t2;
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+      }
+
+    public:
+      Context() :
+        blockSize_(0),
+        length_(0)
+      {
+        static const uint32_t INITIAL[8] = {
+          0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        memcpy(state_, INITIAL, sizeof(state_));
+      }
+
+      void Update(const void *data,
+                  size_t size)
+      {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+        length_ += size;
+
+        while (size > 0)
+        {
+          if (blockSize_ == 0 &&
+              size >= BLOCK_SIZE)
+          {
+            Transform(p);
+            p += BLOCK_SIZE;
+            size -= BLOCK_SIZE;
+          }
+          else
+          {
+            const size_t n = std::min(size, BLOCK_SIZE - blockSize_);
+            memcpy(block_ + blockSize_, p, n);
+            blockSize_ += n;
+            p += n;
+            size -= n;
+
+            if (blockSize_ == BLOCK_SIZE)
+            {
+              Transform(block_);
+              blockSize_ = 0;
+            }
+          }
+        }
+      }
+
+      void Finalize(uint8_t (&digest)[DIGEST_SIZE])
+      {
+        const uint64_t bits = length_ * 8;
+
+        static const uint8_t PADDING[BLOCK_SIZE] = { 0x80 };
+        Update(PADDING, (blockSize_ < 56 ? 56 - blockSize_ : BLOCK_SIZE + 56 - blockSize_));
+
+        uint8_t length[8];
+        for (unsigned int i = 0; i < 8; i++)
+        {
+          length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        Update(length, sizeof(length));
+
+        for (unsigned int i = 0; i < 8; i++)
+        {
+          digest[4 * i] = static_cast<uint8_t>(state_[i] >> 24);
+          digest[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 16);
+          digest[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 8);
+          digest[4 * i + 3] = static_cast<uint8_t>(state_[i]);
+        }
+      }
+    };
+
+
+    void Compute(uint8_t (&digest)[DIGEST_SIZE],
+                 const void *data,
+                 size_t size)
+    {
+      Context context;
+      context.Update(data, size);
+      context.Finalize(digest);
+    }
+
+
+    void Hmac(uint8_t (&digest)[DIGEST_SIZE],
+              const void *key,
+              size_t keySize,
+              const void *data,
+              size_t size)
+    {
+      uint8_t block[BLOCK_SIZE];
+      memset(block, 0, sizeof(block));
+
+      if (keySize > BLOCK_SIZE)
+      {
+        uint8_t hashed[DIGEST_SIZE];
+        Compute(hashed, key, keySize);
+        memcpy(block, hashed, DIGEST_SIZE);
+      }
+      else if (keySize > 0)
+      {
+        memcpy(block, key, keySize);
+      }
+
+      uint8_t pad[BLOCK_SIZE];
+      for (size_t i = 0; i < BLOCK_SIZE; i++)
+      {
+        pad[i] = block[i] ^ 0x36;
+      }
+
+      uint8_t inner[DIGEST_SIZE];
+      Context innerContext;
+      innerContext.Update(pad, BLOCK_SIZE);
+      innerContext.Update(data, size);
+      innerContext.Finalize(inner);
+
+      for (size_t i = 0; i < BLOCK_SIZE; i++)
+      {
+        pad[i] = block[i] ^ 0x5c;
+      }
+
+      Context outerContext;
+      outerContext.Update(pad, BLOCK_SIZE);
+      outerContext.Update(inner, DIGEST_SIZE);
+      outerContext.Finalize(digest);
+    }
+
+
+    std::string ToHex(const uint8_t (&digest)[DIGEST_SIZE])
+    {
+      static const char HEX[] = "0123456789abcdef";
+
+      std::string s(2 * DIGEST_SIZE, '0');
+      for (size_t i = 0; i < DIGEST_SIZE; i++)
+      {
+        s[2 * i] = HEX[digest[i] >> 4];
+        s[2 * i + 1] = HEX[digest[i] & 0x0f];
+      }
+
+      return s;
+    }
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace Saola
+{
+  // SHA-256 and HMAC-SHA256 (FIPS 180-4, RFC 2104), as needed to sign
+  // the requests to the object store (AWS Signature Version 4). The
+  // payloads themselves are not hashed.
+  namespace Sha256
+  {
+    static const size_t DIGEST_SIZE = 32;
+
+    void Compute(uint8_t (&digest)[DIGEST_SIZE],
+                 const void *data,
+                 size_t size);
+
+    void Hmac(uint8_t (&digest)[DIGEST_SIZE],
+              const void *key,
+              size_t keySize,
+              const void *data,
+              size_t size);
+
+    std::string ToHex(const uint8_t (&digest)[DIGEST_SIZE]);
+
+    inline std::string ComputeHex(const std::string &data)
+    {
+      uint8_t digest[DIGEST_SIZE];
+      Compute(digest, data.c_str(), data.size());
+      return ToHex(digest);
+    }
+  }
+}
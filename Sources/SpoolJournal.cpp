@@ -0,0 +1,110 @@
+#include "SpoolJournal.h"
+
+#include <SQLite/Statement.h>
+#include <SQLite/Transaction.h>
+#include <Logging.h>
+
+namespace Saola
+{
+void SpoolJournal::Setup(bool synchronous)
+{
+  db_.Execute(synchronous ? "PRAGMA SYNCHRONOUS=FULL;" : "PRAGMA SYNCHRONOUS=NORMAL;");
+  db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
+  db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+  db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
+
+  {
+    Orthanc::SQLite::Transaction t(db_);
+    t.Begin();
+
+    if (!db_.DoesTableExist("Spool"))
+    {
+      db_.Execute("CREATE TABLE Spool(seq INTEGER PRIMARY KEY AUTOINCREMENT, uuid TEXT UNIQUE, spoolPath TEXT, mount TEXT)");
+    }
+
+    t.Commit();
+  }
+}
+
+
+SpoolJournal::SpoolJournal(const std::string& path,
+                           bool synchronous)
+{
+  db_.Open(path);
+  Setup(synchronous);
+}
+
+
+void SpoolJournal::Add(const Entry& entry)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT OR REPLACE INTO Spool(uuid, spoolPath, mount) VALUES(?, ?, ?)");
+  s.BindString(0, entry.uuid_);
+  s.BindString(1, entry.spoolPath_);
+  s.BindString(2, entry.mount_);
+  s.Run();
+
+  added_.notify_all();
+}
+
+
+void SpoolJournal::Remove(const std::string& uuid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Spool WHERE uuid=?");
+  s.BindString(0, uuid);
+  s.Run();
+}
+
+
+void SpoolJournal::ListPending(std::vector<Entry>& entries,
+                               unsigned int limit)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  entries.clear();
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT uuid, spoolPath, mount FROM Spool ORDER BY seq LIMIT ?");
+  s.BindInt(0, static_cast<int>(limit));
+
+  while (s.Step())
+  {
+    Entry entry;
+    entry.uuid_ = s.ColumnString(0);
+    entry.spoolPath_ = s.ColumnString(1);
+    entry.mount_ = s.ColumnString(2);
+    entries.push_back(entry);
+  }
+}
+
+
+unsigned int SpoolJournal::GetSize()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  unsigned int value = 0;
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT COUNT(*) FROM Spool");
+
+  if (s.Step())
+  {
+    int tmp = s.ColumnInt(0);
+    if (tmp > 0)
+    {
+      value = static_cast<unsigned int>(tmp);
+    }
+  }
+
+  return value;
+}
+
+
+bool SpoolJournal::WaitForEntries(unsigned int timeoutMs)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return added_.timed_wait(lock, boost::posix_time::milliseconds(timeoutMs));
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <SQLite/Connection.h>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+namespace Saola
+{
+  // Journal of the attachments staged on the local spool and not yet
+  // uploaded to their mount directory. An entry is added after the
+  // payload is written to the spool, just before the ".symlink"
+  // pointer is published under the same lock, so that the uploader
+  // never handles an entry whose pointer is being written. After a
+  // crash, the uploader resumes from the journal, and an entry whose
+  // pointer was never written only leaves an orphaned payload to
+  // remove.
+  class SpoolJournal : public boost::noncopyable
+  {
+  public:
+    struct Entry
+    {
+      std::string  uuid_;
+      std::string  spoolPath_;  // Payload in the spool
+      std::string  mount_;      // Final mount directory
+    };
+
+  private:
+    boost::mutex mutex_;
+    boost::condition_variable added_;
+    Orthanc::SQLite::Connection db_;
+
+    void Setup(bool synchronous);
+
+  public:
+    // With "synchronous", each entry is flushed to the disk before the
+    // pointer is published (SQLite "SYNCHRONOUS=FULL")
+    SpoolJournal(const std::string &path,
+                 bool synchronous);
+
+    void Add(const Entry &entry);
+
+    void Remove(const std::string &uuid);
+
+    // Oldest entries first
+    void ListPending(std::vector<Entry> &entries,
+                     unsigned int limit);
+
+    unsigned int GetSize();
+
+    // Returns "true" if an entry was added meanwhile
+    bool WaitForEntries(unsigned int timeoutMs);
+  };
+}
@@ -0,0 +1,169 @@
+#include "SpoolUploader.h"
+#include "SaolaConfiguration.h"
+#include "Trace.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+
+namespace Saola
+{
+  // Upper bound of the delay before a new entry of the journal is handled
+  static const unsigned int GRANULARITY_MS = 1000;
+
+  SpoolUploader::SpoolUploader(std::shared_ptr<StorageArea> &storageArea)
+      : storageArea_(storageArea), running_(false), stopping_(false), thread_(NULL),
+        uploadedCount_(0), discardedCount_(0), failedCount_(0)
+  {
+    if (storageArea_->GetSpoolJournal() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "[SaolaStorage][Spool] The storage area was created without spool");
+    }
+  }
+
+  SpoolUploader::~SpoolUploader()
+  {
+    if (thread_ != NULL)
+    {
+      LOG(ERROR) << "[SaolaStorage][Spool]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  size_t SpoolUploader::UploadBatch(const std::vector<SpoolJournal::Entry> &entries)
+  {
+    const std::string &spool = storageArea_->GetSpoolDirectory();
+    SpoolJournal &journal = *storageArea_->GetSpoolJournal();
+
+    const size_t threadsCount = SaolaConfiguration::Instance()->SpoolThreads();
+
+    std::atomic<size_t> handled(0);
+
+    pool_.Run(std::min(threadsCount, entries.size()), [this, &entries, &spool, &journal, &handled, threadsCount](size_t t)
+    {
+      for (size_t i = t; i < entries.size() && !stopping_; i += threadsCount)
+      {
+        const SpoolJournal::Entry &entry = entries[i];
+
+        try
+        {
+          if (storageArea_->MoveAttachment(entry.uuid_, spool, entry.mount_))
+          {
+            uploadedCount_++;
+          }
+          else
+          {
+            // Removed meanwhile, never published (crash before the
+            // pointer), or already moved (crash before the removal
+            // of the entry): only the staged payload is left
+            storageArea_->RemoveOrphanedPayload(entry.uuid_, entry.spoolPath_);
+            discardedCount_++;
+          }
+
+          journal.Remove(entry.uuid_);
+          handled++;
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Spool] - Cannot upload attachment " << entry.uuid_ << " to " << entry.mount_ << ": " << ex.What();
+          failedCount_++;
+        }
+        catch (std::exception &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Spool] - Cannot upload attachment " << entry.uuid_ << " to " << entry.mount_ << ": " << ex.what();
+          failedCount_++;
+        }
+      }
+    });
+
+    return handled.load();
+  }
+
+  void SpoolUploader::UploadPending()
+  {
+    const unsigned int batchSize = SaolaConfiguration::Instance()->SpoolBatchSize();
+
+    std::vector<SpoolJournal::Entry> entries;
+
+    // Interrupted between two batches by "Stop()", the remaining
+    // entries are uploaded after the restart
+    while (!stopping_)
+    {
+      storageArea_->GetSpoolJournal()->ListPending(entries, batchSize);
+
+      if (entries.empty() ||
+          UploadBatch(entries) == 0)
+      {
+        return;  // Done, or the failed entries are retried later on
+      }
+
+      SAOLA_TRACE(Storage, Verbose) << "[SaolaStorage][Spool] - Uploaded a batch of " << entries.size() << " attachment(s)";
+    }
+  }
+
+  void SpoolUploader::Start()
+  {
+    if (thread_ != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    LOG(WARNING) << "[SaolaStorage][Spool] - Starting the uploader, " << storageArea_->GetSpoolJournal()->GetSize()
+                 << " attachment(s) pending in " << storageArea_->GetSpoolDirectory();
+
+    running_ = true;
+    stopping_ = false;
+
+    thread_ = new std::thread([this]()
+    {
+      while (running_)
+      {
+        try
+        {
+          UploadPending();
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Spool] - Error in the uploader: " << ex.What();
+        }
+        catch (std::exception &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Spool] - Error in the uploader: " << ex.what();
+        }
+
+        storageArea_->GetSpoolJournal()->WaitForEntries(GRANULARITY_MS);
+      }
+    });
+  }
+
+  void SpoolUploader::Stop()
+  {
+    LOG(WARNING) << "[SaolaStorage][Spool] - Stopping the uploader";
+
+    running_ = false;
+    stopping_ = true;
+
+    if (thread_ != NULL)
+    {
+      if (thread_->joinable())
+      {
+        thread_->join();
+      }
+
+      delete thread_;
+      thread_ = NULL;
+    }
+
+    pool_.Stop();
+  }
+
+  void SpoolUploader::GetStatistics(Json::Value &status)
+  {
+    status["PendingAttachments"] = storageArea_->GetSpoolJournal()->GetSize();
+    status["UploadedCount"] = static_cast<Json::UInt64>(uploadedCount_.load());
+    status["DiscardedCount"] = static_cast<Json::UInt64>(discardedCount_.load());
+    status["FailedCount"] = static_cast<Json::UInt64>(failedCount_.load());
+  }
+}
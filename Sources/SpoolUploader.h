@@ -0,0 +1,55 @@
+#pragma once
+
+#include "StorageArea.h"
+#include "WorkerPool.h"
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace Saola
+{
+  // Moves the attachments staged on the local spool to their mount
+  // directory, in the background and with "Spool.Threads" parallel
+  // copies. Each move atomically rewrites the ".symlink" pointer (see
+  // "StorageArea::MoveAttachment()"), so that the readers either see
+  // the spool or the mount directory. The entries of the journal are
+  // only removed once handled: after a restart, or while the mount
+  // directory is unreachable, the pending ones are retried.
+  class SpoolUploader : public boost::noncopyable
+  {
+  private:
+    std::shared_ptr<StorageArea> storageArea_;
+
+    std::atomic<bool> running_;
+    std::atomic<bool> stopping_;  // Interrupts "UploadPending()"
+    std::thread *thread_;
+    WorkerPool pool_;  // Runs the copies of a batch
+
+    std::atomic<uint64_t> uploadedCount_;
+    std::atomic<uint64_t> discardedCount_;  // Removed or relocated before the upload
+    std::atomic<uint64_t> failedCount_;
+
+    // Returns the number of entries removed from the journal
+    size_t UploadBatch(const std::vector<SpoolJournal::Entry> &entries);
+
+  public:
+    explicit SpoolUploader(std::shared_ptr<StorageArea> &storageArea);
+
+    ~SpoolUploader();
+
+    // Uploads the pending attachments until the journal is empty,
+    // until a batch makes no progress (e.g. unreachable mount
+    // directory), or until "Stop()" is called
+    void UploadPending();
+
+    void Start();
+
+    void Stop();
+
+    void GetStatistics(Json::Value &status);
+  };
+}
@@ -18,6 +18,11 @@
 
 #include "StorageArea.h"
 #include "SaolaConfiguration.h"
+#include "Crc32c.h"
+#include "IOToolbox.h"
+#include "IOLatencyRecorder.h"
+#include "Trace.h"
+#include "UringIO.h"
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
@@ -31,13 +36,24 @@
 #include <Logging.h>
 
 #include <boost/filesystem.hpp>
-#include <boost/thread.hpp>
 #include <boost/regex.hpp>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+
 static const boost::regex REGEX_STUDY_DATE("\\d{4}(0[1-9]|1[012])(0[1-9]|[12][0-9]|3[01])");
 
 static const char *EXTENSION = ".symlink";
 
+// Immediate retries, without sleeping: a transient error is either
+// resolved at once, or is not transient
+static const unsigned int MAX_DIRECTORY_ATTEMPTS = 5;
+static const unsigned int MAX_CREATE_ATTEMPTS = 3;
+
 static const char *const STUDY_INSTANCE_UID = "0020,000d";
 static const char *const SERIES_INSTANCE_UID = "0020,000e";
 static const char *const PIXEL_DATA = "7fe0,0010";
@@ -64,7 +80,9 @@ static boost::filesystem::path GetPathInternal(const std::string &root,
   }
 }
 
-static boost::filesystem::path CreateMountDirectory(const std::string &uuid,
+static boost::filesystem::path CreateMountDirectory(const SaolaConfiguration &configuration,
+                                                    const std::string &mount,
+                                                    const std::string &uuid,
                                                     const void *content,
                                                     int64_t size)
 {
@@ -73,7 +91,7 @@ static boost::filesystem::path CreateMountDirectory(const std::string &uuid,
     throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
   }
 
-  assert(!SaolaConfiguration::Instance().GetMountDirectory().empty());
+  assert(!mount.empty());
 
   if (size > 0 && Orthanc::DicomMap::IsDicomFile(content, size))
   {
@@ -97,12 +115,12 @@ static boost::filesystem::path CreateMountDirectory(const std::string &uuid,
     std::string date, time;
     Orthanc::SystemToolbox::GetNowDicom(date, time, true);
 
-    boost::filesystem::path path = SaolaConfiguration::Instance().GetMountDirectory();
+    boost::filesystem::path path = mount;
     path /= "dicom";
 
     try
     {
-      if (SaolaConfiguration::Instance().IsStoragePathFormatFull())
+      if (configuration.IsStoragePathFormatFull())
       {
         OrthancPlugins::OrthancString s;
         s.Assign(OrthancPluginDicomBufferToJson(OrthancPlugins::GetGlobalContext(), content, size,
@@ -150,7 +168,7 @@ static boost::filesystem::path CreateMountDirectory(const std::string &uuid,
     catch (...)
     {
       LOG(ERROR) << "[SaolaStorage][CreateMountDirectory] ERROR Exception. Rollback to default configuration";
-      path = SaolaConfiguration::Instance().GetMountDirectory();
+      path = mount;
       path /= "dicom";
       path /= std::string(&date[0], &date[4]);
       path /= std::string(&date[4], &date[6]);
@@ -164,7 +182,126 @@ static boost::filesystem::path CreateMountDirectory(const std::string &uuid,
     return path;
   }
 
-  return GetPathInternal(SaolaConfiguration::Instance().GetMountDirectory() + "/attachments", uuid);
+  return GetPathInternal(mount + "/attachments", uuid);
+}
+
+void StorageArea::Locator::Parse(const std::string &content)
+{
+  hasChecksum_ = false;
+  crc32c_ = 0;
+  size_ = 0;
+
+  size_t eol = content.find('\n');
+  path_ = content.substr(0, eol);
+
+  bool hasCrc = false;
+  bool hasSize = false;
+
+  while (eol != std::string::npos)
+  {
+    const size_t start = eol + 1;
+    eol = content.find('\n', start);
+
+    const std::string line = content.substr(start, eol == std::string::npos ? std::string::npos : eol - start);
+
+    unsigned int crc;
+    unsigned long long size;
+    if (sscanf(line.c_str(), "crc32c=%8x", &crc) == 1)
+    {
+      crc32c_ = crc;
+      hasCrc = true;
+    }
+    else if (sscanf(line.c_str(), "size=%llu", &size) == 1)
+    {
+      size_ = size;
+      hasSize = true;
+    }
+  }
+
+  hasChecksum_ = (hasCrc && hasSize);
+}
+
+std::string StorageArea::Locator::Format() const
+{
+  if (hasChecksum_)
+  {
+    char buffer[64];
+    sprintf(buffer, "\ncrc32c=%08x\nsize=%llu\n", crc32c_, static_cast<unsigned long long>(size_));
+    return path_ + buffer;
+  }
+  else
+  {
+    return path_;
+  }
+}
+
+// Sets "locator" to the location of the payload, following the ".symlink" pointer if any
+static bool ResolvePointer(StorageArea::Locator &locator,
+                           const std::string &root_path)
+{
+  const std::string pointer = root_path + EXTENSION;
+
+  // One "openat -> read -> close" chain instead of stat(), open(), fstat(), read() and close()
+  std::string content;
+  const int error = (Saola::UringIO::IsEnabled() ? Saola::UringIO::ReadSmallFile(content, pointer) : ENOSYS);
+
+  if (error == 0)
+  {
+    locator.Parse(content);
+    return true;
+  }
+  else if (error != ENOENT &&
+           Orthanc::SystemToolbox::IsExistingFile(pointer))
+  {
+    Orthanc::SystemToolbox::ReadFile(content, pointer);
+    locator.Parse(content);
+    return true;
+  }
+  else
+  {
+    locator = StorageArea::Locator();
+    locator.path_ = root_path;
+    return false;
+  }
+}
+
+static bool ResolvePointer(std::string &path,
+                           const std::string &root_path)
+{
+  StorageArea::Locator locator;
+  const bool found = ResolvePointer(locator, root_path);
+  path = locator.path_;
+  return found;
+}
+
+static bool GetRelativePath(boost::filesystem::path &relative,
+                            const boost::filesystem::path &path,
+                            const boost::filesystem::path &base)
+{
+  boost::filesystem::path::const_iterator p = path.begin();
+
+  for (boost::filesystem::path::const_iterator b = base.begin(); b != base.end(); ++b)
+  {
+    if (*b == ".")
+    {
+      continue; // Trailing separator of the base directory
+    }
+
+    if (p == path.end() || *p != *b)
+    {
+      return false;
+    }
+
+    ++p;
+  }
+
+  relative.clear();
+  for (; p != path.end(); ++p)
+  {
+    relative /= *p;
+  }
+
+  return !relative.empty();
 }
 
 static void CreateOrthancBuffer(OrthancPluginMemoryBuffer64 *target,
@@ -188,17 +325,41 @@ static void CreateOrthancBuffer(OrthancPluginMemoryBuffer64 *target,
   }
 }
 
+// The pointers with a checksum record the size of the payload: it is
+// then read in one io_uring chain, straight into the Orthanc buffer
+static bool ReadPayloadWithUring(OrthancPluginMemoryBuffer64 *target,
+                                 const StorageArea::Locator &locator)
+{
+  if (!locator.hasChecksum_ ||
+      !Saola::UringIO::IsEnabled() ||
+      Saola::S3Backend::IsObjectLocation(locator.path_) ||
+      OrthancPluginCreateMemoryBuffer64(OrthancPlugins::GetGlobalContext(), target, locator.size_) != OrthancPluginErrorCode_Success)
+  {
+    return false;
+  }
+
+  if (Saola::UringIO::ReadFile(target->data, target->size, locator.path_) == 0)
+  {
+    return true;
+  }
+  else
+  {
+    OrthancPluginFreeMemoryBuffer64(OrthancPlugins::GetGlobalContext(), target);
+    return false;
+  }
+}
+
 void StorageArea::ReadWholeFromPath(OrthancPluginMemoryBuffer64 *target,
                                     const std::string &path)
 {
   Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::ReadWholeFromPath path \"" << path << "\"";
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadWholeFromPath path \"" << path << "\"";
 
   std::string content;
   Orthanc::SystemToolbox::ReadFile(content, path);
   CreateOrthancBuffer(target, content);
 
-  LOG(INFO) << "SaolaStorageArea::ReadWholeFromPath path \"" << path << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadWholeFromPath path \"" << path << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
 }
 
 void StorageArea::ReadRangeFromPath(OrthancPluginMemoryBuffer64 *target,
@@ -206,25 +367,28 @@ void StorageArea::ReadRangeFromPath(OrthancPluginMemoryBuffer64 *target,
                                     uint64_t rangeStart)
 {
   Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::ReadRangeFromPath path \"" << path << "\" (range from: " << rangeStart << ")";
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadRangeFromPath path \"" << path << "\" (range from: " << rangeStart << ")";
 
-  std::string content;
-  Orthanc::SystemToolbox::ReadFileRange(
-      content, path, rangeStart, rangeStart + target->size, true);
-
-  if (content.size() != target->size)
-  {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
-  }
-  else if (!content.empty())
-  {
-    memcpy(target->data, content.c_str(), content.size());
-  }
+  Saola::FilesystemBackend().ReadRange(target->data, target->size, path, rangeStart);
 
-  LOG(INFO) << "SaolaStorageArea::ReadRangeFromPath path \"" << path << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadRangeFromPath path \"" << path << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
 }
 
-StorageArea::StorageArea(const std::string &root) : root_(root)
+StorageArea::StorageArea(const std::string &root) :
+  root_(root),
+  pruner_(SaolaConfiguration::Instance()->PrunerIntervalSeconds(),
+          SaolaConfiguration::Instance()->PrunerGraceSeconds()),
+  diskSpace_(SaolaConfiguration::Instance()->DiskSpaceHighWaterPercent(),
+             SaolaConfiguration::Instance()->DiskSpaceLowWaterPercent(),
+             SaolaConfiguration::Instance()->DiskSpaceMinFreeBytes(),
+             SaolaConfiguration::Instance()->DiskSpaceRefreshSeconds()),
+  objectStore_(SaolaConfiguration::Instance()->GetObjectStorage()),
+  replicaReadsCount_(0),
+  samplingCounter_(0),
+  verifiedReadsCount_(0),
+  checksumMismatchesCount_(0),
+  directoryFailuresCount_(0),
+  writeRetriesCount_(0)
 {
   if (root_.empty())
   {
@@ -242,14 +406,14 @@ StorageArea::StorageArea(const std::string &root) : root_(root)
     }
   }
 
-  if (SaolaConfiguration::Instance().GetMountDirectory().empty())
+  if (SaolaConfiguration::Instance()->GetMountDirectory().empty())
   {
     LOG(ERROR) << "[SaolaStorageArea] ERROR MountDirectory should not be null or empty";
     throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
   }
 
   {
-    boost::filesystem::path mount_path = boost::filesystem::absolute(SaolaConfiguration::Instance().GetMountDirectory());
+    boost::filesystem::path mount_path = boost::filesystem::absolute(SaolaConfiguration::Instance()->GetMountDirectory());
     boost::filesystem::perms perms = boost::filesystem::status(mount_path.parent_path()).permissions();
     if ((perms & boost::filesystem::perms::owner_read) == boost::filesystem::perms::no_perms ||
         (perms & boost::filesystem::perms::owner_write) == boost::filesystem::perms::no_perms)
@@ -258,218 +422,1145 @@ StorageArea::StorageArea(const std::string &root) : root_(root)
       throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile);
     }
   }
+
+  std::vector<std::string> mounts;
+  SaolaConfiguration::Instance()->GetWritableMountDirectories(mounts);
+
+  Saola::IOLatencyRecorder::Instance().RegisterVolume(root_);
+  Saola::IOLatencyRecorder::Instance().RegisterVolume(Saola::S3Backend::MakeLocation(SaolaConfiguration::Instance()->GetObjectStorage(), ""));
+
+  if (SaolaConfiguration::Instance()->DiskSpaceEnable())
+  {
+    diskSpace_.RegisterVolume(root_);
+  }
+
+  // The pruner never removes these directories, nor anything above them
+  pruner_.AddRoot(root_);
+  pruner_.AddRoot(SaolaConfiguration::Instance()->GetColdMountDirectory());
+
+  for (size_t i = 0; i < mounts.size(); i++)
+  {
+    Saola::IOLatencyRecorder::Instance().RegisterVolume(mounts[i]);
+    pruner_.AddRoot(mounts[i]);
+
+    if (SaolaConfiguration::Instance()->DiskSpaceEnable())
+    {
+      diskSpace_.RegisterVolume(mounts[i]);
+    }
+  }
+
+  if (SaolaConfiguration::Instance()->SpoolEnable())
+  {
+    spoolDirectory_ = SaolaConfiguration::Instance()->GetSpoolDirectory();
+    spoolJournal_.reset(new Saola::SpoolJournal(SaolaConfiguration::Instance()->SpoolPath(),
+                                                SaolaConfiguration::Instance()->GetFsyncPolicy() == Saola::IOToolbox::FsyncPolicy_Full));
+
+    Saola::IOLatencyRecorder::Instance().RegisterVolume(spoolDirectory_);
+    pruner_.AddRoot(spoolDirectory_);
+
+    if (SaolaConfiguration::Instance()->DiskSpaceEnable())
+    {
+      diskSpace_.RegisterVolume(spoolDirectory_);
+    }
+  }
+
+  if (SaolaConfiguration::Instance()->ReplicationEnable())
+  {
+    replicaDirectory_ = SaolaConfiguration::Instance()->GetReplicaMountDirectory();
+    replicationQueue_.reset(new Saola::ReplicationDatabase(SaolaConfiguration::Instance()->ReplicationPath()));
+
+    Saola::IOLatencyRecorder::Instance().RegisterVolume(replicaDirectory_);
+    pruner_.AddRoot(replicaDirectory_);
+  }
+
+  const std::vector<std::string> additionalMounts = SaolaConfiguration::Instance()->ScrubberAdditionalMountDirectories();
+  for (size_t i = 0; i < additionalMounts.size(); i++)
+  {
+    pruner_.AddRoot(additionalMounts[i]);
+  }
 }
 
 void StorageArea::Create(const std::string &uuid,
                          const void *content,
-                         int64_t size)
+                         int64_t size,
+                         Orthanc::FileContentType type)
 {
+  // One snapshot for the whole creation, even if the configuration is reloaded meanwhile
+  const std::shared_ptr<const SaolaConfiguration> snapshot = SaolaConfiguration::Instance();
+  const SaolaConfiguration &configuration = *snapshot;
+
+  Orthanc::Toolbox::ElapsedTimer resolveTimer;
+
   boost::filesystem::path root_path = GetPathInternal(root_, uuid);
 
-  boost::filesystem::path mount_path = CreateMountDirectory(uuid, content, size);
+  // Fail fast with "FullStorage" instead of retrying a write that
+  // would run out of space halfway
+  if (diskSpace_.IsFull(root_))
+  {
+    diskSpace_.CountRejected();
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_FullStorage,
+                                    "[SaolaStorageArea] StorageDirectory " + root_ + " is full, rejecting attachment " + uuid);
+  }
 
-  Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::Create creating attachment \"" << uuid << "\" to (root=" << root_path << ", mount_path=" << mount_path << ")";
+  if (configuration.GetObjectStorage().enable_)
+  {
+    CreateInObjectStore(configuration, uuid, content, size, type, resolveTimer.GetElapsedMicroseconds());
+    return;
+  }
 
-  // In very unlikely cases, a thread could be deleting a
-  // directory while another thread needs it -> introduce 3 retries at 1 ms interval
-  int retryCount = 0;
-  const int maxRetryCount = 3;
+  std::string mount = configuration.ResolveMountDirectory(type, static_cast<uint64_t>(size));
 
-  while (retryCount < maxRetryCount)
+  if (diskSpace_.IsFull(mount))
   {
-    retryCount++;
-    if (retryCount > 1)
-    {
-      boost::this_thread::sleep(boost::posix_time::milliseconds(2 * retryCount + (rand() % 10)));
-      LOG(INFO) << "Retrying (" << retryCount << ") to create attachment \"" << uuid << ", root=" << root_path << ", mount_path=" << mount_path;
-    }
+    const std::string &overflowMount = configuration.GetOverflowMountDirectory();
 
-    // Validate root directory existence and Make root directory
-    if (boost::filesystem::exists(root_path.parent_path()))
+    if (configuration.GetDiskFullPolicy() == Saola::IOToolbox::DiskFullPolicy_Redirect &&
+        !overflowMount.empty() &&
+        !diskSpace_.IsFull(overflowMount))
     {
-      if (!boost::filesystem::is_directory(root_path.parent_path()))
-      {
-        LOG(ERROR) << "[SaolaStorageArea] ERROR Root directory: " << root_path.parent_path() << " is existed but not a directory";
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile);
-      }
+      diskSpace_.CountRedirected();
+      mount = overflowMount;
     }
     else
     {
-      try
+      diskSpace_.CountRejected();
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_FullStorage,
+                                      "[SaolaStorageArea] Mount directory " + mount + " is full, rejecting attachment " + uuid);
+    }
+  }
+
+  boost::filesystem::path mount_path = CreateMountDirectory(configuration, mount, uuid, content, size);
+
+  // The payload is first staged at the same relative location in the
+  // spool, the uploader moves it to "mount_path" later on. A full
+  // spool is bypassed.
+  Saola::SpoolJournal::Entry spoolEntry;
+  std::string base = mount;
+
+  boost::filesystem::path relative;
+  if (spoolJournal_.get() != NULL &&
+      !diskSpace_.IsFull(spoolDirectory_) &&
+      GetRelativePath(relative, mount_path, mount))
+  {
+    spoolEntry.uuid_ = uuid;
+    spoolEntry.mount_ = mount;
+
+    mount_path = boost::filesystem::path(spoolDirectory_) / relative;
+    mount_path.make_preferred();
+    spoolEntry.spoolPath_ = mount_path.string();
+    base = spoolDirectory_;
+  }
+
+  const uint64_t resolveUs = resolveTimer.GetElapsedMicroseconds();
+
+  Locator locator;
+  locator.path_ = mount_path.string();
+
+  if (configuration.ChecksumEnable())
+  {
+    // The payload is already in memory: hashing it with the CRC32
+    // instructions is much faster than the write itself
+    locator.hasChecksum_ = true;
+    locator.crc32c_ = Saola::Crc32c::Compute(content, static_cast<size_t>(size));
+    locator.size_ = static_cast<uint64_t>(size);
+  }
+
+  Orthanc::Toolbox::ElapsedTimer timer;
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::Create creating attachment \"" << uuid << "\" to (root=" << root_path << ", mount_path=" << mount_path << ")";
+
+  const std::string rootDirectory = root_path.parent_path().string();
+  const std::string mountDirectory = mount_path.parent_path().string();
+
+  // The pruner keeps these directories, and their parents, until the files are published
+  Saola::DirectoryPruner::Pin rootPin(pruner_, rootDirectory);
+  Saola::DirectoryPruner::Pin mountPin(pruner_, mountDirectory);
+
+  const Saola::IOToolbox::FsyncPolicy policy = configuration.GetFsyncPolicy();
+
+  // Large payloads (whole-slide, enhanced MR...) would evict the hot working set from the page cache
+  const bool direct = (configuration.DirectWriteEnable() &&
+                       static_cast<uint64_t>(size) >= configuration.DirectWriteThreshold());
+
+  const std::string pointer = locator.Format();
+
+  if (!direct &&
+      Saola::UringIO::IsEnabled())
+  {
+    // One chain per file, from the creation of its directories to its
+    // publication. After a failure, the blocking path below rewrites
+    // both files and reports the error.
+    int error = Saola::UringIO::WriteFileAtomic(base, content, static_cast<size_t>(size), mount_path.string(), policy);
+
+    if (error == 0)
+    {
+      // The uploader takes the same lock: it never handles the entry before the pointer is published
+      boost::mutex::scoped_lock lock(GetLock(uuid));
+
+      if (!spoolEntry.uuid_.empty())
       {
-        boost::filesystem::create_directories(root_path.parent_path());
+        spoolJournal_->Add(spoolEntry);
       }
-      catch (boost::filesystem::filesystem_error &er)
+
+      error = Saola::UringIO::WriteFileAtomic(root_, pointer.c_str(), pointer.size(), root_path.string() + EXTENSION, policy);
+
+      if (error != 0 &&
+          !spoolEntry.uuid_.empty())
       {
-        if (er.code() == boost::system::errc::file_exists         // the last element of the parent_path is a file
-            || er.code() == boost::system::errc::not_a_directory) // one of the element of the parent_path is not a directory
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile,
-                                          std::string("[SaolaStorageArea] Parent Root directory: ") + root_path.parent_path().c_str() + " is a file"); // no need to retry this error
-        }
-        // ignore other errors and retry
+        spoolJournal_->Remove(uuid);  // The blocking path adds it again
       }
     }
 
-    // Validate mount directory existence and Make mount directory
-    if (boost::filesystem::exists(mount_path.parent_path()))
+    if (error == 0)
     {
-      if (!boost::filesystem::is_directory(mount_path.parent_path()))
-      {
-        LOG(ERROR) << "[SaolaStorageArea] ERROR Mount directory: " << mount_path.parent_path() << " is existed but not a directory";
-        // throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile);
-      }
+      EnqueueReplicaCopy(uuid);
+
+      Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_Create, uuid, size, resolveUs,
+                                                  timer.GetElapsedMicroseconds(), mount_path.string());
+      SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::Create created attachment \"" << uuid << "\" with io_uring (" << timer.GetHumanTransferSpeed(true, size) << ")";
+      return;
     }
-    else
+
+    SAOLA_TRACE(Storage, Info) << "io_uring could not create attachment \"" << uuid << "\" (" << strerror(error) << "), using the blocking path";
+  }
+
+  for (unsigned int attempt = 1; ; attempt++)
+  {
+    MakeDirectory(rootDirectory);
+    MakeDirectory(mountDirectory);
+
+    try
     {
-      try
-      {
-        boost::filesystem::create_directories(mount_path.parent_path());
-      }
-      catch (boost::filesystem::filesystem_error &er)
+      // The payload is published before the pointer, so that a crash
+      // in between leaves at worst an unreferenced payload, never a
+      // pointer to a missing or truncated file
+      Saola::IOToolbox::WriteFileAtomic(content, size, mount_path.string(), policy, direct);
+
       {
-        if (er.code() == boost::system::errc::file_exists         // the last element of the parent_path is a file
-            || er.code() == boost::system::errc::not_a_directory) // one of the element of the parent_path is not a directory
+        boost::mutex::scoped_lock lock(GetLock(uuid));
+
+        if (!spoolEntry.uuid_.empty())
+        {
+          spoolJournal_->Add(spoolEntry);
+        }
+
+        try
         {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile,
-                                          std::string("[SaolaStorageArea] ERROR Parent mount directory: ") + mount_path.parent_path().c_str() + " is a file"); // no need to retry this error
+          Saola::IOToolbox::WriteFileAtomic(pointer.c_str(), pointer.size(), root_path.string() + EXTENSION, policy, false);
+        }
+        catch (Orthanc::OrthancException &)
+        {
+          // No entry is left behind for a pointer that was never published
+          if (!spoolEntry.uuid_.empty())
+          {
+            spoolJournal_->Remove(uuid);
+          }
+
+          throw;
         }
-        // ignore other errors and retry
       }
-    }
 
-    try
-    {
-      Orthanc::SystemToolbox::WriteFile(mount_path.string().c_str(), mount_path.string().size(), root_path.string() + EXTENSION, false);
-      Orthanc::SystemToolbox::WriteFile(content, size, mount_path.string(), false);
-      LOG(INFO) << "SaolaStorageArea::Create created attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, size) << ")";
+      // The replica is written later on by the replication worker,
+      // the ingest only pays for one write of the payload
+      EnqueueReplicaCopy(uuid);
+
+      Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_Create, uuid, size, resolveUs,
+                                                  timer.GetElapsedMicroseconds(), mount_path.string());
+      SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::Create created attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, size) << ")";
       return;
     }
     catch (Orthanc::OrthancException &ex)
     {
-      LOG(INFO) << "Writing file caught exception: " << ex.What();
-      if (retryCount >= maxRetryCount)
+      // Only worth a retry if a directory was removed under our feet
+      // by another process (the pruner respects the pins). A full
+      // disk or a permission error would fail again.
+      if (attempt < MAX_CREATE_ATTEMPTS &&
+          (!boost::filesystem::is_directory(rootDirectory) ||
+           !boost::filesystem::is_directory(mountDirectory)))
+      {
+        writeRetriesCount_++;
+        SAOLA_TRACE(Storage, Info) << "Retrying (" << attempt << ") to create attachment \"" << uuid << "\", a directory vanished: " << ex.What();
+      }
+      else
       {
-        throw ex;
+        throw;
       }
     }
   }
 }
 
-void StorageArea::ReadWhole(std::string &target,
-                            const std::string &uuid)
+void StorageArea::CreateInObjectStore(const SaolaConfiguration &configuration,
+                                      const std::string &uuid,
+                                      const void *content,
+                                      int64_t size,
+                                      Orthanc::FileContentType type,
+                                      uint64_t resolveUs)
 {
-  Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::ReadWhole string attachment \"" << uuid << "\"";
+  Orthanc::Toolbox::ElapsedTimer resolveTimer;
+
+  // The object key mirrors the layout of the mount directories, which
+  // keeps the keys readable and spread over many prefixes
+  const std::string mount = configuration.ResolveMountDirectory(type, static_cast<uint64_t>(size));
+  const boost::filesystem::path mount_path = CreateMountDirectory(configuration, mount, uuid, content, size);
 
-  boost::filesystem::path root_path = GetPathInternal(root_, uuid).string();
-  std::string root_path_extension = root_path.string() + EXTENSION;
-  if (Orthanc::SystemToolbox::IsExistingFile(root_path_extension))
+  boost::filesystem::path relative;
+  if (!GetRelativePath(relative, mount_path, mount))
   {
-    std::string floc;
-    Orthanc::SystemToolbox::ReadFile(floc, root_path_extension);
-    Orthanc::SystemToolbox::ReadFile(target, floc);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
   }
-  else
+
+  const boost::filesystem::path root_path = GetPathInternal(root_, uuid);
+
+  Locator locator;
+  locator.path_ = Saola::S3Backend::MakeLocation(configuration.GetObjectStorage(), relative.generic_string());
+
+  if (configuration.ChecksumEnable())
   {
-    Orthanc::SystemToolbox::ReadFile(target, root_path.c_str());
+    locator.hasChecksum_ = true;
+    locator.crc32c_ = Saola::Crc32c::Compute(content, static_cast<size_t>(size));
+    locator.size_ = static_cast<uint64_t>(size);
   }
 
-  LOG(INFO) << "SaolaStorageArea::ReadWhole string attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target.size()) << ")";
-}
+  resolveUs += resolveTimer.GetElapsedMicroseconds();
 
-void StorageArea::ReadWhole(OrthancPluginMemoryBuffer64 *target,
-                            const std::string &uuid)
-{
   Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::ReadWhole OrthancPluginMemoryBuffer64 attachment \"" << uuid << "\"";
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::Create creating attachment \"" << uuid << "\" to (root=" << root_path << ", object=" << locator.path_ << ")";
 
-  boost::filesystem::path root_path = GetPathInternal(root_, uuid).string();
-  std::string root_path_extension = root_path.string() + EXTENSION;
-  if (Orthanc::SystemToolbox::IsExistingFile(root_path_extension))
+  // As on the filesystem, the payload is published before the pointer
+  objectStore_.Write(locator.path_, content, static_cast<size_t>(size));
+
+  const std::string rootDirectory = root_path.parent_path().string();
+  Saola::DirectoryPruner::Pin rootPin(pruner_, rootDirectory);
+  MakeDirectory(rootDirectory);
+
+  {
+    const std::string pointer = locator.Format();
+    boost::mutex::scoped_lock lock(GetLock(uuid));
+    Saola::IOToolbox::WriteFileAtomic(pointer.c_str(), pointer.size(), root_path.string() + EXTENSION, configuration.GetFsyncPolicy(), false);
+  }
+
+  Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_Create, uuid, size, resolveUs,
+                                              timer.GetElapsedMicroseconds(), locator.path_);
+  SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::Create created attachment \"" << uuid << "\" in the object store (" << timer.GetHumanTransferSpeed(true, size) << ")";
+}
+
+Saola::IStorageBackend &StorageArea::GetBackend(const std::string &location)
+{
+  if (objectStore_.IsOwner(location))
   {
-    std::string floc;
-    Orthanc::SystemToolbox::ReadFile(floc, root_path_extension);
-    ReadWholeFromPath(target, floc);
+    return objectStore_;
   }
   else
   {
-    ReadWholeFromPath(target, root_path.string());
+    return filesystem_;
   }
-
-  LOG(INFO) << "SaolaStorageArea::ReadWhole OrthancPluginMemoryBuffer64 attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
 }
 
-void StorageArea::ReadRange(OrthancPluginMemoryBuffer64 *target,
-                            const std::string &uuid,
-                            uint64_t rangeStart)
+void StorageArea::ReadPayload(std::string &target,
+                              const Locator &locator)
 {
-  Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::ReadRange attachment \"" << uuid << "\" content type (range from: " << rangeStart << ")";
-
-  boost::filesystem::path root_path = GetPathInternal(root_, uuid).string();
-  std::string root_path_extension = root_path.string() + EXTENSION;
-  if (Orthanc::SystemToolbox::IsExistingFile(root_path_extension))
+  std::string replica;
+  if (LookupHedgedReplica(replica, locator.path_))
+  {
+    std::string location = locator.path_;
+    hedgedReader_.ReadWhole(target, location, replica);
+  }
+  else if (objectStore_.IsOwner(locator.path_) &&
+           locator.hasChecksum_)
   {
-    std::string floc;
-    Orthanc::SystemToolbox::ReadFile(floc, root_path_extension);
-    ReadRangeFromPath(target, floc, rangeStart);
+    // The size is known: no HEAD request before the ranged GETs
+    target.resize(static_cast<size_t>(locator.size_));
+    objectStore_.ReadRange(target.empty() ? NULL : &target[0], target.size(), locator.path_, 0);
   }
   else
   {
-    ReadRangeFromPath(target, root_path.string(), rangeStart);
+    GetBackend(locator.path_).ReadWhole(target, locator.path_);
   }
-
-  LOG(INFO) << "SaolaStorageArea::ReadRange attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
 }
 
-void StorageArea::RemoveAttachment(const std::string &uuid)
+void StorageArea::ReadPayload(OrthancPluginMemoryBuffer64 *target,
+                              const Locator &locator)
 {
-  Orthanc::Toolbox::ElapsedTimer timer;
-  LOG(INFO) << "SaolaStorageArea::RemoveAttachment deleting attachment \"" << uuid << "\"";
+  std::string replica;
+  if (LookupHedgedReplica(replica, locator.path_))
+  {
+    std::string content, location = locator.path_;
+    hedgedReader_.ReadWhole(content, location, replica);
+    CreateOrthancBuffer(target, content);
+    return;
+  }
+  else if (!objectStore_.IsOwner(locator.path_))
+  {
+    ReadWholeFromPath(target, locator.path_);
+    return;
+  }
 
-  boost::filesystem::path root_path = GetPathInternal(root_, uuid);
+  // The ranged GETs write straight into the Orthanc buffer
+  const uint64_t size = (locator.hasChecksum_ ? locator.size_ : objectStore_.GetSize(locator.path_));
+
+  OrthancPluginErrorCode code = OrthancPluginCreateMemoryBuffer64(OrthancPlugins::GetGlobalContext(), target, size);
+  if (code != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(static_cast<Orthanc::ErrorCode>(code));
+  }
 
   try
   {
-    if (Orthanc::SystemToolbox::IsExistingFile(root_path.string() + EXTENSION))
-    {
-      LOG(INFO) << "SaolaStorageArea::RemoveAttachment Found and Deleting symlink file " << root_path.string() + EXTENSION;
-      root_path.concat(EXTENSION);
+    objectStore_.ReadRange(target->data, target->size, locator.path_, 0);
+  }
+  catch (Orthanc::OrthancException &)
+  {
+    OrthancPluginFreeMemoryBuffer64(OrthancPlugins::GetGlobalContext(), target);
+    throw;
+  }
+}
+
+void StorageArea::ReadWhole(std::string &target,
+                            const std::string &uuid)
+{
+  Orthanc::Toolbox::ElapsedTimer timer;
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadWhole string attachment \"" << uuid << "\"";
 
-      std::string floc;
-      Orthanc::SystemToolbox::ReadFile(floc, root_path.string());
-      boost::filesystem::path mount_path = floc;
+  const std::string root_path = GetPathInternal(root_, uuid).string();
 
-      boost::system::error_code err;
-      boost::filesystem::remove(root_path, err);
-      boost::filesystem::remove(root_path.parent_path(), err);
-      boost::filesystem::remove(root_path.parent_path().parent_path(), err);
+  Locator locator;
+  bool legacy;
+  const bool hasPointer = ResolveAttachment(locator, legacy, uuid, root_path);
+  const uint64_t resolveUs = timer.GetElapsedMicroseconds();
+
+  bool done = false;
+  std::string hedgedReplica;
+  if (locator.hasChecksum_ &&
+      filesystem_.IsOwner(locator.path_) &&
+      Saola::UringIO::IsEnabled() &&
+      !LookupHedgedReplica(hedgedReplica, locator.path_))
+  {
+    target.resize(locator.size_);
+    done = (Saola::UringIO::ReadFile(target.empty() ? NULL : &target[0], target.size(), locator.path_) == 0);
+  }
 
-      LOG(INFO) << "SaolaStorageArea::RemoveAttachment Found and Deleting mount file " << mount_path;
-      boost::filesystem::remove(mount_path, err);
-      boost::filesystem::remove(mount_path.parent_path(), err);
-      boost::filesystem::remove(mount_path.parent_path().parent_path(), err);
+  if (!done)
+  {
+    try
+    {
+      ReadPayload(target, locator);
     }
-    else
+    catch (Orthanc::OrthancException &)
     {
-      LOG(INFO) << "SaolaStorageArea::RemoveAttachment Deleting regular file " << root_path.string() + EXTENSION;
-      boost::system::error_code err;
-      boost::filesystem::remove(root_path, err);
-      boost::filesystem::remove(root_path.parent_path(), err);
-      boost::filesystem::remove(root_path.parent_path().parent_path(), err);
+      // The payload might have been relocated by the tiering worker
+      // meanwhile, or have a pointer despite the legacy index,
+      // otherwise its replica is the last resort
+      Locator relocated;
+      std::string replica;
+      if ((hasPointer || legacy) && ResolvePointer(relocated, root_path) && relocated.path_ != locator.path_)
+      {
+        if (legacy)
+        {
+          legacyIndex_.CountFalsePositive();
+        }
+
+        locator = relocated;
+      }
+      else if (LookupReplica(replica, uuid, locator.path_))
+      {
+        locator.path_ = replica;
+      }
+      else
+      {
+        throw;
+      }
+
+      ReadPayload(target, locator);
     }
   }
-  catch (...)
+
+  VerifyPayload(locator, uuid, target.empty() ? NULL : target.c_str(), target.size());
+
+  Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_ReadWhole, uuid, target.size(), resolveUs,
+                                              timer.GetElapsedMicroseconds() - resolveUs, locator.path_);
+  SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::ReadWhole string attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target.size()) << ")";
+}
+
+void StorageArea::ReadWhole(OrthancPluginMemoryBuffer64 *target,
+                            const std::string &uuid)
+{
+  Orthanc::Toolbox::ElapsedTimer timer;
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadWhole OrthancPluginMemoryBuffer64 attachment \"" << uuid << "\"";
+
+  const std::string root_path = GetPathInternal(root_, uuid).string();
+
+  Locator locator;
+  bool legacy;
+  const bool hasPointer = ResolveAttachment(locator, legacy, uuid, root_path);
+  const uint64_t resolveUs = timer.GetElapsedMicroseconds();
+
+  std::string hedgedReplica;
+  if (LookupHedgedReplica(hedgedReplica, locator.path_) ||
+      !ReadPayloadWithUring(target, locator))
   {
-    // Ignore the error
+    try
+    {
+      ReadPayload(target, locator);
+    }
+    catch (Orthanc::OrthancException &)
+    {
+      // The payload might have been relocated by the tiering worker
+      // meanwhile, or have a pointer despite the legacy index,
+      // otherwise its replica is the last resort
+      Locator relocated;
+      std::string replica;
+      if ((hasPointer || legacy) && ResolvePointer(relocated, root_path) && relocated.path_ != locator.path_)
+      {
+        if (legacy)
+        {
+          legacyIndex_.CountFalsePositive();
+        }
+
+        locator = relocated;
+      }
+      else if (LookupReplica(replica, uuid, locator.path_))
+      {
+        locator.path_ = replica;
+      }
+      else
+      {
+        throw;
+      }
+
+      ReadPayload(target, locator);
+    }
+  }
+
+  try
+  {
+    VerifyPayload(locator, uuid, target->data, target->size);
+  }
+  catch (Orthanc::OrthancException &)
+  {
+    OrthancPluginFreeMemoryBuffer64(OrthancPlugins::GetGlobalContext(), target);
+    throw;
+  }
+
+  Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_ReadWhole, uuid, target->size, resolveUs,
+                                              timer.GetElapsedMicroseconds() - resolveUs, locator.path_);
+  SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::ReadWhole OrthancPluginMemoryBuffer64 attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
+}
+
+void StorageArea::ReadRange(OrthancPluginMemoryBuffer64 *target,
+                            const std::string &uuid,
+                            uint64_t rangeStart)
+{
+  Orthanc::Toolbox::ElapsedTimer timer;
+  SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::ReadRange attachment \"" << uuid << "\" content type (range from: " << rangeStart << ")";
+
+  const std::string root_path = GetPathInternal(root_, uuid).string();
+
+  Locator locator;
+  bool legacy;
+  const bool hasPointer = ResolveAttachment(locator, legacy, uuid, root_path);
+  const uint64_t resolveUs = timer.GetElapsedMicroseconds();
+
+  std::string path = locator.path_;
+
+  try
+  {
+    std::string replica;
+    if (LookupHedgedReplica(replica, path))
+    {
+      hedgedReader_.ReadRange(target->data, target->size, path, replica, rangeStart);
+    }
+    else
+    {
+      GetBackend(path).ReadRange(target->data, target->size, path, rangeStart);
+    }
+  }
+  catch (Orthanc::OrthancException &)
+  {
+    // The payload might have been relocated by the tiering worker
+    // meanwhile, or have a pointer despite the legacy index,
+    // otherwise its replica is the last resort
+    std::string relocated;
+    std::string replica;
+    if ((hasPointer || legacy) && ResolvePointer(relocated, root_path) && relocated != path)
+    {
+      if (legacy)
+      {
+        legacyIndex_.CountFalsePositive();
+      }
+
+      path = relocated;
+    }
+    else if (LookupReplica(replica, uuid, path))
+    {
+      path = replica;
+    }
+    else
+    {
+      throw;
+    }
+
+    GetBackend(path).ReadRange(target->data, target->size, path, rangeStart);
+  }
+
+  Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_ReadRange, uuid, target->size, resolveUs,
+                                              timer.GetElapsedMicroseconds() - resolveUs, path);
+  SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::ReadRange attachment \"" << uuid << "\" (" << timer.GetHumanTransferSpeed(true, target->size) << ")";
+}
+
+void StorageArea::RemoveAttachment(const std::string &uuid)
+{
+  GetPathInternal(root_, uuid);  // Validates the uuid
+
+  std::vector<std::string> uuids(1, uuid);
+  RemoveAttachments(uuids);
+}
+
+void StorageArea::RemoveAttachments(const std::vector<std::string> &uuids,
+                                    uint64_t *removedBytes,
+                                    std::vector<std::pair<std::string, std::string> > *failed)
+{
+  Orthanc::Toolbox::ElapsedTimer timer;
+
+  if (removedBytes != NULL)
+  {
+    *removedBytes = 0;
+  }
+
+  std::vector<std::string> payloads(uuids.size());
+  std::vector<uint64_t> resolveUs(uuids.size(), 0);
+
+  // Payloads grouped by parent directory (the series directory in the
+  // "FULL" layout), referenced by their index in "uuids"
+  typedef std::map<std::string, std::vector<size_t> > Groups;
+  Groups groups;
+
+  std::set<std::string> pointerDirectories;
+
+  // (uuid, replica) of the removed payloads, enqueued in one transaction
+  std::vector<std::pair<std::string, std::string> > replicas;
+
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    Orthanc::Toolbox::ElapsedTimer resolveTimer;
+    SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::RemoveAttachment deleting attachment \"" << uuids[i] << "\"";
+
+    if (!Orthanc::Toolbox::IsUuid(uuids[i]))
+    {
+      LOG(ERROR) << "[SaolaStorageArea] Not removing attachment with bad uuid \"" << uuids[i] << "\"";
+      continue;
+    }
+
+    const boost::filesystem::path root_path = GetPathInternal(root_, uuids[i]);
+
+    Locator locator;
+    locator.path_ = root_path.string();  // Attachment without pointer
+
+    // The size of a legacy payload confirms that it has no pointer:
+    // this single stat replaces the lookup of the pointer, and the one
+    // of the size of the payload
+    const bool indexed = legacyIndex_.MayContain(uuids[i]);
+    bool legacy = false;
+    uintmax_t legacySize = 0;
+
+    if (indexed)
+    {
+      boost::system::error_code err;
+      legacySize = boost::filesystem::file_size(locator.path_, err);
+      legacy = !err;
+    }
+
+    if (!legacy)
+    {
+      boost::mutex::scoped_lock lock(GetLock(uuids[i]));
+
+      try
+      {
+        if (ResolvePointer(locator, root_path.string()))
+        {
+          if (indexed)
+          {
+            legacyIndex_.CountFalsePositive();
+          }
+
+          SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::RemoveAttachment Found and Deleting symlink file " << root_path.string() + EXTENSION;
+
+          boost::system::error_code err;
+          boost::filesystem::remove(root_path.string() + EXTENSION, err);
+          pointerDirectories.insert(root_path.parent_path().string());
+        }
+      }
+      catch (Orthanc::OrthancException &)
+      {
+        // Ignore the error
+      }
+    }
+
+    payloads[i] = locator.path_;
+
+    if (removedBytes != NULL)
+    {
+      if (legacy)
+      {
+        *removedBytes += legacySize;
+      }
+      else if (locator.hasChecksum_)
+      {
+        *removedBytes += locator.size_;
+      }
+      else if (filesystem_.IsOwner(locator.path_))
+      {
+        // One "stat()" for the payloads written without checksum
+        boost::system::error_code err;
+        const uintmax_t size = boost::filesystem::file_size(locator.path_, err);
+        if (!err)
+        {
+          *removedBytes += size;
+        }
+      }
+    }
+
+    resolveUs[i] = resolveTimer.GetElapsedMicroseconds();
+
+    if (objectStore_.IsOwner(locator.path_))
+    {
+      // One request per object, there is no directory to group by
+      Orthanc::Toolbox::ElapsedTimer removeTimer;
+
+      try
+      {
+        objectStore_.Remove(locator.path_);
+      }
+      catch (Orthanc::OrthancException &e)
+      {
+        LOG(ERROR) << "[SaolaStorageArea] Cannot remove object " << locator.path_ << " of attachment \"" << uuids[i] << "\": " << e.What();
+
+        if (failed != NULL)
+        {
+          failed->push_back(std::make_pair(uuids[i], locator.path_));
+        }
+      }
+
+      Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_Remove, uuids[i], 0, resolveUs[i],
+                                                  removeTimer.GetElapsedMicroseconds(), payloads[i]);
+    }
+    else
+    {
+      groups[boost::filesystem::path(locator.path_).parent_path().string()].push_back(i);
+
+      std::string replica;
+      if (replicationQueue_.get() != NULL &&
+          GetReplicaPath(replica, locator.path_))
+      {
+        replicas.push_back(std::make_pair(uuids[i], replica));
+      }
+    }
+  }
+
+  for (Groups::const_iterator group = groups.begin(); group != groups.end(); ++group)
+  {
+    Orthanc::Toolbox::ElapsedTimer groupTimer;
+
+    std::vector<std::string> names;
+    names.reserve(group->second.size());
+
+    for (size_t j = 0; j < group->second.size(); j++)
+    {
+      names.push_back(boost::filesystem::path(payloads[group->second[j]]).filename().string());
+    }
+
+    SAOLA_TRACE(Storage, Verbose) << "SaolaStorageArea::RemoveAttachments Deleting " << names.size() << " file(s) in " << group->first;
+
+    std::vector<std::string> failedNames;
+    Saola::IOToolbox::RemoveFilesInDirectory(group->first, names, &failedNames);
+
+    if (failed != NULL)
+    {
+      for (size_t j = 0; j < group->second.size(); j++)
+      {
+        if (std::find(failedNames.begin(), failedNames.end(), names[j]) != failedNames.end())
+        {
+          failed->push_back(std::make_pair(uuids[group->second[j]], payloads[group->second[j]]));
+        }
+      }
+    }
+
+    // The directory is removed later on by the pruner if it is empty
+    pruner_.Touch(group->first);
+
+    // The duration of the group is shared by its attachments
+    const uint64_t ioUs = groupTimer.GetElapsedMicroseconds() / group->second.size();
+
+    for (size_t j = 0; j < group->second.size(); j++)
+    {
+      const size_t i = group->second[j];
+      Saola::IOLatencyRecorder::Instance().Record(Saola::IOOperation_Remove, uuids[i], 0, resolveUs[i], ioUs, payloads[i]);
+    }
+  }
+
+  for (std::set<std::string>::const_iterator it = pointerDirectories.begin(); it != pointerDirectories.end(); ++it)
+  {
+    pruner_.Touch(*it);
+  }
+
+  if (!replicas.empty())
+  {
+    try
+    {
+      replicationQueue_->EnqueueRemovals(replicas);
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      // The primary payloads are gone: the orphaned replicas are only wasted space
+      LOG(ERROR) << "[SaolaStorageArea] Cannot enqueue the removal of " << replicas.size() << " replica(s): " << e.What();
+    }
+  }
+
+  SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::RemoveAttachments deleted " << uuids.size() << " attachment(s) in "
+                             << groups.size() << " director" << (groups.size() == 1 ? "y" : "ies") << " (" << timer.GetHumanElapsedDuration() << ")";
+}
+
+boost::mutex &StorageArea::GetLock(const std::string &uuid)
+{
+  // The uuid is random, its last hexadecimal digits are evenly distributed
+  assert(uuid.size() >= 2);
+  return locks_[strtoul(uuid.substr(uuid.size() - 2).c_str(), NULL, 16) % LOCK_STRIPES];
+}
+
+void StorageArea::MakeDirectory(const std::string &directory)
+{
+  for (unsigned int attempt = 1; ; attempt++)
+  {
+    const int error = Saola::IOToolbox::MakeDirectories(directory);
+
+    if (error == 0)
+    {
+      return;
+    }
+    else if (Saola::IOToolbox::IsTransientError(error) &&
+             attempt < MAX_DIRECTORY_ATTEMPTS)
+    {
+      boost::mutex::scoped_lock lock(directoryRetriesMutex_);
+      directoryRetries_[error]++;
+    }
+    else
+    {
+      directoryFailuresCount_++;
+
+      if (error == ENOTDIR || error == EEXIST)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryOverFile,
+                                        "[SaolaStorageArea] A file prevents the creation of the directory " + directory);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_MakeDirectory,
+                                        "[SaolaStorageArea] Cannot create the directory " + directory + ": " + strerror(error));
+      }
+    }
+  }
+}
+
+void StorageArea::GetDirectoryStatistics(Json::Value &status)
+{
+  status["Failures"] = static_cast<Json::UInt64>(directoryFailuresCount_.load());
+  status["WriteRetries"] = static_cast<Json::UInt64>(writeRetriesCount_.load());
+  status["Retries"] = Json::objectValue;
+
+  boost::mutex::scoped_lock lock(directoryRetriesMutex_);
+
+  for (std::map<int, uint64_t>::const_iterator it = directoryRetries_.begin(); it != directoryRetries_.end(); ++it)
+  {
+    status["Retries"][strerror(it->first)] = static_cast<Json::UInt64>(it->second);
+  }
+}
+
+bool StorageArea::MoveAttachment(const std::string &uuid,
+                                 const std::string &sourceMount,
+                                 const std::string &targetMount)
+{
+  return MoveAttachment(uuid, std::vector<std::string>(1, sourceMount), targetMount);
+}
+
+bool StorageArea::MoveAttachment(const std::string &uuid,
+                                 const std::vector<std::string> &sourceMounts,
+                                 const std::string &targetMount)
+{
+  Orthanc::Toolbox::ElapsedTimer timer;
+
+  const std::string pointer = GetPathInternal(root_, uuid).string() + EXTENSION;
+
+  Locator locator;
+
+  {
+    boost::mutex::scoped_lock lock(GetLock(uuid));
+
+    if (!Orthanc::SystemToolbox::IsExistingFile(pointer))
+    {
+      return false;
+    }
+
+    std::string content;
+    Orthanc::SystemToolbox::ReadFile(content, pointer);
+    locator.Parse(content);
+  }
+
+  const std::string source = locator.path_;
+
+  boost::filesystem::path relative;
+
+  bool found = false;
+  for (size_t i = 0; i < sourceMounts.size() && !found; i++)
+  {
+    found = GetRelativePath(relative, source, sourceMounts[i]);
+  }
+
+  if (!found)
+  {
+    return false;
+  }
+
+  boost::filesystem::path target = boost::filesystem::path(targetMount) / relative;
+  target.make_preferred();
+
+  const Saola::IOToolbox::FsyncPolicy policy = SaolaConfiguration::Instance()->GetFsyncPolicy();
+
+  Saola::DirectoryPruner::Pin pin(pruner_, target.parent_path().string());
+
+  // The copy happens outside of the lock, as it might take long on large payloads
+  MakeDirectory(target.parent_path().string());
+  Saola::IOToolbox::CopyFileAtomic(source, target.string(), policy);
+
+  {
+    boost::mutex::scoped_lock lock(GetLock(uuid));
+
+    std::string current;
+    ResolvePointer(current, GetPathInternal(root_, uuid).string());
+
+    if (current != source)
+    {
+      // The attachment was removed or relocated by another thread meanwhile
+      boost::system::error_code err;
+      boost::filesystem::remove(target, err);
+      return false;
+    }
+
+    // "rename()" atomically replaces the pointer: readers either see the old or the new location
+    locator.path_ = target.string();
+    const std::string content = locator.Format();
+    Saola::IOToolbox::WriteFileAtomic(content.c_str(), content.size(), pointer, policy, false);
+  }
+
+  boost::system::error_code err;
+  boost::filesystem::remove(source, err);
+  pruner_.Touch(boost::filesystem::path(source).parent_path().string());
+
+  SAOLA_TRACE(Tiering, Info) << "SaolaStorageArea::MoveAttachment moved attachment \"" << uuid << "\" from " << source << " to " << target
+            << " (" << timer.GetHumanElapsedDuration() << ")";
+  return true;
+}
+
+bool StorageArea::GetReplicaPath(std::string &replica,
+                                 const std::string &payloadPath) const
+{
+  if (replicaDirectory_.empty() ||
+      objectStore_.IsOwner(payloadPath))
+  {
+    return false;
+  }
+
+  const std::shared_ptr<const SaolaConfiguration> snapshot = SaolaConfiguration::Instance();
+  const SaolaConfiguration &configuration = *snapshot;
+
+  std::vector<std::string> mounts;
+  configuration.GetWritableMountDirectories(mounts);
+  mounts.push_back(configuration.GetColdMountDirectory());
+  mounts.push_back(spoolDirectory_);
+  mounts.insert(mounts.end(), configuration.ScrubberAdditionalMountDirectories().begin(),
+                configuration.ScrubberAdditionalMountDirectories().end());
+
+  // The innermost mount wins if they are nested
+  std::string base;
+  boost::filesystem::path relative;
+
+  for (size_t i = 0; i < mounts.size(); i++)
+  {
+    boost::filesystem::path tmp;
+    if (!mounts[i].empty() &&
+        mounts[i].size() > base.size() &&
+        GetRelativePath(tmp, payloadPath, mounts[i]))
+    {
+      base = mounts[i];
+      relative = tmp;
+    }
+  }
+
+  if (base.empty())
+  {
+    return false;
+  }
+
+  boost::filesystem::path target = boost::filesystem::path(replicaDirectory_) / relative;
+  target.make_preferred();
+  replica = target.string();
+  return true;
+}
+
+bool StorageArea::LookupHedgedReplica(std::string &replica,
+                                      const std::string &path) const
+{
+  return (replicationQueue_.get() != NULL &&
+          SaolaConfiguration::Instance()->ReplicationHedgedReads() &&
+          GetReplicaPath(replica, path));
+}
+
+void StorageArea::EnqueueReplicaCopy(const std::string &uuid)
+{
+  if (replicationQueue_.get() != NULL)
+  {
+    try
+    {
+      replicationQueue_->EnqueueCopy(uuid);
+    }
+    catch (Orthanc::OrthancException &e)
+    {
+      // The attachment is stored: its creation must not fail because of its replica
+      LOG(ERROR) << "[SaolaStorageArea] Cannot enqueue the replication of attachment \"" << uuid << "\": " << e.What();
+    }
+  }
+}
+
+bool StorageArea::LookupReplica(std::string &replica,
+                                const std::string &uuid,
+                                const std::string &path)
+{
+  if (replicationQueue_.get() == NULL ||
+      !GetReplicaPath(replica, path) ||
+      !Orthanc::SystemToolbox::IsRegularFile(replica))
+  {
+    return false;
+  }
+
+  replicaReadsCount_++;
+  LOG(WARNING) << "[SaolaStorageArea] Cannot read " << path << ", reading attachment \"" << uuid << "\" from its replica " << replica;
+  return true;
+}
+
+std::string StorageArea::GetLegacyPath(const std::string &uuid) const
+{
+  return GetPathInternal(root_, uuid).string();
+}
+
+bool StorageArea::ResolveAttachment(Locator &locator,
+                                    bool &legacy,
+                                    const std::string &uuid,
+                                    const std::string &rootPath)
+{
+  legacy = legacyIndex_.MayContain(uuid);
+
+  if (legacy)
+  {
+    locator = Locator();
+    locator.path_ = rootPath;
+    return false;
+  }
+  else
+  {
+    return ResolvePointer(locator, rootPath);
+  }
+}
+
+bool StorageArea::LookupPointer(std::string &payloadPath,
+                                const std::string &uuid) const
+{
+  return ResolvePointer(payloadPath, GetPathInternal(root_, uuid).string());
+}
+
+bool StorageArea::LookupLocator(Locator &locator,
+                                const std::string &uuid) const
+{
+  return ResolvePointer(locator, GetPathInternal(root_, uuid).string());
+}
+
+void StorageArea::VerifyPayload(const Locator &locator,
+                                const std::string &uuid,
+                                const void *data,
+                                size_t size)
+{
+  if (!locator.hasChecksum_)
+  {
+    return;  // Attachment stored by a previous version of the plugin
+  }
+
+  const std::shared_ptr<const SaolaConfiguration> snapshot = SaolaConfiguration::Instance();
+  const SaolaConfiguration &configuration = *snapshot;
+
+  switch (configuration.GetChecksumVerification())
+  {
+    case Saola::IOToolbox::ChecksumVerification_Off:
+      return;
+
+    case Saola::IOToolbox::ChecksumVerification_Sampled:
+      if (samplingCounter_++ % configuration.ChecksumSampleEvery() != 0)
+      {
+        return;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  verifiedReadsCount_++;
+
+  const uint32_t crc = Saola::Crc32c::Compute(data, size);
+  if (size != locator.size_ ||
+      crc != locator.crc32c_)
+  {
+    checksumMismatchesCount_++;
+
+    char expected[16], actual[16];
+    sprintf(expected, "%08x", locator.crc32c_);
+    sprintf(actual, "%08x", crc);
+
+    LOG(ERROR) << "[SaolaStorageArea] Payload " << locator.path_ << " of attachment \"" << uuid << "\" is corrupted: expected "
+               << locator.size_ << " bytes with CRC32C " << expected << ", read " << size << " bytes with CRC32C " << actual;
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile,
+                                    "[SaolaStorageArea] Checksum mismatch for attachment \"" + uuid + "\"");
+  }
+}
+
+bool StorageArea::RemoveOrphanedPayload(const std::string &uuid,
+                                        const std::string &path)
+{
+  boost::mutex::scoped_lock lock(GetLock(uuid));
+
+  std::string current;
+  if (LookupPointer(current, uuid) && current == path)
+  {
+    LOG(WARNING) << "[SaolaStorageArea] Payload " << path << " is referenced again by attachment \"" << uuid << "\", not removing it";
+    return false;
+  }
+
+  if (objectStore_.IsOwner(path))
+  {
+    objectStore_.Remove(path);
+  }
+  else
+  {
+    boost::system::error_code err;
+    boost::filesystem::remove(path, err);
+    if (err)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot remove " + path + ": " + err.message());
+    }
+
+    pruner_.Touch(boost::filesystem::path(path).parent_path().string());
   }
 
-  LOG(INFO) << "SaolaStorageArea::RemoveAttachment deleted attachment \"" << uuid << "\" (" << timer.GetHumanElapsedDuration() << ")";
+  SAOLA_TRACE(Storage, Info) << "SaolaStorageArea::RemoveOrphanedPayload removed " << path << " of attachment \"" << uuid << "\"";
+  return true;
 }
 
 std::string StorageArea::GetPath(const std::string &uuid) const
 {
-  return GetPathInternal(SaolaConfiguration::Instance().GetMountDirectory(), uuid).string();
+  return GetPathInternal(SaolaConfiguration::Instance()->GetMountDirectory(), uuid).string();
 }
@@ -19,16 +19,145 @@
 
 #pragma once
 
+#include "DirectoryPruner.h"
+#include "DiskSpaceMonitor.h"
+#include "FilesystemBackend.h"
+#include "HedgedReader.h"
+#include "LegacyIndex.h"
+#include "ReplicationDatabase.h"
+#include "S3Backend.h"
+#include "SpoolJournal.h"
+
+#include <Enumerations.h>
 #include <orthanc/OrthancCPlugin.h>
 
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 class StorageArea : public boost::noncopyable
 {
+public:
+  // Content of a ".symlink" pointer: the location of the payload on
+  // its first line, followed by "crc32c=" and "size=" lines if the
+  // checksum was computed at creation. The pointers written by
+  // previous versions of the plugin only contain the location.
+  struct Locator
+  {
+    std::string  path_;
+    bool         hasChecksum_;
+    uint32_t     crc32c_;
+    uint64_t     size_;
+
+    Locator() :
+      hasChecksum_(false),
+      crc32c_(0),
+      size_(0)
+    {
+    }
+
+    void Parse(const std::string& content);
+
+    std::string Format() const;
+  };
+
 private:
+  // Striped locks serializing the updates of the ".symlink" pointer of one attachment
+  static const size_t LOCK_STRIPES = 64;
+
   std::string root_;
 
+  boost::mutex locks_[LOCK_STRIPES];
+
+  // Removes the directories emptied by the deletions
+  Saola::DirectoryPruner pruner_;
+
+  // Lets "Create()" refuse or redirect the attachments before a volume runs out of space
+  Saola::DiskSpaceMonitor diskSpace_;
+
+  // Stores of the payloads, selected by the location in their pointer
+  Saola::FilesystemBackend filesystem_;
+  Saola::S3Backend objectStore_;
+
+  // Local staging of the new attachments, NULL if "Spool" is disabled
+  std::string spoolDirectory_;
+  std::unique_ptr<Saola::SpoolJournal> spoolJournal_;
+
+  // Asynchronous copy of the payloads on a secondary mount, NULL if "Replication" is disabled
+  std::string replicaDirectory_;
+  std::unique_ptr<Saola::ReplicationDatabase> replicationQueue_;
+  std::atomic<uint64_t> replicaReadsCount_;
+  Saola::HedgedReader hedgedReader_;
+
+  // Attachments without pointer, whose reads skip the lookup of the pointer
+  Saola::LegacyIndex legacyIndex_;
+
+  std::atomic<uint64_t> samplingCounter_;
+  std::atomic<uint64_t> verifiedReadsCount_;
+  std::atomic<uint64_t> checksumMismatchesCount_;
+
+  boost::mutex directoryRetriesMutex_;
+  std::map<int, uint64_t> directoryRetries_;  // Transient errors of "MakeDirectories()", by errno
+  std::atomic<uint64_t> directoryFailuresCount_;
+  std::atomic<uint64_t> writeRetriesCount_;
+
+  boost::mutex& GetLock(const std::string& uuid);
+
+  // Follows the ".symlink" pointer of "uuid", unless the legacy index
+  // reports the attachment as legacy: "locator" is then its legacy
+  // path, and "legacy" is set. As the index has false positives, the
+  // pointer must still be looked up if the legacy path fails.
+  bool ResolveAttachment(Locator& locator,
+                         bool& legacy,
+                         const std::string& uuid,
+                         const std::string& rootPath);
+
+  Saola::IStorageBackend& GetBackend(const std::string& location);
+
+  // Writes the payload to the object store, then its pointer
+  void CreateInObjectStore(const SaolaConfiguration& configuration,
+                           const std::string& uuid,
+                           const void *content,
+                           int64_t size,
+                           Orthanc::FileContentType type,
+                           uint64_t resolveUs);
+
+  void ReadPayload(std::string& target,
+                   const Locator& locator);
+
+  void ReadPayload(OrthancPluginMemoryBuffer64 *target,
+                   const Locator& locator);
+
+  // Replica to read as well if "path" is slow to answer, depending on "Replication.HedgedReads"
+  bool LookupHedgedReplica(std::string& replica,
+                           const std::string& path) const;
+
+  // No-op if "Replication" is disabled
+  void EnqueueReplicaCopy(const std::string& uuid);
+
+  // Location of the replica of "path" after a failed read on the
+  // primary mount. Returns "false" if there is no such replica.
+  bool LookupReplica(std::string& replica,
+                     const std::string& uuid,
+                     const std::string& path);
+
+  // Retries immediately on transient errors, throws on the other ones
+  void MakeDirectory(const std::string& directory);
+
+  // Throws "ErrorCode_CorruptedFile" if the payload does not match
+  // the checksum of the locator, depending on "Checksum.Verify"
+  void VerifyPayload(const Locator& locator,
+                     const std::string& uuid,
+                     const void* data,
+                     size_t size);
+
 public:
   static void ReadWholeFromPath(OrthancPluginMemoryBuffer64 *target,
                                 const std::string& path);  
@@ -39,9 +168,11 @@ public:
 
   explicit StorageArea(const std::string& root);
 
+  // The mount directory depends on the routing rules of "type" and "size"
   void Create(const std::string& uuid,
               const void *content,
-              int64_t size);
+              int64_t size,
+              Orthanc::FileContentType type = Orthanc::FileContentType_Unknown);
 
   void ReadWhole(std::string& target,
                  const std::string& uuid);
@@ -55,5 +186,121 @@ public:
 
   void RemoveAttachment(const std::string& uuid);
 
+  // Removes several attachments at once: the payloads are grouped by
+  // parent directory, so that each directory is opened and pruned
+  // once, whatever the number of its removed files. If "removedBytes"
+  // is not NULL, it receives the total size of the removed payloads.
+  // If "failed" is not NULL, it receives the (uuid, payload) pairs of
+  // the payloads that could not be removed: their pointer is already
+  // gone, they can only be removed by path afterwards.
+  void RemoveAttachments(const std::vector<std::string>& uuids,
+                         uint64_t* removedBytes = NULL,
+                         std::vector<std::pair<std::string, std::string> >* failed = NULL);
+
+  // Copies the payload of the attachment from "sourceMount" to the
+  // same relative location below "targetMount", then atomically
+  // rewrites its ".symlink" pointer. Returns "false" if the
+  // attachment has no pointer, does not live below "sourceMount", or
+  // was removed meanwhile.
+  bool MoveAttachment(const std::string& uuid,
+                      const std::string& sourceMount,
+                      const std::string& targetMount);
+
+  // Same, from whichever of "sourceMounts" contains the payload
+  bool MoveAttachment(const std::string& uuid,
+                      const std::vector<std::string>& sourceMounts,
+                      const std::string& targetMount);
+
+  // Location of the attachments written before the plugin was
+  // installed, directly below StorageDirectory
+  std::string GetLegacyPath(const std::string& uuid) const;
+
+  // Reads the ".symlink" pointer of the attachment, if any
+  bool LookupPointer(std::string& payloadPath,
+                     const std::string& uuid) const;
+
+  bool LookupLocator(Locator& locator,
+                     const std::string& uuid) const;
+
+  // Removes a payload that is not referenced by the pointer of
+  // "uuid", as reported by the consistency scrubber. Returns "false"
+  // if the pointer references it again meanwhile, throws if the
+  // payload exists but cannot be removed.
+  bool RemoveOrphanedPayload(const std::string& uuid,
+                             const std::string& path);
+
   std::string GetPath(const std::string& uuid) const;
+
+  Saola::DirectoryPruner& GetDirectoryPruner()
+  {
+    return pruner_;
+  }
+
+  Saola::DiskSpaceMonitor& GetDiskSpaceMonitor()
+  {
+    return diskSpace_;
+  }
+
+  Saola::S3Backend& GetObjectStore()
+  {
+    return objectStore_;
+  }
+
+  Saola::SpoolJournal* GetSpoolJournal()
+  {
+    return spoolJournal_.get();
+  }
+
+  const std::string& GetSpoolDirectory() const
+  {
+    return spoolDirectory_;
+  }
+
+  Saola::ReplicationDatabase* GetReplicationQueue()
+  {
+    return replicationQueue_.get();
+  }
+
+  const std::string& GetReplicaDirectory() const
+  {
+    return replicaDirectory_;
+  }
+
+  // Same relative location as "payloadPath" below the replica mount.
+  // Returns "false" for the payloads outside of the known mount
+  // directories, and for the object store.
+  bool GetReplicaPath(std::string& replica,
+                      const std::string& payloadPath) const;
+
+  uint64_t GetReplicaReadsCount() const
+  {
+    return replicaReadsCount_;
+  }
+
+  Saola::HedgedReader& GetHedgedReader()
+  {
+    return hedgedReader_;
+  }
+
+  Saola::LegacyIndex& GetLegacyIndex()
+  {
+    return legacyIndex_;
+  }
+
+  void GetDirectoryStatistics(Json::Value& status);
+
+  uint64_t GetVerifiedReadsCount() const
+  {
+    return verifiedReadsCount_;
+  }
+
+  uint64_t GetChecksumMismatchesCount() const
+  {
+    return checksumMismatchesCount_;
+  }
+
+  const std::string& GetRoot() const
+  {
+    return root_;
+  }
 };
@@ -0,0 +1,209 @@
+#include "TemporaryFilesCollector.h"
+#include "IOToolbox.h"
+#include "Trace.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <ctime>
+
+namespace Saola
+{
+  // Writes that did not progress for this long are considered as abandoned
+  static const int64_t GRACE_SECONDS = 600;
+
+  TemporaryFilesCollector::TemporaryFilesCollector(const std::vector<std::string> &roots,
+                                                   unsigned int threadsCount)
+      : roots_(roots), threadsCount_(std::max(1u, threadsCount)), busy_(0),
+        running_(false), done_(false), deadline_(0),
+        scannedDirectories_(0), scannedFiles_(0), removedFiles_(0)
+  {
+  }
+
+  TemporaryFilesCollector::~TemporaryFilesCollector()
+  {
+    if (!threads_.empty())
+    {
+      LOG(ERROR) << "[SaolaStorage][Cleanup]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  void TemporaryFilesCollector::ScanDirectory(const std::string &directory)
+  {
+    scannedDirectories_++;
+
+    boost::system::error_code err;
+    boost::filesystem::directory_iterator it(directory, err), end;
+
+    if (err)
+    {
+      SAOLA_TRACE(Storage, Verbose) << "[SaolaStorage][Cleanup] - Cannot list " << directory << ": " << err.message();
+      return;
+    }
+
+    std::vector<std::string> subdirectories;
+
+    for (; it != end && running_; it.increment(err))
+    {
+      if (err)
+      {
+        break;
+      }
+
+      const boost::filesystem::file_status status = it->symlink_status(err);
+      if (err)
+      {
+        continue;
+      }
+
+      if (boost::filesystem::is_directory(status))
+      {
+        subdirectories.push_back(it->path().string());
+      }
+      else if (boost::filesystem::is_regular_file(status))
+      {
+        scannedFiles_++;
+
+        if (IOToolbox::IsTemporaryPath(it->path().string()))
+        {
+          const std::time_t modified = boost::filesystem::last_write_time(it->path(), err);
+
+          if (!err && static_cast<int64_t>(modified) < deadline_ &&
+              boost::filesystem::remove(it->path(), err))
+          {
+            removedFiles_++;
+            SAOLA_TRACE(Storage, Info) << "[SaolaStorage][Cleanup] - Removed orphaned temporary file " << it->path();
+          }
+        }
+      }
+    }
+
+    if (!subdirectories.empty())
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queue_.insert(queue_.end(), subdirectories.begin(), subdirectories.end());
+      queueChanged_.notify_all();
+    }
+  }
+
+  void TemporaryFilesCollector::Worker()
+  {
+    for (;;)
+    {
+      std::string directory;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        // The scan is over once no directory is queued, and no thread can queue new ones
+        while (running_ && queue_.empty() && busy_ > 0)
+        {
+          queueChanged_.wait(lock);
+        }
+
+        if (!running_ || queue_.empty())
+        {
+          queueChanged_.notify_all();
+          return;
+        }
+
+        directory = queue_.front();
+        queue_.pop_front();
+        busy_++;
+      }
+
+      try
+      {
+        ScanDirectory(directory);
+      }
+      catch (boost::filesystem::filesystem_error &e)
+      {
+        LOG(ERROR) << "[SaolaStorage][Cleanup] - Error while scanning " << directory << ": " << e.what();
+      }
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        busy_--;
+        queueChanged_.notify_all();
+      }
+    }
+  }
+
+  void TemporaryFilesCollector::Start()
+  {
+    if (running_ || !threads_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    LOG(WARNING) << "[SaolaStorage][Cleanup] - Looking for orphaned temporary files with " << threadsCount_ << " thread(s)";
+
+    deadline_ = static_cast<int64_t>(time(NULL)) - GRACE_SECONDS;
+    running_ = true;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queue_.insert(queue_.end(), roots_.begin(), roots_.end());
+    }
+
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      threads_.push_back(new std::thread([this]()
+      {
+        Worker();
+      }));
+    }
+
+    // Reports the end of the scan without blocking the startup of Orthanc
+    threads_.push_back(new std::thread([this]()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (running_ && (!queue_.empty() || busy_ > 0))
+        {
+          queueChanged_.wait(lock);
+        }
+      }
+
+      if (running_)
+      {
+        done_ = true;
+        LOG(WARNING) << "[SaolaStorage][Cleanup] - Done: " << removedFiles_.load() << " orphaned temporary file(s) removed, "
+                     << scannedFiles_.load() << " file(s) in " << scannedDirectories_.load() << " directories scanned";
+      }
+    }));
+  }
+
+  void TemporaryFilesCollector::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      running_ = false;
+      queueChanged_.notify_all();
+    }
+
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+      if (threads_[i]->joinable())
+      {
+        threads_[i]->join();
+      }
+
+      delete threads_[i];
+    }
+
+    threads_.clear();
+  }
+
+  void TemporaryFilesCollector::GetStatistics(Json::Value &status) const
+  {
+    status["Done"] = done_.load();
+    status["ScannedDirectories"] = static_cast<Json::UInt64>(scannedDirectories_.load());
+    status["ScannedFiles"] = static_cast<Json::UInt64>(scannedFiles_.load());
+    status["RemovedFiles"] = static_cast<Json::UInt64>(removedFiles_.load());
+  }
+}
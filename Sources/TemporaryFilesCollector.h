@@ -0,0 +1,57 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Background scan removing the temporary files ("*.saola-tmp") left
+  // behind by a crash in the middle of a write. The directories are
+  // walked by a pool of threads sharing a queue of directories. Only
+  // the files that were not modified for a while are removed, as
+  // another Orthanc sharing the volumes might still be writing.
+  class TemporaryFilesCollector : public boost::noncopyable
+  {
+  private:
+    std::vector<std::string>   roots_;
+    unsigned int               threadsCount_;
+    std::vector<std::thread *> threads_;
+
+    boost::mutex               mutex_;
+    boost::condition_variable  queueChanged_;
+    std::deque<std::string>    queue_;
+    unsigned int               busy_;  // Number of threads currently scanning a directory
+
+    std::atomic<bool>          running_;
+    std::atomic<bool>          done_;
+    int64_t                    deadline_;  // Files modified after this time (seconds since epoch) are kept
+
+    std::atomic<uint64_t>      scannedDirectories_;
+    std::atomic<uint64_t>      scannedFiles_;
+    std::atomic<uint64_t>      removedFiles_;
+
+    void ScanDirectory(const std::string &directory);
+
+    void Worker();
+
+  public:
+    TemporaryFilesCollector(const std::vector<std::string> &roots,
+                            unsigned int threadsCount);
+
+    ~TemporaryFilesCollector();
+
+    void Start();
+
+    void Stop();
+
+    void GetStatistics(Json::Value &status) const;
+  };
+}
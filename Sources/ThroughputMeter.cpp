@@ -0,0 +1,78 @@
+#include "ThroughputMeter.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace Saola
+{
+  const unsigned int ThroughputMeter::MAX_WINDOW_SECONDS;
+
+
+  int64_t ThroughputMeter::GetNow()
+  {
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                  std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+
+  ThroughputMeter::ThroughputMeter(int64_t now) :
+    start_(now)
+  {
+    for (unsigned int i = 0; i < MAX_WINDOW_SECONDS; i++)
+    {
+      buckets_[i].second_ = -1;
+      buckets_[i].count_ = 0;
+      buckets_[i].bytes_ = 0;
+    }
+  }
+
+
+  void ThroughputMeter::Add(uint64_t count,
+                            uint64_t bytes,
+                            int64_t now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Bucket &bucket = buckets_[static_cast<uint64_t>(now) % MAX_WINDOW_SECONDS];
+
+    if (bucket.second_ != now)
+    {
+      // Recycles the bucket of "MAX_WINDOW_SECONDS" ago
+      bucket.second_ = now;
+      bucket.count_ = 0;
+      bucket.bytes_ = 0;
+    }
+
+    bucket.count_ += count;
+    bucket.bytes_ += bytes;
+  }
+
+
+  void ThroughputMeter::GetRates(double &countPerSecond,
+                                 double &bytesPerSecond,
+                                 unsigned int windowSeconds,
+                                 int64_t now) const
+  {
+    const int64_t window = std::max<int64_t>(1, std::min<int64_t>(std::min(windowSeconds, MAX_WINDOW_SECONDS), now - start_ + 1));
+
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (unsigned int i = 0; i < MAX_WINDOW_SECONDS; i++)
+      {
+        if (buckets_[i].second_ > now - window &&
+            buckets_[i].second_ <= now)
+        {
+          count += buckets_[i].count_;
+          bytes += buckets_[i].bytes_;
+        }
+      }
+    }
+
+    countPerSecond = static_cast<double>(count) / static_cast<double>(window);
+    bytesPerSecond = static_cast<double>(bytes) / static_cast<double>(window);
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+
+namespace Saola
+{
+  // Counts of items and bytes over the last minutes, in buckets of
+  // one second, to report the average rates over sliding windows
+  class ThroughputMeter : public boost::noncopyable
+  {
+  public:
+    static const unsigned int MAX_WINDOW_SECONDS = 900;
+
+  private:
+    struct Bucket
+    {
+      int64_t   second_;
+      uint64_t  count_;
+      uint64_t  bytes_;
+    };
+
+    mutable boost::mutex mutex_;
+    Bucket buckets_[MAX_WINDOW_SECONDS];
+    int64_t start_;
+
+  public:
+    // Seconds of a monotonic clock
+    static int64_t GetNow();
+
+    explicit ThroughputMeter(int64_t now = GetNow());
+
+    void Add(uint64_t count,
+             uint64_t bytes,
+             int64_t now = GetNow());
+
+    // Averages per second over the last "windowSeconds" (at most
+    // "MAX_WINDOW_SECONDS"), or since the creation of the meter if
+    // more recent
+    void GetRates(double &countPerSecond,
+                  double &bytesPerSecond,
+                  unsigned int windowSeconds,
+                  int64_t now = GetNow()) const;
+  };
+}
@@ -0,0 +1,176 @@
+#include "TieringDatabase.h"
+
+#include <SQLite/Statement.h>
+#include <SQLite/Transaction.h>
+#include <Logging.h>
+
+namespace Saola
+{
+void TieringDatabase::Setup()
+{
+  db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+  db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
+  db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+  db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
+
+  {
+    Orthanc::SQLite::Transaction t(db_);
+    t.Begin();
+
+    if (!db_.DoesTableExist("Access"))
+    {
+      db_.Execute("CREATE TABLE Access(uuid TEXT PRIMARY KEY, lastAccess INTEGER, tier INTEGER)");
+      db_.Execute("CREATE INDEX AccessTierIndex ON Access(tier, lastAccess)");
+    }
+
+    if (!db_.DoesTableExist("Backfill"))
+    {
+      db_.Execute("CREATE TABLE Backfill(mount TEXT PRIMARY KEY)");
+    }
+
+    t.Commit();
+  }
+}
+
+
+TieringDatabase::TieringDatabase(const std::string& path)
+{
+  db_.Open(path);
+  Setup();
+}
+
+
+void TieringDatabase::Touch(const std::map<std::string, int64_t>& accesses)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Transaction t(db_);
+  t.Begin();
+
+  for (std::map<std::string, int64_t>::const_iterator it = accesses.begin(); it != accesses.end(); ++it)
+  {
+    {
+      Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT OR IGNORE INTO Access VALUES(?, ?, ?)");
+      s.BindString(0, it->first);
+      s.BindInt64(1, it->second);
+      s.BindInt(2, Tier_Hot);
+      s.Run();
+    }
+
+    {
+      Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "UPDATE Access SET lastAccess=? WHERE uuid=? AND lastAccess<?");
+      s.BindInt64(0, it->second);
+      s.BindString(1, it->first);
+      s.BindInt64(2, it->second);
+      s.Run();
+    }
+  }
+
+  t.Commit();
+}
+
+
+void TieringDatabase::Remove(const std::string& uuid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM Access WHERE uuid=?");
+  s.BindString(0, uuid);
+  s.Run();
+}
+
+
+bool TieringDatabase::LookupTier(Tier& tier,
+                                 const std::string& uuid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT tier FROM Access WHERE uuid=?");
+  s.BindString(0, uuid);
+
+  if (s.Step())
+  {
+    tier = static_cast<Tier>(s.ColumnInt(0));
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+void TieringDatabase::SetTier(const std::string& uuid,
+                              Tier tier)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "UPDATE Access SET tier=? WHERE uuid=?");
+  s.BindInt(0, tier);
+  s.BindString(1, uuid);
+  s.Run();
+}
+
+
+void TieringDatabase::ListColdCandidates(std::vector<std::string>& uuids,
+                                         int64_t olderThan,
+                                         unsigned int limit)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  uuids.clear();
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT uuid FROM Access WHERE tier=? AND lastAccess<? ORDER BY lastAccess LIMIT ?");
+  s.BindInt(0, Tier_Hot);
+  s.BindInt64(1, olderThan);
+  s.BindInt(2, static_cast<int>(limit));
+
+  while (s.Step())
+  {
+    uuids.push_back(s.ColumnString(0));
+  }
+}
+
+
+unsigned int TieringDatabase::GetSize(Tier tier)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  unsigned int value = 0;
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT COUNT(*) FROM Access WHERE tier=?");
+  s.BindInt(0, tier);
+
+  if (s.Step())
+  {
+    int tmp = s.ColumnInt(0);
+    if (tmp > 0)
+    {
+      value = static_cast<unsigned int>(tmp);
+    }
+  }
+
+  return value;
+}
+
+
+bool TieringDatabase::IsBackfilled(const std::string& mount)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT 1 FROM Backfill WHERE mount=?");
+  s.BindString(0, mount);
+  return s.Step();
+}
+
+
+void TieringDatabase::SetBackfilled(const std::string& mount)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT OR IGNORE INTO Backfill VALUES(?)");
+  s.BindString(0, mount);
+  s.Run();
+}
+
+}
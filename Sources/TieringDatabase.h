@@ -0,0 +1,53 @@
+#pragma once
+
+#include <SQLite/Connection.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <vector>
+
+namespace Saola
+{
+  enum Tier
+  {
+    Tier_Hot = 0,
+    Tier_Cold = 1,
+    Tier_Unmanaged = 2  // Legacy attachment without ".symlink", cannot be relocated
+  };
+
+  class TieringDatabase : public boost::noncopyable
+  {
+  private:
+    boost::mutex mutex_;
+    Orthanc::SQLite::Connection db_;
+
+    void Setup();
+
+  public:
+    TieringDatabase(const std::string &path);
+
+    // Records the last access time (in seconds since epoch) of a batch of attachments
+    void Touch(const std::map<std::string, int64_t> &accesses);
+
+    void Remove(const std::string &uuid);
+
+    bool LookupTier(Tier &tier,
+                    const std::string &uuid);
+
+    void SetTier(const std::string &uuid,
+                 Tier tier);
+
+    void ListColdCandidates(std::vector<std::string> &uuids,
+                            int64_t olderThan,
+                            unsigned int limit);
+
+    unsigned int GetSize(Tier tier);
+
+    // Whether the payloads already stored in "mount" were recorded,
+    // see "TieringWorker::Backfill()"
+    bool IsBackfilled(const std::string &mount);
+
+    void SetBackfilled(const std::string &mount);
+  };
+}
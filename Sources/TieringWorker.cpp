@@ -0,0 +1,403 @@
+#include "TieringWorker.h"
+#include "SaolaConfiguration.h"
+#include "IOLatencyRecorder.h"
+#include "Trace.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+namespace Saola
+{
+  static int64_t GetNow()
+  {
+    return static_cast<int64_t>(time(NULL));
+  }
+
+  static bool IsBelow(const std::string &path,
+                      const std::string &mount)
+  {
+    return (!mount.empty() &&
+            path.size() > mount.size() &&
+            path.compare(0, mount.size(), mount) == 0 &&
+            (path[mount.size()] == '/' || path[mount.size()] == '\\' ||
+             mount[mount.size() - 1] == '/' || mount[mount.size() - 1] == '\\'));
+  }
+
+  static bool IsBelowAny(const std::string &path,
+                         const std::vector<std::string> &mounts)
+  {
+    for (size_t i = 0; i < mounts.size(); i++)
+    {
+      if (IsBelow(path, mounts[i]))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void TieringWorker::Flush()
+  {
+    std::map<std::string, int64_t> accesses;
+    std::set<std::string> removals;
+
+    {
+      boost::mutex::scoped_lock lock(pendingMutex_);
+      accesses.swap(pendingAccesses_);
+      removals.swap(pendingRemovals_);
+    }
+
+    for (std::set<std::string>::const_iterator it = removals.begin(); it != removals.end(); ++it)
+    {
+      accesses.erase(*it);
+      db_->Remove(*it);
+    }
+
+    if (accesses.empty())
+    {
+      return;
+    }
+
+    std::vector<std::string> promotions;
+
+    if (SaolaConfiguration::Instance()->TieringPromoteOnAccess())
+    {
+      for (std::map<std::string, int64_t>::const_iterator it = accesses.begin(); it != accesses.end(); ++it)
+      {
+        Tier tier;
+        if (db_->LookupTier(tier, it->first) && tier == Tier_Cold)
+        {
+          promotions.push_back(it->first);
+        }
+      }
+    }
+
+    db_->Touch(accesses);
+
+    if (!promotions.empty())
+    {
+      SAOLA_TRACE(Tiering, Info) << "[SaolaStorage][Tiering] - Promoting " << promotions.size() << " attachment(s) back to the hot mount";
+      // A failed promotion is retried at the next access
+      std::vector<std::string> failed;
+      MoveBatch(failed, promotions, false);
+    }
+  }
+
+  void TieringWorker::MoveBatch(std::vector<std::string> &failed,
+                                const std::vector<std::string> &uuids,
+                                bool toCold)
+  {
+    failed.clear();
+
+    boost::mutex failedMutex;
+
+    // The attachments of the routing and overflow mounts are tiered
+    // too, and promoted back to the default mount directory
+    std::vector<std::string> hotMounts;
+    SaolaConfiguration::Instance()->GetWritableMountDirectories(hotMounts);
+
+    // Staged attachments are moved to their hot mount by the uploader
+    std::vector<std::string> pendingMounts = hotMounts;
+    pendingMounts.push_back(SaolaConfiguration::Instance()->GetSpoolDirectory());
+
+    const std::string hot = SaolaConfiguration::Instance()->GetMountDirectory();
+    const std::string cold = SaolaConfiguration::Instance()->GetColdMountDirectory();
+
+    const size_t threadsCount = std::max(1, SaolaConfiguration::Instance()->TieringThreads());
+
+    pool_.Run(std::min(threadsCount, uuids.size()), [this, &failed, &failedMutex, &uuids, &hotMounts, &pendingMounts, &hot, &cold, threadsCount, toCold](size_t t)
+    {
+      for (size_t i = t; i < uuids.size() && this->m_state != State_Done; i += threadsCount)
+      {
+        Tier tier = Tier_Unmanaged;
+
+        try
+        {
+          if (toCold)
+          {
+            tier = (storageArea_->MoveAttachment(uuids[i], hotMounts, cold) ? Tier_Cold : Tier_Unmanaged);
+          }
+          else
+          {
+            tier = (storageArea_->MoveAttachment(uuids[i], cold, hot) ? Tier_Hot : Tier_Unmanaged);
+          }
+
+          std::string path;
+          if (tier == Tier_Unmanaged &&
+              storageArea_->LookupPointer(path, uuids[i]))
+          {
+            // Not moved, but not necessarily unmanaged: only the
+            // attachments without pointer, or stored out of the
+            // mounts (e.g. in the object store) cannot be tiered
+            if (IsBelow(path, toCold ? cold : hot) ||
+                (!toCold && IsBelowAny(path, hotMounts)))
+            {
+              tier = (toCold ? Tier_Cold : Tier_Hot);  // Already there
+            }
+            else if (IsBelowAny(path, pendingMounts) ||
+                     IsBelow(path, cold))
+            {
+              // E.g. still staged in the spool, or relocated by another thread meanwhile
+              SAOLA_TRACE(Tiering, Verbose) << "[SaolaStorage][Tiering] - Attachment " << uuids[i] << " was not moved, retrying later";
+              boost::mutex::scoped_lock lock(failedMutex);
+              failed.push_back(uuids[i]);
+              continue;
+            }
+          }
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Tiering] - Cannot move attachment " << uuids[i] << ": " << ex.What();
+          failedCount_++;
+          boost::mutex::scoped_lock lock(failedMutex);
+          failed.push_back(uuids[i]);
+          continue;
+        }
+        catch (std::exception &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Tiering] - Cannot move attachment " << uuids[i] << ": " << ex.what();
+          failedCount_++;
+          boost::mutex::scoped_lock lock(failedMutex);
+          failed.push_back(uuids[i]);
+          continue;
+        }
+
+        db_->SetTier(uuids[i], tier);
+
+        if (tier == Tier_Cold)
+        {
+          migratedCount_++;
+        }
+        else if (tier == Tier_Hot)
+        {
+          promotedCount_++;
+        }
+      }
+    });
+  }
+
+  void TieringWorker::MigrateColdAttachments()
+  {
+    const int64_t threshold = GetNow() - static_cast<int64_t>(SaolaConfiguration::Instance()->TieringColdAfterDays()) * 24 * 3600;
+    const unsigned int batchSize = std::max(1, SaolaConfiguration::Instance()->TieringBatchSize());
+
+    std::vector<std::string> uuids, failed;
+
+    while (this->m_state != State_Done)
+    {
+      db_->ListColdCandidates(uuids, threshold, batchSize);
+      if (uuids.empty())
+      {
+        break;
+      }
+
+      SAOLA_TRACE(Tiering, Info) << "[SaolaStorage][Tiering] - Migrating " << uuids.size() << " attachment(s) to the cold mount";
+      MoveBatch(failed, uuids, true);
+
+      if (!failed.empty())
+      {
+        // Still hot: moving their last access to the threshold excludes
+        // them from this pass, otherwise they would be selected forever
+        std::map<std::string, int64_t> postponed;
+        for (size_t i = 0; i < failed.size(); i++)
+        {
+          postponed[failed[i]] = threshold;
+        }
+
+        db_->Touch(postponed);
+      }
+
+      // Accesses received during the batch must be visible before selecting the next one
+      Flush();
+    }
+  }
+
+  void TieringWorker::Backfill()
+  {
+    static const size_t CHUNK_SIZE = 1000;
+
+    std::vector<std::string> mounts;
+    SaolaConfiguration::Instance()->GetWritableMountDirectories(mounts);
+
+    for (size_t i = 0; i < mounts.size() && this->m_state != State_Done; i++)
+    {
+      if (db_->IsBackfilled(mounts[i]) ||
+          !boost::filesystem::is_directory(mounts[i]))
+      {
+        continue;
+      }
+
+      LOG(WARNING) << "[SaolaStorage][Tiering] - Recording the attachments already stored in " << mounts[i];
+
+      uint64_t count = 0;
+      std::map<std::string, int64_t> accesses;
+
+      boost::system::error_code err;
+      boost::filesystem::recursive_directory_iterator it(mounts[i], err);
+
+      while (!err &&
+             it != boost::filesystem::recursive_directory_iterator() &&
+             this->m_state != State_Done)
+      {
+        const boost::filesystem::path path = it->path();
+        const boost::filesystem::file_status status = it->symlink_status(err);
+        it.increment(err);
+
+        const std::string filename = path.filename().string();
+
+        std::string pointed;
+        if (boost::filesystem::is_regular_file(status) &&
+            !IOToolbox::IsTemporaryPath(filename) &&
+            Orthanc::Toolbox::IsUuid(filename) &&
+            storageArea_->LookupPointer(pointed, filename) &&
+            boost::filesystem::path(pointed) == path)  // Not an orphaned copy
+        {
+          boost::system::error_code ignored;
+          const std::time_t modified = boost::filesystem::last_write_time(path, ignored);
+          accesses[filename] = (ignored ? GetNow() : static_cast<int64_t>(modified));
+        }
+
+        if (accesses.size() >= CHUNK_SIZE)
+        {
+          count += accesses.size();
+          db_->Touch(accesses);  // Never moves back a more recent access
+          accesses.clear();
+
+          // The accesses received meanwhile must not pile up
+          Flush();
+        }
+      }
+
+      if (err)
+      {
+        LOG(ERROR) << "[SaolaStorage][Tiering] - Error while scanning " << mounts[i] << ": " << err.message();
+        continue;
+      }
+
+      count += accesses.size();
+      db_->Touch(accesses);
+
+      if (this->m_state != State_Done)
+      {
+        db_->SetBackfilled(mounts[i]);
+        LOG(WARNING) << "[SaolaStorage][Tiering] - Recorded " << count << " attachment(s) already stored in " << mounts[i];
+      }
+    }
+  }
+
+  void TieringWorker::Touch(const std::string &uuid)
+  {
+    const int64_t now = GetNow();
+
+    boost::mutex::scoped_lock lock(pendingMutex_);
+    pendingAccesses_[uuid] = now;
+  }
+
+  void TieringWorker::Forget(const std::string &uuid)
+  {
+    boost::mutex::scoped_lock lock(pendingMutex_);
+    pendingAccesses_.erase(uuid);
+    pendingRemovals_.insert(uuid);
+  }
+
+  void TieringWorker::Start()
+  {
+    SAOLA_TRACE(Tiering, Info) << "[SaolaStorage][Tiering] - Starting the tiering thread";
+    static const unsigned int GRANULARITY = 1000;
+    if (this->m_state != State_Setup)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    this->m_state = State_Running;
+
+    this->m_worker = new std::thread([this]()
+    {
+      int64_t lastMigration = GetNow();
+      bool backfilled = false;
+
+      while (this->m_state == State_Running)
+      {
+        try
+        {
+          if (!backfilled)
+          {
+            this->Backfill();
+            backfilled = true;
+          }
+
+          this->Flush();
+
+          if (GetNow() - lastMigration >= SaolaConfiguration::Instance()->TieringIntervalSeconds())
+          {
+            this->MigrateColdAttachments();
+            lastMigration = GetNow();
+          }
+        }
+        catch (Orthanc::OrthancException &ex)
+        {
+          LOG(ERROR) << "[SaolaStorage][Tiering] - Error in the tiering thread: " << ex.What();
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(GRANULARITY));
+      }
+    });
+  }
+
+  void TieringWorker::Stop()
+  {
+    LOG(WARNING) << "[SaolaStorage][Tiering] - Stopping the tiering thread";
+    if (this->m_state == State_Running)
+    {
+      this->m_state = State_Done;
+      if (this->m_worker->joinable())
+        this->m_worker->join();
+      delete this->m_worker;
+      pool_.Stop();
+
+      // Do not lose the accesses received since the last flush
+      Flush();
+    }
+  }
+
+  void TieringWorker::GetStatistics(Json::Value &status)
+  {
+    status["HotAttachments"] = db_->GetSize(Tier_Hot);
+    status["ColdAttachments"] = db_->GetSize(Tier_Cold);
+    status["MigratedCount"] = static_cast<Json::UInt64>(migratedCount_.load());
+    status["PromotedCount"] = static_cast<Json::UInt64>(promotedCount_.load());
+    status["FailedCount"] = static_cast<Json::UInt64>(failedCount_.load());
+  }
+
+  TieringWorker::TieringWorker(std::shared_ptr<StorageArea> &storageArea)
+      : m_worker(NULL), storageArea_(storageArea), m_state(State_Setup),
+        migratedCount_(0), promotedCount_(0), failedCount_(0)
+  {
+    if (SaolaConfiguration::Instance()->GetColdMountDirectory().empty())
+    {
+      LOG(ERROR) << "[SaolaStorage][Tiering] - ColdMountDirectory should not be empty";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    IOLatencyRecorder::Instance().RegisterVolume(SaolaConfiguration::Instance()->GetColdMountDirectory());
+
+    db_.reset(new Saola::TieringDatabase(SaolaConfiguration::Instance()->TieringPath()));
+  }
+
+  TieringWorker::~TieringWorker()
+  {
+    if (this->m_state == State_Running)
+    {
+      LOG(ERROR) << "[SaolaStorage][Tiering]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "TieringDatabase.h"
+#include "StorageArea.h"
+#include "WorkerPool.h"
+
+#include <thread>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <map>
+#include <set>
+
+namespace Saola
+{
+  class TieringWorker : public boost::noncopyable
+  {
+  private:
+    enum State
+    {
+      State_Setup,
+      State_Running,
+      State_Done
+    };
+
+    std::thread *m_worker;
+
+    WorkerPool pool_;  // Moves the attachments of a batch
+
+    std::unique_ptr<Saola::TieringDatabase> db_;
+
+    std::shared_ptr<StorageArea> storageArea_;
+
+    State m_state;
+
+    // Accesses are accumulated in memory, and flushed to the database by the worker thread
+    boost::mutex pendingMutex_;
+    std::map<std::string, int64_t> pendingAccesses_;
+    std::set<std::string> pendingRemovals_;
+
+    std::atomic<uint64_t> migratedCount_;
+    std::atomic<uint64_t> promotedCount_;
+    std::atomic<uint64_t> failedCount_;
+
+    void Flush();
+
+    // Fills "failed" with the attachments that could not be moved
+    void MoveBatch(std::vector<std::string> &failed,
+                   const std::vector<std::string> &uuids,
+                   bool toCold);
+
+  public:
+    TieringWorker(std::shared_ptr<StorageArea> &storageArea);
+
+    ~TieringWorker();
+
+    // Cheap, called from the storage callbacks
+    void Touch(const std::string &uuid);
+
+    void Forget(const std::string &uuid);
+
+    void GetStatistics(Json::Value &status);
+
+    // Records the attachments stored in the hot mounts before tiering
+    // was enabled, at the modification time of their payload. Each
+    // mount is only scanned once, and an interrupted scan is resumed
+    // from scratch at the next startup.
+    void Backfill();
+
+    // Moves the attachments not accessed for "ColdAfterDays" to the
+    // cold mount, one batch at a time. An attachment that cannot be
+    // moved (e.g. missing payload) is postponed to the next pass.
+    void MigrateColdAttachments();
+
+    void Start();
+
+    void Stop();
+  };
+}
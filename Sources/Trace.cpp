@@ -0,0 +1,102 @@
+#include "Trace.h"
+
+#include <OrthancException.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+namespace Saola
+{
+  namespace Trace
+  {
+    std::atomic<int> levels_[TraceCategory_Count];
+
+    static const char *GetCategoryName(TraceCategory category)
+    {
+      switch (category)
+      {
+      case TraceCategory_Storage:
+        return "Storage";
+
+      case TraceCategory_Deletion:
+        return "Deletion";
+
+      case TraceCategory_Tiering:
+        return "Tiering";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    static const char *GetLevelName(int level)
+    {
+      switch (level)
+      {
+      case TraceLevel_Off:
+        return "Off";
+
+      case TraceLevel_Info:
+        return "Info";
+
+      default:
+        return "Verbose";
+      }
+    }
+
+    static TraceLevel ParseLevel(const std::string &value)
+    {
+      if (boost::iequals(value, "Off"))
+      {
+        return TraceLevel_Off;
+      }
+      else if (boost::iequals(value, "Info"))
+      {
+        return TraceLevel_Info;
+      }
+      else if (boost::iequals(value, "Verbose"))
+      {
+        return TraceLevel_Verbose;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown trace level: " + value);
+      }
+    }
+
+    void SetLevel(TraceCategory category,
+                  TraceLevel level)
+    {
+      levels_[category].store(level, std::memory_order_relaxed);
+    }
+
+    void Configure(const Json::Value &config)
+    {
+      if (config.type() != Json::objectValue)
+      {
+        return;
+      }
+
+      for (int i = 0; i < TraceCategory_Count; i++)
+      {
+        const TraceCategory category = static_cast<TraceCategory>(i);
+        const char *name = GetCategoryName(category);
+
+        if (config.isMember(name))
+        {
+          SetLevel(category, ParseLevel(config[name].asString()));
+        }
+      }
+    }
+
+    void ToJson(Json::Value &target)
+    {
+      target = Json::objectValue;
+
+      for (int i = 0; i < TraceCategory_Count; i++)
+      {
+        target[GetCategoryName(static_cast<TraceCategory>(i))] = GetLevelName(levels_[i].load(std::memory_order_relaxed));
+      }
+    }
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Logging.h>
+#include <json/value.h>
+
+#include <atomic>
+
+#if !defined(SAOLA_ENABLE_TRACE)
+#  define SAOLA_ENABLE_TRACE 1
+#endif
+
+namespace Saola
+{
+  enum TraceCategory
+  {
+    TraceCategory_Storage,
+    TraceCategory_Deletion,
+    TraceCategory_Tiering,
+    TraceCategory_Count  // Sentinel
+  };
+
+  enum TraceLevel
+  {
+    TraceLevel_Off = 0,
+    TraceLevel_Info = 1,
+    TraceLevel_Verbose = 2
+  };
+
+  namespace Trace
+  {
+    extern std::atomic<int> levels_[TraceCategory_Count];
+
+    inline bool IsEnabled(TraceCategory category,
+                          TraceLevel level)
+    {
+      return levels_[category].load(std::memory_order_relaxed) >= level;
+    }
+
+    void SetLevel(TraceCategory category,
+                  TraceLevel level);
+
+    // Reads the "Trace" section of the "SaolaStorage" configuration,
+    // e.g. { "Storage" : "Info", "Deletion" : "Off" }
+    void Configure(const Json::Value &config);
+
+    void ToJson(Json::Value &target);
+  }
+}
+
+// The stream arguments are only evaluated (hence formatted) if the
+// category is enabled. If the plugin is built without tracing, the
+// statement is dead code that the compiler removes. The traces are
+// emitted at the warning level with a "[Trace]" prefix: enabling them
+// must not turn on the info logs of Orthanc and of the other plugins.
+#if SAOLA_ENABLE_TRACE == 1
+#  define SAOLA_TRACE(category, level)                                   \
+  if (!::Saola::Trace::IsEnabled(::Saola::TraceCategory_ ## category,   \
+                                 ::Saola::TraceLevel_ ## level)) {}     \
+  else LOG(WARNING) << "[Trace] "
+#else
+#  define SAOLA_TRACE(category, level)          \
+  if (true) {}                                  \
+  else LOG(WARNING) << "[Trace] "
+#endif
@@ -0,0 +1,751 @@
+#include "UringIO.h"
+
+#include "SaolaConfiguration.h"
+
+#include <Logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#if SAOLA_ENABLE_IO_URING == 1
+#  include <boost/noncopyable.hpp>
+#  include <fcntl.h>
+#  include <linux/io_uring.h>
+#  include <stdlib.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#  include <memory>
+#  include <vector>
+#endif
+
+namespace Saola
+{
+  namespace UringIO
+  {
+    static std::atomic<uint64_t> pointerReadsCount_(0);
+    static std::atomic<uint64_t> readsCount_(0);
+    static std::atomic<uint64_t> writesCount_(0);
+    static std::atomic<uint64_t> fallbacksCount_(0);
+
+#if SAOLA_ENABLE_IO_URING == 1
+    static const unsigned int RING_ENTRIES = 64;
+    static const size_t BUFFER_SIZE = 4096;                // Registered buffer, larger than any pointer
+    static const size_t MAX_TRANSFER = 1024 * 1024 * 1024;  // One read()/write() is limited to 2GB
+    static const size_t MAX_DIRECTORIES = 16;              // Longer chains go through the blocking path
+    static const unsigned int FILE_SLOT = 0;
+    static const unsigned int DIRECTORY_SLOT = 1;
+
+    static std::atomic<bool> unavailable_(false);  // The kernel refused to set up a ring
+
+
+    class Ring : public boost::noncopyable
+    {
+    private:
+      int            fd_;
+      void          *sqRing_;
+      size_t         sqRingSize_;
+      void          *cqRing_;  // Same mapping as "sqRing_" with IORING_FEAT_SINGLE_MMAP
+      size_t         cqRingSize_;
+      io_uring_sqe  *sqes_;
+      size_t         sqesSize_;
+      unsigned      *sqHead_;
+      unsigned      *sqTail_;
+      unsigned      *sqArray_;
+      unsigned       sqMask_;
+      unsigned      *cqHead_;
+      unsigned      *cqTail_;
+      io_uring_cqe  *cqes_;
+      unsigned       cqMask_;
+      void          *buffer_;
+      unsigned       prepared_;
+      bool           broken_;
+
+      int Register(unsigned int opcode,
+                   const void *argument,
+                   unsigned int count)
+      {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd_, opcode, argument, count));
+      }
+
+      bool Setup(int &error)
+      {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        // Each ring is only used by the thread that created it
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_DEFER_TASKRUN)
+        params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+#endif
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+
+        if (fd_ < 0 && errno == EINVAL)
+        {
+          // Kernel older than 6.1
+          memset(&params, 0, sizeof(params));
+          fd_ = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+        }
+
+        if (fd_ < 0)
+        {
+          error = errno;
+          return false;
+        }
+
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP);
+        if (singleMap)
+        {
+          sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+
+        void *sq = mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED)
+        {
+          error = errno;
+          return false;
+        }
+        sqRing_ = sq;
+
+        if (singleMap)
+        {
+          cqRing_ = sqRing_;
+        }
+        else
+        {
+          void *cq = mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+          if (cq == MAP_FAILED)
+          {
+            error = errno;
+            return false;
+          }
+          cqRing_ = cq;
+        }
+
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+          error = errno;
+          return false;
+        }
+        sqes_ = reinterpret_cast<io_uring_sqe *>(sqes);
+
+        uint8_t *sqBase = reinterpret_cast<uint8_t *>(sqRing_);
+        sqHead_ = reinterpret_cast<unsigned *>(sqBase + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned *>(sqBase + params.sq_off.tail);
+        sqArray_ = reinterpret_cast<unsigned *>(sqBase + params.sq_off.array);
+        sqMask_ = *reinterpret_cast<unsigned *>(sqBase + params.sq_off.ring_mask);
+
+        uint8_t *cqBase = reinterpret_cast<uint8_t *>(cqRing_);
+        cqHead_ = reinterpret_cast<unsigned *>(cqBase + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned *>(cqBase + params.cq_off.tail);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cqBase + params.cq_off.cqes);
+        cqMask_ = *reinterpret_cast<unsigned *>(cqBase + params.cq_off.ring_mask);
+
+        if (posix_memalign(&buffer_, BUFFER_SIZE, BUFFER_SIZE) != 0)
+        {
+          buffer_ = NULL;
+          error = ENOMEM;
+          return false;
+        }
+
+        struct iovec iov;
+        iov.iov_base = buffer_;
+        iov.iov_len = BUFFER_SIZE;
+
+        // Empty table of direct descriptors, filled by "openat"
+        const int files[2] = { -1, -1 };
+
+        if (Register(IORING_REGISTER_BUFFERS, &iov, 1) < 0 ||
+            Register(IORING_REGISTER_FILES, files, 2) < 0)
+        {
+          error = errno;
+          return false;
+        }
+
+        std::vector<uint8_t> probe(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *ops = reinterpret_cast<io_uring_probe *>(&probe[0]);
+        if (Register(IORING_REGISTER_PROBE, ops, 256) < 0)
+        {
+          error = errno;
+          return false;
+        }
+
+        static const uint8_t REQUIRED[] = {
+          IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+          IORING_OP_FSYNC, IORING_OP_CLOSE, IORING_OP_RENAMEAT, IORING_OP_MKDIRAT
+        };
+
+        for (size_t i = 0; i < sizeof(REQUIRED) / sizeof(REQUIRED[0]); i++)
+        {
+          if (REQUIRED[i] > ops->last_op ||
+              !(ops->ops[REQUIRED[i]].flags & IO_URING_OP_SUPPORTED))
+          {
+            error = EOPNOTSUPP;
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      void Release()
+      {
+        if (sqes_ != NULL)
+        {
+          munmap(sqes_, sqesSize_);
+        }
+
+        if (cqRing_ != NULL && cqRing_ != sqRing_)
+        {
+          munmap(cqRing_, cqRingSize_);
+        }
+
+        if (sqRing_ != NULL)
+        {
+          munmap(sqRing_, sqRingSize_);
+        }
+
+        if (fd_ >= 0)
+        {
+          close(fd_);
+        }
+
+        free(buffer_);
+
+        fd_ = -1;
+        sqRing_ = cqRing_ = buffer_ = NULL;
+        sqes_ = NULL;
+      }
+
+    public:
+      Ring() :
+        fd_(-1), sqRing_(NULL), sqRingSize_(0), cqRing_(NULL), cqRingSize_(0), sqes_(NULL), sqesSize_(0),
+        sqHead_(NULL), sqTail_(NULL), sqArray_(NULL), sqMask_(0), cqHead_(NULL), cqTail_(NULL), cqes_(NULL),
+        cqMask_(0), buffer_(NULL), prepared_(0), broken_(false)
+      {
+      }
+
+      ~Ring()
+      {
+        Release();
+      }
+
+      // Returns 0, or the errno of the failure
+      int Initialize()
+      {
+        int error = 0;
+        if (!Setup(error))
+        {
+          Release();
+        }
+        return error;
+      }
+
+      bool IsBroken() const
+      {
+        return broken_;
+      }
+
+      void *GetBuffer() const
+      {
+        return buffer_;
+      }
+
+      // Adds one request to the chain being prepared, its result goes
+      // to the same index of the "results" given to "Submit()"
+      io_uring_sqe &Prepare(uint8_t opcode,
+                            int fd,
+                            uint8_t flags,
+                            const void *address)
+      {
+        // The tail is only written by this thread
+        const unsigned index = (*sqTail_ + prepared_) & sqMask_;
+
+        io_uring_sqe &sqe = sqes_[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.flags = flags;
+        sqe.addr = reinterpret_cast<uintptr_t>(address);
+        sqe.user_data = prepared_;
+
+        sqArray_[index] = index;
+        prepared_++;
+        return sqe;
+      }
+
+      io_uring_sqe &PrepareOpen(const std::string &path,
+                                int flags,
+                                mode_t mode,
+                                unsigned int slot,
+                                uint8_t link)
+      {
+        io_uring_sqe &sqe = Prepare(IORING_OP_OPENAT, AT_FDCWD, link, path.c_str());
+        // Direct descriptor, never in the file table of the process
+        // (hence no O_CLOEXEC, which the kernel refuses in this case)
+        sqe.open_flags = flags;
+        sqe.len = mode;
+        sqe.file_index = slot + 1;
+        return sqe;
+      }
+
+      void PrepareClose(unsigned int slot,
+                        uint8_t link)
+      {
+        io_uring_sqe &sqe = Prepare(IORING_OP_CLOSE, 0, link, NULL);
+        sqe.file_index = slot + 1;
+      }
+
+      // Submits the prepared chain, and waits for the completion of
+      // all its requests. The requests cancelled because of an
+      // earlier failure of the chain complete with -ECANCELED.
+      bool Submit(int *results)
+      {
+        const unsigned count = prepared_;
+        prepared_ = 0;
+
+        for (unsigned i = 0; i < count; i++)
+        {
+          results[i] = -ECANCELED;
+        }
+
+        const unsigned tail = *sqTail_ + count;
+        __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+        unsigned completed = 0;
+        unsigned idle = 0;
+
+        while (completed < count)
+        {
+          const unsigned toSubmit = tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+          if (syscall(__NR_io_uring_enter, fd_, toSubmit, count - completed, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+              errno != EINTR &&
+              errno != EAGAIN &&
+              errno != EBUSY)
+          {
+            // Unexpected: this ring is discarded, a new one will be set up
+            broken_ = true;
+            return false;
+          }
+
+          unsigned head = *cqHead_;
+          const unsigned available = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+          const unsigned before = completed;
+
+          while (head != available)
+          {
+            const io_uring_cqe &cqe = cqes_[head & cqMask_];
+            if (cqe.user_data < count)
+            {
+              results[cqe.user_data] = cqe.res;
+            }
+
+            head++;
+            completed++;
+          }
+
+          __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+          if (completed == before &&
+              ++idle > 100)
+          {
+            broken_ = true;
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      // Releases a direct descriptor left open by a failed chain
+      void CloseSlot(unsigned int slot)
+      {
+        int result;
+        PrepareClose(slot, 0);
+        Submit(&result);
+      }
+    };
+
+
+    static Ring *GetRing()
+    {
+      static thread_local std::unique_ptr<Ring> ring;
+
+      if (ring.get() != NULL &&
+          ring->IsBroken())
+      {
+        ring.reset();
+      }
+
+      if (ring.get() == NULL &&
+          !unavailable_.load())
+      {
+        std::unique_ptr<Ring> created(new Ring);
+
+        const int error = created->Initialize();
+        if (error == 0)
+        {
+          ring.reset(created.release());
+        }
+        else if (!unavailable_.exchange(true))
+        {
+          LOG(WARNING) << "SaolaStorage - io_uring is not available (" << strerror(error)
+                       << "), using the blocking I/O path";
+        }
+      }
+
+      return ring.get();
+    }
+
+
+    static int Failure(int error)
+    {
+      fallbacksCount_++;
+      return error;
+    }
+
+
+    bool IsEnabled()
+    {
+      return (SaolaConfiguration::Instance()->IOUringEnable() &&
+              GetRing() != NULL);
+    }
+
+
+    int ReadSmallFile(std::string &content,
+                      const std::string &path)
+    {
+      Ring *ring = GetRing();
+      if (ring == NULL)
+      {
+        return ENOSYS;
+      }
+
+      pointerReadsCount_++;
+
+      ring->PrepareOpen(path, O_RDONLY, 0, FILE_SLOT, IOSQE_IO_LINK);
+
+      io_uring_sqe &read = ring->Prepare(IORING_OP_READ_FIXED, FILE_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK, ring->GetBuffer());
+      read.len = BUFFER_SIZE;
+      read.buf_index = 0;
+
+      ring->PrepareClose(FILE_SLOT, 0);
+
+      int results[3];
+      if (!ring->Submit(results))
+      {
+        return Failure(EIO);
+      }
+
+      if (results[0] < 0)
+      {
+        // A missing pointer is an answer, not a failure
+        return (results[0] == -ENOENT ? ENOENT : Failure(-results[0]));
+      }
+
+      if (results[2] != 0)
+      {
+        ring->CloseSlot(FILE_SLOT);
+      }
+
+      if (results[1] < 0)
+      {
+        return Failure(-results[1]);
+      }
+      else if (static_cast<size_t>(results[1]) >= BUFFER_SIZE)
+      {
+        return Failure(EFBIG);
+      }
+      else
+      {
+        content.assign(reinterpret_cast<const char *>(ring->GetBuffer()), results[1]);
+        return 0;
+      }
+    }
+
+
+    int ReadFile(void *target,
+                 size_t size,
+                 const std::string &path)
+    {
+      Ring *ring = GetRing();
+      if (ring == NULL)
+      {
+        return ENOSYS;
+      }
+      else if (size > MAX_TRANSFER)
+      {
+        return Failure(EFBIG);
+      }
+
+      readsCount_++;
+
+      ring->PrepareOpen(path, O_RDONLY, 0, FILE_SLOT, IOSQE_IO_LINK);
+
+      io_uring_sqe &read = ring->Prepare(IORING_OP_READ, FILE_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_LINK,
+                                         size == 0 ? ring->GetBuffer() : target);
+      read.len = static_cast<uint32_t>(size);
+      read.off = 0;
+
+      // Must reach the end of the file, as a blocking read of the whole file would
+      io_uring_sqe &end = ring->Prepare(IORING_OP_READ_FIXED, FILE_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK, ring->GetBuffer());
+      end.len = 1;
+      end.off = size;
+      end.buf_index = 0;
+
+      ring->PrepareClose(FILE_SLOT, 0);
+
+      int results[4];
+      if (!ring->Submit(results))
+      {
+        return Failure(EIO);
+      }
+
+      if (results[0] < 0)
+      {
+        return Failure(-results[0]);
+      }
+
+      if (results[3] != 0)
+      {
+        ring->CloseSlot(FILE_SLOT);
+      }
+
+      if (results[1] < 0)
+      {
+        return Failure(-results[1]);
+      }
+      else if (static_cast<size_t>(results[1]) != size)
+      {
+        return Failure(EIO);
+      }
+      else if (results[2] != 0)
+      {
+        return Failure(results[2] < 0 ? -results[2] : EFBIG);
+      }
+      else
+      {
+        return 0;
+      }
+    }
+
+
+    int WriteFileAtomic(const std::string &base,
+                        const void *content,
+                        size_t size,
+                        const std::string &path,
+                        IOToolbox::FsyncPolicy policy)
+    {
+      Ring *ring = GetRing();
+      if (ring == NULL)
+      {
+        return ENOSYS;
+      }
+      else if (size > MAX_TRANSFER)
+      {
+        return Failure(EFBIG);
+      }
+
+      writesCount_++;
+
+      size_t baseLength = base.size();
+      while (baseLength > 1 && base[baseLength - 1] == '/')
+      {
+        baseLength--;
+      }
+
+      const size_t slash = path.rfind('/');
+      if (slash == std::string::npos ||
+          slash < baseLength ||
+          path.compare(0, baseLength, base, 0, baseLength) != 0 ||
+          path[baseLength] != '/')
+      {
+        return Failure(EINVAL);
+      }
+
+      // The directories between "base" and the parent of "path"
+      std::vector<std::string> directories;
+      for (size_t pos = path.find('/', baseLength + 1); pos != std::string::npos && pos <= slash; pos = path.find('/', pos + 1))
+      {
+        directories.push_back(path.substr(0, pos));
+      }
+
+      if (directories.size() > MAX_DIRECTORIES)
+      {
+        return Failure(E2BIG);
+      }
+
+      const std::string tmp = IOToolbox::GetTemporaryPath(path);
+      const std::string parent = path.substr(0, std::max<size_t>(1, slash));
+      const bool full = (policy == IOToolbox::FsyncPolicy_Full);
+
+      for (size_t i = 0; i < directories.size(); i++)
+      {
+        // Hard links: "EEXIST" must not cancel the rest of the chain
+        io_uring_sqe &mkdirat = ring->Prepare(IORING_OP_MKDIRAT, AT_FDCWD, IOSQE_IO_HARDLINK, directories[i].c_str());
+        mkdirat.len = 0777;
+      }
+
+      const size_t openIndex = directories.size();
+      ring->PrepareOpen(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644, FILE_SLOT, IOSQE_IO_LINK);
+
+      if (size <= BUFFER_SIZE)
+      {
+        // Pointers and small payloads: from the registered buffer
+        memcpy(ring->GetBuffer(), content, size);
+        io_uring_sqe &write = ring->Prepare(IORING_OP_WRITE_FIXED, FILE_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_LINK, ring->GetBuffer());
+        write.len = static_cast<uint32_t>(size);
+        write.buf_index = 0;
+      }
+      else
+      {
+        io_uring_sqe &write = ring->Prepare(IORING_OP_WRITE, FILE_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_LINK, content);
+        write.len = static_cast<uint32_t>(size);
+      }
+
+      if (policy != IOToolbox::FsyncPolicy_None)
+      {
+        io_uring_sqe &fsync = ring->Prepare(IORING_OP_FSYNC, FILE_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_LINK, NULL);
+        fsync.fsync_flags = IORING_FSYNC_DATASYNC;
+      }
+
+      const size_t closeIndex = openIndex + (policy != IOToolbox::FsyncPolicy_None ? 3 : 2);
+      ring->PrepareClose(FILE_SLOT, IOSQE_IO_LINK);
+
+      const size_t renameIndex = closeIndex + 1;
+      io_uring_sqe &renameat = ring->Prepare(IORING_OP_RENAMEAT, AT_FDCWD, full ? IOSQE_IO_LINK : 0, tmp.c_str());
+      renameat.len = AT_FDCWD;
+      renameat.addr2 = reinterpret_cast<uintptr_t>(path.c_str());
+
+      size_t count = renameIndex + 1;
+      if (full)
+      {
+        ring->PrepareOpen(parent, O_RDONLY | O_DIRECTORY, 0, DIRECTORY_SLOT, IOSQE_IO_LINK);
+        ring->Prepare(IORING_OP_FSYNC, DIRECTORY_SLOT, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK, NULL);
+        ring->PrepareClose(DIRECTORY_SLOT, 0);
+        count += 3;
+      }
+
+      int results[RING_ENTRIES];
+      if (!ring->Submit(results))
+      {
+        return Failure(EIO);
+      }
+
+      // The first failure of the chain is the cause of the others
+      int error = 0;
+      for (size_t i = 0; i < count && error == 0; i++)
+      {
+        if (i < openIndex)
+        {
+          if (results[i] < 0 && results[i] != -EEXIST)
+          {
+            error = -results[i];
+          }
+        }
+        else if (i == openIndex + 1)
+        {
+          if (results[i] < 0)
+          {
+            error = -results[i];
+          }
+          else if (static_cast<size_t>(results[i]) != size)
+          {
+            error = EIO;  // Short write, e.g. the volume became full
+          }
+        }
+        else if (results[i] < 0)
+        {
+          error = -results[i];
+        }
+      }
+
+      if (results[openIndex] == 0 &&
+          results[closeIndex] != 0)
+      {
+        ring->CloseSlot(FILE_SLOT);
+      }
+
+      if (full &&
+          results[renameIndex + 1] == 0 &&
+          results[renameIndex + 3] != 0)
+      {
+        ring->CloseSlot(DIRECTORY_SLOT);
+      }
+
+      if (error == 0)
+      {
+        return 0;
+      }
+      else
+      {
+        if (results[openIndex] == 0 &&
+            results[renameIndex] != 0)
+        {
+          unlink(tmp.c_str());
+        }
+
+        return Failure(error);
+      }
+    }
+
+#else
+
+    bool IsEnabled()
+    {
+      return false;
+    }
+
+
+    int ReadSmallFile(std::string &content,
+                      const std::string &path)
+    {
+      return ENOSYS;
+    }
+
+
+    int ReadFile(void *target,
+                 size_t size,
+                 const std::string &path)
+    {
+      return ENOSYS;
+    }
+
+
+    int WriteFileAtomic(const std::string &base,
+                        const void *content,
+                        size_t size,
+                        const std::string &path,
+                        IOToolbox::FsyncPolicy policy)
+    {
+      return ENOSYS;
+    }
+
+#endif
+
+
+    void GetStatistics(Json::Value &status)
+    {
+      status = Json::objectValue;
+#if SAOLA_ENABLE_IO_URING == 1
+      status["Compiled"] = true;
+      status["Available"] = !unavailable_.load();
+#else
+      status["Compiled"] = false;
+      status["Available"] = false;
+#endif
+      status["Enabled"] = SaolaConfiguration::Instance()->IOUringEnable();
+      status["PointerReads"] = static_cast<Json::UInt64>(pointerReadsCount_.load());
+      status["Reads"] = static_cast<Json::UInt64>(readsCount_.load());
+      status["Writes"] = static_cast<Json::UInt64>(writesCount_.load());
+      status["Fallbacks"] = static_cast<Json::UInt64>(fallbacksCount_.load());
+    }
+  }
+}
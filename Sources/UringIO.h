@@ -0,0 +1,56 @@
+#pragma once
+
+#include "IOToolbox.h"
+
+#include <json/value.h>
+
+#include <stdint.h>
+#include <string>
+
+namespace Saola
+{
+  // Optional io_uring backend of the storage area (CMake option
+  // "ENABLE_IO_URING", Linux >= 5.15). Each calling thread owns a
+  // ring, with a registered buffer for the small files and a table of
+  // direct descriptors. One operation (e.g. open, read, close) is
+  // submitted as one chain of linked requests: the kernel runs all its
+  // steps for the price of a single system call.
+  //
+  // The functions never throw: they return 0 on success, or the errno
+  // of the failed step (ENOSYS if io_uring is not available). On an
+  // error, the caller goes through the blocking path of IOToolbox,
+  // which retries and reports the failure as usual.
+  namespace UringIO
+  {
+    // Compiled in, enabled by "IOUring.Enable" and supported by the
+    // kernel (including a seccomp profile of a container)
+    bool IsEnabled();
+
+    // Reads a file of less than 4KB, such as a ".symlink" pointer, in
+    // one chain "openat -> read into the registered buffer -> close".
+    // Returns ENOENT if the file does not exist, and EFBIG if it is
+    // larger than the buffer.
+    int ReadSmallFile(std::string &content,
+                      const std::string &path);
+
+    // Reads "path", whose size must be exactly "size" (as recorded in
+    // the pointer), in one chain "openat -> read -> read past the end
+    // -> close". Returns EIO if the file is shorter, EFBIG if longer.
+    int ReadFile(void *target,
+                 size_t size,
+                 const std::string &path);
+
+    // Counterpart of "IOToolbox::WriteFileAtomic()" (without O_DIRECT),
+    // in one chain: "mkdirat" of each directory between "base" (that
+    // must exist) and the parent of "path", "openat" of the temporary
+    // file, "write", "fsync" according to "policy", "close", "renameat",
+    // and the flush of the parent directory for "FsyncPolicy_Full".
+    int WriteFileAtomic(const std::string &base,
+                        const void *content,
+                        size_t size,
+                        const std::string &path,
+                        IOToolbox::FsyncPolicy policy);
+
+    void GetStatistics(Json::Value &status);
+  }
+}
@@ -0,0 +1,154 @@
+#include "WorkerPool.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <memory>
+
+namespace Saola
+{
+  namespace
+  {
+    // Shared by the caller of "Run()" and its jobs
+    struct Batch
+    {
+      boost::mutex               mutex_;
+      boost::condition_variable  done_;
+      size_t                     pending_;
+
+      explicit Batch(size_t count) :
+        pending_(count)
+      {
+      }
+    };
+  }
+
+
+  WorkerPool::WorkerPool() :
+    stopping_(false)
+  {
+  }
+
+
+  WorkerPool::~WorkerPool()
+  {
+    Stop();
+  }
+
+
+  void WorkerPool::Worker()
+  {
+    for (;;)
+    {
+      Task task;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        while (tasks_.empty() &&
+               !stopping_)
+        {
+          taskAvailable_.wait(lock);
+        }
+
+        if (tasks_.empty())
+        {
+          return;  // Stopping
+        }
+
+        task = tasks_.front();
+        tasks_.pop_front();
+      }
+
+      task();
+    }
+  }
+
+
+  void WorkerPool::Run(size_t count,
+                       const std::function<void(size_t)> &job)
+  {
+    if (count == 0)
+    {
+      return;
+    }
+
+    std::shared_ptr<Batch> batch(new Batch(count));
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (stopping_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+
+      while (workers_.size() < count)
+      {
+        workers_.push_back(new std::thread(&WorkerPool::Worker, this));
+      }
+
+      for (size_t t = 0; t < count; t++)
+      {
+        tasks_.push_back([batch, &job, t]()
+        {
+          try
+          {
+            job(t);
+          }
+          catch (Orthanc::OrthancException &ex)
+          {
+            LOG(ERROR) << "[SaolaStorage] - Error in a worker thread: " << ex.What();
+          }
+          catch (std::exception &ex)
+          {
+            LOG(ERROR) << "[SaolaStorage] - Error in a worker thread: " << ex.what();
+          }
+
+          boost::mutex::scoped_lock lock(batch->mutex_);
+          batch->pending_--;
+          batch->done_.notify_all();
+        });
+      }
+    }
+
+    taskAvailable_.notify_all();
+
+    // "job" is referenced by the tasks until all of them are done
+    boost::mutex::scoped_lock lock(batch->mutex_);
+    while (batch->pending_ > 0)
+    {
+      batch->done_.wait(lock);
+    }
+  }
+
+
+  void WorkerPool::Stop()
+  {
+    std::vector<std::thread *> workers;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+      workers.swap(workers_);
+    }
+
+    taskAvailable_.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      if (workers[i]->joinable())
+      {
+        workers[i]->join();
+      }
+
+      delete workers[i];
+    }
+
+    {
+      // The threads are started again by the next batch
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = false;
+    }
+  }
+}
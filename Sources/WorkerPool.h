@@ -0,0 +1,46 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Threads shared by the batches of one background worker (tiering,
+  // spool uploads, replication), so that a batch does not create and
+  // join its own threads. The threads are started on demand, the
+  // first time a batch needs that many of them, and are kept until
+  // "Stop()" or the destruction of the pool.
+  class WorkerPool : public boost::noncopyable
+  {
+  private:
+    typedef std::function<void()> Task;
+
+    boost::mutex                mutex_;
+    boost::condition_variable   taskAvailable_;
+    std::deque<Task>            tasks_;
+    std::vector<std::thread *>  workers_;
+    bool                        stopping_;
+
+    void Worker();
+
+  public:
+    WorkerPool();
+
+    ~WorkerPool();
+
+    // Runs "job(0)" to "job(count - 1)" in parallel, and returns once
+    // all of them are done. The exceptions of "job" are logged and
+    // swallowed: it is expected to handle its own errors.
+    void Run(size_t count,
+             const std::function<void(size_t)> &job);
+
+    // Waits for the running jobs, and joins the threads
+    void Stop();
+  };
+}
@@ -0,0 +1,289 @@
+#include "WorkloadCapture.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace Saola
+{
+  static const char MAGIC[8] = { 'S', 'A', 'O', 'L', 'A', 'C', 'A', 'P' };
+  static const uint32_t VERSION = 1;
+  static const size_t WRITE_BATCH = 1024;
+  static const unsigned int GRANULARITY = 100;  // Milliseconds between two polls of the queue when idle
+
+  struct FileHeader
+  {
+    char      magic_[8];
+    uint32_t  version_;
+    uint32_t  recordSize_;
+  };
+
+  static_assert(sizeof(WorkloadRecord) == 72, "Unexpected padding in WorkloadRecord");
+  static_assert(sizeof(FileHeader) == 16, "Unexpected padding in FileHeader");
+
+  static uint64_t GetNowMicroseconds()
+  {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::system_clock::now().time_since_epoch()).count());
+  }
+
+  static bool ReadHeader(FILE *f)
+  {
+    FileHeader header;
+    return (fread(&header, sizeof(header), 1, f) == 1 &&
+            memcmp(header.magic_, MAGIC, sizeof(MAGIC)) == 0 &&
+            header.version_ == VERSION &&
+            header.recordSize_ == sizeof(WorkloadRecord));
+  }
+
+  WorkloadCapture::WorkloadCapture(const std::string &path,
+                                   size_t capacity) : path_(path), capacity_(1), mask_(0), enqueuePosition_(0), dequeuePosition_(0),
+                                                      running_(false), writer_(NULL), file_(NULL),
+                                                      capturedCount_(0), droppedCount_(0), writtenCount_(0)
+  {
+    while (capacity_ < capacity)
+    {
+      capacity_ *= 2;
+    }
+
+    cells_.reset(new Cell[capacity_]);
+    mask_ = capacity_ - 1;
+
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      cells_[i].sequence_ = i;
+    }
+  }
+
+  WorkloadCapture::~WorkloadCapture()
+  {
+    if (running_)
+    {
+      LOG(ERROR) << "[SaolaStorage][Capture]::Stop() should have been manually called";
+      Stop();
+    }
+  }
+
+  void WorkloadCapture::Record(IOOperation operation,
+                               const std::string &uuid,
+                               int contentType,
+                               uint64_t size,
+                               uint64_t rangeStart,
+                               uint64_t durationUs,
+                               bool success)
+  {
+    if (!running_)
+    {
+      return;
+    }
+
+    // Multiple-producers bounded queue: a cell is free for position
+    // "pos" iff its sequence equals "pos"
+    uint64_t position = enqueuePosition_.load(std::memory_order_relaxed);
+    Cell *cell = NULL;
+
+    for (;;)
+    {
+      cell = &cells_[position & mask_];
+      const int64_t diff = static_cast<int64_t>(cell->sequence_.load(std::memory_order_acquire)) - static_cast<int64_t>(position);
+
+      if (diff == 0)
+      {
+        if (enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        // Full, the writer thread is lagging behind
+        droppedCount_++;
+        return;
+      }
+      else
+      {
+        position = enqueuePosition_.load(std::memory_order_relaxed);
+      }
+    }
+
+    WorkloadRecord &record = cell->record_;
+    memset(&record, 0, sizeof(record));
+    record.timestamp_ = GetNowMicroseconds() - durationUs;
+    record.size_ = size;
+    record.rangeStart_ = rangeStart;
+    record.durationUs_ = static_cast<uint32_t>(std::min<uint64_t>(durationUs, 0xffffffffu));
+    record.operation_ = static_cast<uint8_t>(operation);
+    record.contentType_ = static_cast<uint8_t>(contentType);
+    record.success_ = success ? 1 : 0;
+    memcpy(record.uuid_, uuid.c_str(), std::min(uuid.size(), sizeof(record.uuid_)));
+
+    cell->sequence_.store(position + 1, std::memory_order_release);
+    capturedCount_++;
+  }
+
+  bool WorkloadCapture::Dequeue(WorkloadRecord &record)
+  {
+    Cell &cell = cells_[dequeuePosition_ & mask_];
+
+    if (cell.sequence_.load(std::memory_order_acquire) != dequeuePosition_ + 1)
+    {
+      return false;  // Empty, or the producer has not finished writing this cell
+    }
+
+    record = cell.record_;
+    cell.sequence_.store(dequeuePosition_ + capacity_, std::memory_order_release);
+    dequeuePosition_++;
+    return true;
+  }
+
+  void WorkloadCapture::Drain()
+  {
+    std::vector<WorkloadRecord> batch;
+    batch.reserve(WRITE_BATCH);
+
+    WorkloadRecord record;
+    while (Dequeue(record))
+    {
+      batch.push_back(record);
+
+      if (batch.size() == WRITE_BATCH)
+      {
+        writtenCount_ += fwrite(&batch[0], sizeof(WorkloadRecord), batch.size(), file_);
+        batch.clear();
+      }
+    }
+
+    if (!batch.empty())
+    {
+      writtenCount_ += fwrite(&batch[0], sizeof(WorkloadRecord), batch.size(), file_);
+    }
+
+    fflush(file_);
+  }
+
+  void WorkloadCapture::Start()
+  {
+    if (running_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    // Append to a previous capture if its format is compatible
+    bool isNew = true;
+
+    FILE *existing = fopen(path_.c_str(), "rb");
+    if (existing != NULL)
+    {
+      const bool compatible = ReadHeader(existing);
+      fseek(existing, 0, SEEK_END);
+      isNew = (ftell(existing) == 0);
+      fclose(existing);
+
+      if (!isNew && !compatible)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Not a workload capture file: " + path_);
+      }
+    }
+
+    file_ = fopen(path_.c_str(), "ab");
+    if (file_ == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot open the workload capture file: " + path_);
+    }
+
+    if (isNew)
+    {
+      FileHeader header;
+      memcpy(header.magic_, MAGIC, sizeof(MAGIC));
+      header.version_ = VERSION;
+      header.recordSize_ = sizeof(WorkloadRecord);
+      fwrite(&header, sizeof(header), 1, file_);
+    }
+
+    LOG(WARNING) << "[SaolaStorage][Capture] - Capturing the storage workload into: " << path_;
+
+    running_ = true;
+
+    writer_ = new std::thread([this]()
+    {
+      while (running_)
+      {
+        Drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds(GRANULARITY));
+      }
+    });
+  }
+
+  void WorkloadCapture::Stop()
+  {
+    if (running_)
+    {
+      running_ = false;
+
+      if (writer_->joinable())
+      {
+        writer_->join();
+      }
+
+      delete writer_;
+      writer_ = NULL;
+
+      // The callbacks that were running while stopping have now completed
+      Drain();
+      fclose(file_);
+      file_ = NULL;
+
+      LOG(WARNING) << "[SaolaStorage][Capture] - Stopped, " << writtenCount_.load() << " record(s) written, "
+                   << droppedCount_.load() << " dropped";
+    }
+  }
+
+  void WorkloadCapture::GetStatistics(Json::Value &status) const
+  {
+    status["Path"] = path_;
+    status["Running"] = running_.load();
+    status["CapturedCount"] = static_cast<Json::UInt64>(capturedCount_.load());
+    status["WrittenCount"] = static_cast<Json::UInt64>(writtenCount_.load());
+    status["DroppedCount"] = static_cast<Json::UInt64>(droppedCount_.load());
+  }
+
+  bool WorkloadCapture::IsCaptureFile(const std::string &path)
+  {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL)
+    {
+      return false;
+    }
+
+    const bool ok = ReadHeader(f);
+    fclose(f);
+    return ok;
+  }
+
+  void WorkloadCapture::ReadCaptureFile(std::vector<WorkloadRecord> &records,
+                                        const std::string &path)
+  {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "Cannot open the workload capture file: " + path);
+    }
+
+    if (!ReadHeader(f))
+    {
+      fclose(f);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Not a workload capture file: " + path);
+    }
+
+    WorkloadRecord record;
+    while (fread(&record, sizeof(record), 1, f) == 1)
+    {
+      records.push_back(record);
+    }
+
+    fclose(f);
+  }
+}
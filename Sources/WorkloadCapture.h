@@ -0,0 +1,92 @@
+#pragma once
+
+#include "IOLatencyRecorder.h"
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Saola
+{
+  // Fixed-size record of one storage callback, as written to the
+  // capture file (host byte order)
+  struct WorkloadRecord
+  {
+    uint64_t  timestamp_;     // Microseconds since epoch, at the start of the callback
+    uint64_t  size_;          // Size of the attachment, or of the range for ReadRange
+    uint64_t  rangeStart_;
+    uint32_t  durationUs_;
+    uint8_t   operation_;     // IOOperation
+    uint8_t   contentType_;   // OrthancPluginContentType
+    uint8_t   success_;
+    uint8_t   reserved_[5];
+    char      uuid_[36];      // Not null-terminated
+  };
+
+  // Logs every storage callback to a binary trace file that can be
+  // replayed offline by "SaolaStorageReplay". The callbacks push into
+  // a bounded lock-free queue (records are dropped if it is full),
+  // a background thread writes them to disk.
+  class WorkloadCapture : public boost::noncopyable
+  {
+  private:
+    struct Cell
+    {
+      std::atomic<uint64_t>  sequence_;
+      WorkloadRecord         record_;
+    };
+
+    std::string              path_;
+    std::unique_ptr<Cell[]>  cells_;
+    size_t                   capacity_;  // Power of 2
+    size_t                   mask_;
+    std::atomic<uint64_t>    enqueuePosition_;
+    uint64_t                 dequeuePosition_;  // Only used by the writer thread
+
+    std::atomic<bool>        running_;
+    std::thread             *writer_;
+    FILE                    *file_;
+
+    std::atomic<uint64_t>    capturedCount_;
+    std::atomic<uint64_t>    droppedCount_;
+    std::atomic<uint64_t>    writtenCount_;
+
+    bool Dequeue(WorkloadRecord &record);
+
+    void Drain();
+
+  public:
+    WorkloadCapture(const std::string &path,
+                    size_t capacity);
+
+    ~WorkloadCapture();
+
+    void Start();
+
+    void Stop();
+
+    // Never blocks, safe to call from the storage callbacks
+    void Record(IOOperation operation,
+                const std::string &uuid,
+                int contentType,
+                uint64_t size,
+                uint64_t rangeStart,
+                uint64_t durationUs,
+                bool success);
+
+    void GetStatistics(Json::Value &status) const;
+
+    // Used by the replay harness
+    static bool IsCaptureFile(const std::string &path);
+
+    static void ReadCaptureFile(std::vector<WorkloadRecord> &records,
+                                const std::string &path);
+  };
+}
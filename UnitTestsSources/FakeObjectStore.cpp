@@ -0,0 +1,408 @@
+#include "FakeObjectStore.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace SaolaTests
+{
+  static std::string ToLower(const std::string &s)
+  {
+    std::string result(s);
+    std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+    return result;
+  }
+
+
+  static std::string MakeAnswer(unsigned int status,
+                                const std::string &reason,
+                                const std::string &body,
+                                const std::string &headers = "",
+                                bool isHead = false)
+  {
+    return ("HTTP/1.1 " + boost::lexical_cast<std::string>(status) + " " + reason + "\r\n" +
+            headers +
+            "Content-Length: " + boost::lexical_cast<std::string>(body.size()) + "\r\n\r\n" +
+            (isHead ? std::string() : body));
+  }
+
+
+  static std::string MakeError(unsigned int status,
+                               const std::string &reason,
+                               const std::string &code)
+  {
+    return MakeAnswer(status, reason, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Error><Code>" + code + "</Code></Error>");
+  }
+
+
+  // Value of "name" in the query string "a=1&b=2"
+  static bool LookupArgument(std::string &value,
+                             const std::string &query,
+                             const std::string &name)
+  {
+    size_t start = 0;
+    while (start <= query.size())
+    {
+      size_t end = query.find('&', start);
+      if (end == std::string::npos)
+      {
+        end = query.size();
+      }
+
+      const std::string item = query.substr(start, end - start);
+      const size_t equal = item.find('=');
+      if (item.substr(0, equal) == name)
+      {
+        value = (equal == std::string::npos ? "" : item.substr(equal + 1));
+        return true;
+      }
+
+      start = end + 1;
+    }
+
+    return false;
+  }
+
+
+  FakeObjectStore::FakeObjectStore() :
+    listener_(-1),
+    port_(0),
+    stopped_(false),
+    nextUploadId_(1),
+    connectionsCount_(0),
+    requestsCount_(0),
+    rangedGetsCount_(0),
+    partsCount_(0)
+  {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;  // Ephemeral port
+
+    socklen_t length = sizeof(address);
+    if (listener_ < 0 ||
+        bind(listener_, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener_, 64) != 0 ||
+        getsockname(listener_, reinterpret_cast<struct sockaddr *>(&address), &length) != 0)
+    {
+      if (listener_ >= 0)
+      {
+        close(listener_);
+      }
+
+      throw std::runtime_error("Cannot start the fake object store");
+    }
+
+    port_ = ntohs(address.sin_port);
+    acceptor_ = std::thread(&FakeObjectStore::Accept, this);
+  }
+
+
+  FakeObjectStore::~FakeObjectStore()
+  {
+    stopped_ = true;
+
+    // Unblocks "accept()" and the pending "recv()"
+    shutdown(listener_, SHUT_RDWR);
+    acceptor_.join();
+    close(listener_);
+
+    std::vector<std::thread> connections;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (size_t i = 0; i < sockets_.size(); i++)
+      {
+        shutdown(sockets_[i], SHUT_RDWR);
+      }
+
+      connections.swap(connections_);
+    }
+
+    for (size_t i = 0; i < connections.size(); i++)
+    {
+      connections[i].join();
+    }
+  }
+
+
+  std::string FakeObjectStore::GetEndpoint() const
+  {
+    return "http://127.0.0.1:" + boost::lexical_cast<std::string>(port_);
+  }
+
+
+  bool FakeObjectStore::HasObject(const std::string &bucket,
+                                  const std::string &key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return objects_.find("/" + bucket + "/" + key) != objects_.end();
+  }
+
+
+  size_t FakeObjectStore::GetObjectsCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return objects_.size();
+  }
+
+
+  void FakeObjectStore::Accept()
+  {
+    while (!stopped_)
+    {
+      const int client = accept(listener_, NULL, NULL);
+      if (client < 0)
+      {
+        continue;
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (stopped_)
+      {
+        close(client);
+        return;
+      }
+
+      connectionsCount_++;
+      sockets_.push_back(client);
+      connections_.push_back(std::thread(&FakeObjectStore::Serve, this, client));
+    }
+  }
+
+
+  void FakeObjectStore::Disconnect(int socket)
+  {
+    // Forgotten before being closed, as its number can be reused at once
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      sockets_.erase(std::remove(sockets_.begin(), sockets_.end(), socket), sockets_.end());
+    }
+
+    close(socket);
+  }
+
+
+  void FakeObjectStore::Serve(int socket)
+  {
+    std::string buffer;
+    char chunk[64 * 1024];
+
+    for (;;)
+    {
+      size_t headerEnd;
+      while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+      {
+        const ssize_t n = recv(socket, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+        {
+          Disconnect(socket);
+          return;
+        }
+
+        buffer.append(chunk, static_cast<size_t>(n));
+      }
+
+      std::map<std::string, std::string> headers;
+      std::string method, target;
+
+      {
+        const std::string head = buffer.substr(0, headerEnd);
+
+        size_t eol = head.find("\r\n");
+        const std::string requestLine = head.substr(0, eol);
+        const size_t space1 = requestLine.find(' ');
+        const size_t space2 = requestLine.find(' ', space1 + 1);
+        method = requestLine.substr(0, space1);
+        target = requestLine.substr(space1 + 1, space2 - space1 - 1);
+
+        while (eol != std::string::npos)
+        {
+          const size_t start = eol + 2;
+          eol = head.find("\r\n", start);
+
+          const std::string line = head.substr(start, eol == std::string::npos ? std::string::npos : eol - start);
+          const size_t colon = line.find(':');
+          if (colon != std::string::npos)
+          {
+            size_t value = colon + 1;
+            while (value < line.size() && line[value] == ' ')
+            {
+              value++;
+            }
+
+            headers[ToLower(line.substr(0, colon))] = line.substr(value);
+          }
+        }
+      }
+
+      buffer.erase(0, headerEnd + 4);
+
+      const size_t bodySize = (headers.find("content-length") == headers.end() ? 0 :
+                               boost::lexical_cast<size_t>(headers["content-length"]));
+
+      while (buffer.size() < bodySize)
+      {
+        const ssize_t n = recv(socket, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+        {
+          Disconnect(socket);
+          return;
+        }
+
+        buffer.append(chunk, static_cast<size_t>(n));
+      }
+
+      const std::string body = buffer.substr(0, bodySize);
+      buffer.erase(0, bodySize);
+
+      requestsCount_++;
+
+      std::string answer;
+      Handle(answer, method, target, headers, body);
+
+      size_t sent = 0;
+      while (sent < answer.size())
+      {
+        const ssize_t n = send(socket, answer.c_str() + sent, answer.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+          Disconnect(socket);
+          return;
+        }
+
+        sent += static_cast<size_t>(n);
+      }
+    }
+  }
+
+
+  void FakeObjectStore::Handle(std::string &answer,
+                               const std::string &method,
+                               const std::string &target,
+                               const std::map<std::string, std::string> &headers,
+                               const std::string &body)
+  {
+    const size_t question = target.find('?');
+    const std::string path = target.substr(0, question);
+    const std::string query = (question == std::string::npos ? "" : target.substr(question + 1));
+
+    std::string uploadId, partNumber;
+    const bool hasUploadId = LookupArgument(uploadId, query, "uploadId");
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (method == "POST" && LookupArgument(uploadId, query, "uploads"))
+    {
+      uploadId = "upload-" + boost::lexical_cast<std::string>(nextUploadId_++);
+      uploads_[uploadId].clear();
+      answer = MakeAnswer(200, "OK", "<InitiateMultipartUploadResult><UploadId>" + uploadId + "</UploadId></InitiateMultipartUploadResult>");
+    }
+    else if (method == "PUT" && hasUploadId && LookupArgument(partNumber, query, "partNumber"))
+    {
+      if (uploads_.find(uploadId) == uploads_.end())
+      {
+        answer = MakeError(404, "Not Found", "NoSuchUpload");
+        return;
+      }
+
+      uploads_[uploadId][boost::lexical_cast<unsigned int>(partNumber)] = body;
+      partsCount_++;
+      answer = MakeAnswer(200, "OK", "", "ETag: \"etag-" + partNumber + "\"\r\n");
+    }
+    else if (method == "POST" && hasUploadId)
+    {
+      std::map<std::string, std::map<unsigned int, std::string> >::iterator upload = uploads_.find(uploadId);
+      if (upload == uploads_.end())
+      {
+        answer = MakeError(404, "Not Found", "NoSuchUpload");
+        return;
+      }
+
+      // Each listed part must have been uploaded
+      std::string content;
+      for (std::map<unsigned int, std::string>::const_iterator part = upload->second.begin(); part != upload->second.end(); ++part)
+      {
+        if (body.find("<PartNumber>" + boost::lexical_cast<std::string>(part->first) + "</PartNumber>") == std::string::npos)
+        {
+          answer = MakeAnswer(200, "OK", "<Error><Code>InvalidPart</Code></Error>");
+          return;
+        }
+
+        content += part->second;
+      }
+
+      objects_[path] = content;
+      uploads_.erase(upload);
+      answer = MakeAnswer(200, "OK", "<CompleteMultipartUploadResult></CompleteMultipartUploadResult>");
+    }
+    else if (method == "DELETE" && hasUploadId)
+    {
+      uploads_.erase(uploadId);
+      answer = MakeAnswer(204, "No Content", "");
+    }
+    else if (method == "PUT")
+    {
+      objects_[path] = body;
+      answer = MakeAnswer(200, "OK", "", "ETag: \"etag\"\r\n");
+    }
+    else if (method == "GET" || method == "HEAD")
+    {
+      std::map<std::string, std::string>::const_iterator found = objects_.find(path);
+      if (found == objects_.end())
+      {
+        answer = (method == "HEAD" ? MakeAnswer(404, "Not Found", "") : MakeError(404, "Not Found", "NoSuchKey"));
+        return;
+      }
+
+      const std::string &content = found->second;
+
+      std::map<std::string, std::string>::const_iterator range = headers.find("range");
+      unsigned long long start, end;
+      if (method == "GET" &&
+          range != headers.end() &&
+          sscanf(range->second.c_str(), "bytes=%llu-%llu", &start, &end) == 2)
+      {
+        if (start >= content.size() ||
+            end < start)
+        {
+          answer = MakeError(416, "Range Not Satisfiable", "InvalidRange");
+          return;
+        }
+
+        end = std::min(end, static_cast<unsigned long long>(content.size() - 1));
+        rangedGetsCount_++;
+        answer = MakeAnswer(206, "Partial Content", content.substr(start, end - start + 1),
+                            "Content-Range: bytes " + boost::lexical_cast<std::string>(start) + "-" +
+                            boost::lexical_cast<std::string>(end) + "/" + boost::lexical_cast<std::string>(content.size()) + "\r\n");
+      }
+      else
+      {
+        answer = MakeAnswer(200, "OK", content, "", method == "HEAD");
+      }
+    }
+    else if (method == "DELETE")
+    {
+      objects_.erase(path);
+      answer = MakeAnswer(204, "No Content", "");
+    }
+    else
+    {
+      answer = MakeError(400, "Bad Request", "NotImplemented");
+    }
+  }
+}
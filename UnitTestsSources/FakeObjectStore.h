@@ -0,0 +1,86 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SaolaTests
+{
+  // In-memory stand-in for an S3-compatible object store (e.g. MinIO),
+  // listening on an ephemeral port of the loopback interface. It
+  // implements the requests issued by "S3Backend": PUT, GET (with a
+  // "Range" header), HEAD, DELETE and the multipart uploads. The
+  // signatures are not checked.
+  class FakeObjectStore : public boost::noncopyable
+  {
+  private:
+    int       listener_;
+    uint16_t  port_;
+
+    std::atomic<bool>  stopped_;
+    std::thread        acceptor_;
+
+    boost::mutex               mutex_;
+    std::vector<std::thread>   connections_;
+    std::vector<int>           sockets_;
+    std::map<std::string, std::string>  objects_;   // By "/bucket/key"
+    std::map<std::string, std::map<unsigned int, std::string> >  uploads_;
+    unsigned int  nextUploadId_;
+
+    std::atomic<uint64_t>  connectionsCount_;
+    std::atomic<uint64_t>  requestsCount_;
+    std::atomic<uint64_t>  rangedGetsCount_;
+    std::atomic<uint64_t>  partsCount_;
+
+    void Accept();
+
+    void Serve(int socket);
+
+    void Disconnect(int socket);
+
+    void Handle(std::string &answer,
+                const std::string &method,
+                const std::string &target,
+                const std::map<std::string, std::string> &headers,
+                const std::string &body);
+
+  public:
+    FakeObjectStore();
+
+    ~FakeObjectStore();
+
+    // "http://127.0.0.1:<port>"
+    std::string GetEndpoint() const;
+
+    bool HasObject(const std::string &bucket,
+                   const std::string &key);
+
+    size_t GetObjectsCount();
+
+    uint64_t GetConnectionsCount() const
+    {
+      return connectionsCount_;
+    }
+
+    uint64_t GetRequestsCount() const
+    {
+      return requestsCount_;
+    }
+
+    uint64_t GetRangedGetsCount() const
+    {
+      return rangedGetsCount_;
+    }
+
+    uint64_t GetPartsCount() const
+    {
+      return partsCount_;
+    }
+  };
+}
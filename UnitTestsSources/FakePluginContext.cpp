@@ -0,0 +1,256 @@
+#include "FakePluginContext.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace SaolaTests
+{
+  static char *CopyString(const std::string &s)
+  {
+    char *result = reinterpret_cast<char *>(malloc(s.size() + 1));
+    if (result != NULL)
+    {
+      memcpy(result, s.c_str(), s.size() + 1);
+    }
+
+    return result;
+  }
+
+  void FakePluginContext::Free(void *buffer)
+  {
+    free(buffer);
+  }
+
+  OrthancPluginErrorCode FakePluginContext::InvokeService(OrthancPluginContext *context,
+                                                          _OrthancPluginService service,
+                                                          const void *params)
+  {
+    return reinterpret_cast<FakePluginContext *>(context->pluginsManager)->Invoke(service, params);
+  }
+
+  void FakePluginContext::Log(const char *level,
+                              const char *message)
+  {
+    if (verbose_)
+    {
+      std::cerr << level << " " << message << std::endl;
+    }
+  }
+
+  OrthancPluginErrorCode FakePluginContext::Invoke(_OrthancPluginService service,
+                                                   const void *params)
+  {
+    switch (service)
+    {
+    case _OrthancPluginService_LogInfo:
+      Log("I", reinterpret_cast<const char *>(params));
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_LogWarning:
+      Log("W", reinterpret_cast<const char *>(params));
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_LogError:
+      Log("E", reinterpret_cast<const char *>(params));
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_LogMessage:
+    {
+      const _OrthancPluginLogMessage &p = *reinterpret_cast<const _OrthancPluginLogMessage *>(params);
+      Log(p.level == OrthancPluginLogLevel_Error ? "E" : (p.level == OrthancPluginLogLevel_Warning ? "W" : "I"), p.message);
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_GetConfiguration:
+    {
+      const _OrthancPluginRetrieveDynamicString &p = *reinterpret_cast<const _OrthancPluginRetrieveDynamicString *>(params);
+      *p.result = CopyString(configuration_);
+      return (*p.result == NULL ? OrthancPluginErrorCode_NotEnoughMemory : OrthancPluginErrorCode_Success);
+    }
+
+    case _OrthancPluginService_GetDatabaseServerIdentifier:
+    {
+      const _OrthancPluginRetrieveStaticString &p = *reinterpret_cast<const _OrthancPluginRetrieveStaticString *>(params);
+      *p.result = databaseServerIdentifier_.c_str();
+      return OrthancPluginErrorCode_Success;
+    }
+
+    case _OrthancPluginService_CreateMemoryBuffer64:
+    {
+      const _OrthancPluginCreateMemoryBuffer64 &p = *reinterpret_cast<const _OrthancPluginCreateMemoryBuffer64 *>(params);
+      p.target->size = p.size;
+      p.target->data = malloc(p.size == 0 ? 1 : p.size);
+      return (p.target->data == NULL ? OrthancPluginErrorCode_NotEnoughMemory : OrthancPluginErrorCode_Success);
+    }
+
+    case _OrthancPluginService_DicomBufferToJson:
+    {
+      const _OrthancPluginDicomToJson &p = *reinterpret_cast<const _OrthancPluginDicomToJson *>(params);
+
+      std::string s;
+
+      {
+        boost::mutex::scoped_lock lock(dicomTagsMutex_);
+        Orthanc::Toolbox::WriteFastJson(s, dicomTags_);
+      }
+
+      *p.result = CopyString(s);
+      return (*p.result == NULL ? OrthancPluginErrorCode_NotEnoughMemory : OrthancPluginErrorCode_Success);
+    }
+
+    case _OrthancPluginService_GetInstanceJson:
+    {
+      // The "Full" format, as expected by "FilterIncomingDicomInstance()"
+      const _OrthancPluginAccessDicomInstance &p = *reinterpret_cast<const _OrthancPluginAccessDicomInstance *>(params);
+
+      Json::Value full = Json::objectValue;
+
+      {
+        boost::mutex::scoped_lock lock(dicomTagsMutex_);
+
+        Json::Value::Members tags = dicomTags_.getMemberNames();
+        for (size_t i = 0; i < tags.size(); i++)
+        {
+          full[tags[i]]["Type"] = "String";
+          full[tags[i]]["Value"] = dicomTags_[tags[i]];
+        }
+      }
+
+      std::string s;
+      Orthanc::Toolbox::WriteFastJson(s, full);
+      *p.resultStringToFree = CopyString(s);
+      return (*p.resultStringToFree == NULL ? OrthancPluginErrorCode_NotEnoughMemory : OrthancPluginErrorCode_Success);
+    }
+
+    case _OrthancPluginService_RestApiGet:
+      // No resource is ever stored in the fake Orthanc core
+      return OrthancPluginErrorCode_UnknownResource;
+
+    case _OrthancPluginService_RegisterStorageArea2:
+      storageArea_ = *reinterpret_cast<const _OrthancPluginRegisterStorageArea2 *>(params);
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_RegisterOnChangeCallback:
+      onChange_ = reinterpret_cast<const _OrthancPluginOnChangeCallback *>(params)->callback;
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_RegisterIncomingDicomInstanceFilter:
+      incomingFilter_ = reinterpret_cast<const _OrthancPluginIncomingDicomInstanceFilter *>(params)->callback;
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_RegisterRestCallback:
+    case _OrthancPluginService_RegisterRestCallbackNoLock:
+    case _OrthancPluginService_SetPluginProperty:
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_SetMetricsValue:
+    {
+      const _OrthancPluginSetMetricsValue &p = *reinterpret_cast<const _OrthancPluginSetMetricsValue *>(params);
+      boost::mutex::scoped_lock lock(metricsMutex_);
+      metrics_[p.name] = p.value;
+      return OrthancPluginErrorCode_Success;
+    }
+
+    default:
+      Log("E", ("Service not implemented by the fake plugin context: " + std::to_string(static_cast<int>(service))).c_str());
+      return OrthancPluginErrorCode_NotImplemented;
+    }
+  }
+
+  FakePluginContext::FakePluginContext(const Json::Value &configuration) :
+    databaseServerIdentifier_("unit-tests"),
+    verbose_(false),
+    dicomTags_(Json::objectValue),
+    onChange_(NULL),
+    incomingFilter_(NULL)
+  {
+    memset(&storageArea_, 0, sizeof(storageArea_));
+
+    Orthanc::Toolbox::WriteFastJson(configuration_, configuration);
+
+    context_.pluginsManager = this;
+    context_.orthancVersion = "1.12.5";
+    context_.Free = Free;
+    context_.InvokeService = InvokeService;
+  }
+
+  void FakePluginContext::SetDicomTags(const Json::Value &tags)
+  {
+    boost::mutex::scoped_lock lock(dicomTagsMutex_);
+    dicomTags_ = tags;
+  }
+
+  const _OrthancPluginRegisterStorageArea2 &FakePluginContext::GetStorageArea() const
+  {
+    if (storageArea_.create == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "The plugin has not registered its storage area");
+    }
+
+    return storageArea_;
+  }
+
+  void FakePluginContext::NotifyChange(OrthancPluginChangeType changeType)
+  {
+    if (onChange_ != NULL)
+    {
+      onChange_(changeType, OrthancPluginResourceType_None, NULL);
+    }
+  }
+
+  bool FakePluginContext::FilterIncomingInstance()
+  {
+    // The instance is opaque to the plugin, which only accesses it through "GetInstanceJson"
+    static const char INSTANCE = 0;
+
+    return (incomingFilter_ == NULL ||
+            incomingFilter_(reinterpret_cast<const OrthancPluginDicomInstance *>(&INSTANCE)) != 0);
+  }
+
+  bool FakePluginContext::LookupMetric(float &value,
+                                       const std::string &name)
+  {
+    boost::mutex::scoped_lock lock(metricsMutex_);
+
+    std::map<std::string, float>::const_iterator found = metrics_.find(name);
+    if (found == metrics_.end())
+    {
+      return false;
+    }
+    else
+    {
+      value = found->second;
+      return true;
+    }
+  }
+
+  void FakePluginContext::CreateConfiguration(Json::Value &configuration,
+                                              const std::string &directory)
+  {
+    const boost::filesystem::path root(directory);
+
+    configuration = Json::objectValue;
+    configuration["StorageDirectory"] = (root / "storage").string();
+    configuration["SaolaStorage"] = Json::objectValue;
+    configuration["SaolaStorage"]["Enable"] = true;
+    configuration["SaolaStorage"]["MountDirectory"] = (root / "mount").string();
+    configuration["SaolaStorage"]["StoragePathFormat"] = "FULL";
+    configuration["SaolaStorage"]["DelayedDeletion"] = Json::objectValue;
+    configuration["SaolaStorage"]["DelayedDeletion"]["Path"] = (root / "pending-deletions.db").string();
+    configuration["SaolaStorage"]["Tiering"] = Json::objectValue;
+    configuration["SaolaStorage"]["Tiering"]["ColdMountDirectory"] = (root / "cold").string();
+    configuration["SaolaStorage"]["Tiering"]["Path"] = (root / "tiering.db").string();
+    configuration["SaolaStorage"]["Pruner"] = Json::objectValue;
+    configuration["SaolaStorage"]["Pruner"]["GraceSeconds"] = 0;
+    configuration["SaolaStorage"]["Checksum"] = Json::objectValue;
+    configuration["SaolaStorage"]["Checksum"]["Verify"] = "Always";
+    configuration["SaolaStorage"]["DiskSpace"] = Json::objectValue;
+    configuration["SaolaStorage"]["DiskSpace"]["HighWaterPercent"] = 100;  // Whatever the free space of the build machine
+  }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
+#include <map>
+#include <string>
+
+namespace SaolaTests
+{
+  // Minimal stand-in for the Orthanc core, implementing the services
+  // of the plugin SDK that are used by the storage area. This allows
+  // to drive "StorageArea" and the workers without a running Orthanc.
+  class FakePluginContext : public boost::noncopyable
+  {
+  private:
+    OrthancPluginContext context_;
+    std::string configuration_;
+    std::string databaseServerIdentifier_;
+    bool verbose_;
+
+    boost::mutex dicomTagsMutex_;
+    Json::Value dicomTags_;
+
+    // Callbacks registered by "OrthancPluginInitialize()"
+    _OrthancPluginRegisterStorageArea2 storageArea_;
+    OrthancPluginOnChangeCallback onChange_;
+    OrthancPluginIncomingDicomInstanceFilter incomingFilter_;
+
+    boost::mutex metricsMutex_;
+    std::map<std::string, float> metrics_;
+
+    static void Free(void *buffer);
+
+    static OrthancPluginErrorCode InvokeService(OrthancPluginContext *context,
+                                                _OrthancPluginService service,
+                                                const void *params);
+
+    OrthancPluginErrorCode Invoke(_OrthancPluginService service,
+                                  const void *params);
+
+    void Log(const char *level,
+             const char *message);
+
+  public:
+    // "configuration" is the content of the Orthanc configuration file
+    explicit FakePluginContext(const Json::Value &configuration);
+
+    OrthancPluginContext *GetContext()
+    {
+      return &context_;
+    }
+
+    void SetVerbose(bool verbose)
+    {
+      verbose_ = verbose;
+    }
+
+    // Tags returned by "OrthancPluginDicomBufferToJson()", in the "Short" format
+    void SetDicomTags(const Json::Value &tags);
+
+    // The storage area registered by the plugin through "OrthancPluginRegisterStorageArea2()"
+    const _OrthancPluginRegisterStorageArea2 &GetStorageArea() const;
+
+    void NotifyChange(OrthancPluginChangeType changeType);
+
+    // Runs the incoming instance filter of the plugin (if any) on the current DICOM tags
+    bool FilterIncomingInstance();
+
+    bool LookupMetric(float &value,
+                      const std::string &name);
+
+    // Creates the configuration of a plugin storing into the given temporary directory
+    static void CreateConfiguration(Json::Value &configuration,
+                                    const std::string &directory);
+  };
+
+  // Provided by the "main()" of each test executable
+  FakePluginContext &GetFakeContext();
+
+  const std::string &GetTemporaryDirectory();
+}
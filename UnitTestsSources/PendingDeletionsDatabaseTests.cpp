@@ -0,0 +1,279 @@
+#include "FakePluginContext.h"
+
+#include "../Sources/PendingDeletionsDatabase.h"
+
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+static std::string GetDatabasePath()
+{
+  return (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) /
+          ("pending-" + Orthanc::Toolbox::GenerateUuid() + ".db")).string();
+}
+
+TEST(PendingDeletionsDatabase, EnqueueDequeue)
+{
+  Saola::PendingDeletionsDatabase db(GetDatabasePath());
+  ASSERT_EQ(0u, db.GetSize());
+
+  std::string uuid;
+  Orthanc::FileContentType type;
+  ASSERT_FALSE(db.Dequeue(uuid, type));
+
+  db.Enqueue("a", Orthanc::FileContentType_Dicom);
+  db.Enqueue("b", Orthanc::FileContentType_DicomAsJson);
+  ASSERT_EQ(2u, db.GetSize());
+
+  std::set<std::string> dequeued;
+
+  ASSERT_TRUE(db.Dequeue(uuid, type));
+  dequeued.insert(uuid);
+  ASSERT_TRUE(db.Dequeue(uuid, type));
+  dequeued.insert(uuid);
+  ASSERT_FALSE(db.Dequeue(uuid, type));
+
+  ASSERT_EQ(2u, dequeued.size());
+  ASSERT_TRUE(dequeued.count("a") == 1 && dequeued.count("b") == 1);
+  ASSERT_EQ(0u, db.GetSize());
+}
+
+TEST(PendingDeletionsDatabase, Persistence)
+{
+  const std::string path = GetDatabasePath();
+
+  {
+    Saola::PendingDeletionsDatabase db(path);
+    db.Enqueue("a", Orthanc::FileContentType_DicomUntilPixelData);
+  }
+
+  {
+    Saola::PendingDeletionsDatabase db(path);
+    ASSERT_EQ(1u, db.GetSize());
+
+    std::string uuid;
+    Orthanc::FileContentType type;
+    ASSERT_TRUE(db.Dequeue(uuid, type));
+    ASSERT_EQ("a", uuid);
+    ASSERT_EQ(Orthanc::FileContentType_DicomUntilPixelData, type);
+  }
+}
+
+TEST(PendingDeletionsDatabase, Orphans)
+{
+  Saola::PendingDeletionsDatabase db(GetDatabasePath());
+
+  // Two orphaned copies of the same attachment
+  db.EnqueueOrphan("a", "/mount1/a");
+  db.EnqueueOrphan("a", "/mount2/a");
+  db.Enqueue("b", Orthanc::FileContentType_Dicom);
+  ASSERT_EQ(3u, db.GetSize());
+
+  std::set<std::string> paths;
+  std::string uuid, path;
+  Orthanc::FileContentType type;
+
+  while (db.Dequeue(uuid, type, path))
+  {
+    if (uuid == "a")
+    {
+      paths.insert(path);
+    }
+    else
+    {
+      ASSERT_EQ("b", uuid);
+      ASSERT_TRUE(path.empty());
+    }
+  }
+
+  ASSERT_EQ(2u, paths.size());
+  ASSERT_EQ(0u, db.GetSize());
+}
+
+TEST(PendingDeletionsDatabase, Priorities)
+{
+  Saola::PendingDeletionsDatabase db(GetDatabasePath());
+
+  db.Enqueue("purge1", Orthanc::FileContentType_Dicom);
+  db.Enqueue("purge2", Orthanc::FileContentType_Dicom);
+  db.Enqueue("urgent", Orthanc::FileContentType_Dicom, 10);
+  db.Enqueue("purge3", Orthanc::FileContentType_Dicom);
+
+  ASSERT_TRUE(db.SetPriority("purge3", 5));
+  ASSERT_FALSE(db.SetPriority("nope", 5));
+
+  std::map<int, unsigned int> byPriority;
+  db.GetSizeByPriority(byPriority);
+  ASSERT_EQ(3u, byPriority.size());
+  ASSERT_EQ(2u, byPriority[0]);
+
+  std::string uuid;
+  Orthanc::FileContentType type;
+  ASSERT_TRUE(db.Dequeue(uuid, type));  ASSERT_EQ("urgent", uuid);
+  ASSERT_TRUE(db.Dequeue(uuid, type));  ASSERT_EQ("purge3", uuid);
+  ASSERT_TRUE(db.Dequeue(uuid, type));  ASSERT_EQ("purge1", uuid);
+  ASSERT_TRUE(db.Dequeue(uuid, type));  ASSERT_EQ("purge2", uuid);
+  ASSERT_FALSE(db.Dequeue(uuid, type));
+}
+
+TEST(PendingDeletionsDatabase, Aging)
+{
+  // One level of priority is worth one second of waiting
+  Saola::PendingDeletionsDatabase db(GetDatabasePath(), 1);
+
+  db.Enqueue("old", Orthanc::FileContentType_Dicom, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+  db.Enqueue("recent", Orthanc::FileContentType_Dicom, 1);
+
+  std::string uuid;
+  Orthanc::FileContentType type;
+  ASSERT_TRUE(db.Dequeue(uuid, type));
+  ASSERT_EQ("old", uuid);
+}
+
+TEST(PendingDeletionsDatabase, DequeueBatch)
+{
+  Saola::PendingDeletionsDatabase db(GetDatabasePath());
+
+  db.Enqueue("a", Orthanc::FileContentType_Dicom);
+  db.Enqueue("b", Orthanc::FileContentType_Dicom);
+  db.EnqueueOrphan("c", "/mount/c");
+  db.Enqueue("d", Orthanc::FileContentType_Dicom, 1);
+
+  std::vector<Saola::PendingDeletionsDatabase::Entry> entries;
+  db.DequeueBatch(entries, 3);
+  ASSERT_EQ(3u, entries.size());
+  ASSERT_EQ("d", entries[0].uuid_);
+  ASSERT_EQ("a", entries[1].uuid_);
+  ASSERT_EQ("b", entries[2].uuid_);
+  ASSERT_TRUE(entries[0].path_.empty());
+
+  db.DequeueBatch(entries, 3);
+  ASSERT_EQ(1u, entries.size());
+  ASSERT_EQ("/mount/c", entries[0].path_);
+
+  db.DequeueBatch(entries, 3);
+  ASSERT_TRUE(entries.empty());
+  ASSERT_EQ(0u, db.GetSize());
+}
+
+TEST(PendingDeletionsDatabase, Counters)
+{
+  const std::string path = GetDatabasePath();
+
+  {
+    Saola::PendingDeletionsDatabase db(path);
+
+    int64_t oldest;
+    ASSERT_FALSE(db.LookupOldestEnqueued(oldest));
+
+    db.Enqueue("a", Orthanc::FileContentType_Dicom);
+    db.Enqueue("a", Orthanc::FileContentType_DicomAsJson, 2);
+    db.Enqueue("b", Orthanc::FileContentType_Dicom, 2);
+    db.EnqueueOrphan("c", "/tmp/orphan");
+
+    ASSERT_TRUE(db.LookupOldestEnqueued(oldest));
+    ASSERT_TRUE(oldest > 0);
+
+    // Both entries of "a" move to the new priority
+    ASSERT_TRUE(db.SetPriority("a", 7));
+
+    std::map<int, unsigned int> byPriority;
+    db.GetSizeByPriority(byPriority);
+    ASSERT_EQ(3u, byPriority.size());
+    ASSERT_EQ(1u, byPriority[0]);
+    ASSERT_EQ(1u, byPriority[2]);
+    ASSERT_EQ(2u, byPriority[7]);
+
+    std::vector<Saola::PendingDeletionsDatabase::Entry> entries;
+    db.DequeueBatch(entries, 2);
+    ASSERT_EQ(2u, db.GetSize());
+
+    db.GetSizeByPriority(byPriority);
+    ASSERT_EQ(2u, byPriority.size());
+    ASSERT_EQ(0u, byPriority.count(7));
+  }
+
+  // Counted again when the database is reopened
+  {
+    Saola::PendingDeletionsDatabase db(path);
+    ASSERT_EQ(2u, db.GetSize());
+
+    std::map<int, unsigned int> byPriority;
+    db.GetSizeByPriority(byPriority);
+    ASSERT_EQ(1u, byPriority[0]);
+    ASSERT_EQ(1u, byPriority[2]);
+
+    std::string uuid;
+    Orthanc::FileContentType type;
+    ASSERT_TRUE(db.Dequeue(uuid, type));
+    ASSERT_TRUE(db.Dequeue(uuid, type));
+    ASSERT_FALSE(db.Dequeue(uuid, type));
+    ASSERT_EQ(0u, db.GetSize());
+
+    db.GetSizeByPriority(byPriority);
+    ASSERT_TRUE(byPriority.empty());
+  }
+}
+
+TEST(PendingDeletionsDatabase, SharedQueue)
+{
+  // Two nodes sharing the same database
+  const std::string path = GetDatabasePath();
+  Saola::PendingDeletionsDatabase node1(path, 3600, true);
+  Saola::PendingDeletionsDatabase node2(path, 3600, true);
+  ASSERT_TRUE(node1.IsShared());
+
+  node1.Enqueue("a", Orthanc::FileContentType_Dicom);
+  node2.Enqueue("b", Orthanc::FileContentType_Dicom);
+  node1.Enqueue("c", Orthanc::FileContentType_Dicom);
+  node2.Enqueue("d", Orthanc::FileContentType_Dicom);
+
+  std::vector<Saola::PendingDeletionsDatabase::Entry> leased1, leased2;
+  node1.LeaseBatch(leased1, 2, "node1", 3600);
+  node2.LeaseBatch(leased2, 3, "node2", 3600);
+  ASSERT_EQ(2u, leased1.size());
+  ASSERT_EQ("a", leased1[0].uuid_);
+  ASSERT_EQ("b", leased1[1].uuid_);
+  ASSERT_EQ(2u, leased2.size());
+  ASSERT_EQ("c", leased2[0].uuid_);
+  ASSERT_EQ("d", leased2[1].uuid_);
+
+  // The leased entries are skipped by all the nodes
+  std::vector<Saola::PendingDeletionsDatabase::Entry> entries;
+  node2.LeaseBatch(entries, 3, "node2", 3600);
+  ASSERT_TRUE(entries.empty());
+  node1.DequeueBatch(entries, 3);
+  ASSERT_TRUE(entries.empty());
+
+  node1.Complete(leased1);
+  node2.RefreshCounters();
+  ASSERT_EQ(2u, node2.GetSize());
+
+  // "node2" crashes and restarts
+  node2.ReleaseLeases("node2");
+  node1.LeaseBatch(entries, 3, "node1", 0);
+  ASSERT_EQ(2u, entries.size());
+  ASSERT_EQ("c", entries[0].uuid_);
+
+  // The zero-second lease expires at once and is taken over by "node2"
+  node2.LeaseBatch(leased2, 1, "node2", 3600);
+  ASSERT_EQ(1u, leased2.size());
+  ASSERT_EQ("c", leased2[0].uuid_);
+
+  // "node1" only completes the entry it still holds
+  node1.Complete(entries);
+  node1.RefreshCounters();
+  ASSERT_EQ(1u, node1.GetSize());
+
+  node2.Complete(leased2);
+  node2.RefreshCounters();
+  ASSERT_EQ(0u, node2.GetSize());
+}
@@ -0,0 +1,324 @@
+#include "FakePluginContext.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "../Sources/PendingDeletionsDatabase.h"
+#include "../Sources/SaolaConfiguration.h"
+#include "../Sources/StorageArea.h"
+#include "../Sources/Trace.h"
+#include "../Sources/UringIO.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+static std::unique_ptr<SaolaTests::FakePluginContext> context_;
+static std::string temporaryDirectory_;
+
+namespace SaolaTests
+{
+  FakePluginContext &GetFakeContext()
+  {
+    return *context_;
+  }
+
+  const std::string &GetTemporaryDirectory()
+  {
+    return temporaryDirectory_;
+  }
+}
+
+
+struct Options
+{
+  std::vector<size_t>        sizes_;
+  std::vector<unsigned int>  threads_;
+  unsigned int               count_;       // Number of operations per thread
+  std::string                directory_;
+
+  Options() : count_(200)
+  {
+    sizes_.push_back(4 * 1024);
+    sizes_.push_back(512 * 1024);
+    sizes_.push_back(16 * 1024 * 1024);
+    threads_.push_back(1);
+    threads_.push_back(4);
+    threads_.push_back(16);
+  }
+};
+
+
+template <typename T>
+static void ParseList(std::vector<T> &target,
+                      const std::string &value)
+{
+  std::vector<std::string> tokens;
+  boost::split(tokens, value, boost::is_any_of(","));
+
+  target.clear();
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    target.push_back(boost::lexical_cast<T>(tokens[i]));
+  }
+}
+
+
+static bool ParseOptions(Options &options,
+                         int argc,
+                         char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg(argv[i]);
+
+    if (boost::starts_with(arg, "--sizes="))
+    {
+      ParseList(options.sizes_, arg.substr(8));
+    }
+    else if (boost::starts_with(arg, "--threads="))
+    {
+      ParseList(options.threads_, arg.substr(10));
+    }
+    else if (boost::starts_with(arg, "--count="))
+    {
+      options.count_ = boost::lexical_cast<unsigned int>(arg.substr(8));
+    }
+    else if (boost::starts_with(arg, "--directory="))
+    {
+      options.directory_ = arg.substr(12);
+    }
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--sizes=4096,524288] [--threads=1,4,16] [--count=200] [--directory=/path/to/volume]" << std::endl
+                << "  --sizes      Comma-separated list of attachment sizes, in bytes" << std::endl
+                << "  --threads    Comma-separated list of numbers of concurrent callers" << std::endl
+                << "  --count      Number of operations per thread" << std::endl
+                << "  --directory  Volume to benchmark (defaults to a temporary directory)" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+// Runs "operation(thread, index)" for "count" indices on each thread, returns the elapsed seconds
+static double RunParallel(unsigned int threadsCount,
+                          unsigned int count,
+                          const std::function<void(unsigned int, unsigned int)> &operation)
+{
+  Orthanc::Toolbox::ElapsedTimer timer;
+
+  std::vector<std::thread *> threads;
+  for (unsigned int t = 0; t < threadsCount; t++)
+  {
+    threads.push_back(new std::thread([t, count, &operation]()
+    {
+      for (unsigned int i = 0; i < count; i++)
+      {
+        operation(t, i);
+      }
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++)
+  {
+    threads[t]->join();
+    delete threads[t];
+  }
+
+  return static_cast<double>(timer.GetElapsedMicroseconds()) / 1000000.0;
+}
+
+
+static void Report(const std::string &name,
+                   size_t size,
+                   unsigned int threads,
+                   uint64_t operations,
+                   double seconds)
+{
+  const double opsPerSecond = static_cast<double>(operations) / seconds;
+  printf("%-24s size=%-10lu threads=%-4u %12.0f ops/s %10.1f MB/s\n", name.c_str(), static_cast<unsigned long>(size),
+         threads, opsPerSecond, opsPerSecond * static_cast<double>(size) / (1024.0 * 1024.0));
+  fflush(stdout);
+}
+
+
+static void BenchmarkStorageArea(StorageArea &area,
+                                 const std::string &prefix,
+                                 size_t size,
+                                 unsigned int threads,
+                                 unsigned int count)
+{
+  std::string content(size, '\0');
+  for (size_t i = 0; i < size; i++)
+  {
+    content[i] = static_cast<char>(i * 7);
+  }
+
+  std::vector<std::vector<std::string> > uuids(threads);
+  for (unsigned int t = 0; t < threads; t++)
+  {
+    for (unsigned int i = 0; i < count; i++)
+    {
+      uuids[t].push_back(Orthanc::Toolbox::GenerateUuid());
+    }
+  }
+
+  const uint64_t operations = static_cast<uint64_t>(threads) * count;
+
+  Report(prefix + "Create", size, threads, operations, RunParallel(threads, count, [&](unsigned int t, unsigned int i)
+  {
+    area.Create(uuids[t][i], content.c_str(), content.size());
+  }));
+
+  Report(prefix + "ReadWhole", size, threads, operations, RunParallel(threads, count, [&](unsigned int t, unsigned int i)
+  {
+    OrthancPluginMemoryBuffer64 buffer;
+    area.ReadWhole(&buffer, uuids[t][i]);
+    free(buffer.data);
+  }));
+
+  // Read the second half of the attachment, as the "StorageReadRange" callback would
+  const size_t rangeSize = std::max<size_t>(1, size / 2);
+  Report(prefix + "ReadRange", rangeSize, threads, operations, RunParallel(threads, count, [&](unsigned int t, unsigned int i)
+  {
+    std::string data(rangeSize, '\0');
+    OrthancPluginMemoryBuffer64 buffer;
+    buffer.data = &data[0];
+    buffer.size = rangeSize;
+    area.ReadRange(&buffer, uuids[t][i], size - rangeSize);
+  }));
+
+  Report(prefix + "Remove", size, threads, operations, RunParallel(threads, count, [&](unsigned int t, unsigned int i)
+  {
+    area.RemoveAttachment(uuids[t][i]);
+  }));
+}
+
+
+static void BenchmarkPendingDeletions(const std::string &directory,
+                                      unsigned int threads,
+                                      unsigned int count)
+{
+  Saola::PendingDeletionsDatabase db((boost::filesystem::path(directory) / ("benchmark-" + Orthanc::Toolbox::GenerateUuid() + ".db")).string());
+
+  const uint64_t operations = static_cast<uint64_t>(threads) * count;
+
+  Report("DeletionQueue.Enqueue", 0, threads, operations, RunParallel(threads, count, [&](unsigned int t, unsigned int i)
+  {
+    db.Enqueue(Orthanc::Toolbox::GenerateUuid(), Orthanc::FileContentType_Dicom);
+  }));
+
+  Report("DeletionQueue.Dequeue", 0, threads, operations, RunParallel(threads, count, [&](unsigned int t, unsigned int i)
+  {
+    std::string uuid;
+    Orthanc::FileContentType type;
+    db.Dequeue(uuid, type);
+  }));
+}
+
+
+static void SetIOUring(bool enable)
+{
+  Json::Value config;
+  config["IOUring"]["Enable"] = enable;
+  SaolaConfiguration::ApplyConfiguration(config);
+}
+
+
+// The same total number of operations for each number of callers
+static void BenchmarkIOUring(StorageArea &area,
+                             size_t size,
+                             unsigned int count)
+{
+  static const unsigned int CALLERS[] = { 1, 8, 64 };
+
+  for (size_t c = 0; c < sizeof(CALLERS) / sizeof(CALLERS[0]); c++)
+  {
+    const unsigned int perThread = std::max(1u, count * 8 / CALLERS[c]);
+
+    SetIOUring(false);
+    BenchmarkStorageArea(area, "Blocking.", size, CALLERS[c], perThread);
+    SetIOUring(true);
+    BenchmarkStorageArea(area, "IOUring.", size, CALLERS[c], perThread);
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!ParseOptions(options, argc, argv))
+  {
+    return -1;
+  }
+
+  boost::filesystem::path tmp = (options.directory_.empty() ?
+                                 boost::filesystem::temp_directory_path() :
+                                 boost::filesystem::path(options.directory_));
+  tmp /= boost::filesystem::unique_path("saola-benchmarks-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(tmp);
+  temporaryDirectory_ = tmp.string();
+
+  Json::Value configuration;
+  SaolaTests::FakePluginContext::CreateConfiguration(configuration, temporaryDirectory_);
+  context_.reset(new SaolaTests::FakePluginContext(configuration));
+
+  OrthancPlugins::SetGlobalContext(context_->GetContext());
+  Orthanc::Logging::InitializePluginContext(context_->GetContext());
+
+  int result = 0;
+
+  try
+  {
+    StorageArea area((tmp / "storage").string());
+
+    for (size_t s = 0; s < options.sizes_.size(); s++)
+    {
+      for (size_t t = 0; t < options.threads_.size(); t++)
+      {
+        BenchmarkStorageArea(area, "", options.sizes_[s], options.threads_[t], options.count_);
+      }
+    }
+
+    for (size_t t = 0; t < options.threads_.size(); t++)
+    {
+      BenchmarkPendingDeletions(temporaryDirectory_, options.threads_[t], options.count_);
+    }
+
+    // Cost of the trace statements of the hot path, once formatted (the
+    // fake Orthanc core discards the messages, as a non-verbose Orthanc would)
+    Saola::Trace::SetLevel(Saola::TraceCategory_Storage, Saola::TraceLevel_Off);
+    BenchmarkStorageArea(area, "TraceOff.", 4096, 1, options.count_ * 10);
+    Saola::Trace::SetLevel(Saola::TraceCategory_Storage, Saola::TraceLevel_Verbose);
+    BenchmarkStorageArea(area, "TraceVerbose.", 4096, 1, options.count_ * 10);
+    Saola::Trace::SetLevel(Saola::TraceCategory_Storage, Saola::TraceLevel_Off);
+
+    // Chains of linked io_uring requests against the blocking path (if
+    // the benchmark is built with ENABLE_IO_URING and the kernel allows it)
+    if (Saola::UringIO::IsEnabled())
+    {
+      BenchmarkIOUring(area, 4096, options.count_);
+      BenchmarkIOUring(area, 512 * 1024, options.count_);
+    }
+  }
+  catch (Orthanc::OrthancException &e)
+  {
+    std::cerr << "Benchmark failed: " << e.What() << std::endl;
+    result = -1;
+  }
+
+  boost::system::error_code err;
+  boost::filesystem::remove_all(tmp, err);
+
+  return result;
+}
@@ -0,0 +1,480 @@
+#include "FakePluginContext.h"
+
+#include "../Sources/WorkloadCapture.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <thread>
+
+extern "C"
+{
+  int32_t OrthancPluginInitialize(OrthancPluginContext *context);
+  void OrthancPluginFinalize();
+}
+
+static std::unique_ptr<SaolaTests::FakePluginContext> context_;
+static std::string temporaryDirectory_;
+
+namespace SaolaTests
+{
+  FakePluginContext &GetFakeContext()
+  {
+    return *context_;
+  }
+
+  const std::string &GetTemporaryDirectory()
+  {
+    return temporaryDirectory_;
+  }
+}
+
+
+static const char *const OPERATION_NAMES[] = { "create", "read-whole", "read-range", "remove" };
+
+
+struct Record
+{
+  Saola::IOOperation        operation_;
+  std::string               uuid_;
+  OrthancPluginContentType  type_;
+  uint64_t                  size_;        // Size of the attachment, or of the range for "read-range"
+  uint64_t                  rangeStart_;
+  uint64_t                  timestamp_;   // Microseconds since the beginning of the trace
+};
+
+
+struct Options
+{
+  std::string   trace_;
+  unsigned int  concurrency_;
+  unsigned int  synthetic_;
+  uint64_t      size_;
+  std::string   directory_;
+  bool          timed_;
+  bool          verbose_;
+
+  Options() : concurrency_(8), synthetic_(1000), size_(512 * 1024), timed_(false), verbose_(false)
+  {
+  }
+};
+
+
+static bool ParseOptions(Options &options,
+                         int argc,
+                         char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg(argv[i]);
+
+    if (boost::starts_with(arg, "--trace="))
+    {
+      options.trace_ = arg.substr(8);
+    }
+    else if (boost::starts_with(arg, "--concurrency="))
+    {
+      options.concurrency_ = std::max(1u, boost::lexical_cast<unsigned int>(arg.substr(14)));
+    }
+    else if (boost::starts_with(arg, "--synthetic="))
+    {
+      options.synthetic_ = boost::lexical_cast<unsigned int>(arg.substr(12));
+    }
+    else if (boost::starts_with(arg, "--size="))
+    {
+      options.size_ = boost::lexical_cast<uint64_t>(arg.substr(7));
+    }
+    else if (boost::starts_with(arg, "--directory="))
+    {
+      options.directory_ = arg.substr(12);
+    }
+    else if (arg == "--timed")
+    {
+      options.timed_ = true;
+    }
+    else if (arg == "--verbose")
+    {
+      options.verbose_ = true;
+    }
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--trace=FILE] [--concurrency=8] [--synthetic=1000] [--size=524288] [--directory=PATH] [--timed] [--verbose]" << std::endl
+                << "  --trace        Recorded workload: either a capture file of the plugin (\"Capture\" configuration)," << std::endl
+                << "                 or a text file with one operation per line:" << std::endl
+                << "                 \"create|read-whole|read-range|remove <uuid> <content-type> <size> <range-start>\"" << std::endl
+                << "  --concurrency  Number of concurrent callers of the storage area" << std::endl
+                << "  --synthetic    Without trace, number of attachments to create, read twice, then remove" << std::endl
+                << "  --size         Without trace, size of the synthetic attachments" << std::endl
+                << "  --directory    Volume hosting StorageDirectory and MountDirectory (defaults to a temporary directory)" << std::endl
+                << "  --timed        Respect the original pacing of the captured operations instead of replaying as fast as possible" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+static void LoadTextTrace(std::vector<Record> &records,
+                          const std::string &path)
+{
+  std::ifstream f(path.c_str());
+  if (!f.good())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "Cannot open trace: " + path);
+  }
+
+  std::string line;
+  while (std::getline(f, line))
+  {
+    boost::trim(line);
+    if (line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+
+    std::vector<std::string> tokens;
+    boost::split(tokens, line, boost::is_any_of(" \t"), boost::token_compress_on);
+
+    if (tokens.size() != 5)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad line in trace: " + line);
+    }
+
+    Record record;
+
+    const char *const *found = std::find(OPERATION_NAMES, OPERATION_NAMES + Saola::IOOperation_Count, tokens[0]);
+    if (found == OPERATION_NAMES + Saola::IOOperation_Count)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Unknown operation in trace: " + tokens[0]);
+    }
+
+    record.operation_ = static_cast<Saola::IOOperation>(found - OPERATION_NAMES);
+    record.uuid_ = tokens[1];
+    record.type_ = static_cast<OrthancPluginContentType>(boost::lexical_cast<int>(tokens[2]));
+    record.size_ = boost::lexical_cast<uint64_t>(tokens[3]);
+    record.rangeStart_ = boost::lexical_cast<uint64_t>(tokens[4]);
+    record.timestamp_ = 0;
+    records.push_back(record);
+  }
+}
+
+
+static void LoadCaptureFile(std::vector<Record> &records,
+                            const std::string &path)
+{
+  std::vector<Saola::WorkloadRecord> captured;
+  Saola::WorkloadCapture::ReadCaptureFile(captured, path);
+
+  for (size_t i = 0; i < captured.size(); i++)
+  {
+    const Saola::WorkloadRecord &source = captured[i];
+
+    if (source.operation_ >= Saola::IOOperation_Count)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Unknown operation in capture file");
+    }
+
+    // Failed calls (e.g. reads of missing attachments) would only
+    // fail again, or succeed and skew the statistics
+    if (!source.success_)
+    {
+      continue;
+    }
+
+    Record record;
+    record.operation_ = static_cast<Saola::IOOperation>(source.operation_);
+    record.uuid_.assign(source.uuid_, strnlen(source.uuid_, sizeof(source.uuid_)));
+    record.type_ = static_cast<OrthancPluginContentType>(source.contentType_);
+    record.size_ = source.size_;
+    record.rangeStart_ = source.rangeStart_;
+    record.timestamp_ = source.timestamp_ - captured[0].timestamp_;
+    records.push_back(record);
+  }
+}
+
+
+static void GenerateSyntheticTrace(std::vector<Record> &records,
+                                   unsigned int count,
+                                   uint64_t size)
+{
+  std::vector<std::string> uuids;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    uuids.push_back(Orthanc::Toolbox::GenerateUuid());
+  }
+
+  Record record;
+  record.type_ = OrthancPluginContentType_Unknown;
+  record.rangeStart_ = 0;
+  record.timestamp_ = 0;
+
+  for (int op = 0; op < Saola::IOOperation_Count; op++)
+  {
+    for (unsigned int i = 0; i < count; i++)
+    {
+      record.operation_ = static_cast<Saola::IOOperation>(op);
+      record.uuid_ = uuids[i];
+      record.size_ = size;
+
+      if (record.operation_ == Saola::IOOperation_ReadRange)
+      {
+        // Second half of the attachment
+        record.size_ = std::max<uint64_t>(1, size / 2);
+        record.rangeStart_ = size - record.size_;
+      }
+
+      records.push_back(record);
+      record.rangeStart_ = 0;
+    }
+  }
+}
+
+
+static void CreateAttachment(const _OrthancPluginRegisterStorageArea2 &storage,
+                             const Record &record)
+{
+  std::string content(record.size_, '\0');
+  for (size_t i = 0; i < content.size(); i++)
+  {
+    content[i] = static_cast<char>(i * 7);
+  }
+
+  OrthancPluginErrorCode code = storage.create(record.uuid_.c_str(), content.c_str(), content.size(), record.type_);
+  if (code != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(static_cast<Orthanc::ErrorCode>(code), "Cannot create " + record.uuid_);
+  }
+}
+
+
+static void Execute(const _OrthancPluginRegisterStorageArea2 &storage,
+                    const Record &record)
+{
+  OrthancPluginErrorCode code = OrthancPluginErrorCode_Success;
+
+  switch (record.operation_)
+  {
+  case Saola::IOOperation_Create:
+    CreateAttachment(storage, record);
+    break;
+
+  case Saola::IOOperation_ReadWhole:
+  {
+    OrthancPluginMemoryBuffer64 buffer;
+    code = storage.readWhole(&buffer, record.uuid_.c_str(), record.type_);
+    if (code == OrthancPluginErrorCode_Success)
+    {
+      free(buffer.data);
+    }
+    break;
+  }
+
+  case Saola::IOOperation_ReadRange:
+  {
+    std::string data(record.size_, '\0');
+    OrthancPluginMemoryBuffer64 buffer;
+    buffer.data = (data.empty() ? NULL : &data[0]);
+    buffer.size = record.size_;
+    code = storage.readRange(&buffer, record.uuid_.c_str(), record.type_, record.rangeStart_);
+    break;
+  }
+
+  case Saola::IOOperation_Remove:
+    code = storage.remove(record.uuid_.c_str(), record.type_);
+    break;
+
+  default:
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  if (code != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(static_cast<Orthanc::ErrorCode>(code),
+                                    std::string("Cannot ") + OPERATION_NAMES[record.operation_] + " " + record.uuid_);
+  }
+}
+
+
+static void Replay(const std::vector<Record> &records,
+                   unsigned int concurrency,
+                   bool timed)
+{
+  const _OrthancPluginRegisterStorageArea2 &storage = SaolaTests::GetFakeContext().GetStorageArea();
+
+  // Attachments that are accessed before being created in the trace already existed in production
+  {
+    std::set<std::string> known;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      if (known.insert(records[i].uuid_).second &&
+          records[i].operation_ != Saola::IOOperation_Create)
+      {
+        Record record = records[i];
+        record.size_ = std::max<uint64_t>(record.size_ + record.rangeStart_, 1);
+        CreateAttachment(storage, record);
+      }
+    }
+  }
+
+  // All the operations on one attachment are replayed by the same
+  // thread, in the order of the trace
+  std::vector<std::vector<size_t> > queues(concurrency);
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    queues[std::hash<std::string>()(records[i].uuid_) % concurrency].push_back(i);
+  }
+
+  std::vector<std::vector<uint64_t> > latencies(concurrency * Saola::IOOperation_Count);
+  std::atomic<uint64_t> errors(0);
+
+  Orthanc::Toolbox::ElapsedTimer timer;
+
+  std::vector<std::thread *> threads;
+  for (unsigned int t = 0; t < concurrency; t++)
+  {
+    threads.push_back(new std::thread([t, timed, &timer, &records, &queues, &latencies, &errors, &storage]()
+    {
+      for (size_t i = 0; i < queues[t].size(); i++)
+      {
+        const Record &record = records[queues[t][i]];
+
+        if (timed)
+        {
+          const uint64_t now = timer.GetElapsedMicroseconds();
+          if (record.timestamp_ > now)
+          {
+            std::this_thread::sleep_for(std::chrono::microseconds(record.timestamp_ - now));
+          }
+        }
+
+        Orthanc::Toolbox::ElapsedTimer latency;
+
+        try
+        {
+          Execute(storage, record);
+          latencies[t * Saola::IOOperation_Count + record.operation_].push_back(latency.GetElapsedMicroseconds());
+        }
+        catch (Orthanc::OrthancException &e)
+        {
+          LOG(ERROR) << e.What() << " " << (e.HasDetails() ? e.GetDetails() : "");
+          errors++;
+        }
+      }
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++)
+  {
+    threads[t]->join();
+    delete threads[t];
+  }
+
+  const double seconds = static_cast<double>(timer.GetElapsedMicroseconds()) / 1000000.0;
+
+  printf("Replayed %lu operations with %u concurrent callers in %.3f s: %.0f ops/s, %lu error(s)\n",
+         static_cast<unsigned long>(records.size()), concurrency, seconds,
+         static_cast<double>(records.size()) / seconds, static_cast<unsigned long>(errors.load()));
+
+  printf("%-12s %10s %10s %10s %10s %10s\n", "operation", "count", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)");
+
+  for (int op = 0; op < Saola::IOOperation_Count; op++)
+  {
+    std::vector<uint64_t> merged;
+    for (unsigned int t = 0; t < concurrency; t++)
+    {
+      const std::vector<uint64_t> &l = latencies[t * Saola::IOOperation_Count + op];
+      merged.insert(merged.end(), l.begin(), l.end());
+    }
+
+    if (!merged.empty())
+    {
+      std::sort(merged.begin(), merged.end());
+      printf("%-12s %10lu %10.3f %10.3f %10.3f %10.3f\n", OPERATION_NAMES[op], static_cast<unsigned long>(merged.size()),
+             static_cast<double>(merged[merged.size() * 50 / 100]) / 1000.0,
+             static_cast<double>(merged[merged.size() * 90 / 100]) / 1000.0,
+             static_cast<double>(merged[merged.size() * 99 / 100]) / 1000.0,
+             static_cast<double>(merged.back()) / 1000.0);
+    }
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!ParseOptions(options, argc, argv))
+  {
+    return -1;
+  }
+
+  boost::filesystem::path tmp = (options.directory_.empty() ?
+                                 boost::filesystem::temp_directory_path() :
+                                 boost::filesystem::path(options.directory_));
+  tmp /= boost::filesystem::unique_path("saola-replay-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(tmp);
+  temporaryDirectory_ = tmp.string();
+
+  Json::Value configuration;
+  SaolaTests::FakePluginContext::CreateConfiguration(configuration, temporaryDirectory_);
+  context_.reset(new SaolaTests::FakePluginContext(configuration));
+  context_->SetVerbose(options.verbose_);
+
+  int result = 0;
+
+  try
+  {
+    std::vector<Record> records;
+    if (options.trace_.empty())
+    {
+      GenerateSyntheticTrace(records, options.synthetic_, options.size_);
+    }
+    else
+    {
+      if (Saola::WorkloadCapture::IsCaptureFile(options.trace_))
+      {
+        LoadCaptureFile(records, options.trace_);
+      }
+      else
+      {
+        LoadTextTrace(records, options.trace_);
+      }
+    }
+
+    if (OrthancPluginInitialize(context_->GetContext()) != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin, "Cannot initialize the plugin");
+    }
+
+    context_->NotifyChange(OrthancPluginChangeType_OrthancStarted);
+    Replay(records, options.concurrency_, options.timed_);
+    context_->NotifyChange(OrthancPluginChangeType_OrthancStopped);
+
+    OrthancPluginFinalize();
+  }
+  catch (Orthanc::OrthancException &e)
+  {
+    std::cerr << "Replay failed: " << e.What() << " " << (e.HasDetails() ? e.GetDetails() : "") << std::endl;
+    result = -1;
+  }
+
+  boost::system::error_code err;
+  boost::filesystem::remove_all(tmp, err);
+
+  return result;
+}
@@ -0,0 +1,1048 @@
+#include "FakeObjectStore.h"
+#include "FakePluginContext.h"
+
+#include "../Sources/ConsistencyScrubber.h"
+#include "../Sources/SaolaConfiguration.h"
+#include "../Sources/ReplicationWorker.h"
+#include "../Sources/SpoolUploader.h"
+#include "../Sources/StorageArea.h"
+#include "../Sources/TieringWorker.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <thread>
+#include <vector>
+
+static std::string GetStorageDirectory()
+{
+  return (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / "storage").string();
+}
+
+static std::string GetPointerPath(const std::string &uuid)
+{
+  boost::filesystem::path p = GetStorageDirectory();
+  p /= uuid.substr(0, 2);
+  p /= uuid.substr(2, 2);
+  p /= uuid + ".symlink";
+  return p.string();
+}
+
+static std::string CreateDicomBuffer(size_t size)
+{
+  std::string dicom(size, 'x');
+  memset(&dicom[0], 0, 128);
+  memcpy(&dicom[128], "DICM", 4);
+  return dicom;
+}
+
+TEST(StorageArea, CreateReadRemove)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string content = "Hello, world";
+
+  area.Create(uuid, content.c_str(), content.size());
+
+  ASSERT_TRUE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(uuid)));
+
+  std::string mountPath;
+  ASSERT_TRUE(area.LookupPointer(mountPath, uuid));
+  ASSERT_TRUE(mountPath.find(SaolaConfiguration::Instance()->GetMountDirectory()) == 0);
+  ASSERT_TRUE(mountPath.find("attachments") != std::string::npos);
+  ASSERT_TRUE(Orthanc::SystemToolbox::IsExistingFile(mountPath));
+
+  std::string s;
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ(content, s);
+
+  OrthancPluginMemoryBuffer64 buffer;
+  area.ReadWhole(&buffer, uuid);
+  ASSERT_EQ(content.size(), buffer.size);
+  ASSERT_EQ(0, memcmp(content.c_str(), buffer.data, buffer.size));
+  free(buffer.data);
+
+  area.RemoveAttachment(uuid);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(uuid)));
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(mountPath));
+  ASSERT_THROW(area.ReadWhole(s, uuid), Orthanc::OrthancException);
+}
+
+TEST(StorageArea, ReadRange)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string content = "0123456789";
+  area.Create(uuid, content.c_str(), content.size());
+
+  char data[4];
+  OrthancPluginMemoryBuffer64 buffer;
+  buffer.data = data;
+  buffer.size = sizeof(data);
+
+  area.ReadRange(&buffer, uuid, 3);
+  ASSERT_EQ("3456", std::string(data, sizeof(data)));
+
+  ASSERT_THROW(area.ReadRange(&buffer, uuid, 8), Orthanc::OrthancException);
+
+  area.RemoveAttachment(uuid);
+}
+
+TEST(StorageArea, DicomFullLayout)
+{
+  StorageArea area(GetStorageDirectory());
+
+  Json::Value tags = Json::objectValue;
+  tags["0008,0020"] = "20240131";
+  tags["0020,000d"] = "1.2.3";
+  tags["0020,000e"] = "1.2.3.4";
+  SaolaTests::GetFakeContext().SetDicomTags(tags);
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string dicom = CreateDicomBuffer(1024);
+  area.Create(uuid, dicom.c_str(), dicom.size());
+
+  std::string mountPath;
+  ASSERT_TRUE(area.LookupPointer(mountPath, uuid));
+
+  boost::filesystem::path expected = SaolaConfiguration::Instance()->GetMountDirectory();
+  expected = expected / "dicom" / "2024" / "01" / "31" / "1.2.3" / "1.2.3.4" / uuid;
+  ASSERT_EQ(expected.string(), mountPath);
+
+  std::string s;
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ(dicom, s);
+
+  area.RemoveAttachment(uuid);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(mountPath));
+}
+
+TEST(StorageArea, RemoveAttachments)
+{
+  StorageArea area(GetStorageDirectory());
+
+  Json::Value tags = Json::objectValue;
+  tags["0008,0020"] = "20240201";
+  tags["0020,000d"] = "1.2.3.5";
+  tags["0020,000e"] = "1.2.3.5.6";
+  SaolaTests::GetFakeContext().SetDicomTags(tags);
+
+  const std::string dicom = CreateDicomBuffer(256);
+
+  std::vector<std::string> uuids;
+  std::vector<std::string> paths;
+  for (unsigned int i = 0; i < 10; i++)
+  {
+    uuids.push_back(Orthanc::Toolbox::GenerateUuid());
+    area.Create(uuids.back(), dicom.c_str(), dicom.size());
+
+    std::string path;
+    ASSERT_TRUE(area.LookupPointer(path, uuids.back()));
+    paths.push_back(path);
+  }
+
+  const std::string other = Orthanc::Toolbox::GenerateUuid();
+  area.Create(other, "other", 5);
+
+  const boost::filesystem::path series = boost::filesystem::path(paths[0]).parent_path();
+  ASSERT_EQ("1.2.3.5.6", series.filename().string());
+
+  uuids.push_back("not-a-uuid");  // Skipped
+  area.RemoveAttachments(uuids);
+
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(paths[i]));
+    ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(uuids[i])));
+  }
+
+  // The emptied series and study directories are removed by the pruner
+  ASSERT_TRUE(boost::filesystem::exists(series));
+  ASSERT_TRUE(area.GetDirectoryPruner().Sweep() >= 2u);
+  ASSERT_FALSE(boost::filesystem::exists(series));
+  ASSERT_FALSE(boost::filesystem::exists(series.parent_path()));
+  ASSERT_TRUE(boost::filesystem::exists(SaolaConfiguration::Instance()->GetMountDirectory()));
+
+  std::string s;
+  area.ReadWhole(s, other);
+  ASSERT_EQ("other", s);
+  area.RemoveAttachment(other);
+}
+
+TEST(StorageArea, LegacyAttachmentWithoutPointer)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  std::string legacy = GetPointerPath(uuid);
+  legacy.resize(legacy.size() - strlen(".symlink"));
+
+  boost::filesystem::create_directories(boost::filesystem::path(legacy).parent_path());
+  Orthanc::SystemToolbox::WriteFile(std::string("legacy"), legacy);
+
+  std::string s;
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ("legacy", s);
+
+  area.RemoveAttachment(uuid);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(legacy));
+}
+
+TEST(StorageArea, LegacyIndex)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const std::string legacyUuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string legacy = area.GetLegacyPath(legacyUuid);
+  boost::filesystem::create_directories(boost::filesystem::path(legacy).parent_path());
+  Orthanc::SystemToolbox::WriteFile(std::string("legacy"), legacy);
+
+  const std::string recentUuid = Orthanc::Toolbox::GenerateUuid();
+  area.Create(recentUuid, "recent", 6);
+
+  // Legacy payload written then replaced by an attachment with pointer after the scan
+  const std::string replacedUuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string replaced = area.GetLegacyPath(replacedUuid);
+  boost::filesystem::create_directories(boost::filesystem::path(replaced).parent_path());
+  Orthanc::SystemToolbox::WriteFile(std::string("stale"), replaced);
+
+  Saola::LegacyIndex &index = area.GetLegacyIndex();
+  index.Scan(GetStorageDirectory(), 4);
+  ASSERT_TRUE(index.MayContain(legacyUuid));
+  ASSERT_TRUE(index.MayContain(replacedUuid));
+  ASSERT_FALSE(index.MayContain("nope"));
+
+  boost::filesystem::remove(replaced);
+  area.Create(replacedUuid, "replaced", 8);
+
+  std::string s;
+  area.ReadWhole(s, legacyUuid);
+  ASSERT_EQ("legacy", s);
+  area.ReadWhole(s, recentUuid);
+  ASSERT_EQ("recent", s);
+
+  // False positive: the pointer is looked up once the legacy path fails
+  area.ReadWhole(s, replacedUuid);
+  ASSERT_EQ("replaced", s);
+
+  Json::Value status;
+  index.GetStatistics(status);
+  ASSERT_EQ(1u, status["FalsePositivesCount"].asUInt64());
+
+  // Saved, then loaded as is
+  const std::string path = (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / "legacy-index.bin").string();
+  index.Save(path);
+
+  Saola::LegacyIndex loaded;
+  ASSERT_FALSE(loaded.MayContain(legacyUuid));
+  ASSERT_TRUE(loaded.Load(path));
+  ASSERT_TRUE(loaded.MayContain(legacyUuid));
+
+  Orthanc::SystemToolbox::WriteFile(std::string("garbage"), path);
+  ASSERT_FALSE(loaded.Load(path));
+
+  uint64_t removedBytes = 0;
+  std::vector<std::string> uuids;
+  uuids.push_back(legacyUuid);
+  uuids.push_back(replacedUuid);
+  area.RemoveAttachments(uuids, &removedBytes);
+  ASSERT_EQ(6u + 8u, removedBytes);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(legacy));
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(replacedUuid)));
+
+  area.RemoveAttachment(recentUuid);
+}
+
+TEST(StorageArea, BadUuid)
+{
+  StorageArea area(GetStorageDirectory());
+
+  std::string s;
+  ASSERT_THROW(area.Create("nope", "a", 1), Orthanc::OrthancException);
+  ASSERT_THROW(area.ReadWhole(s, "../../etc/passwd"), Orthanc::OrthancException);
+}
+
+TEST(StorageArea, MoveAttachment)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string content = "cold data";
+  area.Create(uuid, content.c_str(), content.size());
+
+  std::string hotPath;
+  ASSERT_TRUE(area.LookupPointer(hotPath, uuid));
+
+  const std::string hot = SaolaConfiguration::Instance()->GetMountDirectory();
+  const std::string cold = SaolaConfiguration::Instance()->GetColdMountDirectory();
+
+  ASSERT_FALSE(area.MoveAttachment(uuid, cold, hot));  // Not on the cold mount
+  ASSERT_TRUE(area.MoveAttachment(uuid, hot, cold));
+
+  std::string coldPath;
+  ASSERT_TRUE(area.LookupPointer(coldPath, uuid));
+  ASSERT_TRUE(coldPath.find(cold) == 0);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(hotPath));
+
+  std::string s;
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ(content, s);
+
+  ASSERT_TRUE(area.MoveAttachment(uuid, cold, hot));
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ(content, s);
+
+  area.RemoveAttachment(uuid);
+  ASSERT_FALSE(area.MoveAttachment(uuid, hot, cold));
+}
+
+TEST(StorageArea, Checksum)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string content = "checksummed payload";
+  area.Create(uuid, content.c_str(), content.size());
+
+  StorageArea::Locator locator;
+  ASSERT_TRUE(area.LookupLocator(locator, uuid));
+  ASSERT_TRUE(locator.hasChecksum_);
+  ASSERT_EQ(content.size(), locator.size_);
+
+  StorageArea::Locator parsed;
+  parsed.Parse(locator.Format());
+  ASSERT_EQ(locator.path_, parsed.path_);
+  ASSERT_EQ(locator.crc32c_, parsed.crc32c_);
+
+  std::string s;
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ(content, s);
+
+  // Silent corruption of one byte, the size is unchanged
+  std::string corrupted = content;
+  corrupted[3] ^= 0x01;
+  Orthanc::SystemToolbox::WriteFile(corrupted, locator.path_);
+
+  const uint64_t mismatches = area.GetChecksumMismatchesCount();
+  ASSERT_THROW(area.ReadWhole(s, uuid), Orthanc::OrthancException);
+  ASSERT_EQ(mismatches + 1, area.GetChecksumMismatchesCount());
+
+  OrthancPluginMemoryBuffer64 buffer;
+  ASSERT_THROW(area.ReadWhole(&buffer, uuid), Orthanc::OrthancException);
+
+  // Pointers written by previous versions only contain the location
+  Orthanc::SystemToolbox::WriteFile(locator.path_, GetPointerPath(uuid));
+  area.ReadWhole(s, uuid);
+  ASSERT_EQ(corrupted, s);
+
+  area.RemoveAttachment(uuid);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(locator.path_));
+}
+
+TEST(StorageArea, DiskFull)
+{
+  StorageArea area(GetStorageDirectory());
+  Saola::DiskSpaceMonitor &monitor = area.GetDiskSpaceMonitor();
+
+  // Every volume crosses the high-water mark
+  monitor.SetThresholds(0, 0, 0);
+  monitor.Refresh();
+
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+
+  try
+  {
+    area.Create(uuid, "full", 4);
+    FAIL();
+  }
+  catch (Orthanc::OrthancException &e)
+  {
+    ASSERT_EQ(Orthanc::ErrorCode_FullStorage, e.GetErrorCode());
+  }
+
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(uuid)));
+
+  Json::Value status;
+  monitor.GetStatistics(status);
+  ASSERT_EQ(1u, status["RejectedCreates"].asUInt());
+
+  monitor.SetThresholds(100, 100, 0);
+  monitor.Refresh();
+  area.Create(uuid, "free", 4);
+  ASSERT_TRUE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(uuid)));
+  area.RemoveAttachment(uuid);
+}
+
+TEST(SaolaConfiguration, Reload)
+{
+  const std::shared_ptr<const SaolaConfiguration> before = SaolaConfiguration::Instance();
+  const std::string mount = before->GetMountDirectory();
+  const unsigned int batchSize = before->DelayedDeletionBatchSize();
+
+  Json::Value config;
+  config["MountDirectory"] = mount + "-reloaded";
+  config["DelayedDeletion"]["BatchSize"] = 7;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  std::shared_ptr<const SaolaConfiguration> after = SaolaConfiguration::Instance();
+  ASSERT_NE(before.get(), after.get());
+  ASSERT_EQ(mount + "-reloaded", after->GetMountDirectory());
+  ASSERT_EQ(7u, after->DelayedDeletionBatchSize());
+  ASSERT_EQ(before->GetChecksumVerification(), after->GetChecksumVerification());
+
+  // The previous snapshot is still valid and unchanged while it is held
+  ASSERT_EQ(mount, before->GetMountDirectory());
+  ASSERT_EQ(batchSize, before->DelayedDeletionBatchSize());
+
+  Json::Value invalid;
+  invalid["Checksum"]["Verify"] = "Never";
+  ASSERT_THROW(SaolaConfiguration::ApplyConfiguration(invalid), Orthanc::OrthancException);
+  ASSERT_EQ(after.get(), SaolaConfiguration::Instance().get());
+
+  // Freed once its last reader releases it
+  std::weak_ptr<const SaolaConfiguration> previous = after;
+  SaolaConfiguration::ApplyConfiguration(config);
+  ASSERT_FALSE(previous.expired());
+  after.reset();
+  ASSERT_TRUE(previous.expired());
+
+  Json::Value restore;
+  restore["MountDirectory"] = mount;
+  restore["DelayedDeletion"]["BatchSize"] = batchSize;
+  SaolaConfiguration::ApplyConfiguration(restore);
+  ASSERT_EQ(mount, SaolaConfiguration::Instance()->GetMountDirectory());
+}
+
+TEST(SaolaConfiguration, InsecureObjectStorage)
+{
+  Json::Value config;
+  config["ObjectStorage"]["Enable"] = true;
+  config["ObjectStorage"]["Endpoint"] = "http://s3.example.com";
+  ASSERT_THROW(SaolaConfiguration::ApplyConfiguration(config), Orthanc::OrthancException);
+  ASSERT_FALSE(SaolaConfiguration::Instance()->GetObjectStorage().enable_);
+
+  config["ObjectStorage"]["Endpoint"] = "http://localhost:9000";
+  SaolaConfiguration::ApplyConfiguration(config);
+  ASSERT_EQ("localhost", SaolaConfiguration::Instance()->GetObjectStorage().host_);
+
+  config["ObjectStorage"]["Endpoint"] = "http://s3.example.com";
+  config["ObjectStorage"]["AllowInsecure"] = true;
+  SaolaConfiguration::ApplyConfiguration(config);
+  ASSERT_EQ("s3.example.com", SaolaConfiguration::Instance()->GetObjectStorage().host_);
+
+  Json::Value restore;
+  restore["ObjectStorage"]["Enable"] = false;
+  restore["ObjectStorage"]["Endpoint"] = "http://127.0.0.1:9000";
+  restore["ObjectStorage"]["AllowInsecure"] = false;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(StorageArea, Routing)
+{
+  StorageArea area(GetStorageDirectory());
+
+  const boost::filesystem::path root(SaolaTests::GetTemporaryDirectory());
+  const std::string ssd = (root / "ssd").string();
+  const std::string large = (root / "large").string();
+
+  Json::Value config;
+  config["Routing"] = Json::arrayValue;
+  config["Routing"].append(Json::objectValue);
+  config["Routing"][0]["ContentType"] = "DicomAsJson";
+  config["Routing"][0]["MountDirectory"] = ssd;
+  config["Routing"].append(Json::objectValue);
+  config["Routing"][1]["MinSizeKB"] = 4;
+  config["Routing"][1]["MountDirectory"] = large;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  const std::string json = Orthanc::Toolbox::GenerateUuid();
+  area.Create(json, "{}", 2, Orthanc::FileContentType_DicomAsJson);
+
+  const std::string small = Orthanc::Toolbox::GenerateUuid();
+  area.Create(small, "small", 5, Orthanc::FileContentType_Unknown);
+
+  const std::string big(8192, 'x');
+  const std::string bigUuid = Orthanc::Toolbox::GenerateUuid();
+  area.Create(bigUuid, big.c_str(), big.size(), Orthanc::FileContentType_Unknown);
+
+  std::string path;
+  ASSERT_TRUE(area.LookupPointer(path, json));
+  ASSERT_EQ(0u, path.find(ssd));
+  ASSERT_TRUE(area.LookupPointer(path, small));
+  ASSERT_EQ(0u, path.find(SaolaConfiguration::Instance()->GetMountDirectory()));
+  ASSERT_TRUE(area.LookupPointer(path, bigUuid));
+  ASSERT_EQ(0u, path.find(large));
+
+  std::vector<std::string> mounts;
+  SaolaConfiguration::Instance()->GetWritableMountDirectories(mounts);
+  ASSERT_EQ(3u, mounts.size());
+
+  Json::Value restore;
+  restore["Routing"] = Json::arrayValue;
+  SaolaConfiguration::ApplyConfiguration(restore);
+
+  // The attachments stay readable wherever they were routed
+  std::string s;
+  area.ReadWhole(s, bigUuid);
+  ASSERT_EQ(big, s);
+
+  area.RemoveAttachment(json);
+  area.RemoveAttachment(small);
+  area.RemoveAttachment(bigUuid);
+
+  Json::Value invalid;
+  invalid["Routing"] = Json::arrayValue;
+  invalid["Routing"].append(Json::objectValue);
+  invalid["Routing"][0]["ContentType"] = "Dicom";
+  ASSERT_THROW(SaolaConfiguration::ApplyConfiguration(invalid), Orthanc::OrthancException);
+}
+
+TEST(StorageArea, ObjectStorage)
+{
+  SaolaTests::FakeObjectStore store;
+
+  Json::Value config;
+  config["ObjectStorage"]["Enable"] = false;
+  config["ObjectStorage"]["Endpoint"] = store.GetEndpoint();
+  config["ObjectStorage"]["Bucket"] = "saola";
+  config["ObjectStorage"]["AccessKey"] = "minio";
+  config["ObjectStorage"]["SecretKey"] = "minio123";
+  config["ObjectStorage"]["MultipartThresholdMB"] = 1;
+  config["ObjectStorage"]["PartSizeMB"] = 1;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  // The endpoint is read by the constructor
+  StorageArea area(GetStorageDirectory());
+
+  const std::string local = Orthanc::Toolbox::GenerateUuid();
+  area.Create(local, "local", 5);
+
+  Json::Value enable;
+  enable["ObjectStorage"]["Enable"] = true;
+  SaolaConfiguration::ApplyConfiguration(enable);
+
+  std::string large(3 * 1024 * 1024 + 100, 0);
+  for (size_t i = 0; i < large.size(); i++)
+  {
+    large[i] = static_cast<char>(i * 7);
+  }
+
+  const std::string small = Orthanc::Toolbox::GenerateUuid();
+  const std::string largeUuid = Orthanc::Toolbox::GenerateUuid();
+  area.Create(small, "small", 5);
+  area.Create(largeUuid, large.c_str(), large.size());
+
+  // The pointers stay on the filesystem, and locate the objects
+  std::string path;
+  ASSERT_TRUE(area.LookupPointer(path, largeUuid));
+  ASSERT_EQ(0u, path.find("s3://saola/attachments/"));
+  ASSERT_EQ(2u, store.GetObjectsCount());
+  ASSERT_EQ(4u, store.GetPartsCount());  // Uploaded in parts of 1MB
+
+  std::string s;
+  area.ReadWhole(s, small);
+  ASSERT_EQ("small", s);
+  area.ReadWhole(s, largeUuid);
+  ASSERT_EQ(large, s);
+  ASSERT_GE(store.GetRangedGetsCount(), 4u);  // Parallel ranged GETs
+
+  OrthancPluginMemoryBuffer64 buffer;
+  area.ReadWhole(&buffer, largeUuid);
+  ASSERT_EQ(large.size(), buffer.size);
+  ASSERT_EQ(0, memcmp(large.c_str(), buffer.data, buffer.size));
+  free(buffer.data);
+
+  buffer.size = 1000;
+  buffer.data = malloc(buffer.size);
+  area.ReadRange(&buffer, largeUuid, 2 * 1024 * 1024 - 10);
+  ASSERT_EQ(0, memcmp(large.c_str() + 2 * 1024 * 1024 - 10, buffer.data, buffer.size));
+  free(buffer.data);
+
+  // The connections are kept alive between the requests
+  ASSERT_LT(store.GetConnectionsCount(), store.GetRequestsCount());
+
+  // The attachments created before stay on the filesystem
+  area.ReadWhole(s, local);
+  ASSERT_EQ("local", s);
+
+  std::vector<std::string> uuids;
+  uuids.push_back(local);
+  uuids.push_back(small);
+  uuids.push_back(largeUuid);
+  area.RemoveAttachments(uuids);
+
+  ASSERT_EQ(0u, store.GetObjectsCount());
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(GetPointerPath(largeUuid)));
+  ASSERT_THROW(area.ReadWhole(s, largeUuid), Orthanc::OrthancException);
+
+  Json::Value restore;
+  restore["ObjectStorage"]["Enable"] = false;
+  restore["ObjectStorage"]["Endpoint"] = "http://127.0.0.1:9000";
+  restore["ObjectStorage"]["Bucket"] = "orthanc";
+  restore["ObjectStorage"]["AccessKey"] = "";
+  restore["ObjectStorage"]["SecretKey"] = "";
+  restore["ObjectStorage"]["MultipartThresholdMB"] = 16;
+  restore["ObjectStorage"]["PartSizeMB"] = 8;
+  SaolaConfiguration::ApplyConfiguration(restore);
+  ASSERT_FALSE(SaolaConfiguration::Instance()->GetObjectStorage().enable_);
+}
+
+TEST(StorageArea, Spool)
+{
+  const boost::filesystem::path root(SaolaTests::GetTemporaryDirectory());
+  const std::string spool = (root / "spool").string();
+
+  Json::Value config;
+  config["Spool"]["Enable"] = true;
+  config["Spool"]["Directory"] = spool;
+  config["Spool"]["Path"] = (root / "spool.db").string();
+  config["Spool"]["Threads"] = 2;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  const std::string content = "Hello, spool";
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  const std::string removed = Orthanc::Toolbox::GenerateUuid();
+
+  std::string spoolPath;
+
+  {
+    StorageArea area(GetStorageDirectory());
+    area.Create(uuid, content.c_str(), content.size());
+    area.Create(removed, "x", 1);
+
+    // Staged at the same relative location as in the mount directory
+    ASSERT_TRUE(area.LookupPointer(spoolPath, uuid));
+    ASSERT_EQ(0u, spoolPath.find(spool));
+    ASSERT_TRUE(spoolPath.find("attachments") != std::string::npos);
+    ASSERT_EQ(2u, area.GetSpoolJournal()->GetSize());
+
+    std::string s;
+    area.ReadWhole(s, uuid);
+    ASSERT_EQ(content, s);
+
+    area.RemoveAttachment(removed);
+
+    // Simulated crash: nothing is uploaded before the area is destroyed
+  }
+
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+  ASSERT_EQ(2u, area->GetSpoolJournal()->GetSize());
+
+  Saola::SpoolUploader uploader(area);
+  uploader.UploadPending();
+  ASSERT_EQ(0u, area->GetSpoolJournal()->GetSize());
+
+  std::string mountPath;
+  ASSERT_TRUE(area->LookupPointer(mountPath, uuid));
+  ASSERT_EQ(0u, mountPath.find(SaolaConfiguration::Instance()->GetMountDirectory()));
+  ASSERT_EQ(spoolPath.substr(spool.size()), mountPath.substr(SaolaConfiguration::Instance()->GetMountDirectory().size()));
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(spoolPath));
+
+  std::string s;
+  area->ReadWhole(s, uuid);
+  ASSERT_EQ(content, s);
+
+  Json::Value status;
+  uploader.GetStatistics(status);
+  ASSERT_EQ(1u, status["UploadedCount"].asUInt64());
+  ASSERT_EQ(1u, status["DiscardedCount"].asUInt64());
+
+  area->RemoveAttachment(uuid);
+  area.reset();
+
+  Json::Value restore;
+  restore["Spool"]["Enable"] = false;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(StorageArea, SpoolUploadDuringCreate)
+{
+  const boost::filesystem::path root(SaolaTests::GetTemporaryDirectory());
+
+  Json::Value config;
+  config["Spool"]["Enable"] = true;
+  config["Spool"]["Directory"] = (root / "spool-concurrent").string();
+  config["Spool"]["Path"] = (root / "spool-concurrent.db").string();
+  config["Spool"]["Threads"] = 2;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+  Saola::SpoolUploader uploader(area);
+
+  // The uploader polls the journal while the attachments are being created
+  std::atomic<bool> done(false);
+  std::thread polling([&uploader, &done]()
+  {
+    while (!done)
+    {
+      uploader.UploadPending();
+    }
+  });
+
+  std::vector<std::string> uuids;
+  for (size_t i = 0; i < 200; i++)
+  {
+    uuids.push_back(Orthanc::Toolbox::GenerateUuid());
+    area->Create(uuids.back(), uuids.back().c_str(), uuids.back().size());
+  }
+
+  done = true;
+  polling.join();
+  uploader.UploadPending();
+
+  // No acknowledged attachment was discarded as "never published"
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    std::string s;
+    area->ReadWhole(s, uuids[i]);
+    ASSERT_EQ(uuids[i], s);
+  }
+
+  Json::Value status;
+  uploader.GetStatistics(status);
+  ASSERT_EQ(200u, status["UploadedCount"].asUInt64());
+  ASSERT_EQ(0u, status["DiscardedCount"].asUInt64());
+
+  area->RemoveAttachments(uuids);
+  area.reset();
+
+  Json::Value restore;
+  restore["Spool"]["Enable"] = false;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(StorageArea, Replication)
+{
+  const boost::filesystem::path root(SaolaTests::GetTemporaryDirectory());
+  const std::string replicaMount = (root / "replica").string();
+
+  Json::Value config;
+  config["Replication"]["Enable"] = true;
+  config["Replication"]["MountDirectory"] = replicaMount;
+  config["Replication"]["Path"] = (root / "replication.db").string();
+  config["Replication"]["Threads"] = 2;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+  Saola::ReplicationWorker worker(area);
+
+  const std::string content = "Hello, replica";
+  const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+  area->Create(uuid, content.c_str(), content.size());
+
+  // Only queued by the ingest
+  std::string primary, replica;
+  ASSERT_TRUE(area->LookupPointer(primary, uuid));
+  ASSERT_TRUE(area->GetReplicaPath(replica, primary));
+  ASSERT_EQ(0u, replica.find(replicaMount));
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(replica));
+  ASSERT_EQ(1u, area->GetReplicationQueue()->GetSize());
+
+  worker.ReplicatePending();
+  ASSERT_EQ(0u, area->GetReplicationQueue()->GetSize());
+
+  std::string s;
+  Orthanc::SystemToolbox::ReadFile(s, replica);
+  ASSERT_EQ(content, s);
+
+  // Lost primary payload: the reads fall back to the replica
+  boost::filesystem::remove(primary);
+  s.clear();
+  area->ReadWhole(s, uuid);
+  ASSERT_EQ(content, s);
+  ASSERT_EQ(1u, area->GetReplicaReadsCount());
+
+  area->RemoveAttachment(uuid);
+  ASSERT_EQ(1u, area->GetReplicationQueue()->GetSize());
+  worker.ReplicatePending();
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(replica));
+
+  Json::Value status;
+  worker.GetStatistics(status);
+  ASSERT_EQ(1u, status["ReplicatedCount"].asUInt64());
+  ASSERT_EQ(1u, status["RemovedCount"].asUInt64());
+  ASSERT_EQ(0u, status["PendingCount"].asUInt());
+  ASSERT_FALSE(status["LagExceeded"].asBool());
+
+  area.reset();
+
+  Json::Value restore;
+  restore["Replication"]["Enable"] = false;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(ReplicationDatabase, Backoff)
+{
+  const boost::filesystem::path root(SaolaTests::GetTemporaryDirectory());
+  Saola::ReplicationDatabase queue((root / "replication-backoff.db").string());
+
+  queue.EnqueueCopy("a");
+  queue.EnqueueCopy("b");
+
+  std::vector<Saola::ReplicationDatabase::Entry> entries;
+  queue.ListPending(entries, 10);
+  ASSERT_EQ(2u, entries.size());
+  ASSERT_EQ("a", entries[0].uuid_);
+
+  // A postponed entry does not hold the next ones, and is still counted in the lag
+  queue.CountFailure(entries[0].seq_, 3600);
+  queue.ListPending(entries, 10);
+  ASSERT_EQ(1u, entries.size());
+  ASSERT_EQ("b", entries[0].uuid_);
+  ASSERT_EQ(0u, entries[0].attempts_);
+  ASSERT_EQ(2u, queue.GetSize());
+
+  queue.CountFailure(entries[0].seq_, 0);
+  queue.ListPending(entries, 10);
+  ASSERT_EQ(1u, entries.size());
+  ASSERT_EQ("b", entries[0].uuid_);
+  ASSERT_EQ(1u, entries[0].attempts_);
+}
+
+TEST(TieringWorker, MissingPayload)
+{
+  const std::string tieringPath = SaolaConfiguration::Instance()->TieringPath();
+
+  Json::Value config;
+  config["Tiering"]["Path"] = (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / "tiering-missing.db").string();
+  config["Tiering"]["Threads"] = 1;
+  config["Tiering"]["BatchSize"] = 1;
+  config["Tiering"]["ColdAfterDays"] = 1;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+
+  const std::string healthy = Orthanc::Toolbox::GenerateUuid();
+  area->Create(healthy, "healthy", 7);
+
+  const std::string missing = Orthanc::Toolbox::GenerateUuid();
+  area->Create(missing, "missing", 7);
+
+  std::string path;
+  ASSERT_TRUE(area->LookupPointer(path, missing));
+  boost::filesystem::remove(path);
+
+  {
+    // The failing attachment is the oldest one, hence selected first
+    Saola::TieringDatabase db(SaolaConfiguration::Instance()->TieringPath());
+    std::map<std::string, int64_t> accesses;
+    accesses[missing] = 100;
+    accesses[healthy] = 200;
+    db.Touch(accesses);
+  }
+
+  Saola::TieringWorker worker(area);
+  worker.MigrateColdAttachments();  // Must terminate
+
+  Json::Value status;
+  worker.GetStatistics(status);
+  ASSERT_EQ(1u, status["MigratedCount"].asUInt64());
+  ASSERT_EQ(1u, status["FailedCount"].asUInt64());
+  ASSERT_EQ(1u, status["HotAttachments"].asUInt());
+  ASSERT_EQ(1u, status["ColdAttachments"].asUInt());
+
+  ASSERT_TRUE(area->LookupPointer(path, healthy));
+  ASSERT_EQ(0u, path.find(SaolaConfiguration::Instance()->GetColdMountDirectory()));
+
+  std::string s;
+  area->ReadWhole(s, healthy);
+  ASSERT_EQ("healthy", s);
+
+  area->RemoveAttachment(healthy);
+  area->RemoveAttachment(missing);
+
+  Json::Value restore;
+  restore["Tiering"]["Path"] = tieringPath;
+  restore["Tiering"]["Threads"] = 4;
+  restore["Tiering"]["BatchSize"] = 100;
+  restore["Tiering"]["ColdAfterDays"] = 90;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(TieringWorker, RoutedAttachment)
+{
+  const std::string tieringPath = SaolaConfiguration::Instance()->TieringPath();
+  const std::string ssd = (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / "tiering-ssd").string();
+
+  Json::Value config;
+  config["Tiering"]["Path"] = (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / "tiering-routed.db").string();
+  config["Tiering"]["ColdAfterDays"] = 1;
+  config["Routing"] = Json::arrayValue;
+  config["Routing"].append(Json::objectValue);
+  config["Routing"][0]["ContentType"] = "DicomAsJson";
+  config["Routing"][0]["MountDirectory"] = ssd;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+
+  const std::string routed = Orthanc::Toolbox::GenerateUuid();
+  area->Create(routed, "{}", 2, Orthanc::FileContentType_DicomAsJson);
+
+  // No pointer, e.g. a legacy attachment: cannot be relocated
+  const std::string unknown = Orthanc::Toolbox::GenerateUuid();
+
+  {
+    Saola::TieringDatabase db(SaolaConfiguration::Instance()->TieringPath());
+    std::map<std::string, int64_t> accesses;
+    accesses[routed] = 100;
+    accesses[unknown] = 100;
+    db.Touch(accesses);
+  }
+
+  Saola::TieringWorker worker(area);
+  worker.MigrateColdAttachments();
+
+  // The routing mounts are hot mounts too
+  std::string path;
+  ASSERT_TRUE(area->LookupPointer(path, routed));
+  ASSERT_EQ(0u, path.find(SaolaConfiguration::Instance()->GetColdMountDirectory()));
+
+  Json::Value status;
+  worker.GetStatistics(status);
+  ASSERT_EQ(1u, status["MigratedCount"].asUInt64());
+  ASSERT_EQ(0u, status["FailedCount"].asUInt64());
+  ASSERT_EQ(1u, status["ColdAttachments"].asUInt());
+  ASSERT_EQ(0u, status["HotAttachments"].asUInt());  // "unknown" has no pointer: unmanaged
+
+  std::string s;
+  area->ReadWhole(s, routed);
+  ASSERT_EQ("{}", s);
+  area->RemoveAttachment(routed);
+
+  Json::Value restore;
+  restore["Tiering"]["Path"] = tieringPath;
+  restore["Tiering"]["ColdAfterDays"] = 90;
+  restore["Routing"] = Json::arrayValue;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(TieringWorker, Backfill)
+{
+  const std::string tieringPath = SaolaConfiguration::Instance()->TieringPath();
+
+  Json::Value config;
+  config["Tiering"]["Path"] = (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / "tiering-backfill.db").string();
+  config["Tiering"]["ColdAfterDays"] = 1;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+
+  // Stored before tiering was enabled, and not accessed for a week
+  const std::string old = Orthanc::Toolbox::GenerateUuid();
+  area->Create(old, "old", 3);
+
+  std::string path;
+  ASSERT_TRUE(area->LookupPointer(path, old));
+  boost::filesystem::last_write_time(path, time(NULL) - 7 * 24 * 3600);
+
+  const std::string recent = Orthanc::Toolbox::GenerateUuid();
+  area->Create(recent, "recent", 6);
+
+  Saola::TieringWorker worker(area);
+  worker.Backfill();
+  worker.MigrateColdAttachments();
+
+  ASSERT_TRUE(area->LookupPointer(path, old));
+  ASSERT_EQ(0u, path.find(SaolaConfiguration::Instance()->GetColdMountDirectory()));
+  ASSERT_TRUE(area->LookupPointer(path, recent));
+  ASSERT_EQ(0u, path.find(SaolaConfiguration::Instance()->GetMountDirectory()));
+
+  Json::Value status;
+  worker.GetStatistics(status);
+  ASSERT_EQ(1u, status["MigratedCount"].asUInt64());
+
+  // The mount is only scanned once
+  boost::filesystem::last_write_time(path, time(NULL) - 7 * 24 * 3600);
+  worker.Backfill();
+  worker.MigrateColdAttachments();
+  worker.GetStatistics(status);
+  ASSERT_EQ(1u, status["MigratedCount"].asUInt64());
+
+  area->RemoveAttachment(old);
+  area->RemoveAttachment(recent);
+
+  Json::Value restore;
+  restore["Tiering"]["Path"] = tieringPath;
+  restore["Tiering"]["ColdAfterDays"] = 90;
+  SaolaConfiguration::ApplyConfiguration(restore);
+}
+
+TEST(ConsistencyScrubber, DanglingPointersAndOrphans)
+{
+  std::shared_ptr<StorageArea> area(new StorageArea(GetStorageDirectory()));
+
+  const std::string healthy = Orthanc::Toolbox::GenerateUuid();
+  area->Create(healthy, "healthy", 7);
+
+  const std::string dangling = Orthanc::Toolbox::GenerateUuid();
+  area->Create(dangling, "dangling", 8);
+
+  std::string danglingPath;
+  ASSERT_TRUE(area->LookupPointer(danglingPath, dangling));
+  boost::filesystem::remove(danglingPath);
+
+  const std::string corrupted = Orthanc::Toolbox::GenerateUuid();
+  area->Create(corrupted, "corrupted", 9);
+
+  std::string corruptedPath;
+  ASSERT_TRUE(area->LookupPointer(corruptedPath, corrupted));
+  Orthanc::SystemToolbox::WriteFile(std::string("CORRUPTED"), corruptedPath);
+
+  // Payloads without pointer, one of them possibly still being created
+  boost::filesystem::path mount = boost::filesystem::path(SaolaConfiguration::Instance()->GetMountDirectory()) / "attachments" / "ff";
+  boost::filesystem::create_directories(mount);
+
+  const std::string orphan = Orthanc::Toolbox::GenerateUuid();
+  const std::string recent = Orthanc::Toolbox::GenerateUuid();
+  Orthanc::SystemToolbox::WriteFile(std::string("orphan"), (mount / orphan).string());
+  Orthanc::SystemToolbox::WriteFile(std::string("recent"), (mount / recent).string());
+  boost::filesystem::last_write_time(mount / orphan, time(NULL) - 3600);
+
+  Saola::ConsistencyScrubber scrubber(area, NULL);
+  scrubber.Start(false, true);
+
+  Json::Value status;
+  for (unsigned int i = 0; i < 500; i++)
+  {
+    scrubber.GetStatus(status);
+    if (status["State"].asString() != "Running")
+    {
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  scrubber.Stop();
+
+  ASSERT_EQ("Completed", status["State"].asString());
+  ASSERT_TRUE(status["Pointers"].asUInt() >= 2u);
+  ASSERT_TRUE(status["VerifiedBytes"].asUInt() >= 7u);
+
+  std::string report;
+  Orthanc::SystemToolbox::ReadFile(report, SaolaConfiguration::Instance()->ScrubberReportPath());
+  ASSERT_NE(std::string::npos, report.find("dangling-pointer\t" + dangling));
+  ASSERT_NE(std::string::npos, report.find("orphaned-payload\t" + orphan));
+  ASSERT_NE(std::string::npos, report.find("corrupted-payload\t" + corrupted));
+  ASSERT_EQ(1u, status["CorruptedPayloads"].asUInt());
+  ASSERT_EQ(std::string::npos, report.find(recent));
+  ASSERT_EQ(std::string::npos, report.find(healthy));
+
+  ASSERT_TRUE(area->RemoveOrphanedPayload(orphan, (mount / orphan).string()));
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile((mount / orphan).string()));
+
+  area->RemoveAttachment(healthy);
+  area->RemoveAttachment(dangling);
+  area->RemoveAttachment(corrupted);
+  boost::filesystem::remove(mount / recent);
+}
@@ -0,0 +1,654 @@
+#include "FakePluginContext.h"
+
+#include "../Sources/Crc32c.h"
+#include "../Sources/DirectoryPruner.h"
+#include "../Sources/DiskSpaceMonitor.h"
+#include "../Sources/HedgedReader.h"
+#include "../Sources/IOLatencyRecorder.h"
+#include "../Sources/IOToolbox.h"
+#include "../Sources/SaolaConfiguration.h"
+#include "../Sources/Sha256.h"
+#include "../Sources/TemporaryFilesCollector.h"
+#include "../Sources/ThroughputMeter.h"
+#include "../Sources/TieringDatabase.h"
+#include "../Sources/Trace.h"
+#include "../Sources/UringIO.h"
+#include "../Sources/WorkerPool.h"
+#include "../Sources/WorkloadCapture.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <limits>
+#include <set>
+#include <thread>
+
+static std::string GetTemporaryPath(const std::string &name)
+{
+  return (boost::filesystem::path(SaolaTests::GetTemporaryDirectory()) / name).string();
+}
+
+TEST(Crc32c, Basic)
+{
+  // Check value of the CRC-32C catalogue
+  ASSERT_EQ(0xe3069283u, Saola::Crc32c::Compute("123456789", 9));
+  ASSERT_EQ(0xe3069283u, Saola::Crc32c::ExtendSoftware(0, "123456789", 9));
+  ASSERT_EQ(0u, Saola::Crc32c::Compute(NULL, 0));
+
+  std::string buffer(100000, '\0');
+  for (size_t i = 0; i < buffer.size(); i++)
+  {
+    buffer[i] = static_cast<char>(i * 7 + (i >> 8));
+  }
+
+  // Unaligned starts and tails, and incremental computation
+  for (size_t offset = 0; offset < 16; offset++)
+  {
+    const size_t size = buffer.size() - offset - 3;
+    const uint32_t crc = Saola::Crc32c::Compute(&buffer[offset], size);
+    ASSERT_EQ(Saola::Crc32c::ExtendSoftware(0, &buffer[offset], size), crc);
+    ASSERT_EQ(crc, Saola::Crc32c::Extend(Saola::Crc32c::Extend(0, &buffer[offset], 4099), &buffer[offset + 4099], size - 4099));
+  }
+}
+
+TEST(IOToolbox, WriteFileDirect)
+{
+  // Sizes around the alignment of O_DIRECT, and above its chunk size
+  const size_t sizes[] = { 0, 1, 4095, 4096, 4097, 3 * 4096 + 17, 9 * 1024 * 1024 + 5 };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++)
+  {
+    std::string content(sizes[i], '\0');
+    for (size_t j = 0; j < content.size(); j++)
+    {
+      content[j] = static_cast<char>(j * 31);
+    }
+
+    const std::string path = GetTemporaryPath("direct.bin");
+    Saola::IOToolbox::WriteFileDirect(content.empty() ? NULL : content.c_str(), content.size(), path);
+
+    std::string s;
+    Orthanc::SystemToolbox::ReadFile(s, path);
+    ASSERT_EQ(content, s);
+  }
+}
+
+TEST(IOToolbox, WriteFileAtomic)
+{
+  const Saola::IOToolbox::FsyncPolicy policies[] = {
+    Saola::IOToolbox::FsyncPolicy_None, Saola::IOToolbox::FsyncPolicy_Data, Saola::IOToolbox::FsyncPolicy_Full
+  };
+
+  const std::string path = GetTemporaryPath("atomic.bin");
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    for (int direct = 0; direct < 2; direct++)
+    {
+      const std::string content(5000 + i, 'a' + static_cast<char>(i));
+      Saola::IOToolbox::WriteFileAtomic(content.c_str(), content.size(), path, policies[i], direct != 0);
+
+      std::string s;
+      Orthanc::SystemToolbox::ReadFile(s, path);
+      ASSERT_EQ(content, s);
+      ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(Saola::IOToolbox::GetTemporaryPath(path)));
+    }
+  }
+
+  ASSERT_TRUE(Saola::IOToolbox::IsTemporaryPath(Saola::IOToolbox::GetTemporaryPath(path)));
+  ASSERT_FALSE(Saola::IOToolbox::IsTemporaryPath(path));
+  ASSERT_EQ(Saola::IOToolbox::FsyncPolicy_Full, Saola::IOToolbox::StringToFsyncPolicy("full"));
+  ASSERT_THROW(Saola::IOToolbox::StringToFsyncPolicy("Sometimes"), Orthanc::OrthancException);
+
+  // Writing into a missing directory must not leave anything behind
+  ASSERT_THROW(Saola::IOToolbox::WriteFileAtomic("a", 1, GetTemporaryPath("missing/atomic.bin"),
+                                                 Saola::IOToolbox::FsyncPolicy_Data, false), Orthanc::OrthancException);
+}
+
+TEST(IOToolbox, CopyFileAtomic)
+{
+  const std::string source = GetTemporaryPath("copy-source.bin");
+  const std::string target = GetTemporaryPath("copy-target.bin");
+
+  std::string content(3 * 1024 * 1024 + 17, '\0');
+  for (size_t i = 0; i < content.size(); i++)
+  {
+    content[i] = static_cast<char>(i % 251);
+  }
+
+  Orthanc::SystemToolbox::WriteFile(content, source);
+  Orthanc::SystemToolbox::WriteFile("previous", target);
+
+  Saola::IOToolbox::CopyFileAtomic(source, target, Saola::IOToolbox::FsyncPolicy_Full);
+
+  std::string s;
+  Orthanc::SystemToolbox::ReadFile(s, target);
+  ASSERT_EQ(content, s);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(Saola::IOToolbox::GetTemporaryPath(target)));
+
+  // A missing source leaves the target untouched
+  ASSERT_THROW(Saola::IOToolbox::CopyFileAtomic(GetTemporaryPath("copy-missing.bin"), target,
+                                                Saola::IOToolbox::FsyncPolicy_Data), Orthanc::OrthancException);
+  Orthanc::SystemToolbox::ReadFile(s, target);
+  ASSERT_EQ(content, s);
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(Saola::IOToolbox::GetTemporaryPath(target)));
+}
+
+TEST(IOToolbox, MakeDirectories)
+{
+  const boost::filesystem::path root = GetTemporaryPath("mkdir");
+  const std::string directory = (root / "a" / "." / "b" / "c").string();
+
+  ASSERT_EQ(0, Saola::IOToolbox::MakeDirectories(directory));
+  ASSERT_TRUE(boost::filesystem::is_directory(root / "a" / "b" / "c"));
+  ASSERT_EQ(0, Saola::IOToolbox::MakeDirectories(directory));  // Already existing
+
+  Orthanc::SystemToolbox::WriteFile(std::string("file"), (root / "f").string());
+  const int error = Saola::IOToolbox::MakeDirectories((root / "f" / "g").string());
+  ASSERT_NE(0, error);
+  ASSERT_FALSE(Saola::IOToolbox::IsTransientError(error));
+  ASSERT_TRUE(Saola::IOToolbox::IsTransientError(ENOENT));
+}
+
+TEST(IOToolbox, RemoveFilesInDirectory)
+{
+  const boost::filesystem::path root = GetTemporaryPath("remove");
+  boost::filesystem::create_directories(root / "directory");
+  Orthanc::SystemToolbox::WriteFile(std::string("a"), (root / "file").string());
+  Orthanc::SystemToolbox::WriteFile(std::string("b"), (root / "directory" / "file").string());
+
+  std::vector<std::string> names;
+  names.push_back("file");
+  names.push_back("missing");
+  names.push_back("directory");  // Not a file, cannot be unlinked
+
+  std::vector<std::string> failed;
+  ASSERT_EQ(1u, Saola::IOToolbox::RemoveFilesInDirectory(root.string(), names, &failed));
+  ASSERT_EQ(1u, failed.size());
+  ASSERT_EQ("directory", failed[0]);
+  ASSERT_FALSE(boost::filesystem::exists(root / "file"));
+
+  failed.clear();
+  ASSERT_EQ(0u, Saola::IOToolbox::RemoveFilesInDirectory((root / "missing").string(), names, &failed));
+  ASSERT_TRUE(failed.empty());
+}
+
+TEST(UringIO, Chains)
+{
+  if (!Saola::UringIO::IsEnabled())
+  {
+    return;  // Built without ENABLE_IO_URING, or refused by the kernel
+  }
+
+  const boost::filesystem::path root = GetTemporaryPath("uring");
+  boost::filesystem::create_directories(root);
+
+  const std::string path = (root / "a" / "b" / "file").string();
+  const std::string content = "hello";
+
+  std::string s;
+  ASSERT_EQ(ENOENT, Saola::UringIO::ReadSmallFile(s, path));
+
+  ASSERT_EQ(0, Saola::UringIO::WriteFileAtomic(root.string(), content.c_str(), content.size(), path, Saola::IOToolbox::FsyncPolicy_Full));
+  ASSERT_FALSE(boost::filesystem::exists(Saola::IOToolbox::GetTemporaryPath(path)));
+  ASSERT_EQ(0, Saola::UringIO::ReadSmallFile(s, path));
+  ASSERT_EQ(content, s);
+
+  std::string buffer(content.size(), '\0');
+  ASSERT_EQ(0, Saola::UringIO::ReadFile(&buffer[0], buffer.size(), path));
+  ASSERT_EQ(content, buffer);
+  ASSERT_EQ(EFBIG, Saola::UringIO::ReadFile(&buffer[0], buffer.size() - 1, path));  // The size recorded in a pointer is checked
+
+  // A file in place of a directory stops the chain
+  ASSERT_EQ(ENOTDIR, Saola::UringIO::WriteFileAtomic(root.string(), "x", 1, (root / "a" / "b" / "file" / "c").string(), Saola::IOToolbox::FsyncPolicy_None));
+}
+
+TEST(TemporaryFilesCollector, RemovesOnlyAbandonedFiles)
+{
+  const boost::filesystem::path root = GetTemporaryPath("collector");
+  boost::filesystem::create_directories(root / "ab" / "cd");
+
+  const std::string abandoned = Saola::IOToolbox::GetTemporaryPath((root / "ab" / "cd" / "abandoned").string());
+  const std::string inProgress = Saola::IOToolbox::GetTemporaryPath((root / "ab" / "in-progress").string());
+  const std::string regular = (root / "ab" / "cd" / "regular").string();
+
+  Orthanc::SystemToolbox::WriteFile("x", abandoned);
+  Orthanc::SystemToolbox::WriteFile("x", inProgress);
+  Orthanc::SystemToolbox::WriteFile("x", regular);
+  boost::filesystem::last_write_time(abandoned, time(NULL) - 3600);
+  boost::filesystem::last_write_time(regular, time(NULL) - 3600);
+
+  std::vector<std::string> roots;
+  roots.push_back(root.string());
+  roots.push_back(GetTemporaryPath("inexistent"));
+
+  Saola::TemporaryFilesCollector collector(roots, 4);
+  collector.Start();
+
+  Json::Value status;
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    collector.GetStatistics(status);
+    if (status["Done"].asBool())
+    {
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  collector.Stop();
+
+  ASSERT_TRUE(status["Done"].asBool());
+  ASSERT_EQ(1u, status["RemovedFiles"].asUInt());
+  ASSERT_EQ(3u, status["ScannedFiles"].asUInt());
+  ASSERT_FALSE(Orthanc::SystemToolbox::IsExistingFile(abandoned));
+  ASSERT_TRUE(Orthanc::SystemToolbox::IsExistingFile(inProgress));
+  ASSERT_TRUE(Orthanc::SystemToolbox::IsExistingFile(regular));
+}
+
+TEST(DirectoryPruner, Sweep)
+{
+  const boost::filesystem::path root = GetTemporaryPath("pruner");
+  const boost::filesystem::path outside = GetTemporaryPath("pruner-outside");
+
+  boost::filesystem::create_directories(root / "a" / "b" / "c");
+  boost::filesystem::create_directories(root / "d");
+  boost::filesystem::create_directories(outside / "e");
+  Orthanc::SystemToolbox::WriteFile(std::string("keep"), (root / "d" / "file").string());
+
+  Saola::DirectoryPruner pruner(60, 0);
+  pruner.AddRoot(root.string() + "/");
+
+  pruner.Touch((root / "a" / "b" / "c").string());
+  pruner.Touch((root / "d").string());
+  pruner.Touch(root.string());
+  pruner.Touch((outside / "e").string());
+
+  ASSERT_EQ(3u, pruner.Sweep());
+  ASSERT_FALSE(boost::filesystem::exists(root / "a"));
+  ASSERT_TRUE(boost::filesystem::exists(root / "d" / "file"));
+  ASSERT_TRUE(boost::filesystem::exists(root));
+  ASSERT_TRUE(boost::filesystem::exists(outside / "e"));
+
+  // Recently modified directories are kept for the next sweep
+  Saola::DirectoryPruner patient(60, 3600);
+  patient.AddRoot(root.string());
+  boost::filesystem::create_directories(root / "f");
+  patient.Touch((root / "f").string());
+  ASSERT_EQ(0u, patient.Sweep());
+  ASSERT_TRUE(boost::filesystem::exists(root / "f"));
+
+  Json::Value status;
+  patient.GetStatistics(status);
+  ASSERT_EQ(1u, status["PendingDirectories"].asUInt());
+}
+
+TEST(DirectoryPruner, Pin)
+{
+  const boost::filesystem::path root = GetTemporaryPath("pruner-pin");
+  boost::filesystem::create_directories(root / "a" / "b");
+  boost::filesystem::create_directories(root / "a-b");
+
+  Saola::DirectoryPruner pruner(60, 0);
+  pruner.AddRoot(root.string());
+
+  {
+    // Pinning a directory that does not exist yet protects its existing parents
+    Saola::DirectoryPruner::Pin pin(pruner, (root / "a" / "b" / "c").string());
+
+    pruner.Touch((root / "a" / "b").string());
+    pruner.Touch((root / "a-b").string());
+    ASSERT_EQ(1u, pruner.Sweep());
+    ASSERT_TRUE(boost::filesystem::exists(root / "a" / "b"));
+    ASSERT_FALSE(boost::filesystem::exists(root / "a-b"));
+
+    ASSERT_EQ(0, Saola::IOToolbox::MakeDirectories((root / "a" / "b" / "c").string()));
+  }
+
+  // Once unpinned, the deferred directories are removed
+  pruner.Touch((root / "a" / "b" / "c").string());
+  ASSERT_EQ(3u, pruner.Sweep());
+  ASSERT_FALSE(boost::filesystem::exists(root / "a"));
+
+  Json::Value status;
+  pruner.GetStatistics(status);
+  ASSERT_EQ(0u, status["PinnedDirectories"].asUInt());
+  ASSERT_EQ(1u, status["SkippedPinnedDirectories"].asUInt());
+}
+
+TEST(DiskSpaceMonitor, Thresholds)
+{
+  const boost::filesystem::path root = GetTemporaryPath("disk-space");
+  boost::filesystem::create_directories(root);
+
+  Saola::DiskSpaceMonitor monitor(100, 100, 0, 60);
+  monitor.RegisterVolume(root.string());
+  ASSERT_FALSE(monitor.IsFull(root.string()));
+  ASSERT_FALSE(monitor.IsFull("/nowhere"));
+
+  monitor.SetThresholds(0, 0, 0);
+  monitor.Refresh();
+  ASSERT_TRUE(monitor.IsFull(root.string()));
+
+  // Hysteresis: the volume stays full until it goes below the low-water mark
+  monitor.SetThresholds(100, 0, 0);
+  monitor.Refresh();
+  ASSERT_TRUE(monitor.IsFull(root.string()));
+
+  monitor.SetThresholds(100, 100, 0);
+  monitor.Refresh();
+  ASSERT_FALSE(monitor.IsFull(root.string()));
+
+  monitor.SetThresholds(100, 100, std::numeric_limits<uint64_t>::max());
+  monitor.Refresh();
+  ASSERT_TRUE(monitor.IsFull(root.string()));
+
+  Json::Value status;
+  monitor.GetStatistics(status);
+  ASSERT_EQ(1u, status["Volumes"].size());
+  ASSERT_TRUE(status["Volumes"][0]["Full"].asBool());
+  ASSERT_TRUE(status["Volumes"][0]["Valid"].asBool());
+
+  float value;
+  ASSERT_TRUE(SaolaTests::GetFakeContext().LookupMetric(value, "saola_create_rejected_full"));
+  ASSERT_EQ(0.0f, value);
+}
+
+TEST(IOLatencyRecorder, Format)
+{
+  Saola::IOLatencyRecorder &recorder = Saola::IOLatencyRecorder::Instance();
+  recorder.RegisterVolume("/fast");
+
+  recorder.Record(Saola::IOOperation_ReadWhole, "slow", 1024, 10, 500000, "/fast/a");
+  recorder.Record(Saola::IOOperation_ReadWhole, "quick", 1024, 10, 10, "/fast/b");
+
+  Json::Value json;
+  recorder.Format(json, 100000, 10);
+
+  ASSERT_TRUE(json["Operations"]["ReadWhole"]["Count"].asUInt() >= 2u);
+  ASSERT_TRUE(json["Volumes"].isMember("/fast"));
+
+  bool found = false;
+  for (Json::ArrayIndex i = 0; i < json["SlowOperations"].size(); i++)
+  {
+    ASSERT_NE("quick", json["SlowOperations"][i]["Uuid"].asString());
+    if (json["SlowOperations"][i]["Uuid"].asString() == "slow")
+    {
+      ASSERT_EQ("/fast", json["SlowOperations"][i]["Volume"].asString());
+      found = true;
+    }
+  }
+
+  ASSERT_TRUE(found);
+}
+
+TEST(IOLatencyRecorder, ReadPercentile)
+{
+  Saola::IOLatencyRecorder &recorder = Saola::IOLatencyRecorder::Instance();
+  recorder.RegisterVolume("/histogram");
+
+  uint64_t latency;
+  ASSERT_FALSE(recorder.LookupReadPercentile(latency, "/histogram/a", 95));
+
+  for (unsigned int i = 0; i < 90; i++)
+  {
+    recorder.Record(Saola::IOOperation_ReadWhole, "fast", 1024, 0, 100, "/histogram/a");
+  }
+
+  for (unsigned int i = 0; i < 10; i++)
+  {
+    recorder.Record(Saola::IOOperation_ReadRange, "slow", 1024, 0, 100000, "/histogram/b");
+  }
+
+  // The writes are not part of the read latencies
+  recorder.Record(Saola::IOOperation_Create, "write", 1024, 0, 10000000, "/histogram/c");
+
+  ASSERT_TRUE(recorder.LookupReadPercentile(latency, "/histogram/a", 50));
+  ASSERT_TRUE(latency >= 64 && latency <= 128);
+
+  ASSERT_TRUE(recorder.LookupReadPercentile(latency, "/histogram/a", 95));
+  ASSERT_TRUE(latency >= 65536 && latency <= 131072);
+}
+
+TEST(HedgedReader, Basic)
+{
+  Json::Value config;
+  config["Replication"]["HedgedReadsMinDelayMs"] = 2;
+  config["Replication"]["HedgedReadsMaxDelayMs"] = 20;
+  SaolaConfiguration::ApplyConfiguration(config);
+
+  // No read latencies known yet for this volume
+  ASSERT_EQ(20000u, Saola::HedgedReader::GetDelayUs("/unknown-volume/a"));
+
+  const std::string primary = GetTemporaryPath("hedged-primary.bin");
+  const std::string replica = GetTemporaryPath("hedged-replica.bin");
+  Orthanc::SystemToolbox::WriteFile(std::string("primary"), primary);
+  Orthanc::SystemToolbox::WriteFile(std::string("replica"), replica);
+
+  Saola::HedgedReader reader;
+
+  // Pool not started yet: read on the caller thread
+  std::string content;
+  std::string location = primary;
+  reader.ReadWhole(content, location, replica);
+  ASSERT_EQ("primary", content);
+  ASSERT_EQ(primary, location);
+
+  reader.Start(2);
+
+  location = primary;
+  reader.ReadWhole(content, location, replica);
+  ASSERT_EQ("primary", content);
+  ASSERT_EQ(primary, location);
+
+  char range[3];
+  location = primary;
+  reader.ReadRange(range, sizeof(range), location, replica, 2);
+  ASSERT_EQ("ima", std::string(range, sizeof(range)));
+
+  // A failure of the primary is reported at once, the caller decides on the fallbacks
+  location = GetTemporaryPath("hedged-missing.bin");
+  ASSERT_THROW(reader.ReadWhole(content, location, replica), Orthanc::OrthancException);
+
+  // Not replicated yet: nothing to hedge with
+  location = primary;
+  reader.ReadWhole(content, location, GetTemporaryPath("hedged-missing.bin"));
+  ASSERT_EQ("primary", content);
+
+  reader.Stop();
+
+  Json::Value status;
+  reader.GetStatistics(status);
+  ASSERT_EQ(5u, status["ReadsCount"].asUInt64());
+  ASSERT_EQ(1u, status["SaturatedCount"].asUInt64());
+}
+
+TEST(ThroughputMeter, SlidingWindows)
+{
+  Saola::ThroughputMeter meter(1000);
+
+  double files, bytes;
+  meter.GetRates(files, bytes, 60, 1000);
+  ASSERT_EQ(0.0, files);
+
+  // Not a full minute yet: averaged since the creation of the meter
+  meter.Add(10, 1000, 1000);
+  meter.Add(10, 1000, 1009);
+  meter.GetRates(files, bytes, 60, 1009);
+  ASSERT_DOUBLE_EQ(2.0, files);
+  ASSERT_DOUBLE_EQ(200.0, bytes);
+
+  meter.Add(60, 0, 1100);
+  meter.GetRates(files, bytes, 60, 1119);
+  ASSERT_DOUBLE_EQ(1.0, files);
+  ASSERT_DOUBLE_EQ(0.0, bytes);
+
+  meter.GetRates(files, bytes, 300, 1119);
+  ASSERT_DOUBLE_EQ(80.0 / 120.0, files);
+
+  // The buckets older than the longest window are recycled
+  meter.Add(5, 0, 1000 + Saola::ThroughputMeter::MAX_WINDOW_SECONDS);
+  meter.GetRates(files, bytes, Saola::ThroughputMeter::MAX_WINDOW_SECONDS, 1000 + Saola::ThroughputMeter::MAX_WINDOW_SECONDS);
+  ASSERT_DOUBLE_EQ(75.0 / Saola::ThroughputMeter::MAX_WINDOW_SECONDS, files);
+}
+
+TEST(TieringDatabase, ColdCandidates)
+{
+  Saola::TieringDatabase db(GetTemporaryPath("tiering-" + Orthanc::Toolbox::GenerateUuid() + ".db"));
+
+  std::map<std::string, int64_t> accesses;
+  accesses["old"] = 100;
+  accesses["recent"] = 1000;
+  db.Touch(accesses);
+
+  std::vector<std::string> uuids;
+  db.ListColdCandidates(uuids, 500, 10);
+  ASSERT_EQ(1u, uuids.size());
+  ASSERT_EQ("old", uuids[0]);
+
+  db.SetTier("old", Saola::Tier_Cold);
+  db.ListColdCandidates(uuids, 500, 10);
+  ASSERT_TRUE(uuids.empty());
+
+  Saola::Tier tier;
+  ASSERT_TRUE(db.LookupTier(tier, "old"));
+  ASSERT_EQ(Saola::Tier_Cold, tier);
+
+  // A more recent access must not change the tier
+  accesses.clear();
+  accesses["old"] = 2000;
+  db.Touch(accesses);
+  ASSERT_TRUE(db.LookupTier(tier, "old"));
+  ASSERT_EQ(Saola::Tier_Cold, tier);
+
+  db.Remove("old");
+  ASSERT_FALSE(db.LookupTier(tier, "old"));
+  ASSERT_EQ(1u, db.GetSize(Saola::Tier_Hot));
+}
+
+TEST(Trace, Configure)
+{
+  Json::Value config = Json::objectValue;
+  config["Storage"] = "Verbose";
+  config["Deletion"] = "off";
+  Saola::Trace::Configure(config);
+
+  ASSERT_TRUE(Saola::Trace::IsEnabled(Saola::TraceCategory_Storage, Saola::TraceLevel_Verbose));
+  ASSERT_FALSE(Saola::Trace::IsEnabled(Saola::TraceCategory_Deletion, Saola::TraceLevel_Info));
+
+  config["Storage"] = "Nope";
+  ASSERT_THROW(Saola::Trace::Configure(config), Orthanc::OrthancException);
+
+  Saola::Trace::SetLevel(Saola::TraceCategory_Storage, Saola::TraceLevel_Off);
+  ASSERT_FALSE(Saola::Trace::IsEnabled(Saola::TraceCategory_Storage, Saola::TraceLevel_Info));
+}
+
+TEST(WorkloadCapture, RoundTrip)
+{
+  const std::string path = GetTemporaryPath("capture.trace");
+  const std::string uuid = "0b8a7e8c-5f33-4f3c-8e87-6dd2b2c1a7f4";
+
+  for (int pass = 0; pass < 2; pass++)
+  {
+    // Second pass appends to the existing capture
+    Saola::WorkloadCapture capture(path, 3);
+    capture.Record(Saola::IOOperation_Create, uuid, 1, 1000, 0, 10, true);  // Dropped, not started
+    capture.Start();
+
+    for (int i = 0; i < 3; i++)
+    {
+      capture.Record(Saola::IOOperation_ReadRange, uuid, 1, 100, i, 20, (i != 1));
+    }
+
+    capture.Stop();
+  }
+
+  ASSERT_TRUE(Saola::WorkloadCapture::IsCaptureFile(path));
+
+  std::vector<Saola::WorkloadRecord> records;
+  Saola::WorkloadCapture::ReadCaptureFile(records, path);
+  ASSERT_EQ(6u, records.size());
+
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    ASSERT_EQ(Saola::IOOperation_ReadRange, records[i].operation_);
+    ASSERT_EQ(uuid, std::string(records[i].uuid_, sizeof(records[i].uuid_)));
+    ASSERT_EQ(i % 3, records[i].rangeStart_);
+    ASSERT_EQ((i % 3 != 1), records[i].success_ != 0);
+    ASSERT_EQ(20u, records[i].durationUs_);
+  }
+
+  Orthanc::SystemToolbox::WriteFile("not a capture", path);
+  ASSERT_FALSE(Saola::WorkloadCapture::IsCaptureFile(path));
+}
+
+
+TEST(Sha256, Vectors)
+{
+  // FIPS 180-4 and RFC 4231 (test case 2)
+  ASSERT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", Saola::Sha256::ComputeHex(""));
+  ASSERT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", Saola::Sha256::ComputeHex("abc"));
+  ASSERT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Saola::Sha256::ComputeHex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+
+  const std::string key = "Jefe";
+  const std::string data = "what do ya want for nothing?";
+
+  uint8_t digest[Saola::Sha256::DIGEST_SIZE];
+  Saola::Sha256::Hmac(digest, key.c_str(), key.size(), data.c_str(), data.size());
+  ASSERT_EQ("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843", Saola::Sha256::ToHex(digest));
+}
+
+
+TEST(WorkerPool, Reuse)
+{
+  Saola::WorkerPool pool;
+
+  boost::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<unsigned int> count(0);
+
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    pool.Run(3, [&mutex, &threads, &count](size_t t)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        threads.insert(std::this_thread::get_id());
+      }
+
+      count++;
+
+      if (t == 1)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);  // Swallowed
+      }
+    });
+  }
+
+  // All the batches ran on the same threads
+  ASSERT_EQ(60u, count.load());
+  ASSERT_GE(3u, threads.size());
+  ASSERT_EQ(0u, threads.count(std::this_thread::get_id()));
+
+  pool.Stop();
+
+  // Started again on demand
+  pool.Run(1, [&count](size_t t)
+  {
+    count++;
+  });
+
+  ASSERT_EQ(61u, count.load());
+  pool.Stop();
+}
@@ -0,0 +1,46 @@
+#include "FakePluginContext.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+
+static std::unique_ptr<SaolaTests::FakePluginContext> context_;
+static std::string temporaryDirectory_;
+
+namespace SaolaTests
+{
+  FakePluginContext &GetFakeContext()
+  {
+    return *context_;
+  }
+
+  const std::string &GetTemporaryDirectory()
+  {
+    return temporaryDirectory_;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  boost::filesystem::path tmp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("saola-unit-tests-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(tmp);
+  temporaryDirectory_ = tmp.string();
+
+  Json::Value configuration;
+  SaolaTests::FakePluginContext::CreateConfiguration(configuration, temporaryDirectory_);
+  context_.reset(new SaolaTests::FakePluginContext(configuration));
+
+  OrthancPlugins::SetGlobalContext(context_->GetContext());
+  Orthanc::Logging::InitializePluginContext(context_->GetContext());
+
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+
+  boost::system::error_code err;
+  boost::filesystem::remove_all(tmp, err);
+
+  return result;
+}